@@ -37,33 +37,6 @@ static constexpr const uint32_t UPDATE_INTERVAL_MS = 1500;
 WireGuard wg;
 bool alertBlink = false;
 
-bool time_synchro(const char *tz, char *dest, int dest_size) {
-  if(tz != NULL) {
-    setenv("TZ", tz, 1);
-    tzset();
-  }
-
-  configTime(0, 0, "pool.ntp.org", "time.nist.gov");
-  const time_t MIN_VALID_EPOCH = 1672531200; // 2023-01-01 00:00:00 UTC
-  time_t now = 0;
-
-  for (int i = 0; i < 30; i++) {   // 30 * 500ms = 15s
-    now = time(nullptr);
-    if (now >= MIN_VALID_EPOCH) break;
-    delay(500);
-  }
-
-  if (now < MIN_VALID_EPOCH) {
-    return false;
-  } else {
-    struct tm tm_now;
-    localtime_r(&now, &tm_now);
-
-    strftime(dest, dest_size, "%Y-%m-%d %H:%M:%S", &tm_now);
-  }  
-  return true;
-}
-
 void setup() {
 
   Serial.begin(115200);
@@ -80,15 +53,10 @@ void setup() {
   }
   Serial.printf("\nWiFi OK. IP: %s\n", WiFi.localIP().toString().c_str());
   
-  // 2. Test NTP
-  Serial.println("2. NTP time synchro...");
-
-  char buftime[32];
-  if(time_synchro("CET-1CEST,M3.5.0/2,M10.5.0/3", buftime, sizeof(buftime))) {
-    Serial.printf("time: %s\n", buftime);    
-  } else {
-    Serial.printf("NTP sync failed. check WiFi/DNS/UDP 123.\n");
-  }
+  // 2. NTP in the background - the tunnel does not wait for it, handshake
+  // timestamps continue from the previous boot (WIREGUARD_MONOTONIC_TAI64N)
+  Serial.println("2. NTP time synchro (background)...");
+  configTime(0, 0, "pool.ntp.org", "time.nist.gov");
   
   // 3. Test random
   test_wireguard_random();
@@ -167,6 +135,7 @@ static void http_get_once() {
 
 void loop() {
   watchdog_update();
+  wg.maintain();
   digitalWrite(LED_BUILTIN, (alertBlink = !alertBlink));
 
   static uint32_t last = 0;
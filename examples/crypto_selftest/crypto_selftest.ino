@@ -0,0 +1,30 @@
+#include <Arduino.h>
+
+#include "WireguardTests.h"
+
+// Known-answer tests and microbenchmarks of the crypto primitives, no Wi-Fi needed.
+// The same vectors run on a PC with extras/host (wg_crypto_test), compare the numbers
+// before and after changing any of the primitives.
+
+// RFC 7748 iterated X25519 test - every iteration is one x25519(), 1000 take a while here
+static const uint32_t X25519_ITERATIONS = 1000;
+
+// Time per primitive and input size
+static const uint32_t BENCH_MS_PER_SIZE = 500;
+
+void setup() {
+  Serial.begin(115200);
+  delay(3000);  // wait for Serial
+
+  uint32_t start = millis();
+  bool ok = test_crypto_primitives(X25519_ITERATIONS);
+  Serial.printf("Known-answer tests took %lu ms\n\n", (unsigned long)(millis() - start));
+
+  if (ok) {
+    test_crypto_benchmark(BENCH_MS_PER_SIZE);
+  }
+}
+
+void loop() {
+  delay(1000);
+}
@@ -0,0 +1,132 @@
+/*
+ * OpenSSL (libcrypto) crypto backend for the host build - X25519 and the AEADs.
+ * SPDX-License-Identifier: BSD-3-Clause
+ *
+ * Registered by wireguard_platform_init() when built with WG_HOST_OPENSSL; wireguard_crypto_select()
+ * then checks it against the known-answer tests and the reference, and uses it where it is faster.
+ * libcrypto has assembly (SIMD) ChaCha20 and Poly1305 and a 64-bit X25519. BLAKE2s is left to the
+ * reference: libcrypto has no keyed BLAKE2s with a short digest on the blake2s_ctx state.
+ */
+
+#include "crypto-openssl.h"
+
+#include <string.h>
+
+#include <openssl/evp.h>
+
+#include "crypto/refc/chacha20.h"
+
+// One context for every call - the host tools run the core on one thread
+static EVP_CIPHER_CTX *cipher_ctx() {
+  static EVP_CIPHER_CTX *ctx = NULL;
+  if (ctx == NULL) {
+    ctx = EVP_CIPHER_CTX_new();
+  }
+  return ctx;
+}
+
+static int openssl_x25519(uint8_t *out, const uint8_t *scalar, const uint8_t *point) {
+  EVP_PKEY *private_key = EVP_PKEY_new_raw_private_key(EVP_PKEY_X25519, NULL, scalar, 32);
+  EVP_PKEY *public_key = EVP_PKEY_new_raw_public_key(EVP_PKEY_X25519, NULL, point, 32);
+  EVP_PKEY_CTX *ctx = private_key ? EVP_PKEY_CTX_new(private_key, NULL) : NULL;
+  size_t len = 32;
+  int result = -1;
+  // libcrypto refuses an all-zero result, like the reference it then returns zeros and an error
+  if (ctx && public_key && (EVP_PKEY_derive_init(ctx) == 1) && (EVP_PKEY_derive_set_peer(ctx, public_key) == 1)
+      && (EVP_PKEY_derive(ctx, out, &len) == 1) && (len == 32)) {
+    result = 0;
+  } else {
+    memset(out, 0, 32);
+  }
+  EVP_PKEY_CTX_free(ctx);
+  EVP_PKEY_free(public_key);
+  EVP_PKEY_free(private_key);
+  return result;
+}
+
+// RFC 7539 nonce: 32 zero bits, then the 64-bit WireGuard counter little-endian
+static void aead_iv(uint8_t *iv, uint64_t nonce) {
+  memset(iv, 0, 4);
+  U64TO8_LITTLE(&iv[4], nonce);
+}
+
+static void aead_encrypt_iv(uint8_t *dst, const uint8_t *src, size_t src_len, const uint8_t *ad, size_t ad_len, const uint8_t *iv, const uint8_t *key) {
+  EVP_CIPHER_CTX *ctx = cipher_ctx();
+  int len;
+  EVP_EncryptInit_ex(ctx, EVP_chacha20_poly1305(), NULL, key, iv);
+  if (ad_len > 0) {
+    EVP_EncryptUpdate(ctx, NULL, &len, ad, (int)ad_len);
+  }
+  if (src_len > 0) {
+    EVP_EncryptUpdate(ctx, dst, &len, src, (int)src_len);
+  }
+  EVP_EncryptFinal_ex(ctx, dst + src_len, &len);
+  EVP_CIPHER_CTX_ctrl(ctx, EVP_CTRL_AEAD_GET_TAG, 16, dst + src_len);
+}
+
+static bool aead_decrypt_iv(uint8_t *dst, const uint8_t *src, size_t src_len, const uint8_t *ad, size_t ad_len, const uint8_t *iv, const uint8_t *key) {
+  EVP_CIPHER_CTX *ctx = cipher_ctx();
+  uint8_t tag[16];
+  size_t len = src_len - 16;
+  int out_len;
+  bool result = false;
+  if (src_len >= 16) {
+    // src may be dst
+    memcpy(tag, src + len, sizeof(tag));
+    EVP_DecryptInit_ex(ctx, EVP_chacha20_poly1305(), NULL, key, iv);
+    if (ad_len > 0) {
+      EVP_DecryptUpdate(ctx, NULL, &out_len, ad, (int)ad_len);
+    }
+    if (len > 0) {
+      EVP_DecryptUpdate(ctx, dst, &out_len, src, (int)len);
+    }
+    EVP_CIPHER_CTX_ctrl(ctx, EVP_CTRL_AEAD_SET_TAG, 16, tag);
+    result = (EVP_DecryptFinal_ex(ctx, dst + len, &out_len) == 1);
+    if (!result) {
+      memset(dst, 0, len);
+    }
+  }
+  return result;
+}
+
+static void openssl_aead_encrypt(uint8_t *dst, const uint8_t *src, size_t src_len, const uint8_t *ad, size_t ad_len, uint64_t nonce, const uint8_t *key) {
+  uint8_t iv[12];
+  aead_iv(iv, nonce);
+  aead_encrypt_iv(dst, src, src_len, ad, ad_len, iv, key);
+}
+
+static bool openssl_aead_decrypt(uint8_t *dst, const uint8_t *src, size_t src_len, const uint8_t *ad, size_t ad_len, uint64_t nonce, const uint8_t *key) {
+  uint8_t iv[12];
+  aead_iv(iv, nonce);
+  return aead_decrypt_iv(dst, src, src_len, ad, ad_len, iv, key);
+}
+
+// XChaCha20-Poly1305: HChaCha20 (reference) subkey from the first 16 bytes of the nonce, the last 8 as the counter
+static void openssl_xaead_encrypt(uint8_t *dst, const uint8_t *src, size_t src_len, const uint8_t *ad, size_t ad_len, const uint8_t *nonce, const uint8_t *key) {
+  uint8_t subkey[CHACHA20_KEY_SIZE];
+  uint8_t iv[12];
+  hchacha20(subkey, nonce, key);
+  memset(iv, 0, 4);
+  memcpy(&iv[4], &nonce[16], 8);
+  aead_encrypt_iv(dst, src, src_len, ad, ad_len, iv, subkey);
+  crypto_zero(subkey, sizeof(subkey));
+}
+
+static bool openssl_xaead_decrypt(uint8_t *dst, const uint8_t *src, size_t src_len, const uint8_t *ad, size_t ad_len, const uint8_t *nonce, const uint8_t *key) {
+  uint8_t subkey[CHACHA20_KEY_SIZE];
+  uint8_t iv[12];
+  bool result;
+  hchacha20(subkey, nonce, key);
+  memset(iv, 0, 4);
+  memcpy(&iv[4], &nonce[16], 8);
+  result = aead_decrypt_iv(dst, src, src_len, ad, ad_len, iv, subkey);
+  crypto_zero(subkey, sizeof(subkey));
+  return result;
+}
+
+const struct wireguard_crypto_backend wireguard_crypto_openssl = {
+  "openssl",
+  NULL, NULL, NULL, NULL,
+  openssl_x25519,
+  openssl_aead_encrypt, openssl_aead_decrypt, openssl_xaead_encrypt, openssl_xaead_decrypt
+};
@@ -0,0 +1,13 @@
+/*
+ * OpenSSL (libcrypto) crypto backend for the host build (see crypto.h).
+ * SPDX-License-Identifier: BSD-3-Clause
+ */
+
+#ifndef _WIREGUARD_HOST_CRYPTO_OPENSSL_H_
+#define _WIREGUARD_HOST_CRYPTO_OPENSSL_H_
+
+#include "crypto.h"
+
+extern const struct wireguard_crypto_backend wireguard_crypto_openssl;
+
+#endif /* _WIREGUARD_HOST_CRYPTO_OPENSSL_H_ */
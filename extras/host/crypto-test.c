@@ -0,0 +1,121 @@
+/*
+ * Crypto known-answer tests and per-primitive microbenchmarks for the host build.
+ * SPDX-License-Identifier: BSD-3-Clause
+ *
+ * Runs the vectors of wireguard-selftest.h - the same ones the device runs - and exits with
+ * status 1 if any of them fails, which is what ctest checks. -x sets how far the RFC 7748
+ * iterated X25519 test goes (1000 by default, 1000000 takes a while). With -b the primitives
+ * are timed afterwards for about that many ms per input size: ops/s, MB/s and
+ * wireguard_cycle_count() ticks per byte (TSC cycles on x86, nanoseconds elsewhere).
+ *
+ * Every registered crypto backend besides the reference (crypto.h, e.g. OpenSSL with
+ * WG_HOST_OPENSSL) is run through the vectors of its groups and compared with the reference
+ * on -r rounds of generated inputs, then benchmarked on its own.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "wireguard-platform.h"
+#include "wireguard-selftest.h"
+
+static bool verbose;
+
+static void print_line(void *arg, const char *line) {
+  (void)arg;
+  // Failures always, passes with -v
+  if (verbose || strstr(line, "FAILED")) {
+    printf("%s\n", line);
+  }
+}
+
+static void print_bench(void *arg, uint8_t primitive, size_t size, uint32_t ops, uint32_t ticks) {
+  double seconds = (double)ticks / wireguard_cycle_frequency();
+  (void)arg;
+  printf("%-18s %6zu %10.0f %10.2f %12.0f %10.2f\n",
+    wireguard_selftest_name(primitive),
+    size,
+    ops / seconds,
+    ((double)ops * size) / seconds / 1e6,
+    (double)ticks / ops,
+    (double)ticks / ((double)ops * size));
+}
+
+static void usage(const char *name) {
+  fprintf(stderr, "usage: %s [-v] [-x x25519_iterations] [-r compare_rounds] [-b bench_ms_per_size (1..1000)]\n", name);
+}
+
+static const char *group_names[WIREGUARD_CRYPTO_GROUPS] = { "blake2s", "x25519", "aead" };
+
+// Vectors and the comparison with the reference for each group a backend provides
+static int test_backend(const struct wireguard_crypto_backend *backend, uint32_t iterations, uint32_t rounds) {
+  int failed = 0;
+  int f;
+  uint8_t group;
+  for (group = 0; group < WIREGUARD_CRYPTO_GROUPS; group++) {
+    if (wireguard_crypto_provides(backend, group)) {
+      f = wireguard_selftest_group(backend, group, iterations, print_line, NULL);
+      f += wireguard_selftest_compare(backend, group, rounds, print_line, NULL);
+      printf("%-8s %-9s %s\n", backend->name, group_names[group], f ? "FAILED" : "ok");
+      failed += f;
+    }
+  }
+  return failed;
+}
+
+int main(int argc, char **argv) {
+  uint32_t iterations = 1000;
+  uint32_t bench_ms = 0;
+  uint32_t rounds = 1000;
+  const struct wireguard_crypto_backend *backend;
+  uint8_t x;
+  int failed = 0;
+  uint8_t primitive;
+  int opt;
+
+  while ((opt = getopt(argc, argv, "vx:r:b:h")) != -1) {
+    switch (opt) {
+      case 'v': verbose = true; break;
+      case 'x': iterations = (uint32_t)strtoul(optarg, NULL, 0); break;
+      case 'r': rounds = (uint32_t)strtoul(optarg, NULL, 0); break;
+      case 'b': bench_ms = (uint32_t)strtoul(optarg, NULL, 0); break;
+      default: usage(argv[0]); return 2;
+    }
+  }
+  if (bench_ms > 1000) {
+    usage(argv[0]);
+    return 2;
+  }
+
+  wireguard_platform_init();
+  for (primitive = 0; primitive < WIREGUARD_SELFTEST_PRIMITIVES; primitive++) {
+    int f = wireguard_selftest_run(primitive, iterations, print_line, NULL);
+    printf("%-18s %s\n", wireguard_selftest_name(primitive), f ? "FAILED" : "ok");
+    failed += f;
+  }
+  for (x = 1; (backend = wireguard_crypto_backend(x)) != NULL; x++) {
+    failed += test_backend(backend, iterations, rounds);
+  }
+
+  // What wireguard_init() would use
+  wireguard_crypto_select(WIREGUARD_CRYPTO_SELECT_MS);
+  printf("selected: blake2s %s, x25519 %s, aead %s\n",
+    wireguard_crypto_selected(WIREGUARD_CRYPTO_BLAKE2S),
+    wireguard_crypto_selected(WIREGUARD_CRYPTO_X25519),
+    wireguard_crypto_selected(WIREGUARD_CRYPTO_AEAD));
+
+  if (bench_ms > 0) {
+    for (x = 0; (backend = wireguard_crypto_backend(x)) != NULL; x++) {
+      printf("\n%s\n%-18s %6s %10s %10s %12s %10s\n", backend->name, "primitive", "bytes", "ops/s", "MB/s", "ticks/op", "ticks/B");
+      wireguard_selftest_bench(backend, bench_ms, print_bench, NULL);
+    }
+    printf("\ncycle counter: %u Hz\n", wireguard_cycle_frequency());
+  }
+
+  if (failed) {
+    printf("%d vectors failed\n", failed);
+  }
+  return failed ? 1 : 0;
+}
@@ -0,0 +1,369 @@
+/*
+ * Handshake throughput benchmark and flood generator for the host build.
+ * SPDX-License-Identifier: BSD-3-Clause
+ *
+ * A responder (wireguardif on lwIP, see host-net.h) is fed pregenerated handshake
+ * messages through wireguardif_network_rx(), one phase at a time:
+ *   idle    - no flood, data packets only (baseline latency)
+ *   mac1    - initiations with a random, invalid mac1
+ *   replay  - one valid initiation sent over and over
+ *   valid   - fresh initiations from -p synthetic peers, round robin, each from its own address
+ *   spoof   - initiations with a valid mac1 from an unknown key, all from the address of the data
+ *             device, while that device handshakes again; it has to get its session back
+ * Meanwhile a second device with an established session sends a data packet through the
+ * responder every -d flood messages; the time from its netif->output() to the delivery of
+ * the decrypted packet to a UDP socket behind the responder is the data latency.
+ *
+ * Message generation is not timed. CPU time is process time, so it includes lwIP and the
+ * data path. The wg_handshake_capacity build turns the rate limits off to measure what the
+ * handshake code itself can absorb; wg_handshake_bench keeps the shipped defaults.
+ *
+ * -H / -L turn a run into a gate: the exit status is 1 when the valid phase completes fewer
+ * handshakes per second, or the flood phases show a higher p99 data latency, than given. It is
+ * always 1 when the spoofed flood keeps the data device from handshaking.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "lwip/ip.h"
+#include "lwip/pbuf.h"
+#include "lwip/udp.h"
+
+#include "crypto.h"
+#include "wireguard.h"
+#include "wireguardif.h"
+#include "host-net.h"
+#include "host-util.h"
+
+#define RESPONDER_PORT        51820
+#define DATA_PORT             51821
+#define SINK_PORT             9
+#define SYNTHETIC_PORT        50000
+#define DATA_PAYLOAD_LEN      64
+
+#define SYNTHETIC_MAX_PEERS   (WIREGUARD_MAX_PEERS - 1)
+// Several REKEY_TIMEOUT retries of the data device, with a cookie round trip in between
+#define SPOOF_TIMEOUT_MS      30000
+
+struct phase_result {
+  const char *name;
+  uint32_t messages;
+  double wall_s;
+  double cpu_s;
+  struct wireguard_peer_stats before;
+  struct wireguard_peer_stats after;
+  uint32_t cookies_tx;
+  uint32_t latency_count;
+  double latency_p50_us;
+  double latency_p99_us;
+  double latency_max_us;
+};
+
+static struct netif responder_netif;
+static struct netif data_netif;
+static uint8_t responder_public[WIREGUARD_PUBLIC_KEY_LEN];
+
+static double *latency_samples;
+static uint32_t latency_count;
+static uint32_t latency_capacity;
+static uint32_t data_sent;
+
+// 10.9.0.2:9 -> 10.9.0.1:9 through the tunnel, the payload carries the send time
+static void send_data_packet() {
+  ip4_addr_t src, dest;
+  uint64_t now = host_clock_ns(CLOCK_MONOTONIC);
+  struct pbuf *p;
+
+  IP4_ADDR(&src, 10, 9, 0, 2);
+  IP4_ADDR(&dest, 10, 9, 0, 1);
+  p = host_udp_packet(&src, &dest, SINK_PORT, &now, sizeof(now), 28 + DATA_PAYLOAD_LEN);
+  if (p) {
+    data_netif.output(&data_netif, p, &dest);
+    pbuf_free(p);
+    data_sent++;
+  }
+}
+
+static void sink_recv(void *arg, struct udp_pcb *pcb, struct pbuf *p, const ip_addr_t *addr, u16_t port) {
+  uint64_t sent;
+  LWIP_UNUSED_ARG(arg);
+  LWIP_UNUSED_ARG(pcb);
+  LWIP_UNUSED_ARG(addr);
+  LWIP_UNUSED_ARG(port);
+  if (pbuf_copy_partial(p, &sent, sizeof(sent), 0) == sizeof(sent) && latency_count < latency_capacity) {
+    latency_samples[latency_count++] = (double)(host_clock_ns(CLOCK_MONOTONIC) - sent) / 1000.0;
+  }
+  pbuf_free(p);
+}
+
+static int compare_double(const void *a, const void *b) {
+  double x = *(const double *)a;
+  double y = *(const double *)b;
+  return (x > y) - (x < y);
+}
+
+static void responder_stats(struct wireguard_peer_stats *totals, uint32_t *cookies_tx) {
+  struct wireguard_device_stats stats;
+  wireguardif_get_device_stats(&responder_netif, &stats);
+  memcpy(totals, &stats.totals, sizeof(*totals));
+  if (cookies_tx) {
+    *cookies_tx = stats.cookies_tx;
+  }
+}
+
+static void run_phase(struct phase_result *result, const char *name, const uint8_t *messages, size_t message_len, const ip_addr_t *sources, uint32_t source_count, uint32_t count, uint32_t data_interval) {
+  uint32_t cookies_before = 0;
+  uint64_t wall_start, cpu_start;
+  uint32_t m;
+
+  memset(result, 0, sizeof(*result));
+  result->name = name;
+  result->messages = messages ? count : 0;
+  latency_count = 0;
+  responder_stats(&result->before, &cookies_before);
+
+  wall_start = host_clock_ns(CLOCK_MONOTONIC);
+  cpu_start = host_clock_ns(CLOCK_PROCESS_CPUTIME_ID);
+  for (m = 0; m < count; m++) {
+    if (messages) {
+      host_net_send(&sources[m % source_count], SYNTHETIC_PORT, RESPONDER_PORT, &messages[(size_t)m * message_len], message_len);
+    }
+    if (((m + 1) % data_interval) == 0) {
+      send_data_packet();
+      host_net_poll();
+    }
+  }
+  host_net_poll();
+  result->cpu_s = (double)(host_clock_ns(CLOCK_PROCESS_CPUTIME_ID) - cpu_start) / 1e9;
+  result->wall_s = (double)(host_clock_ns(CLOCK_MONOTONIC) - wall_start) / 1e9;
+
+  responder_stats(&result->after, &result->cookies_tx);
+  result->cookies_tx -= cookies_before;
+  result->latency_count = latency_count;
+  if (latency_count > 0) {
+    qsort(latency_samples, latency_count, sizeof(double), compare_double);
+    result->latency_p50_us = latency_samples[latency_count / 2];
+    result->latency_p99_us = latency_samples[(latency_count * 99) / 100];
+    result->latency_max_us = latency_samples[latency_count - 1];
+  }
+}
+
+// The data device starts over and has to handshake while its own address floods the responder
+static bool run_spoof_phase(struct phase_result *result, const uint8_t *messages, size_t message_len, uint32_t count, u8_t index) {
+  uint32_t cookies_before = 0;
+  uint64_t wall_start, cpu_start, end;
+  ip_addr_t source;
+  bool up = false;
+  uint32_t m = 0;
+
+  memset(result, 0, sizeof(*result));
+  result->name = "spoof";
+  latency_count = 0;
+  responder_stats(&result->before, &cookies_before);
+  IP_ADDR4(&source, 192, 0, 2, 1);
+
+  wireguardif_disconnect(&data_netif, index);
+  wireguardif_connect(&data_netif, index);
+  wall_start = host_clock_ns(CLOCK_MONOTONIC);
+  cpu_start = host_clock_ns(CLOCK_PROCESS_CPUTIME_ID);
+  end = wall_start + (uint64_t)SPOOF_TIMEOUT_MS * 1000000ULL;
+  while (!up && (host_clock_ns(CLOCK_MONOTONIC) < end)) {
+    host_net_send(&source, DATA_PORT, RESPONDER_PORT, &messages[(size_t)(m % count) * message_len], message_len);
+    m++;
+    if ((m % 16) == 0) {
+      host_net_poll();
+      up = (wireguardif_peer_is_up(&data_netif, index, NULL, NULL) == ERR_OK);
+      usleep(1000);
+    }
+  }
+  host_net_poll();
+  result->messages = m;
+  result->cpu_s = (double)(host_clock_ns(CLOCK_PROCESS_CPUTIME_ID) - cpu_start) / 1e9;
+  result->wall_s = (double)(host_clock_ns(CLOCK_MONOTONIC) - wall_start) / 1e9;
+
+  responder_stats(&result->after, &result->cookies_tx);
+  result->cookies_tx -= cookies_before;
+  return up;
+}
+
+static double handshakes_per_second(const struct phase_result *r) {
+  uint32_t handshakes = r->after.handshake_responses_tx - r->before.handshake_responses_tx;
+  return (r->wall_s > 0) ? handshakes / r->wall_s : 0;
+}
+
+static void print_result(const struct phase_result *r) {
+  uint32_t handshakes = r->after.handshake_responses_tx - r->before.handshake_responses_tx;
+  double cpu_us = r->cpu_s * 1e6;
+  printf("%-7s %8u %10.0f %9.1f %8u %10.0f %9.1f %7u %7u %7u %7u | %5u %9.1f %9.1f %9.1f\n",
+    r->name,
+    r->messages,
+    r->messages ? r->messages / r->wall_s : 0.0,
+    r->messages ? cpu_us / r->messages : 0.0,
+    handshakes,
+    handshakes_per_second(r),
+    handshakes ? cpu_us / handshakes : 0.0,
+    r->cookies_tx,
+    r->after.drops.bad_mac1 - r->before.drops.bad_mac1,
+    r->after.drops.replay - r->before.drops.replay,
+    r->after.drops.rate_limited - r->before.drops.rate_limited,
+    r->latency_count,
+    r->latency_p50_us,
+    r->latency_p99_us,
+    r->latency_max_us);
+}
+
+static void usage(const char *name) {
+  fprintf(stderr, "usage: %s [-p peers] [-n messages] [-d data_interval] [-H min_handshakes_per_s] [-L max_p99_latency_us]\n", name);
+}
+
+int main(int argc, char **argv) {
+  uint32_t peers = SYNTHETIC_MAX_PEERS < 32 ? SYNTHETIC_MAX_PEERS : 32;
+  uint32_t count = 2000;
+  uint32_t data_interval = 16;
+  double min_handshakes = 0;
+  double max_latency = 0;
+  int opt;
+
+  while ((opt = getopt(argc, argv, "p:n:d:H:L:h")) != -1) {
+    switch (opt) {
+      case 'p': peers = (uint32_t)strtoul(optarg, NULL, 0); break;
+      case 'n': count = (uint32_t)strtoul(optarg, NULL, 0); break;
+      case 'd': data_interval = (uint32_t)strtoul(optarg, NULL, 0); break;
+      case 'H': min_handshakes = strtod(optarg, NULL); break;
+      case 'L': max_latency = strtod(optarg, NULL); break;
+      default: usage(argv[0]); return 2;
+    }
+  }
+  if (peers < 1 || peers > SYNTHETIC_MAX_PEERS || count < 1 || data_interval < 1) {
+    fprintf(stderr, "peers must be 1..%d (WIREGUARD_MAX_PEERS - 1), messages and data interval at least 1\n", SYNTHETIC_MAX_PEERS);
+    return 2;
+  }
+
+  wireguard_platform_init();
+  // What WireGuard::begin() does on the Pico - loads and moves the timestamp mark in $WG_STORAGE_DIR
+  wireguard_tai64n_reserve();
+  struct netif *station = host_net_init("192.0.2.1");
+  if (!station) {
+    fprintf(stderr, "station netif setup failed\n");
+    return 1;
+  }
+
+  // Responder and the data device, on the same station address
+  uint8_t private_key[WIREGUARD_PRIVATE_KEY_LEN];
+  uint8_t data_public[WIREGUARD_PUBLIC_KEY_LEN];
+  char responder_private[HOST_KEY_BASE64_LEN], data_private[HOST_KEY_BASE64_LEN];
+  u8_t index;
+  host_make_key(private_key, responder_public, responder_private);
+  host_make_key(private_key, data_public, data_private);
+  if (!host_add_device(&responder_netif, responder_private, RESPONDER_PORT, "10.9.0.1", station)
+      || !host_add_device(&data_netif, data_private, DATA_PORT, "10.9.0.2", station)
+      || !host_add_peer(&data_netif, responder_public, "10.9.0.0", "255.255.255.0", "192.0.2.1", RESPONDER_PORT, &index)
+      || !host_add_peer(&responder_netif, data_public, "10.9.0.0", "255.255.255.0", NULL, 0, NULL)) {
+    fprintf(stderr, "device setup failed\n");
+    return 1;
+  }
+
+  struct udp_pcb *sink = udp_new();
+  udp_bind(sink, IP_ANY_TYPE, SINK_PORT);
+  udp_recv(sink, sink_recv, NULL);
+  latency_capacity = count / data_interval + 1;
+  latency_samples = (double *)calloc(latency_capacity, sizeof(double));
+
+  // Synthetic initiators: core-only devices, one per peer, each with its own source address
+  struct wireguard_device *initiators = (struct wireguard_device *)calloc(peers, sizeof(struct wireguard_device));
+  ip_addr_t *sources = (ip_addr_t *)calloc(peers, sizeof(ip_addr_t));
+  struct message_handshake_initiation *valid = (struct message_handshake_initiation *)calloc(count, sizeof(struct message_handshake_initiation));
+  struct message_handshake_initiation *bad_mac1 = (struct message_handshake_initiation *)calloc(count, sizeof(struct message_handshake_initiation));
+  struct message_handshake_initiation *replayed = (struct message_handshake_initiation *)calloc(count, sizeof(struct message_handshake_initiation));
+  struct message_handshake_initiation *spoofed = (struct message_handshake_initiation *)calloc(count, sizeof(struct message_handshake_initiation));
+  struct wireguard_device *attacker = (struct wireguard_device *)calloc(1, sizeof(struct wireguard_device));
+  uint32_t x;
+  if (!initiators || !sources || !valid || !bad_mac1 || !replayed || !spoofed || !attacker || !latency_samples) {
+    fprintf(stderr, "out of memory\n");
+    return 1;
+  }
+  for (x = 0; x < peers; x++) {
+    uint8_t peer_public[WIREGUARD_PUBLIC_KEY_LEN];
+    char allowed[16];
+    host_make_key(private_key, peer_public, NULL);
+    wireguard_device_init(&initiators[x], private_key);
+    wireguard_peer_init(&initiators[x], peer_alloc(&initiators[x]), responder_public, NULL);
+    snprintf(allowed, sizeof(allowed), "10.10.%u.%u", x / 250, x % 250 + 1);
+    if (!host_add_peer(&responder_netif, peer_public, allowed, "255.255.255.255", NULL, 0, NULL)) {
+      fprintf(stderr, "adding peer %u failed\n", x);
+      return 1;
+    }
+    IP_ADDR4(&sources[x], 198, 18, x / 250, x % 250 + 1);
+  }
+  // Knows the public key of the responder (so mac1 is valid) but is not one of its peers
+  uint8_t attacker_public[WIREGUARD_PUBLIC_KEY_LEN];
+  host_make_key(private_key, attacker_public, NULL);
+  wireguard_device_init(attacker, private_key);
+  wireguard_peer_init(attacker, peer_alloc(attacker), responder_public, NULL);
+  crypto_zero(private_key, sizeof(private_key));
+
+  printf("generating %u messages per phase for %u peers...\n", count, peers);
+  // The replayed message is older than all of the valid ones, so it does not turn them into replays
+  wireguard_create_handshake_initiation(&initiators[0], &initiators[0].peers[0], &replayed[0]);
+  for (x = 1; x < count; x++) {
+    memcpy(&replayed[x], &replayed[0], sizeof(replayed[0]));
+  }
+  for (x = 0; x < count; x++) {
+    wireguard_create_handshake_initiation(&initiators[x % peers], &initiators[x % peers].peers[0], &valid[x]);
+    wireguard_random_bytes(&bad_mac1[x], sizeof(bad_mac1[x]));
+    bad_mac1[x].type = MESSAGE_HANDSHAKE_INITIATION;
+    memset(bad_mac1[x].reserved, 0, sizeof(bad_mac1[x].reserved));
+    wireguard_create_handshake_initiation(attacker, &attacker->peers[0], &spoofed[x]);
+  }
+
+  // Session for the data path
+  wireguardif_connect(&data_netif, index);
+  if (!host_wait_up(&data_netif, index, 5000)) {
+    fprintf(stderr, "data session did not come up\n");
+    return 1;
+  }
+
+  struct phase_result results[5];
+  run_phase(&results[0], "idle", NULL, 0, sources, peers, count, data_interval);
+  host_settle(1500);
+  run_phase(&results[1], "mac1", (const uint8_t *)bad_mac1, sizeof(bad_mac1[0]), sources, peers, count, data_interval);
+  host_settle(1500);
+  run_phase(&results[2], "replay", (const uint8_t *)replayed, sizeof(replayed[0]), sources, 1, count, data_interval);
+  host_settle(1500);
+  run_phase(&results[3], "valid", (const uint8_t *)valid, sizeof(valid[0]), sources, peers, count, data_interval);
+  host_settle(1500);
+  bool spoof_up = run_spoof_phase(&results[4], (const uint8_t *)spoofed, sizeof(spoofed[0]), count, index);
+
+  printf("\n%-7s %8s %10s %9s %8s %10s %9s %7s %7s %7s %7s | %5s %9s %9s %9s\n",
+    "phase", "msgs", "msgs/s", "cpu_us/m", "hs", "hs/s", "cpu_us/hs", "cookies", "badmac1", "replay", "ratelim",
+    "data", "p50_us", "p99_us", "max_us");
+  for (x = 0; x < 5; x++) {
+    print_result(&results[x]);
+  }
+
+  struct host_net_stats net;
+  host_net_get_stats(&net);
+  printf("\nnetwork: %u queued, %u delivered, %u to synthetic peers, %u dropped; %u data packets sent\n",
+    net.queued, net.delivered, net.unrouted, net.dropped, data_sent);
+
+  int status = 0;
+  if (!spoof_up) {
+    printf("FAIL: no session for the data device within %u ms of a flood spoofing its address\n", SPOOF_TIMEOUT_MS);
+    status = 1;
+  }
+  if (min_handshakes > 0 && handshakes_per_second(&results[3]) < min_handshakes) {
+    printf("FAIL: %.0f handshakes/s < %.0f\n", handshakes_per_second(&results[3]), min_handshakes);
+    status = 1;
+  }
+  for (x = 1; x < 4; x++) {
+    if (max_latency > 0 && results[x].latency_p99_us > max_latency) {
+      printf("FAIL: %s p99 data latency %.1f us > %.1f us\n", results[x].name, results[x].latency_p99_us, max_latency);
+      status = 1;
+    }
+  }
+  return status;
+}
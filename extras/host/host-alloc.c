@@ -0,0 +1,44 @@
+/*
+ * Counting allocator behind lwIP's heap on the host (see host-alloc.h).
+ * SPDX-License-Identifier: BSD-3-Clause
+ */
+
+#include "host-alloc.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+static struct host_alloc_stats stats;
+
+void host_alloc_get_stats(struct host_alloc_stats *out) {
+  memcpy(out, &stats, sizeof(stats));
+}
+
+void *host_mem_malloc(size_t size) {
+  void *ptr = malloc(size);
+  if (ptr) {
+    stats.allocs++;
+    stats.bytes += size;
+  } else {
+    stats.failed++;
+  }
+  return ptr;
+}
+
+void *host_mem_calloc(size_t count, size_t size) {
+  void *ptr = calloc(count, size);
+  if (ptr) {
+    stats.allocs++;
+    stats.bytes += count * size;
+  } else {
+    stats.failed++;
+  }
+  return ptr;
+}
+
+void host_mem_free(void *ptr) {
+  if (ptr) {
+    stats.frees++;
+  }
+  free(ptr);
+}
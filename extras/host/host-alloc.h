@@ -0,0 +1,36 @@
+/*
+ * Counting malloc()/calloc()/free() behind lwIP's heap on the host (MEM_LIBC_MALLOC, see
+ * lwipopts.h). With MEMP_MEM_MALLOC every pbuf and pool element goes through here too,
+ * so the difference of two snapshots is the number of allocations in between.
+ * SPDX-License-Identifier: BSD-3-Clause
+ */
+
+#ifndef _WIREGUARD_HOST_ALLOC_H_
+#define _WIREGUARD_HOST_ALLOC_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+struct host_alloc_stats {
+	uint64_t allocs;
+	uint64_t frees;
+	uint64_t bytes;		// Requested, freed memory is not subtracted
+	uint64_t failed;
+};
+
+void host_alloc_get_stats(struct host_alloc_stats *stats);
+
+// mem_clib_malloc / mem_clib_calloc / mem_clib_free of lwIP
+void *host_mem_malloc(size_t size);
+void *host_mem_calloc(size_t count, size_t size);
+void host_mem_free(void *ptr);
+
+#ifdef __cplusplus
+} /* extern "C" */
+#endif
+
+#endif /* _WIREGUARD_HOST_ALLOC_H_ */
@@ -0,0 +1,200 @@
+/*
+ * In-memory "network" for the host tools in extras/host (see host-net.h).
+ * SPDX-License-Identifier: BSD-3-Clause
+ */
+
+#include "host-net.h"
+
+#include <string.h>
+
+#include "lwip/init.h"
+#include "lwip/ip.h"
+#include "lwip/pbuf.h"
+#include "lwip/timeouts.h"
+
+struct host_net_datagram {
+  ip_addr_t src;
+  u16_t src_port;
+  u16_t dst_port;
+  u16_t len;
+  uint8_t data[HOST_NET_MAX_DATAGRAM];
+};
+
+static struct netif station;
+static struct host_net_datagram queue[HOST_NET_QUEUE_LEN];
+static size_t queue_head = 0;
+static size_t queue_count = 0;
+static struct udp_pcb *attached[HOST_NET_MAX_ATTACHED];
+static struct host_net_stats stats;
+static host_net_tap_fn tap = NULL;
+static void *tap_arg = NULL;
+static struct host_net_datagram tapped;
+
+static struct host_net_datagram *queue_push() {
+  struct host_net_datagram *d = NULL;
+  if (queue_count < HOST_NET_QUEUE_LEN) {
+    d = &queue[(queue_head + queue_count) % HOST_NET_QUEUE_LEN];
+    queue_count++;
+    stats.queued++;
+  } else {
+    stats.dropped++;
+  }
+  return d;
+}
+
+// netif->output of the station: parse the IPv4 and UDP headers lwIP built and queue the payload
+static err_t station_output(struct netif *netif, struct pbuf *p, const ip4_addr_t *ipaddr) {
+  uint8_t header[60 + 8] = {0};
+  u16_t copied = pbuf_copy_partial(p, header, sizeof(header), 0);
+  size_t ihl = (size_t)(header[0] & 0x0F) * 4;
+  LWIP_UNUSED_ARG(netif);
+  LWIP_UNUSED_ARG(ipaddr);
+
+  if ((copied < 28) || ((header[0] >> 4) != 4) || (header[9] != 17) || (ihl < 20) || (copied < ihl + 8)) {
+    stats.dropped++;
+    return ERR_OK;
+  }
+  size_t total = ((size_t)header[2] << 8) | header[3];
+  if ((total > p->tot_len) || (total < ihl + 8) || (total - ihl - 8 > HOST_NET_MAX_DATAGRAM)) {
+    stats.dropped++;
+    return ERR_OK;
+  }
+  // Parsed into a scratch slot first when a tap may take it over
+  struct host_net_datagram *d = tap ? &tapped : queue_push();
+  if (d) {
+    IP_ADDR4(&d->src, header[12], header[13], header[14], header[15]);
+    d->src_port = (u16_t)((header[ihl] << 8) | header[ihl + 1]);
+    d->dst_port = (u16_t)((header[ihl + 2] << 8) | header[ihl + 3]);
+    d->len = (u16_t)(total - ihl - 8);
+    pbuf_copy_partial(p, d->data, d->len, (u16_t)(ihl + 8));
+  }
+  if (tap && !tap(&tapped.src, tapped.src_port, tapped.dst_port, tapped.data, tapped.len, tap_arg)) {
+    d = queue_push();
+    if (d) {
+      memcpy(d, &tapped, sizeof(tapped));
+    }
+  }
+  return ERR_OK;
+}
+
+static err_t station_init(struct netif *netif) {
+  netif->name[0] = 'h';
+  netif->name[1] = 'n';
+  netif->output = station_output;
+  netif->mtu = 1500;
+  return ERR_OK;
+}
+
+struct netif *host_net_init(const char *address) {
+  ip4_addr_t addr, mask, gw;
+  struct netif *result = NULL;
+
+  lwip_init();
+  memset(&stats, 0, sizeof(stats));
+  if (ip4addr_aton(address, &addr)) {
+    IP4_ADDR(&mask, 255, 255, 255, 0);
+    ip4_addr_set_zero(&gw);
+    if (netif_add(&station, &addr, &mask, &gw, NULL, station_init, ip_input)) {
+      netif_set_default(&station);
+      netif_set_up(&station);
+      netif_set_link_up(&station);
+      result = &station;
+    }
+  }
+  return result;
+}
+
+bool host_net_attach(struct udp_pcb *pcb) {
+  int x;
+  for (x = 0; x < HOST_NET_MAX_ATTACHED; x++) {
+    if (attached[x] == NULL || attached[x] == pcb) {
+      attached[x] = pcb;
+      return true;
+    }
+  }
+  return false;
+}
+
+void host_net_detach(struct udp_pcb *pcb) {
+  int x;
+  for (x = 0; x < HOST_NET_MAX_ATTACHED; x++) {
+    if (attached[x] == pcb) {
+      attached[x] = NULL;
+    }
+  }
+}
+
+bool host_net_send(const ip_addr_t *src, u16_t src_port, u16_t dst_port, const void *data, size_t len) {
+  struct host_net_datagram *d = NULL;
+  if (len <= HOST_NET_MAX_DATAGRAM) {
+    d = queue_push();
+  } else {
+    stats.dropped++;
+  }
+  if (d) {
+    ip_addr_copy(d->src, *src);
+    d->src_port = src_port;
+    d->dst_port = dst_port;
+    d->len = (u16_t)len;
+    memcpy(d->data, data, len);
+  }
+  return d != NULL;
+}
+
+static struct udp_pcb *attached_pcb(u16_t port) {
+  int x;
+  for (x = 0; x < HOST_NET_MAX_ATTACHED; x++) {
+    if (attached[x] && attached[x]->local_port == port && attached[x]->recv) {
+      return attached[x];
+    }
+  }
+  return NULL;
+}
+
+void host_net_set_tap(host_net_tap_fn new_tap, void *arg) {
+  tap = new_tap;
+  tap_arg = arg;
+}
+
+bool host_net_deliver(const ip_addr_t *src, u16_t src_port, u16_t dst_port, const void *data, size_t len) {
+  struct udp_pcb *pcb = attached_pcb(dst_port);
+  // Same layout udp_input() hands over: headers reserved in front of the payload
+  struct pbuf *p = (pcb && (len <= HOST_NET_MAX_DATAGRAM)) ? pbuf_alloc(PBUF_TRANSPORT, (u16_t)len, PBUF_RAM) : NULL;
+  ip_addr_t from;
+
+  if (!pcb) {
+    stats.unrouted++;
+  } else if (!p) {
+    stats.dropped++;
+  } else {
+    pbuf_take(p, data, (u16_t)len);
+    ip_addr_copy(from, *src);
+    stats.delivered++;
+    stats.bytes += len;
+    pcb->recv(pcb->recv_arg, pcb, p, &from, src_port);
+  }
+  return p != NULL;
+}
+
+uint32_t host_net_poll() {
+  uint32_t delivered = 0;
+  while (queue_count > 0) {
+    struct host_net_datagram *d = &queue[queue_head];
+    // Freed before delivery so recv() can send - host_net_deliver() copies it before calling recv()
+    queue_head = (queue_head + 1) % HOST_NET_QUEUE_LEN;
+    queue_count--;
+    if (host_net_deliver(&d->src, d->src_port, d->dst_port, d->data, d->len)) {
+      delivered++;
+    }
+  }
+  sys_check_timeouts();
+  return delivered;
+}
+
+size_t host_net_pending() {
+  return queue_count;
+}
+
+void host_net_get_stats(struct host_net_stats *out) {
+  memcpy(out, &stats, sizeof(stats));
+}
@@ -0,0 +1,78 @@
+/*
+ * In-memory "network" for the host tools in extras/host.
+ * SPDX-License-Identifier: BSD-3-Clause
+ *
+ * One lwIP netif stands in for the Wi-Fi station and is the default route. Every
+ * IPv4/UDP datagram lwIP sends out of it is queued instead of transmitted, and
+ * host_net_poll() hands queued datagrams to the udp_pcb attached for the destination
+ * port by calling its receive callback directly - wireguardif_network_rx() for a
+ * WireGuard device. Datagrams can also be queued from outside (synthetic peers,
+ * floods, replays). Several devices on the same host each attach their own port.
+ *
+ * A tap can take over what lwIP sends instead (loss, delay and reordering in a simulation)
+ * and hand it back later with host_net_deliver().
+ */
+
+#ifndef _WIREGUARD_HOST_NET_H_
+#define _WIREGUARD_HOST_NET_H_
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+#include "lwip/netif.h"
+#include "lwip/udp.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// Datagrams in flight at most, anything beyond is counted in dropped
+#ifndef HOST_NET_QUEUE_LEN
+#define HOST_NET_QUEUE_LEN		(1024)
+#endif
+
+#define HOST_NET_MAX_DATAGRAM	(1600)
+#define HOST_NET_MAX_ATTACHED	(16)
+
+struct host_net_stats {
+	uint32_t queued;		// Datagrams sent by lwIP or queued with host_net_send()
+	uint32_t delivered;		// Handed to an attached udp_pcb
+	uint32_t unrouted;		// No udp_pcb attached for the destination (e.g. replies to synthetic peers)
+	uint32_t dropped;		// Queue full, not IPv4/UDP or too large
+	uint64_t bytes;			// UDP payload bytes delivered
+};
+
+// Sees every datagram lwIP sends out of the station before it is queued, returns true when it
+// took the datagram over (data is only valid during the call)
+typedef bool (*host_net_tap_fn)(const ip_addr_t *src, u16_t src_port, u16_t dst_port, const uint8_t *data, size_t len, void *arg);
+
+// lwip_init() and the station netif with the given address (/24), set as default route
+struct netif *host_net_init(const char *address);
+
+// Deliver datagrams for pcb->local_port to pcb (any destination address)
+bool host_net_attach(struct udp_pcb *pcb);
+void host_net_detach(struct udp_pcb *pcb);
+
+// Queue a datagram as if it had arrived from src:src_port for the attached pcb on dst_port
+bool host_net_send(const ip_addr_t *src, u16_t src_port, u16_t dst_port, const void *data, size_t len);
+
+// NULL removes the tap
+void host_net_set_tap(host_net_tap_fn tap, void *arg);
+
+// Hand a datagram from src:src_port to the pcb attached for dst_port right away (no timers run),
+// false if nothing is attached or no pbuf could be allocated
+bool host_net_deliver(const ip_addr_t *src, u16_t src_port, u16_t dst_port, const void *data, size_t len);
+
+// Deliver queued datagrams (including the ones sent while delivering) and run due lwIP timers,
+// returns the number delivered
+uint32_t host_net_poll(void);
+
+size_t host_net_pending(void);
+void host_net_get_stats(struct host_net_stats *stats);
+
+#ifdef __cplusplus
+} /* extern "C" */
+#endif
+
+#endif /* _WIREGUARD_HOST_NET_H_ */
@@ -0,0 +1,30 @@
+/*
+ * lwIP system functions for the host build (NO_SYS), in place of the unix port's sys_arch.c.
+ * SPDX-License-Identifier: BSD-3-Clause
+ *
+ * lwIP's clock is wireguard_sys_now(): with platform hooks installed (extras/host/sim.c) the lwIP
+ * timers, the wireguardif timer among them, run on the same simulated clock as the WireGuard code.
+ */
+
+#include "lwip/opt.h"
+#include "lwip/sys.h"
+
+#include "wireguard-platform.h"
+
+void sys_init(void) {
+}
+
+u32_t sys_now(void) {
+  return wireguard_sys_now();
+}
+
+u32_t sys_jiffies(void) {
+  return wireguard_sys_now();
+}
+
+// LWIP_RAND() of the unix port (initial ports, IP ids) - seeded along with everything else in a simulation
+u32_t lwip_port_rand(void) {
+  u32_t r;
+  wireguard_random_bytes(&r, sizeof(r));
+  return r;
+}
@@ -0,0 +1,133 @@
+/*
+ * Helpers shared by the host tools in extras/host (see host-util.h).
+ * SPDX-License-Identifier: BSD-3-Clause
+ */
+
+#include "host-util.h"
+
+#include <string.h>
+#include <unistd.h>
+
+#include "lwip/ip.h"
+
+#include "crypto.h"
+#include "wireguard.h"
+#include "wireguardif.h"
+#include "host-net.h"
+
+#define HOST_MAX_PACKET_LEN		(2048)
+
+uint64_t host_clock_ns(clockid_t clock) {
+  struct timespec ts;
+  clock_gettime(clock, &ts);
+  return (uint64_t)ts.tv_sec * 1000000000ULL + (uint64_t)ts.tv_nsec;
+}
+
+void host_make_key(uint8_t *private_key, uint8_t *public_key, char *private_base64) {
+  size_t len = HOST_KEY_BASE64_LEN;
+  wireguard_random_bytes(private_key, WIREGUARD_PRIVATE_KEY_LEN);
+  x25519_base(public_key, private_key, 1);
+  if (private_base64) {
+    wireguard_base64_encode(private_key, WIREGUARD_PRIVATE_KEY_LEN, private_base64, &len);
+  }
+}
+
+bool host_add_device(struct netif *netif, const char *private_base64, u16_t port, const char *address, struct netif *station) {
+  struct wireguardif_init_data init;
+  ip4_addr_t addr, mask, gw;
+  init.private_key = private_base64;
+  init.listen_port = port;
+  init.bind_netif = station;
+  ip4addr_aton(address, &addr);
+  IP4_ADDR(&mask, 255, 255, 255, 0);
+  ip4_addr_set_zero(&gw);
+  if (!netif_add(netif, &addr, &mask, &gw, &init, wireguardif_init, ip_input)) {
+    return false;
+  }
+  netif_set_up(netif);
+  return host_net_attach(((struct wireguard_device *)netif->state)->udp_pcb);
+}
+
+bool host_add_peer(struct netif *netif, const uint8_t *public_key, const char *allowed, const char *mask, const char *endpoint, u16_t port, u8_t *index) {
+  struct wireguardif_peer peer;
+  char public_base64[HOST_KEY_BASE64_LEN];
+  size_t len = sizeof(public_base64);
+  wireguard_base64_encode(public_key, WIREGUARD_PUBLIC_KEY_LEN, public_base64, &len);
+  wireguardif_peer_init(&peer);
+  peer.public_key = public_base64;
+  ip4addr_aton(allowed, ip_2_ip4(&peer.allowed_ip));
+  ip4addr_aton(mask, ip_2_ip4(&peer.allowed_mask));
+  if (endpoint) {
+    ip4addr_aton(endpoint, ip_2_ip4(&peer.endpoint_ip));
+    peer.endport_port = port;
+  }
+  return wireguardif_add_peer(netif, &peer, index) == ERR_OK;
+}
+
+bool host_wait_up(struct netif *netif, u8_t index, uint32_t timeout_ms) {
+  uint64_t end = host_clock_ns(CLOCK_MONOTONIC) + (uint64_t)timeout_ms * 1000000ULL;
+  while (wireguardif_peer_is_up(netif, index, NULL, NULL) != ERR_OK) {
+    if (host_clock_ns(CLOCK_MONOTONIC) > end) {
+      return false;
+    }
+    host_settle(1);
+  }
+  return true;
+}
+
+void host_settle(uint32_t ms) {
+  uint64_t end = host_clock_ns(CLOCK_MONOTONIC) + (uint64_t)ms * 1000000ULL;
+  while (host_clock_ns(CLOCK_MONOTONIC) < end) {
+    host_net_poll();
+    usleep(1000);
+  }
+}
+
+static u16_t ip_checksum(const uint8_t *header, size_t len) {
+  uint32_t sum = 0;
+  size_t x;
+  for (x = 0; x < len; x += 2) {
+    sum += ((uint32_t)header[x] << 8) | header[x + 1];
+  }
+  while (sum >> 16) {
+    sum = (sum & 0xFFFF) + (sum >> 16);
+  }
+  return (u16_t)~sum;
+}
+
+struct pbuf *host_udp_packet(const ip4_addr_t *src, const ip4_addr_t *dst, u16_t port, const void *payload, size_t payload_len, size_t total_len) {
+  uint8_t packet[HOST_MAX_PACKET_LEN];
+  struct pbuf *p = NULL;
+  u16_t checksum;
+
+  if ((total_len < 28) || (total_len > sizeof(packet)) || (payload_len > total_len - 28)) {
+    return NULL;
+  }
+  memset(packet, 0, total_len);
+  packet[0] = 0x45;
+  packet[2] = (uint8_t)(total_len >> 8);
+  packet[3] = (uint8_t)total_len;
+  packet[8] = 64;
+  packet[9] = 17;
+  memcpy(&packet[12], &ip4_addr_get_u32(src), 4);
+  memcpy(&packet[16], &ip4_addr_get_u32(dst), 4);
+  checksum = ip_checksum(packet, 20);
+  packet[10] = (uint8_t)(checksum >> 8);
+  packet[11] = (uint8_t)checksum;
+  // UDP checksum 0 - not computed, allowed over IPv4
+  packet[20] = (uint8_t)(port >> 8);
+  packet[21] = (uint8_t)port;
+  packet[22] = (uint8_t)(port >> 8);
+  packet[23] = (uint8_t)port;
+  packet[24] = (uint8_t)((total_len - 20) >> 8);
+  packet[25] = (uint8_t)(total_len - 20);
+  if (payload_len) {
+    memcpy(&packet[28], payload, payload_len);
+  }
+
+  p = pbuf_alloc(PBUF_IP, (u16_t)total_len, PBUF_RAM);
+  if (p) {
+    pbuf_take(p, packet, (u16_t)total_len);
+  }
+  return p;
+}
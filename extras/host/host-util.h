@@ -0,0 +1,49 @@
+/*
+ * Helpers shared by the host tools in extras/host: keys, devices and peers on the
+ * in-memory network (host-net.h), inner test packets and clocks.
+ * SPDX-License-Identifier: BSD-3-Clause
+ */
+
+#ifndef _WIREGUARD_HOST_UTIL_H_
+#define _WIREGUARD_HOST_UTIL_H_
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <time.h>
+
+#include "lwip/netif.h"
+#include "lwip/pbuf.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define HOST_KEY_BASE64_LEN		(45)
+
+uint64_t host_clock_ns(clockid_t clock);
+
+// Fresh key pair, private_base64 (HOST_KEY_BASE64_LEN bytes) may be NULL
+void host_make_key(uint8_t *private_key, uint8_t *public_key, char *private_base64);
+
+// wireguardif netif with address/24 bound to station, its udp_pcb attached to the in-memory network
+bool host_add_device(struct netif *netif, const char *private_base64, u16_t port, const char *address, struct netif *station);
+
+// endpoint may be NULL, index may be NULL
+bool host_add_peer(struct netif *netif, const uint8_t *public_key, const char *allowed, const char *mask, const char *endpoint, u16_t port, u8_t *index);
+
+// Polls the network until the peer has a session, false after timeout_ms
+bool host_wait_up(struct netif *netif, u8_t index, uint32_t timeout_ms);
+
+// Keeps lwIP timers and the network running for ms of real time
+void host_settle(uint32_t ms);
+
+// IPv4/UDP packet of total_len bytes (at least 28) from src:port to dst:port, payload copied to
+// the front of the UDP data and the rest zero - PBUF_IP pbuf ready for netif->output()
+struct pbuf *host_udp_packet(const ip4_addr_t *src, const ip4_addr_t *dst, u16_t port, const void *payload, size_t payload_len, size_t total_len);
+
+#ifdef __cplusplus
+} /* extern "C" */
+#endif
+
+#endif /* _WIREGUARD_HOST_UTIL_H_ */
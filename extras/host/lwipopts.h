@@ -0,0 +1,54 @@
+/*
+ * lwIP options for the host build in extras/host (NO_SYS, IPv4 + UDP only).
+ * SPDX-License-Identifier: BSD-3-Clause
+ */
+
+#ifndef _WIREGUARD_HOST_LWIPOPTS_H_
+#define _WIREGUARD_HOST_LWIPOPTS_H_
+
+// Single threaded: the benchmarks call into lwIP and sys_check_timeouts() from main()
+#define NO_SYS						1
+#define SYS_LIGHTWEIGHT_PROT		0
+#define LWIP_SOCKET					0
+#define LWIP_NETCONN				0
+
+// Heap and pools come from malloc() so sizes never limit a benchmark - counted, see host-alloc.h
+#include "host-alloc.h"
+#define MEM_LIBC_MALLOC				1
+#define MEMP_MEM_MALLOC				1
+#define mem_clib_malloc				host_mem_malloc
+#define mem_clib_calloc				host_mem_calloc
+#define mem_clib_free				host_mem_free
+#define MEM_ALIGNMENT				8
+#define PBUF_POOL_SIZE				64
+#define MEMP_NUM_UDP_PCB			16
+#define MEMP_NUM_SYS_TIMEOUT		(LWIP_NUM_SYS_TIMEOUT_INTERNAL + 16)
+
+#define LWIP_IPV4					1
+#define LWIP_IPV6					0
+#define LWIP_UDP					1
+#define LWIP_TCP					0
+#define LWIP_RAW					0
+#define LWIP_ICMP					0
+#define LWIP_IGMP					0
+#define LWIP_DHCP					0
+#define LWIP_AUTOIP					0
+#define LWIP_DNS					0
+#define LWIP_ARP					0
+#define LWIP_ETHERNET				0
+#define LWIP_NETIF_LOOPBACK			0
+#define LWIP_HAVE_LOOPIF			0
+#define IP_REASSEMBLY				0
+#define IP_FRAG						0
+// The transport pbuf pool (WIREGUARD_PBUF_POOL_SIZE) is made of custom pbufs, which lwIP otherwise only
+// enables along with fragmentation
+#define LWIP_SUPPORT_CUSTOM_PBUF	1
+
+// Same callbacks the Arduino-Pico build has, wireguardif.c relies on them
+#define LWIP_NETIF_STATUS_CALLBACK		1
+#define LWIP_NETIF_LINK_CALLBACK		1
+#define LWIP_NETIF_EXT_STATUS_CALLBACK	1
+
+#define LWIP_STATS					0
+
+#endif /* _WIREGUARD_HOST_LWIPOPTS_H_ */
@@ -0,0 +1,63 @@
+/*
+ * Receive replay window test for the host build.
+ * SPDX-License-Identifier: BSD-3-Clause
+ *
+ * Feeds counters to wireguard_check_replay() on a fresh keypair and checks which are taken:
+ * counter 0 (the first packet of every WireGuard session), the oldest counter still in the
+ * window and the first one past it, packets out of order inside the window, duplicates and
+ * jumps larger than the window. Exits with status 1 if any step fails, which is what ctest checks.
+ */
+
+#include <stdio.h>
+#include <string.h>
+
+#include "wireguard.h"
+
+#define WINDOW    (sizeof(((struct wireguard_keypair *)0)->replay_bitmap) * 8)
+
+static int failed;
+
+static void expect(struct wireguard_keypair *keypair, uint64_t counter, bool accepted, const char *what) {
+  bool result = wireguard_check_replay(keypair, counter);
+  if (result != accepted) {
+    printf("FAILED: %s - counter %llu %s\n", what, (unsigned long long)counter, result ? "accepted" : "rejected");
+    failed++;
+  }
+}
+
+int main(void) {
+  struct wireguard_keypair keypair;
+  uint64_t x;
+
+  memset(&keypair, 0, sizeof(keypair));
+  expect(&keypair, 0, true, "first packet of a session");
+  expect(&keypair, 0, false, "counter 0 again");
+  for (x = 1; x < WINDOW; x++) {
+    expect(&keypair, x, true, "in order");
+  }
+
+  memset(&keypair, 0, sizeof(keypair));
+  expect(&keypair, 100, true, "jump ahead");
+  expect(&keypair, 100 - (WINDOW - 1), true, "oldest counter in the window (window - 1 behind)");
+  expect(&keypair, 100 - WINDOW, false, "one past the window (window behind)");
+  expect(&keypair, 100 - (WINDOW - 1), false, "duplicate at the window edge");
+  expect(&keypair, 95, true, "out of order inside the window");
+  expect(&keypair, 97, true, "out of order inside the window");
+  expect(&keypair, 95, false, "duplicate inside the window");
+  expect(&keypair, 100, false, "duplicate of the newest");
+  expect(&keypair, 101, true, "next in order");
+  expect(&keypair, 97, false, "duplicate after the window moved");
+  expect(&keypair, 101 - WINDOW, false, "fell out of the window as it moved");
+
+  memset(&keypair, 0, sizeof(keypair));
+  expect(&keypair, 5, true, "start");
+  expect(&keypair, 5 + WINDOW, true, "jump of exactly the window");
+  expect(&keypair, 6, true, "window - 1 behind after the jump");
+  expect(&keypair, 5, false, "window behind after the jump");
+  expect(&keypair, 1000, true, "jump far past the window");
+  expect(&keypair, 5 + WINDOW, false, "before the far jump");
+  expect(&keypair, 999, true, "right behind the far jump");
+
+  printf("replay window (%u packets): %s\n", (unsigned)WINDOW, failed ? "FAILED" : "ok");
+  return failed ? 1 : 0;
+}
@@ -0,0 +1,481 @@
+/*
+ * Receive path replay of a trace recorded with WIREGUARD_RECORD (wireguard-record.h).
+ * SPDX-License-Identifier: BSD-3-Clause
+ *
+ * The device in the trace is rebuilt from its snapshot: same private key, listen port,
+ * cookie secret, peers and the sessions they had when recording started. Then every
+ * recorded datagram goes through wireguardif_network_rx() again, one after the other
+ * and as fast as possible. The clock follows the record timestamps, so the wireguardif
+ * timer runs as it did on the device; wireguard_random_bytes() hands out the recorded
+ * random bytes in order, so a handshake answered here derives the same session keys and
+ * the transport data after it still decrypts. Whatever the device sends is discarded.
+ *
+ * Reported per message type: count, wireguard_cycle_count() ticks per datagram (mean, p50,
+ * p99 - TSC cycles on x86, nanoseconds elsewhere) and the drop counters each type moved.
+ * "random desync" counts requests for randomness that did not line up with the trace (a
+ * different code path ran, or records were lost); results after the first one are suspect.
+ *
+ * Not in the snapshot: rate limiter / load state, pending handshakes and peer timers, so
+ * the first seconds of a trace taken under a handshake flood may drop differently.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "lwip/ip.h"
+#include "lwip/pbuf.h"
+#include "lwip/timeouts.h"
+#include "lwip/udp.h"
+
+#include "crypto.h"
+#include "wireguard.h"
+#include "wireguardif.h"
+#include "wireguard-record.h"
+#include "host-net.h"
+#include "host-util.h"
+
+// Seconds since 1970 the replayed TAI64N clock starts from
+#define REPLAY_EPOCH          1700000000ULL
+
+enum replay_class {
+  REPLAY_INITIATION = 0,
+  REPLAY_RESPONSE,
+  REPLAY_COOKIE,
+  REPLAY_TRANSPORT,
+  REPLAY_KEEPALIVE,
+  REPLAY_OTHER,
+  REPLAY_CLASSES
+};
+
+static const char *class_names[REPLAY_CLASSES] = {
+  "initiation", "response", "cookie", "transport", "keep-alive", "other"
+};
+
+#define DROP_REASONS          (sizeof(struct wireguard_drop_stats) / sizeof(uint32_t))
+
+static const char *drop_names[] = {
+  "bad mac1", "replay", "auth failure", "no keypair", "no memory", "allowed ip", "key expired", "malformed", "rate limited"
+};
+
+_Static_assert(sizeof(drop_names) / sizeof(drop_names[0]) == DROP_REASONS, "drop reason names out of date");
+
+struct replay_stats {
+  uint32_t count;
+  uint32_t dropped;
+  uint64_t bytes;
+  uint64_t cycles;
+  uint32_t drops[DROP_REASONS];
+  uint32_t *samples;
+};
+
+struct trace_record {
+  uint8_t type;
+  uint16_t len;
+  uint32_t millis;
+  const uint8_t *payload;
+};
+
+static uint8_t *trace;
+static size_t trace_len;
+
+static struct netif replay_netif;
+static struct wireguard_device *device;
+static struct replay_stats stats[REPLAY_CLASSES];
+
+static uint32_t now_ms;
+static bool replaying;
+static size_t random_pos;
+static uint32_t random_desync;
+static uint64_t fill_state = 1;
+static uint64_t last_tai64n_ns;
+
+// peer index in the trace -> peer index here
+static u8_t peer_map[256];
+
+static uint16_t get_u16(const uint8_t *p) {
+  return (uint16_t)(p[0] | (p[1] << 8));
+}
+
+static uint32_t get_u32(const uint8_t *p) {
+  return U8TO32_LITTLE(p);
+}
+
+static uint64_t get_u64(const uint8_t *p) {
+  return U8TO64_LITTLE(p);
+}
+
+static void get_ip4(ip_addr_t *addr, const uint8_t *p) {
+  uint32_t raw;
+  memcpy(&raw, p, 4);
+  IP_ADDR4(addr, 0, 0, 0, 0);
+  ip4_addr_set_u32(ip_2_ip4(addr), raw);
+}
+
+// Record at *pos, advances *pos - false at the end of the trace or on a truncated record
+static bool trace_next(size_t *pos, struct trace_record *record) {
+  const uint8_t *p = &trace[*pos];
+  if (*pos + WIREGUARD_RECORD_HEADER_LEN > trace_len) {
+    return false;
+  }
+  record->type = p[0];
+  record->len = get_u16(&p[2]);
+  record->millis = get_u32(&p[4]);
+  record->payload = &p[WIREGUARD_RECORD_HEADER_LEN];
+  if (*pos + WIREGUARD_RECORD_HEADER_LEN + record->len > trace_len) {
+    return false;
+  }
+  *pos += WIREGUARD_RECORD_HEADER_LEN + record->len;
+  return true;
+}
+
+// ---- Platform hooks ----
+
+static uint64_t splitmix64(uint64_t *state) {
+  uint64_t z = (*state += 0x9E3779B97F4A7C15ULL);
+  z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+  z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+  return z ^ (z >> 31);
+}
+
+static uint32_t replay_sys_now() {
+  return now_ms;
+}
+
+static void fill_bytes(uint8_t *p, size_t size) {
+  while (size > 0) {
+    uint64_t r = splitmix64(&fill_state);
+    size_t n = (size < sizeof(r)) ? size : sizeof(r);
+    memcpy(p, &r, n);
+    p += n;
+    size -= n;
+  }
+}
+
+// The next RANDOM record, which has to be exactly as long as the request
+static void replay_random_bytes(void *bytes, size_t size) {
+  struct trace_record record;
+  bool found = false;
+  if (!replaying) {
+    // Device setup - the trace starts after it
+    fill_bytes((uint8_t *)bytes, size);
+    return;
+  }
+  while (!found && trace_next(&random_pos, &record)) {
+    found = (record.type == WIREGUARD_RECORD_RANDOM);
+  }
+  if (found && record.len == size) {
+    memcpy(bytes, record.payload, size);
+  } else {
+    random_desync++;
+    fill_bytes((uint8_t *)bytes, size);
+  }
+}
+
+static void replay_tai64n_now(uint8_t *output) {
+  uint64_t ns = (uint64_t)now_ms * 1000000ULL;
+  if (ns <= last_tai64n_ns) {
+    ns = last_tai64n_ns + 1;
+  }
+  last_tai64n_ns = ns;
+  U64TO8_BIG(output + 0, 0x400000000000000aULL + REPLAY_EPOCH + ns / 1000000000ULL);
+  U32TO8_BIG(output + 8, (uint32_t)(ns % 1000000000ULL));
+}
+
+static const struct wireguard_platform_hooks replay_hooks = {
+  replay_sys_now,
+  replay_random_bytes,
+  replay_tai64n_now
+};
+
+static bool discard_tx(const ip_addr_t *src, u16_t src_port, u16_t dst_port, const uint8_t *data, size_t len, void *arg) {
+  LWIP_UNUSED_ARG(src);
+  LWIP_UNUSED_ARG(src_port);
+  LWIP_UNUSED_ARG(dst_port);
+  LWIP_UNUSED_ARG(data);
+  LWIP_UNUSED_ARG(len);
+  LWIP_UNUSED_ARG(arg);
+  return true;
+}
+
+// ---- Rebuilding the device ----
+
+static bool restore_device(const struct trace_record *record, struct netif *station) {
+  const uint8_t *p = record->payload;
+  char private_base64[HOST_KEY_BASE64_LEN];
+  size_t len = sizeof(private_base64);
+  ip_addr_t addr, mask;
+  bool result = false;
+
+  if (record->len >= WIREGUARD_RECORD_DEVICE_LEN && wireguard_base64_encode(p, WIREGUARD_PRIVATE_KEY_LEN, private_base64, &len)) {
+    get_ip4(&addr, &p[70]);
+    get_ip4(&mask, &p[74]);
+    if (host_add_device(&replay_netif, private_base64, get_u16(&p[32]), ipaddr_ntoa(&addr), station)) {
+      netif_set_netmask(&replay_netif, ip_2_ip4(&mask));
+      device = (struct wireguard_device *)replay_netif.state;
+      memcpy(device->cookie_secret, &p[34], WIREGUARD_HASH_LEN);
+      device->cookie_secret_millis = now_ms - get_u32(&p[66]);
+      result = true;
+    }
+  }
+  crypto_zero(private_base64, sizeof(private_base64));
+  return result;
+}
+
+static bool restore_peer(const struct trace_record *record) {
+  const uint8_t *p = record->payload;
+  struct wireguardif_peer peer;
+  char public_base64[HOST_KEY_BASE64_LEN];
+  size_t len = sizeof(public_base64);
+  ip_addr_t ip, mask;
+  uint8_t count;
+  uint8_t x;
+  u8_t index;
+
+  if (record->len < WIREGUARD_RECORD_PEER_LEN) {
+    return false;
+  }
+  count = p[WIREGUARD_RECORD_PEER_LEN - 1];
+  if (count == 0 || record->len != WIREGUARD_RECORD_PEER_LEN + count * 8) {
+    return false;
+  }
+  wireguard_base64_encode(&p[3], WIREGUARD_PUBLIC_KEY_LEN, public_base64, &len);
+  wireguardif_peer_init(&peer);
+  peer.public_key = public_base64;
+  peer.preshared_key = &p[35];
+  memcpy(peer.greatest_timestamp, &p[67], sizeof(peer.greatest_timestamp));
+  get_ip4(&peer.endpoint_ip, &p[79]);
+  peer.endport_port = get_u16(&p[83]);
+  peer.keep_alive = get_u16(&p[1]);
+  get_ip4(&peer.allowed_ip, &p[WIREGUARD_RECORD_PEER_LEN]);
+  get_ip4(&peer.allowed_mask, &p[WIREGUARD_RECORD_PEER_LEN + 4]);
+  if (wireguardif_add_peer(&replay_netif, &peer, &index) != ERR_OK) {
+    return false;
+  }
+  for (x = 1; x < count; x++) {
+    get_ip4(&ip, &p[WIREGUARD_RECORD_PEER_LEN + x * 8]);
+    get_ip4(&mask, &p[WIREGUARD_RECORD_PEER_LEN + x * 8 + 4]);
+    if (wireguardif_add_allowed_ip(&replay_netif, index, &ip, &mask) != ERR_OK) {
+      return false;
+    }
+  }
+  peer_map[p[0]] = index;
+  return true;
+}
+
+static bool restore_keypair(const struct trace_record *record) {
+  const uint8_t *p = record->payload;
+  struct wireguard_peer *peer;
+  struct wireguard_keypair *keypair;
+  uint8_t flags;
+
+  if (record->len != WIREGUARD_RECORD_KEYPAIR_LEN || p[1] > 2) {
+    return false;
+  }
+  peer = peer_lookup_by_peer_index(device, peer_map[p[0]]);
+  if (!peer) {
+    return false;
+  }
+  keypair = (p[1] == 0) ? PEER_CURR_KEYPAIR(peer) : (p[1] == 1) ? PEER_PREV_KEYPAIR(peer) : PEER_NEXT_KEYPAIR(peer);
+  flags = p[2];
+  memset(keypair, 0, sizeof(struct wireguard_keypair));
+  keypair->valid = true;
+  keypair->initiator = (flags & WIREGUARD_RECORD_KEYPAIR_INITIATOR) != 0;
+  keypair->sending_valid = (flags & WIREGUARD_RECORD_KEYPAIR_SENDING) != 0;
+  keypair->receiving_valid = (flags & WIREGUARD_RECORD_KEYPAIR_RECEIVING) != 0;
+  keypair->local_index = get_u32(&p[3]);
+  keypair->remote_index = get_u32(&p[7]);
+  keypair->keypair_millis = now_ms - get_u32(&p[11]);
+  keypair->sending_counter = get_u64(&p[15]);
+  keypair->replay_counter = get_u64(&p[23]);
+  keypair->replay_bitmap = get_u32(&p[31]);
+  memcpy(keypair->sending_key, &p[35], WIREGUARD_SESSION_KEY_LEN);
+  memcpy(keypair->receiving_key, &p[67], WIREGUARD_SESSION_KEY_LEN);
+  keypair->last_tx = now_ms;
+  keypair->last_rx = now_ms;
+  return true;
+}
+
+// Snapshot records up to the first datagram or random bytes, *pos ends up after them
+static bool restore(size_t *pos, uint32_t *sessions) {
+  struct trace_record record;
+  size_t next = *pos;
+  bool ok = true;
+
+  struct netif *station = host_net_init("192.0.2.1");
+  if (!station || !trace_next(&next, &record) || record.type != WIREGUARD_RECORD_DEVICE) {
+    return false;
+  }
+  host_net_set_tap(discard_tx, NULL);
+  now_ms = record.millis;
+  ok = restore_device(&record, station);
+  *pos = next;
+  while (ok && trace_next(&next, &record) && (record.type == WIREGUARD_RECORD_PEER || record.type == WIREGUARD_RECORD_KEYPAIR)) {
+    if (record.type == WIREGUARD_RECORD_PEER) {
+      ok = restore_peer(&record);
+    } else {
+      ok = restore_keypair(&record);
+      (*sessions)++;
+    }
+    *pos = next;
+  }
+  return ok;
+}
+
+// ---- Replay ----
+
+static enum replay_class message_class(const uint8_t *data, size_t len) {
+  switch ((len > 0) ? data[0] : 0) {
+    case MESSAGE_HANDSHAKE_INITIATION: return REPLAY_INITIATION;
+    case MESSAGE_HANDSHAKE_RESPONSE: return REPLAY_RESPONSE;
+    case MESSAGE_COOKIE_REPLY: return REPLAY_COOKIE;
+    case MESSAGE_TRANSPORT_DATA: return (len == sizeof(struct message_transport_data) + WIREGUARD_AUTHTAG_LEN) ? REPLAY_KEEPALIVE : REPLAY_TRANSPORT;
+    default: return REPLAY_OTHER;
+  }
+}
+
+static void replay_datagram(const struct trace_record *record) {
+  const uint8_t *data = record->payload + WIREGUARD_RECORD_RX_HEADER_LEN;
+  size_t len = record->len - WIREGUARD_RECORD_RX_HEADER_LEN;
+  struct replay_stats *s = &stats[message_class(data, len)];
+  struct wireguard_device_stats before, after;
+  const uint32_t *b = (const uint32_t *)&before.totals.drops;
+  const uint32_t *a = (const uint32_t *)&after.totals.drops;
+  ip_addr_t src;
+  uint32_t cycles;
+  uint32_t start;
+  bool dropped = false;
+  size_t x;
+
+  get_ip4(&src, record->payload);
+  now_ms = record->millis;
+  sys_check_timeouts();
+
+  wireguardif_get_device_stats(&replay_netif, &before);
+  start = wireguard_cycle_count();
+  host_net_deliver(&src, get_u16(&record->payload[4]), device->udp_pcb->local_port, data, len);
+  cycles = wireguard_cycle_count() - start;
+  wireguardif_get_device_stats(&replay_netif, &after);
+
+  for (x = 0; x < DROP_REASONS; x++) {
+    if (a[x] != b[x]) {
+      s->drops[x] += a[x] - b[x];
+      dropped = true;
+    }
+  }
+  s->samples[s->count++] = cycles;
+  s->cycles += cycles;
+  s->bytes += len;
+  s->dropped += dropped ? 1 : 0;
+}
+
+static int compare_u32(const void *a, const void *b) {
+  uint32_t x = *(const uint32_t *)a;
+  uint32_t y = *(const uint32_t *)b;
+  return (x > y) - (x < y);
+}
+
+static void report(uint32_t datagrams, uint32_t lost, uint32_t sessions, uint32_t first_ms, uint32_t last_ms, uint64_t wall_ns) {
+  size_t c, x;
+
+  printf("trace: %u datagrams over %.1f s, %u sessions restored, %u records lost while recording, %u random desync\n",
+    datagrams, (last_ms - first_ms) / 1000.0, sessions, lost, random_desync);
+  printf("replayed in %.1f ms (%.0f datagrams/s)\n\n", wall_ns / 1e6, wall_ns ? datagrams / (wall_ns / 1e9) : 0.0);
+
+  printf("%-11s %8s %10s %10s %10s %10s %8s\n", "type", "count", "bytes", "mean", "p50", "p99", "dropped");
+  for (c = 0; c < REPLAY_CLASSES; c++) {
+    struct replay_stats *s = &stats[c];
+    if (s->count == 0) {
+      continue;
+    }
+    qsort(s->samples, s->count, sizeof(uint32_t), compare_u32);
+    printf("%-11s %8u %10llu %10.0f %10u %10u %8u\n", class_names[c], s->count, (unsigned long long)s->bytes,
+      (double)s->cycles / s->count, s->samples[s->count / 2], s->samples[(uint32_t)(s->count * 0.99)], s->dropped);
+  }
+
+  printf("\ndrop reasons:\n");
+  for (c = 0; c < REPLAY_CLASSES; c++) {
+    for (x = 0; x < DROP_REASONS; x++) {
+      if (stats[c].drops[x]) {
+        printf("  %-11s %-13s %8u\n", class_names[c], drop_names[x], stats[c].drops[x]);
+      }
+    }
+  }
+  printf("\ncycle counter: %u Hz\n", wireguard_cycle_frequency());
+}
+
+static bool load_trace(const char *path) {
+  FILE *f = fopen(path, "rb");
+  long size;
+  bool result = false;
+  if (f) {
+    if (fseek(f, 0, SEEK_END) == 0 && (size = ftell(f)) >= WIREGUARD_RECORD_FILE_HEADER_LEN && fseek(f, 0, SEEK_SET) == 0) {
+      trace = malloc((size_t)size);
+      trace_len = (size_t)size;
+      result = trace && fread(trace, 1, trace_len, f) == trace_len;
+    }
+    fclose(f);
+  }
+  return result && memcmp(trace, WIREGUARD_RECORD_MAGIC, 4) == 0 && get_u16(&trace[4]) == WIREGUARD_RECORD_VERSION;
+}
+
+int main(int argc, char **argv) {
+  struct trace_record record;
+  size_t pos = WIREGUARD_RECORD_FILE_HEADER_LEN;
+  size_t scan;
+  uint32_t counts[REPLAY_CLASSES] = { 0 };
+  uint32_t datagrams = 0, lost = 0, sessions = 0;
+  uint32_t first_ms = 0, last_ms = 0;
+  uint64_t wall_start, wall_ns;
+  size_t c;
+
+  if (argc != 2) {
+    fprintf(stderr, "usage: %s trace-file (recorded with WIREGUARD_RECORD, e.g. wg_sim -w)\n", argv[0]);
+    return 2;
+  }
+  if (!load_trace(argv[1])) {
+    fprintf(stderr, "%s: not a version %d trace\n", argv[1], WIREGUARD_RECORD_VERSION);
+    return 1;
+  }
+
+  wireguard_platform_init();
+  wireguard_platform_set_hooks(&replay_hooks);
+  if (!restore(&pos, &sessions)) {
+    fprintf(stderr, "could not rebuild the device from the trace\n");
+    return 1;
+  }
+
+  // Count first so that the timed loop does not allocate
+  scan = pos;
+  while (trace_next(&scan, &record)) {
+    if (record.type == WIREGUARD_RECORD_RX && record.len >= WIREGUARD_RECORD_RX_HEADER_LEN) {
+      counts[message_class(record.payload + WIREGUARD_RECORD_RX_HEADER_LEN, record.len - WIREGUARD_RECORD_RX_HEADER_LEN)]++;
+    }
+  }
+  for (c = 0; c < REPLAY_CLASSES; c++) {
+    stats[c].samples = malloc((counts[c] + 1) * sizeof(uint32_t));
+    if (!stats[c].samples) {
+      fprintf(stderr, "out of memory\n");
+      return 1;
+    }
+  }
+
+  random_pos = pos;
+  replaying = true;
+  first_ms = now_ms;
+  wall_start = host_clock_ns(CLOCK_MONOTONIC);
+  while (trace_next(&pos, &record)) {
+    if (record.type == WIREGUARD_RECORD_RX && record.len >= WIREGUARD_RECORD_RX_HEADER_LEN) {
+      replay_datagram(&record);
+      datagrams++;
+      last_ms = record.millis;
+    } else if (record.type == WIREGUARD_RECORD_LOST && record.len >= 4) {
+      lost += get_u32(record.payload);
+    }
+  }
+  wall_ns = host_clock_ns(CLOCK_MONOTONIC) - wall_start;
+
+  report(datagrams, lost, sessions, first_ms, last_ms, wall_ns);
+  return 0;
+}
@@ -0,0 +1,647 @@
+/*
+ * Time-compressed, deterministic simulation of tunnel life for the host build.
+ * SPDX-License-Identifier: BSD-3-Clause
+ *
+ * A server device and -p client devices (wireguardif on lwIP, see host-net.h) run on a
+ * simulated millisecond clock installed through wireguard_platform_set_hooks(). lwIP's
+ * sys_now() follows it (host-sys.c), so the wireguardif timer - handshakes, rekeys,
+ * keep-alives, session expiry - runs on the same clock. Nothing waits: the loop jumps
+ * straight to the next event (a datagram arriving, a client sending, an lwIP timer), so
+ * hours of tunnel life take seconds.
+ *
+ * Every datagram the devices send is taken over by a tap and delivered after -d ms plus
+ * up to -j ms of jitter, dropped with probability -l percent, or held back another -R ms
+ * with probability -r percent (reordering). Each client sends an inner UDP packet to the
+ * server every -i ms, the server echoes it back. With -a/-q the clients alternate between
+ * active and quiet periods, which lets sessions expire and restart.
+ *
+ * Keys, handshake randomness, timestamps and the network decisions all come from the seed
+ * (-s), so a run is repeated exactly - the trace digest at the end compares two runs.
+ * With -w the server records what it receives (WIREGUARD_RECORD) for wg_replay.
+ * Reported: handshake counts per client and at the server, the longest delivery gaps per
+ * direction and the stalls over -g ms, and process CPU time per kind of event. Built with
+ * WIREGUARD_STACK_PROBE (wg_sim_stack) it also reports the deepest stack use below the lwIP
+ * callbacks of any device and exits with status 1 if that went over WIREGUARD_STACK_BUDGET.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "lwip/ip.h"
+#include "lwip/pbuf.h"
+#include "lwip/timeouts.h"
+#include "lwip/udp.h"
+
+#include "crypto.h"
+#include "wireguard.h"
+#include "wireguardif.h"
+#include "host-net.h"
+#include "host-util.h"
+
+#define SERVER_PORT           51820
+#define CLIENT_PORT_BASE      51821
+#define SINK_PORT             9
+#define PROBE_PACKET_LEN      64
+
+// One station port is left for the server
+#define SIM_MAX_CLIENTS       ((WIREGUARD_MAX_PEERS < HOST_NET_MAX_ATTACHED - 1) ? WIREGUARD_MAX_PEERS : HOST_NET_MAX_ATTACHED - 1)
+
+// Simulated time starts here rather than at zero, which the core reads as "never"
+#define SIM_START_MS          1000
+// Seconds since 1970 the simulated TAI64N clock starts from
+#define SIM_EPOCH             1700000000ULL
+
+enum sim_cpu_class {
+  SIM_CPU_INITIATION = 0,
+  SIM_CPU_RESPONSE,
+  SIM_CPU_COOKIE,
+  SIM_CPU_TRANSPORT,
+  SIM_CPU_SEND,
+  SIM_CPU_TIMERS,
+  SIM_CPU_CLASSES
+};
+
+static const char *cpu_class_names[SIM_CPU_CLASSES] = {
+  "initiation rx", "response rx", "cookie rx", "transport rx", "inner send", "timers"
+};
+
+struct sim_cpu {
+  uint64_t events;
+  uint64_t ns;
+};
+
+// Delivery of one direction of one client's probes
+struct sim_gaps {
+  uint32_t received;
+  bool tracking;
+  uint64_t last_ms;
+  uint64_t max_ms;
+  uint32_t stalls;
+  uint64_t stalled_ms;
+};
+
+struct sim_client {
+  struct netif netif;
+  u8_t peer_index;    // The server, on the client
+  u8_t server_index;  // The client, on the server
+  ip_addr_t outer;    // Address its datagrams appear to come from
+  ip4_addr_t inner;
+  uint64_t next_send_ms;
+  uint32_t sent;
+  struct sim_gaps up;    // At the server
+  struct sim_gaps down;  // Echoes back at the client
+};
+
+struct sim_datagram {
+  uint64_t at_ms;
+  uint64_t seq;
+  ip_addr_t src;
+  u16_t src_port;
+  u16_t dst_port;
+  u16_t len;
+  uint8_t data[];
+};
+
+struct sim_config {
+  uint32_t clients;
+  uint64_t duration_ms;
+  uint32_t interval_ms;
+  double loss;
+  uint32_t delay_ms;
+  uint32_t jitter_ms;
+  double reorder;
+  uint32_t reorder_ms;
+  uint32_t active_ms;
+  uint32_t quiet_ms;
+  uint32_t gap_ms;
+  uint64_t seed;
+};
+
+static struct sim_config config;
+static uint64_t now_ms = SIM_START_MS;
+static uint64_t net_state;
+static uint64_t key_state;
+static uint64_t last_tai64n_ns;
+
+static struct netif server_netif;
+static struct sim_client clients[HOST_NET_MAX_ATTACHED];
+static struct sim_cpu cpu[SIM_CPU_CLASSES];
+
+static struct sim_datagram **pending;
+static size_t pending_count;
+static size_t pending_capacity;
+static uint64_t datagram_seq;
+static uint32_t datagrams_sent;
+static uint32_t datagrams_lost;
+static uint32_t datagrams_reordered;
+static uint64_t digest = 0xcbf29ce484222325ULL;
+static FILE *record_file;
+
+// ---- Deterministic sources ----
+
+static uint64_t splitmix64(uint64_t *state) {
+  uint64_t z = (*state += 0x9E3779B97F4A7C15ULL);
+  z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+  z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+  return z ^ (z >> 31);
+}
+
+// Uniform in [0, 1)
+static double net_uniform() {
+  return (double)(splitmix64(&net_state) >> 11) / 9007199254740992.0;
+}
+
+static uint32_t sim_sys_now() {
+  return (uint32_t)now_ms;
+}
+
+// Not random at all - reproducible keys and ephemerals are the point here
+static void sim_random_bytes(void *bytes, size_t size) {
+  uint8_t *p = (uint8_t *)bytes;
+  while (size > 0) {
+    uint64_t r = splitmix64(&key_state);
+    size_t n = (size < sizeof(r)) ? size : sizeof(r);
+    memcpy(p, &r, n);
+    p += n;
+    size -= n;
+  }
+}
+
+// Simulated wall clock, strictly increasing as the responder's replay check needs
+static void sim_tai64n_now(uint8_t *output) {
+  uint64_t ns = now_ms * 1000000ULL;
+  if (ns <= last_tai64n_ns) {
+    ns = last_tai64n_ns + 1;
+  }
+  last_tai64n_ns = ns;
+  U64TO8_BIG(output + 0, 0x400000000000000aULL + SIM_EPOCH + ns / 1000000000ULL);
+  U32TO8_BIG(output + 8, (uint32_t)(ns % 1000000000ULL));
+}
+
+static const struct wireguard_platform_hooks sim_hooks = {
+  sim_sys_now,
+  sim_random_bytes,
+  sim_tai64n_now
+};
+
+static void digest_add(const void *data, size_t len) {
+  const uint8_t *p = (const uint8_t *)data;
+  while (len--) {
+    digest = (digest ^ *p++) * 0x100000001b3ULL;
+  }
+}
+
+// ---- Datagrams in flight: binary heap on (arrival, send order) ----
+
+static bool datagram_before(const struct sim_datagram *a, const struct sim_datagram *b) {
+  return (a->at_ms < b->at_ms) || ((a->at_ms == b->at_ms) && (a->seq < b->seq));
+}
+
+static bool pending_push(struct sim_datagram *d) {
+  size_t x;
+  if (pending_count == pending_capacity) {
+    size_t capacity = pending_capacity ? pending_capacity * 2 : 256;
+    struct sim_datagram **grown = realloc(pending, capacity * sizeof(*pending));
+    if (!grown) {
+      return false;
+    }
+    pending = grown;
+    pending_capacity = capacity;
+  }
+  x = pending_count++;
+  while (x > 0 && datagram_before(d, pending[(x - 1) / 2])) {
+    pending[x] = pending[(x - 1) / 2];
+    x = (x - 1) / 2;
+  }
+  pending[x] = d;
+  return true;
+}
+
+static struct sim_datagram *pending_pop() {
+  struct sim_datagram *top = pending[0];
+  struct sim_datagram *last = pending[--pending_count];
+  size_t x = 0;
+  for (;;) {
+    size_t child = 2 * x + 1;
+    if (child >= pending_count) {
+      break;
+    }
+    if ((child + 1 < pending_count) && datagram_before(pending[child + 1], pending[child])) {
+      child++;
+    }
+    if (!datagram_before(pending[child], last)) {
+      break;
+    }
+    pending[x] = pending[child];
+    x = child;
+  }
+  if (pending_count > 0) {
+    pending[x] = last;
+  }
+  return top;
+}
+
+// Everything the devices send passes through here: lose, delay, reorder
+static bool network_tap(const ip_addr_t *src, u16_t src_port, u16_t dst_port, const uint8_t *data, size_t len, void *arg) {
+  struct sim_datagram *d;
+  uint32_t client;
+  LWIP_UNUSED_ARG(arg);
+
+  datagrams_sent++;
+  if (net_uniform() * 100.0 < config.loss) {
+    datagrams_lost++;
+    return true;
+  }
+  d = malloc(sizeof(*d) + len);
+  if (!d) {
+    datagrams_lost++;
+    return true;
+  }
+  d->at_ms = now_ms + config.delay_ms;
+  if (config.jitter_ms) {
+    d->at_ms += splitmix64(&net_state) % (config.jitter_ms + 1);
+  }
+  if (net_uniform() * 100.0 < config.reorder) {
+    d->at_ms += config.reorder_ms;
+    datagrams_reordered++;
+  }
+  d->seq = datagram_seq++;
+  // All devices share the station address - give each client its own, as if behind separate NATs,
+  // so the server's per-source rate limit sees them apart
+  ip_addr_copy(d->src, *src);
+  client = (uint32_t)(src_port - CLIENT_PORT_BASE);
+  if ((src_port >= CLIENT_PORT_BASE) && (client < config.clients)) {
+    ip_addr_copy(d->src, clients[client].outer);
+  }
+  d->src_port = src_port;
+  d->dst_port = dst_port;
+  d->len = (u16_t)len;
+  memcpy(d->data, data, len);
+  if (!pending_push(d)) {
+    free(d);
+    datagrams_lost++;
+  }
+  return true;
+}
+
+// ---- Inner traffic ----
+
+struct sim_probe {
+  uint32_t client;
+  uint32_t seq;
+};
+
+static bool client_active(uint64_t t) {
+  return (config.quiet_ms == 0) || (((t - SIM_START_MS) % (config.active_ms + config.quiet_ms)) < config.active_ms);
+}
+
+static void gaps_start(struct sim_gaps *gaps) {
+  if (!gaps->tracking) {
+    gaps->tracking = true;
+    gaps->last_ms = now_ms;
+  }
+}
+
+static void gaps_received(struct sim_gaps *gaps) {
+  gaps->received++;
+  if (gaps->tracking) {
+    uint64_t gap = now_ms - gaps->last_ms;
+    if (gap > gaps->max_ms) {
+      gaps->max_ms = gap;
+    }
+    if (gap > config.gap_ms) {
+      gaps->stalls++;
+      gaps->stalled_ms += gap;
+    }
+    gaps->last_ms = now_ms;
+  }
+}
+
+static void client_send(struct sim_client *client, uint32_t index) {
+  ip4_addr_t server_inner;
+  struct sim_probe probe;
+  struct pbuf *p;
+  uint64_t start;
+
+  if (!client_active(now_ms)) {
+    // Quiet periods are not stalls
+    client->up.tracking = false;
+    client->down.tracking = false;
+    return;
+  }
+  gaps_start(&client->up);
+  gaps_start(&client->down);
+  IP4_ADDR(&server_inner, 10, 9, 0, 1);
+  probe.client = index;
+  probe.seq = client->sent++;
+  p = host_udp_packet(&client->inner, &server_inner, SINK_PORT, &probe, sizeof(probe), PROBE_PACKET_LEN);
+  if (p) {
+    start = host_clock_ns(CLOCK_PROCESS_CPUTIME_ID);
+    client->netif.output(&client->netif, p, &server_inner);
+    cpu[SIM_CPU_SEND].ns += host_clock_ns(CLOCK_PROCESS_CPUTIME_ID) - start;
+    cpu[SIM_CPU_SEND].events++;
+    pbuf_free(p);
+  }
+}
+
+// Port 9 on every device: the server echoes, the clients count
+static void sink_recv(void *arg, struct udp_pcb *pcb, struct pbuf *p, const ip_addr_t *addr, u16_t port) {
+  struct netif *inp = ip_current_input_netif();
+  struct sim_probe probe;
+  LWIP_UNUSED_ARG(arg);
+  LWIP_UNUSED_ARG(port);
+
+  if ((pbuf_copy_partial(p, &probe, sizeof(probe), 0) == sizeof(probe)) && (probe.client < config.clients)) {
+    if (inp == &server_netif) {
+      gaps_received(&clients[probe.client].up);
+      struct pbuf *echo = pbuf_alloc(PBUF_TRANSPORT, p->tot_len, PBUF_RAM);
+      if (echo) {
+        pbuf_copy(echo, p);
+        udp_sendto_if(pcb, echo, addr, SINK_PORT, &server_netif);
+        pbuf_free(echo);
+      }
+    } else if (inp == &clients[probe.client].netif) {
+      gaps_received(&clients[probe.client].down);
+    }
+  }
+  pbuf_free(p);
+}
+
+static uint64_t next_send_ms() {
+  uint64_t next = UINT64_MAX;
+  uint32_t x;
+  for (x = 0; x < config.clients; x++) {
+    if (clients[x].next_send_ms < next) {
+      next = clients[x].next_send_ms;
+    }
+  }
+  return next;
+}
+
+static enum sim_cpu_class message_class(const struct sim_datagram *d) {
+  switch ((d->len > 0) ? d->data[0] : 0) {
+    case MESSAGE_HANDSHAKE_INITIATION: return SIM_CPU_INITIATION;
+    case MESSAGE_HANDSHAKE_RESPONSE: return SIM_CPU_RESPONSE;
+    case MESSAGE_COOKIE_REPLY: return SIM_CPU_COOKIE;
+    default: return SIM_CPU_TRANSPORT;
+  }
+}
+
+static void deliver(struct sim_datagram *d) {
+  enum sim_cpu_class class = message_class(d);
+  uint64_t start;
+  digest_add(&d->at_ms, sizeof(d->at_ms));
+  digest_add(d->data, d->len);
+  start = host_clock_ns(CLOCK_PROCESS_CPUTIME_ID);
+  host_net_deliver(&d->src, d->src_port, d->dst_port, d->data, d->len);
+  cpu[class].ns += host_clock_ns(CLOCK_PROCESS_CPUTIME_ID) - start;
+  cpu[class].events++;
+  free(d);
+}
+
+static void record_write(void *arg, const uint8_t *data, size_t len) {
+  fwrite(data, 1, len, (FILE *)arg);
+}
+
+static void run(uint64_t end_ms) {
+  while (now_ms < end_ms) {
+    uint64_t next = end_ms;
+    uint64_t start;
+    u32_t sleep;
+    uint32_t x;
+
+    if (pending_count > 0 && pending[0]->at_ms < next) {
+      next = pending[0]->at_ms;
+    }
+    if (next_send_ms() < next) {
+      next = next_send_ms();
+    }
+    sleep = sys_timeouts_sleeptime();
+    if ((sleep != SYS_TIMEOUTS_SLEEPTIME_INFINITE) && (now_ms + sleep < next)) {
+      next = now_ms + sleep;
+    }
+    if (next > now_ms) {
+      now_ms = next;
+    }
+
+    while (pending_count > 0 && pending[0]->at_ms <= now_ms) {
+      deliver(pending_pop());
+    }
+    for (x = 0; x < config.clients; x++) {
+      while (clients[x].next_send_ms <= now_ms) {
+        client_send(&clients[x], x);
+        clients[x].next_send_ms += config.interval_ms;
+      }
+    }
+    start = host_clock_ns(CLOCK_PROCESS_CPUTIME_ID);
+    sys_check_timeouts();
+    cpu[SIM_CPU_TIMERS].ns += host_clock_ns(CLOCK_PROCESS_CPUTIME_ID) - start;
+    cpu[SIM_CPU_TIMERS].events++;
+    if (record_file) {
+      wireguardif_record_drain(&server_netif, record_write, record_file);
+    }
+  }
+}
+
+// ---- Setup and report ----
+
+static bool setup() {
+  uint8_t private_key[WIREGUARD_PRIVATE_KEY_LEN];
+  uint8_t server_public[WIREGUARD_PUBLIC_KEY_LEN];
+  uint8_t client_public[WIREGUARD_PUBLIC_KEY_LEN];
+  char private_base64[HOST_KEY_BASE64_LEN];
+  char address[16];
+  ip_addr_t server_inner, host_mask;
+  uint32_t x;
+
+  struct netif *station = host_net_init("192.0.2.1");
+  if (!station) {
+    return false;
+  }
+  host_net_set_tap(network_tap, NULL);
+
+  host_make_key(private_key, server_public, private_base64);
+  if (!host_add_device(&server_netif, private_base64, SERVER_PORT, "10.9.0.1", station)) {
+    return false;
+  }
+  IP_ADDR4(&server_inner, 10, 9, 0, 1);
+  IP_ADDR4(&host_mask, 255, 255, 255, 255);
+
+  for (x = 0; x < config.clients; x++) {
+    struct sim_client *client = &clients[x];
+    host_make_key(private_key, client_public, private_base64);
+    IP4_ADDR(&client->inner, 10, 9, 0, 2 + x);
+    IP_ADDR4(&client->outer, 192, 0, 2, 10 + x);
+    snprintf(address, sizeof(address), "10.9.0.%u", (unsigned)(2 + x));
+    if (!host_add_device(&client->netif, private_base64, (u16_t)(CLIENT_PORT_BASE + x), address, station)
+        || !host_add_peer(&client->netif, server_public, "10.9.0.0", "255.255.255.0", "192.0.2.1", SERVER_PORT, &client->peer_index)
+        || !host_add_peer(&server_netif, client_public, address, "255.255.255.255", NULL, 0, &client->server_index)
+        // Received packets are matched on their inner destination, so every peer also allows the server's address
+        || (wireguardif_add_allowed_ip(&server_netif, client->server_index, &server_inner, &host_mask) != ERR_OK)) {
+      return false;
+    }
+    // Spread the clients over one interval
+    client->next_send_ms = now_ms + splitmix64(&net_state) % config.interval_ms;
+    wireguardif_connect(&client->netif, client->peer_index);
+  }
+
+  struct udp_pcb *sink = udp_new();
+  if (!sink || udp_bind(sink, IP_ANY_TYPE, SINK_PORT) != ERR_OK) {
+    return false;
+  }
+  udp_recv(sink, sink_recv, NULL);
+  return true;
+}
+
+static void print_gaps(const char *direction, const struct sim_gaps *gaps) {
+  printf("  %-4s %9u %11.1f %8u %12.1f", direction, gaps->received, gaps->max_ms / 1000.0, gaps->stalls, gaps->stalled_ms / 1000.0);
+}
+
+static void report(double wall_s) {
+  struct wireguard_device_stats server;
+  double hours = (double)config.duration_ms / 3600000.0;
+  uint64_t total_ns = 0;
+  uint32_t x;
+
+  printf("simulated %.2f h in %.2f s (%.0fx), seed %llu\n", hours, wall_s, hours * 3600.0 / wall_s, (unsigned long long)config.seed);
+  printf("network: %u datagrams, %u lost, %u reordered\n\n", datagrams_sent, datagrams_lost, datagrams_reordered);
+
+  printf("%6s %8s %10s %10s %10s %8s %8s %10s\n", "client", "probes", "init tx", "resp rx", "sessions", "per h", "cookies", "drops");
+  for (x = 0; x < config.clients; x++) {
+    struct wireguard_peer_stats stats;
+    const struct wireguard_drop_stats *d = &stats.drops;
+    wireguardif_get_peer_stats(&clients[x].netif, clients[x].peer_index, &stats);
+    printf("%6u %8u %10u %10u %10u %8.1f %8u %10u\n", x, clients[x].sent,
+      stats.handshake_initiations_tx, stats.handshake_responses_rx, stats.handshakes_completed,
+      stats.handshakes_completed / hours, stats.cookies_rx,
+      d->bad_mac1 + d->replay + d->auth_failure + d->no_keypair + d->no_memory + d->allowed_ip + d->key_expired + d->malformed + d->rate_limited);
+  }
+  wireguardif_get_device_stats(&server_netif, &server);
+  printf("server: %u initiations rx, %u responses tx, %u sessions, %u cookies tx, drops: %u replay %u no keypair %u expired %u rate limited\n\n",
+    server.totals.handshake_initiations_rx, server.totals.handshake_responses_tx, server.totals.handshakes_completed, server.cookies_tx,
+    server.totals.drops.replay, server.totals.drops.no_keypair, server.totals.drops.key_expired, server.totals.drops.rate_limited);
+
+  printf("%6s %4s %9s %11s %8s %12s\n", "client", "dir", "delivered", "max gap s", "stalls", "stalled s");
+  for (x = 0; x < config.clients; x++) {
+    printf("%6u", x);
+    print_gaps("up", &clients[x].up);
+    printf("\n%6s", "");
+    print_gaps("down", &clients[x].down);
+    printf("\n");
+  }
+  printf("(stall: no probe delivered for more than %u ms while the client was sending)\n\n", config.gap_ms);
+
+  for (x = 0; x < SIM_CPU_CLASSES; x++) {
+    total_ns += cpu[x].ns;
+  }
+  printf("%-14s %10s %10s %10s %7s\n", "cpu", "events", "total ms", "us/event", "share");
+  for (x = 0; x < SIM_CPU_CLASSES; x++) {
+    printf("%-14s %10llu %10.1f %10.2f %6.1f%%\n", cpu_class_names[x], (unsigned long long)cpu[x].events, cpu[x].ns / 1e6,
+      cpu[x].events ? (double)cpu[x].ns / 1000.0 / cpu[x].events : 0.0, total_ns ? 100.0 * cpu[x].ns / total_ns : 0.0);
+  }
+  printf("\ntrace digest %016llx\n", (unsigned long long)digest);
+}
+
+#if WIREGUARD_STACK_PROBE
+// False if a device went over the budget
+static bool report_stack() {
+  struct wireguard_device_stats stats;
+  uint32_t high_water;
+  uint32_t over;
+  uint32_t x;
+  wireguardif_get_device_stats(&server_netif, &stats);
+  high_water = stats.stack_high_water;
+  over = stats.stack_over_budget;
+  for (x = 0; x < config.clients; x++) {
+    wireguardif_get_device_stats(&clients[x].netif, &stats);
+    if (stats.stack_high_water > high_water) {
+      high_water = stats.stack_high_water;
+    }
+    over += stats.stack_over_budget;
+  }
+  printf("stack: at most %u bytes below the lwIP callbacks (budget %u), %u callbacks over budget\n",
+    high_water, WIREGUARD_STACK_BUDGET, over);
+  return (over == 0);
+}
+#endif
+
+static void usage(const char *name) {
+  fprintf(stderr, "usage: %s [-p clients (1..%d)] [-t seconds] [-i probe_interval_ms] [-l loss_%%] [-d delay_ms] [-j jitter_ms]\n"
+    "          [-r reorder_%%] [-R reorder_hold_ms] [-a active_s -q quiet_s] [-g stall_ms] [-s seed] [-w trace_file]\n", name, SIM_MAX_CLIENTS);
+}
+
+int main(int argc, char **argv) {
+  uint64_t wall_start;
+  int opt;
+
+  config.clients = 4;
+  config.duration_ms = 3 * 3600 * 1000ULL;
+  config.interval_ms = 1000;
+  config.delay_ms = 20;
+  config.jitter_ms = 5;
+  config.reorder_ms = 30;
+  config.gap_ms = 3000;
+  config.seed = 1;
+
+  while ((opt = getopt(argc, argv, "p:t:i:l:d:j:r:R:a:q:g:s:w:h")) != -1) {
+    switch (opt) {
+      case 'p': config.clients = (uint32_t)strtoul(optarg, NULL, 0); break;
+      case 't': config.duration_ms = strtoull(optarg, NULL, 0) * 1000ULL; break;
+      case 'i': config.interval_ms = (uint32_t)strtoul(optarg, NULL, 0); break;
+      case 'l': config.loss = strtod(optarg, NULL); break;
+      case 'd': config.delay_ms = (uint32_t)strtoul(optarg, NULL, 0); break;
+      case 'j': config.jitter_ms = (uint32_t)strtoul(optarg, NULL, 0); break;
+      case 'r': config.reorder = strtod(optarg, NULL); break;
+      case 'R': config.reorder_ms = (uint32_t)strtoul(optarg, NULL, 0); break;
+      case 'a': config.active_ms = (uint32_t)strtoul(optarg, NULL, 0) * 1000U; break;
+      case 'q': config.quiet_ms = (uint32_t)strtoul(optarg, NULL, 0) * 1000U; break;
+      case 'g': config.gap_ms = (uint32_t)strtoul(optarg, NULL, 0); break;
+      case 's': config.seed = strtoull(optarg, NULL, 0); break;
+      case 'w':
+        record_file = fopen(optarg, "wb");
+        if (!record_file) {
+          perror(optarg);
+          return 1;
+        }
+        break;
+      default: usage(argv[0]); return 2;
+    }
+  }
+  if (config.clients < 1 || config.clients > SIM_MAX_CLIENTS || config.duration_ms == 0 || config.interval_ms == 0
+      || (config.quiet_ms && !config.active_ms)) {
+    usage(argv[0]);
+    return 2;
+  }
+
+  net_state = config.seed;
+  key_state = config.seed ^ 0x5DEECE66DULL;
+  wireguard_platform_init();
+  wireguard_platform_set_hooks(&sim_hooks);
+
+  if (!setup()) {
+    fprintf(stderr, "setup failed\n");
+    return 1;
+  }
+  // Recording starts once the clients are configured and their first initiations are on the way
+  if (record_file && wireguardif_record_start(&server_netif) != ERR_OK) {
+    fprintf(stderr, "recording needs a build with WIREGUARD_RECORD=1\n");
+    return 1;
+  }
+  wall_start = host_clock_ns(CLOCK_MONOTONIC);
+  run(SIM_START_MS + config.duration_ms);
+  if (record_file) {
+    wireguardif_record_stop(&server_netif);
+    wireguardif_record_drain(&server_netif, record_write, record_file);
+    fclose(record_file);
+  }
+  report((double)(host_clock_ns(CLOCK_MONOTONIC) - wall_start) / 1e9);
+#if WIREGUARD_STACK_PROBE
+  if (!report_stack()) {
+    return 1;
+  }
+#endif
+  return 0;
+}
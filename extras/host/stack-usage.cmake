@@ -0,0 +1,83 @@
+# Stack frames of the core from the -fstack-usage files of a build (run by ctest as stack_usage):
+#
+#   cmake -DSU_DIR=<object dir> -DBUDGET=<bytes> [-DSRC_DIR=<dir>] [-DTOP=<n>] -P stack-usage.cmake
+#
+# With SRC_DIR only functions of the sources under it count (the library, not the host helpers built
+# into the same target). Prints the TOP (default 15) largest frames and fails if any frame is over BUDGET bytes or unbounded
+# ("dynamic" without "bounded", i.e. alloca or a variable length array). Frames only - what a whole call
+# chain needs below an lwIP callback is measured at run time by WIREGUARD_STACK_PROBE (wg_sim_stack).
+
+if(NOT SU_DIR OR NOT BUDGET)
+  message(FATAL_ERROR "usage: cmake -DSU_DIR=<object dir> -DBUDGET=<bytes> [-DSRC_DIR=<dir>] [-DTOP=<n>] -P stack-usage.cmake")
+endif()
+if(SRC_DIR)
+  get_filename_component(SRC_DIR "${SRC_DIR}" ABSOLUTE)
+endif()
+if(NOT TOP)
+  set(TOP 15)
+endif()
+
+file(GLOB_RECURSE su_files "${SU_DIR}/*.su")
+if(NOT su_files)
+  message(FATAL_ERROR "No .su files under ${SU_DIR} - build with -fstack-usage first")
+endif()
+
+# Each line: <file>:<line>:<column>:<function> TAB <bytes> TAB <static|dynamic|dynamic,bounded>
+set(frames "")
+set(failures "")
+foreach(su ${su_files})
+  file(STRINGS "${su}" lines)
+  foreach(line ${lines})
+    set(at -1)
+    if(line MATCHES "^(.*)\t([0-9]+)\t([a-z,]+)$")
+      set(where "${CMAKE_MATCH_1}")
+      set(bytes "${CMAKE_MATCH_2}")
+      set(kind "${CMAKE_MATCH_3}")
+      if(SRC_DIR)
+        string(FIND "${where}" "${SRC_DIR}/" at)
+      else()
+        set(at 0)
+      endif()
+    endif()
+    if(at EQUAL 0)
+      # <file>:<line>:<column>:<function> without the directories
+      string(REGEX REPLACE "^.*/" "" where "${where}")
+      # Zero padded so that a string sort orders by size
+      set(padded "0000000${bytes}")
+      string(LENGTH "${padded}" digits)
+      math(EXPR start "${digits} - 8")
+      string(SUBSTRING "${padded}" ${start} 8 padded)
+      list(APPEND frames "${padded} ${kind} ${where}")
+      if(bytes GREATER BUDGET)
+        list(APPEND failures "${bytes} bytes: ${where}")
+      endif()
+      if(kind STREQUAL "dynamic")
+        list(APPEND failures "unbounded: ${where}")
+      endif()
+    endif()
+  endforeach()
+endforeach()
+
+if(NOT frames)
+  message(FATAL_ERROR "No stack frames of ${SRC_DIR} in ${SU_DIR}")
+endif()
+list(SORT frames)
+list(REVERSE frames)
+list(LENGTH frames count)
+if(TOP GREATER count)
+  set(TOP ${count})
+endif()
+message("largest of ${count} stack frames (budget ${BUDGET} bytes):")
+math(EXPR last "${TOP} - 1")
+foreach(x RANGE ${last})
+  list(GET frames ${x} frame)
+  string(REGEX MATCH "^0*([0-9]+ .*)$" frame "${frame}")
+  message("  ${CMAKE_MATCH_1}")
+endforeach()
+
+if(failures)
+  foreach(failure ${failures})
+    message("over budget - ${failure}")
+  endforeach()
+  message(FATAL_ERROR "stack frames over budget")
+endif()
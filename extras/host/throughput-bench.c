@@ -0,0 +1,217 @@
+/*
+ * End-to-end data path benchmark for the host build.
+ * SPDX-License-Identifier: BSD-3-Clause
+ *
+ * Two wireguardif devices on the in-memory network (host-net.h) complete a handshake,
+ * then device A streams inner IPv4/UDP packets of each size to a UDP socket behind
+ * device B: wireguardif_output() -> encrypt -> udp_sendto() -> wireguardif_network_rx()
+ * -> decrypt -> ip_input(). Every packet is sent and delivered before the next one, so the
+ * numbers are the cost of one packet through both ends of the tunnel.
+ *
+ * Reported per size: packets/s and Mbit/s of inner packets, wireguard_cycle_count() ticks
+ * per inner byte (TSC cycles on x86, nanoseconds elsewhere) and lwIP heap allocations and
+ * frees per packet (host-alloc.h). Building the inner packet is not counted; the pbuf the
+ * network shim allocates for each received datagram, as a Wi-Fi driver would, is. The
+ * transport pbufs come from the WireGuard pbuf pool (wireguard-pbufpool.h) and are not heap
+ * allocations; its counters are printed at the end.
+ *
+ * Built with WIREGUARD_ALLOC_STATS (wg_throughput_alloc) the heap allocations made by the
+ * WireGuard code itself are counted too (wg-heap/p, failed allocations included). With -z the
+ * run fails unless that is zero for every size, which is what ctest checks.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "lwip/ip.h"
+#include "lwip/pbuf.h"
+#include "lwip/udp.h"
+
+#include "wireguard.h"
+#include "wireguardif.h"
+#include "host-alloc.h"
+#include "host-net.h"
+#include "host-util.h"
+
+#define PORT_A                51820
+#define PORT_B                51821
+#define SINK_PORT             9
+#define MAX_SIZES             16
+#define MAX_INNER_LEN         1420
+
+static struct netif netif_a;
+static struct netif netif_b;
+
+static uint32_t received;
+
+static void sink_recv(void *arg, struct udp_pcb *pcb, struct pbuf *p, const ip_addr_t *addr, u16_t port) {
+  LWIP_UNUSED_ARG(arg);
+  LWIP_UNUSED_ARG(pcb);
+  LWIP_UNUSED_ARG(addr);
+  LWIP_UNUSED_ARG(port);
+  received++;
+  pbuf_free(p);
+}
+
+static void usage(const char *name) {
+  fprintf(stderr, "usage: %s [-z] [-n packets_per_size] [-s size[,size...]] (sizes are inner IPv4 packet lengths, 28..%d)\n", name, MAX_INNER_LEN);
+}
+
+// Heap and failed allocations at the WireGuard allocation sites so far, false without WIREGUARD_ALLOC_STATS
+static bool wg_heap_allocs(uint64_t *count) {
+  struct wireguard_alloc_stats stats;
+  int x;
+  if (wireguardif_get_alloc_stats(&stats) != ERR_OK) {
+    return false;
+  }
+  *count = 0;
+  for (x = 0; x < WIREGUARD_ALLOC_SITE_COUNT; x++) {
+    *count += stats.sites[x].heap + stats.sites[x].failures;
+  }
+  return true;
+}
+
+static int parse_sizes(const char *list, uint32_t *sizes) {
+  int count = 0;
+  char *end;
+  while (*list && count < MAX_SIZES) {
+    unsigned long size = strtoul(list, &end, 0);
+    if (end == list || size < 28 || size > MAX_INNER_LEN) {
+      return -1;
+    }
+    sizes[count++] = (uint32_t)size;
+    list = (*end == ',') ? end + 1 : end;
+  }
+  return count;
+}
+
+int main(int argc, char **argv) {
+  uint32_t sizes[MAX_SIZES] = { 64, 128, 256, 512, 1024, MAX_INNER_LEN };
+  int size_count = 6;
+  uint32_t count = 20000;
+  bool zero_alloc = false;
+  bool failed = false;
+  uint64_t wg_count;
+  int opt;
+
+  while ((opt = getopt(argc, argv, "zn:s:h")) != -1) {
+    switch (opt) {
+      case 'z': zero_alloc = true; break;
+      case 'n': count = (uint32_t)strtoul(optarg, NULL, 0); break;
+      case 's': size_count = parse_sizes(optarg, sizes); break;
+      default: usage(argv[0]); return 2;
+    }
+  }
+  if (count < 1 || size_count < 1) {
+    usage(argv[0]);
+    return 2;
+  }
+  if (zero_alloc && !wg_heap_allocs(&wg_count)) {
+    fprintf(stderr, "-z needs a build with WIREGUARD_ALLOC_STATS (wg_throughput_alloc)\n");
+    return 2;
+  }
+
+  wireguard_platform_init();
+  // What WireGuard::begin() does on the Pico - loads and moves the timestamp mark in $WG_STORAGE_DIR
+  wireguard_tai64n_reserve();
+  struct netif *station = host_net_init("192.0.2.1");
+  if (!station) {
+    fprintf(stderr, "station netif setup failed\n");
+    return 1;
+  }
+
+  uint8_t private_key[WIREGUARD_PRIVATE_KEY_LEN];
+  uint8_t public_a[WIREGUARD_PUBLIC_KEY_LEN], public_b[WIREGUARD_PUBLIC_KEY_LEN];
+  char private_a[HOST_KEY_BASE64_LEN], private_b[HOST_KEY_BASE64_LEN];
+  u8_t index;
+  host_make_key(private_key, public_a, private_a);
+  host_make_key(private_key, public_b, private_b);
+  if (!host_add_device(&netif_a, private_a, PORT_A, "10.9.0.1", station)
+      || !host_add_device(&netif_b, private_b, PORT_B, "10.9.0.2", station)
+      || !host_add_peer(&netif_a, public_b, "10.9.0.0", "255.255.255.0", "192.0.2.1", PORT_B, &index)
+      || !host_add_peer(&netif_b, public_a, "10.9.0.0", "255.255.255.0", "192.0.2.1", PORT_A, NULL)) {
+    fprintf(stderr, "device setup failed\n");
+    return 1;
+  }
+
+  struct udp_pcb *sink = udp_new();
+  udp_bind(sink, IP_ANY_TYPE, SINK_PORT);
+  udp_recv(sink, sink_recv, NULL);
+
+  wireguardif_connect(&netif_a, index);
+  if (!host_wait_up(&netif_a, index, 5000)) {
+    fprintf(stderr, "session did not come up\n");
+    return 1;
+  }
+
+  printf("%6s %8s %10s %9s %11s %10s %9s %10s %8s\n", "size", "packets", "pkts/s", "Mbit/s", "cycles/B", "allocs/p", "frees/p", "wg-heap/p", "lost");
+
+  ip4_addr_t src, dest;
+  IP4_ADDR(&src, 10, 9, 0, 1);
+  IP4_ADDR(&dest, 10, 9, 0, 2);
+  int s;
+  for (s = 0; s < size_count; s++) {
+    struct host_alloc_stats before, after;
+    uint64_t allocs = 0, frees = 0, cycles = 0, wall_ns = 0;
+    uint64_t wg_before = 0, wg_after = 0;
+    bool wg_counted;
+    char wg_heap[16];
+    uint32_t m;
+
+    received = 0;
+    wg_counted = wg_heap_allocs(&wg_before);
+    for (m = 0; m < count; m++) {
+      struct pbuf *p = host_udp_packet(&src, &dest, SINK_PORT, NULL, 0, sizes[s]);
+      if (!p) {
+        fprintf(stderr, "out of memory\n");
+        return 1;
+      }
+      host_alloc_get_stats(&before);
+      uint64_t wall_start = host_clock_ns(CLOCK_MONOTONIC);
+      uint32_t cycle_start = wireguard_cycle_count();
+
+      netif_a.output(&netif_a, p, &dest);
+      host_net_poll();
+
+      cycles += (uint32_t)(wireguard_cycle_count() - cycle_start);
+      wall_ns += host_clock_ns(CLOCK_MONOTONIC) - wall_start;
+      host_alloc_get_stats(&after);
+      allocs += after.allocs - before.allocs;
+      frees += after.frees - before.frees;
+      pbuf_free(p);
+    }
+
+    strcpy(wg_heap, "-");
+    if (wg_counted && wg_heap_allocs(&wg_after)) {
+      snprintf(wg_heap, sizeof(wg_heap), "%.2f", (double)(wg_after - wg_before) / count);
+      if (zero_alloc && (wg_after != wg_before)) {
+        failed = true;
+      }
+    }
+
+    double seconds = (double)wall_ns / 1e9;
+    printf("%6u %8u %10.0f %9.1f %11.2f %10.2f %9.2f %10s %8u\n",
+      sizes[s],
+      count,
+      count / seconds,
+      ((double)count * sizes[s] * 8.0) / seconds / 1e6,
+      (double)cycles / ((double)count * sizes[s]),
+      (double)allocs / count,
+      (double)frees / count,
+      wg_heap,
+      count - received);
+  }
+
+  struct wireguard_device_stats stats;
+  wireguardif_get_device_stats(&netif_a, &stats);
+  printf("\npbuf pool: %u buffers, %u allocations, %u from the heap, at most %u in use\n",
+    stats.pbuf_pool.size, stats.pbuf_pool.allocs, stats.pbuf_pool.heap_fallbacks, stats.pbuf_pool.high_water);
+  printf("cycle counter: %u Hz\n", wireguard_cycle_frequency());
+  if (zero_alloc) {
+    printf("zero WireGuard heap allocations per packet: %s\n", failed ? "FAILED" : "ok");
+  }
+  return failed ? 1 : 0;
+}
@@ -0,0 +1,40 @@
+/*
+ * Host replacement of src/wg_port_pico.cpp: log output goes to stderr, and only when
+ * WG_HOST_LOG is set in the environment so benchmarks are not slowed down by printing.
+ * SPDX-License-Identifier: BSD-3-Clause
+ */
+
+#include "wg_port_pico.h"
+
+#include <stdlib.h>
+
+static int log_enabled = -1;
+
+static int host_log_enabled() {
+  if (log_enabled < 0) {
+    log_enabled = (getenv("WG_HOST_LOG") != NULL);
+  }
+  return log_enabled;
+}
+
+void dbg(const char *format, ...) {
+  if (!host_log_enabled()) {
+    return;
+  }
+  va_list ap;
+  va_start(ap, format);
+  vfprintf(stderr, format, ap);
+  va_end(ap);
+}
+
+void wg_logf_(const char *lvl, const char *fmt, ...) {
+  if (!host_log_enabled()) {
+    return;
+  }
+  va_list ap;
+  va_start(ap, fmt);
+  fprintf(stderr, "[%s] ", lvl);
+  vfprintf(stderr, fmt, ap);
+  fputc('\n', stderr);
+  va_end(ap);
+}
@@ -0,0 +1,178 @@
+/*
+ * Host (Linux / POSIX) implementation of wireguard-platform.h, used to build the
+ * protocol core outside of the Pico for benchmarks and tests. Not compiled by Arduino.
+ * SPDX-License-Identifier: BSD-3-Clause
+ */
+
+#include "wireguard-platform.h"
+
+#include <stdlib.h>
+#include <stdint.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <sys/random.h>
+
+#include "crypto.h"          // for U64TO8_BIG / U32TO8_BIG
+#include "wireguard-tai64n.h"
+#if WG_HOST_OPENSSL
+#include "crypto-openssl.h"
+#endif
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#define HOST_HAVE_TSC 1
+#endif
+
+static uint64_t monotonic_ns() {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * 1000000000ULL + (uint64_t)ts.tv_nsec;
+}
+
+#if WIREGUARD_PLATFORM_HOOKS
+static const struct wireguard_platform_hooks *hooks = NULL;
+
+void wireguard_platform_set_hooks(const struct wireguard_platform_hooks *new_hooks) {
+  hooks = new_hooks;
+}
+#endif
+
+#if HOST_HAVE_TSC
+static uint32_t tsc_frequency = 0;
+
+// Measure the TSC rate against the monotonic clock once (invariant TSC assumed)
+static void calibrate_tsc() {
+  uint64_t ns_start = monotonic_ns();
+  uint64_t tsc_start = __rdtsc();
+  while (monotonic_ns() - ns_start < 50000000ULL) {
+  }
+  uint64_t ns = monotonic_ns() - ns_start;
+  uint64_t ticks = __rdtsc() - tsc_start;
+  uint64_t hz = (ticks * 1000000000ULL) / ns;
+  tsc_frequency = (hz > UINT32_MAX) ? UINT32_MAX : (uint32_t)hz;
+}
+#endif
+
+void wireguard_platform_init() {
+#if HOST_HAVE_TSC
+  if (tsc_frequency == 0) {
+    calibrate_tsc();
+  }
+#endif
+#if WG_HOST_OPENSSL
+  // A candidate for wireguard_crypto_select()
+  wireguard_crypto_register(&wireguard_crypto_openssl);
+#endif
+}
+
+void wireguard_random_bytes(void *bytes, size_t size) {
+  uint8_t *p = (uint8_t *)bytes;
+#if WIREGUARD_PLATFORM_HOOKS
+  if (hooks && hooks->random_bytes) {
+    hooks->random_bytes(bytes, size);
+    return;
+  }
+#endif
+  while (size > 0) {
+    ssize_t n = getrandom(p, size, 0);
+    if (n <= 0) {
+      abort();
+    }
+    p += n;
+    size -= (size_t)n;
+  }
+}
+
+uint32_t wireguard_sys_now() {
+#if WIREGUARD_PLATFORM_HOOKS
+  if (hooks && hooks->sys_now) {
+    return hooks->sys_now();
+  }
+#endif
+  return (uint32_t)(monotonic_ns() / 1000000ULL);
+}
+
+void wireguard_tai64n_reserve() {
+#if WIREGUARD_MONOTONIC_TAI64N
+  struct timespec ts;
+  clock_gettime(CLOCK_REALTIME, &ts);
+  wireguard_tai64n_monotonic_reserve(monotonic_ns() / 1000ULL, (uint64_t)ts.tv_sec * 1000000ULL + (uint64_t)ts.tv_nsec / 1000ULL);
+#endif
+}
+
+void wireguard_tai64n_now(uint8_t *output) {
+  struct timespec ts;
+#if WIREGUARD_PLATFORM_HOOKS
+  if (hooks && hooks->tai64n_now) {
+    hooks->tai64n_now(output);
+    return;
+  }
+#endif
+  clock_gettime(CLOCK_REALTIME, &ts);
+
+#if WIREGUARD_MONOTONIC_TAI64N
+  wireguard_tai64n_monotonic(output, monotonic_ns() / 1000ULL, (uint64_t)ts.tv_sec * 1000000ULL + (uint64_t)ts.tv_nsec / 1000ULL);
+#else
+  uint64_t seconds = 0x400000000000000aULL + (uint64_t)ts.tv_sec;
+  uint32_t nanos = (uint32_t)ts.tv_nsec;
+
+  U64TO8_BIG(output + 0, seconds);
+  U32TO8_BIG(output + 8, nanos);
+#endif
+}
+
+bool wireguard_is_under_load() {
+  return false;
+}
+
+// Raw TSC on x86 (wraps after ~1s at 3GHz, long enough for any single stage), nanoseconds elsewhere
+uint32_t wireguard_cycle_count() {
+#if HOST_HAVE_TSC
+  return (uint32_t)__rdtsc();
+#else
+  return (uint32_t)monotonic_ns();
+#endif
+}
+
+uint32_t wireguard_cycle_frequency() {
+#if HOST_HAVE_TSC
+  if (tsc_frequency == 0) {
+    calibrate_tsc();
+  }
+  return tsc_frequency;
+#else
+  return 1000000000U;
+#endif
+}
+
+// One file per item in $WG_STORAGE_DIR (default: current directory)
+static void storage_path(const char *name, char *path, size_t size) {
+  const char *dir = getenv("WG_STORAGE_DIR");
+  snprintf(path, size, "%s/wg-%s", dir ? dir : ".", name);
+}
+
+bool wireguard_storage_read(const char *name, uint8_t *data, size_t len) {
+  char path[512];
+  storage_path(name, path, sizeof(path));
+  FILE *f = fopen(path, "rb");
+  if (!f) {
+    return false;
+  }
+  size_t n = fread(data, 1, len, f);
+  bool ok = (n == len) && (fgetc(f) == EOF);
+  fclose(f);
+  return ok;
+}
+
+bool wireguard_storage_write(const char *name, const uint8_t *data, size_t len) {
+  char path[512];
+  storage_path(name, path, sizeof(path));
+  FILE *f = fopen(path, "wb");
+  if (!f) {
+    return false;
+  }
+  bool ok = (fwrite(data, 1, len, f) == len);
+  return (fclose(f) == 0) && ok;
+}
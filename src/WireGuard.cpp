@@ -186,17 +186,61 @@ void WireGuard::end() {
         return;
     }
 
-    wireguardif_remove_peer(wg_netif, peer_index);
-    netif_remove(wg_netif);
-
+    // The tunnel timer and the receive callback may run on the other core - hold them off
+    // until the device is gone, as suspend() and resume() do.
+    WG_LWIP_LOCK();
     if (previous_default_netif != nullptr) {
         netif_set_default(previous_default_netif);
     }
 
+    wireguardif_remove_peer(wg_netif, peer_index);
+    netif_set_down(wg_netif);
+    netif_remove(wg_netif);
+    // Stops the timer, releases the UDP pcb and frees the device.
+    wireguardif_shutdown(wg_netif);
+    WG_LWIP_UNLOCK();
+
     _is_initialized = false;
+    _is_suspended = false;
     peer_index = WIREGUARDIF_INVALID_INDEX;
 }
 
+bool WireGuard::suspend() {
+    if (!_is_initialized) return false;
+    if (_is_suspended) return true;
+
+    // The netif stays (and stays the default route when routing everything), so nothing
+    // goes out in the clear while the tunnel sleeps.
+    if (wireguardif_suspend(wg_netif) != ERR_OK) {
+        return false;
+    }
+    _is_suspended = true;
+    return true;
+}
+
+bool WireGuard::resume() {
+    if (!_is_initialized) return false;
+    if (!_is_suspended) return true;
+
+    // Sketch context - move the timestamp mark in flash ahead if it runs short
+    wireguard_tai64n_reserve();
+    err_t err = wireguardif_resume(wg_netif);
+    if (err != ERR_OK) {
+        log_e(TAG "wireguardif_resume() failed err=%d", (int)err);
+        return false;
+    }
+    _is_suspended = false;
+    return true;
+}
+
+void WireGuard::maintain() {
+    if (!_is_initialized) return;
+
+    wireguardif_maintain(wg_netif);
+    // Move the timestamp mark in flash ahead before handshakes catch up with it
+    wireguard_tai64n_reserve();
+}
+
 bool WireGuard::peerUp(IPAddress* currentEndpointIp, uint16_t* currentEndpointPort) const {
     if (!_is_initialized) return false;
     if (wg_netif == nullptr || peer_index == WIREGUARDIF_INVALID_INDEX) return false;
@@ -225,6 +269,25 @@ bool WireGuard::peerUp(IPAddress* currentEndpointIp, uint16_t* currentEndpointPo
     return true;
 }
 
+bool WireGuard::addEndpoint(const char* host, uint16_t port) {
+    if (!_is_initialized) return false;
+
+    ip4_addr_t endpoint4;
+    if (!resolve_ipv4(host, &endpoint4)) {
+        log_e(TAG "Failed to resolve endpoint '%s'", host ? host : "");
+        return false;
+    }
+
+    ip_addr_t endpoint;
+    ip_addr_copy_from_ip4(endpoint, endpoint4);
+    err_t err = wireguardif_add_endpoint(wg_netif, peer_index, &endpoint, port);
+    if (err != ERR_OK) {
+        log_e(TAG "wireguardif_add_endpoint() failed err=%d", (int)err);
+        return false;
+    }
+    return true;
+}
+
 bool WireGuard::kickHandshake(const IPAddress& probeIp, uint16_t probePort, uint32_t minIntervalMs) {
     if (!_is_initialized) return false;
 
@@ -243,4 +306,80 @@ bool WireGuard::kickHandshake(const IPAddress& probeIp, uint16_t probePort, uint
     udp.stop();
 
     return true;
-}
\ No newline at end of file
+}
+
+bool WireGuard::getStats(wireguard_device_stats* deviceStats, wireguard_peer_stats* peerStats) const {
+    if (!_is_initialized) return false;
+
+    if (deviceStats && wireguardif_get_device_stats(wg_netif, deviceStats) != ERR_OK) {
+        return false;
+    }
+    if (peerStats && wireguardif_get_peer_stats(wg_netif, peer_index, peerStats) != ERR_OK) {
+        return false;
+    }
+    return true;
+}
+
+bool WireGuard::getPeerLiveness(wireguard_peer_liveness* liveness) const {
+    if (!_is_initialized || liveness == nullptr) return false;
+    return wireguardif_get_peer_liveness(wg_netif, peer_index, liveness) == ERR_OK;
+}
+
+wireguard_liveness_state WireGuard::liveness() const {
+    wireguard_peer_liveness info;
+    if (!getPeerLiveness(&info)) return WIREGUARD_LIVENESS_DOWN;
+    return (wireguard_liveness_state)info.state;
+}
+
+bool WireGuard::getLatencyHistogram(wireguard_latency_stage stage, wireguard_histogram* histogram) const {
+    if (!_is_initialized || histogram == nullptr) return false;
+    return wireguardif_get_latency_histogram(wg_netif, (u8_t)stage, histogram) == ERR_OK;
+}
+
+bool WireGuard::resetLatencyHistograms() {
+    if (!_is_initialized) return false;
+    return wireguardif_reset_latency_histograms(wg_netif) == ERR_OK;
+}
+
+bool WireGuard::getAllocStats(wireguard_alloc_stats* stats) const {
+    if (stats == nullptr) return false;
+    return wireguardif_get_alloc_stats(stats) == ERR_OK;
+}
+
+bool WireGuard::resetAllocStats() {
+    return wireguardif_reset_alloc_stats() == ERR_OK;
+}
+
+static void capture_write_to_print(void *arg, const uint8_t *data, size_t len) {
+    static_cast<Print *>(arg)->write(data, len);
+}
+
+bool WireGuard::setCaptureEnabled(bool enabled) {
+    if (!_is_initialized) return false;
+    return wireguardif_capture_enable(wg_netif, enabled) == ERR_OK;
+}
+
+bool WireGuard::clearCapture() {
+    if (!_is_initialized) return false;
+    return wireguardif_capture_clear(wg_netif) == ERR_OK;
+}
+
+bool WireGuard::exportCapture(Print& out) {
+    if (!_is_initialized) return false;
+    return wireguardif_capture_export(wg_netif, capture_write_to_print, &out) == ERR_OK;
+}
+
+bool WireGuard::startRecording() {
+    if (!_is_initialized) return false;
+    return wireguardif_record_start(wg_netif) == ERR_OK;
+}
+
+bool WireGuard::stopRecording() {
+    if (!_is_initialized) return false;
+    return wireguardif_record_stop(wg_netif) == ERR_OK;
+}
+
+bool WireGuard::drainRecording(Print& out) {
+    if (!_is_initialized) return false;
+    return wireguardif_record_drain(wg_netif, capture_write_to_print, &out) == ERR_OK;
+}
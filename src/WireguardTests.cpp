@@ -8,48 +8,53 @@ void test_wireguard_random() {
                 rand_test[0], rand_test[1], rand_test[2], rand_test[3]);
 }
 
-void test_crypto_primitives() {
+static void print_to_serial(void *arg, const char *line) {
+    (void)arg;
+    Serial.println(line);
+}
+
+// Known-answer tests of every primitive (wireguard-selftest.h), x25519_iterations of the RFC 7748
+// iterated test - 1000 takes a while on the Pico. Registered backends are also compared with the reference.
+bool test_crypto_primitives(uint32_t x25519_iterations) {
     Serial.println("=== Testing crypto primitives ===");
-    
-    // Test BLAKE2s
-    uint8_t hash[32];
-    uint8_t test_data[] = "WireGuard test";
-    
-    if (blake2s(hash, 32, NULL, 0, test_data, sizeof(test_data)-1) == 0) {
-        Serial.print("BLAKE2s OK: ");
-        for(int i=0; i<4; i++) Serial.printf("%02x", hash[i]);
-        Serial.println("...");
-    } else {
-        Serial.println("BLAKE2s FAILED!");
+    bool ok = wireguard_selftest(x25519_iterations, print_to_serial, NULL);
+    const struct wireguard_crypto_backend *backend;
+    for (uint8_t x = 1; (backend = wireguard_crypto_backend(x)) != NULL; x++) {
+        for (uint8_t group = 0; group < WIREGUARD_CRYPTO_GROUPS; group++) {
+            if (wireguard_crypto_provides(backend, group)) {
+                ok &= (wireguard_selftest_group(backend, group, 1, print_to_serial, NULL) == 0);
+                ok &= (wireguard_selftest_compare(backend, group, 64, print_to_serial, NULL) == 0);
+            }
+        }
     }
-    
-    // Test X25519 (basic)
-    uint8_t private_key[32] = {0};
-    uint8_t public_key[32];
-    uint8_t basepoint[32] = {9};
-    
-    // fill private key with testing data
-    for(int i=0; i<32; i++) private_key[i] = i;
-    
-    int result = x25519(public_key, private_key, basepoint, 1);
-    Serial.printf("X25519 result: %d\n", result);
-    if(result == 0) {
-        Serial.print("X25519 OK, public key: ");
-        for(int i=0; i<4; i++) Serial.printf("%02x", public_key[i]);
-        Serial.println("...");
-    } else {
-        Serial.println("X25519 FAILED!");
+    Serial.printf("Crypto in use: blake2s %s, x25519 %s, aead %s\n",
+                  wireguard_crypto_selected(WIREGUARD_CRYPTO_BLAKE2S),
+                  wireguard_crypto_selected(WIREGUARD_CRYPTO_X25519),
+                  wireguard_crypto_selected(WIREGUARD_CRYPTO_AEAD));
+    Serial.println(ok ? "Crypto known-answer tests OK" : "Crypto known-answer tests FAILED!");
+    return ok;
+}
+
+static void print_bench(void *arg, uint8_t primitive, size_t size, uint32_t ops, uint32_t ticks) {
+    (void)arg;
+    uint64_t ns = (uint64_t)ticks * 1000000000ULL / wireguard_cycle_frequency();
+    // A zero budget runs each operation once, which can finish within one tick
+    if (ns == 0 || ops == 0) {
+        Serial.printf("%-18s %5u B   too fast to time (%lu ops in %lu ticks)\n",
+                      wireguard_selftest_name(primitive), (unsigned)size,
+                      (unsigned long)ops, (unsigned long)ticks);
+        return;
     }
-    
-    // Test ChaCha20
-    struct chacha20_ctx ctx;
-    uint8_t key[32] = {0};
-    uint8_t plaintext[64] = {0};
-    uint8_t ciphertext[64];
-    
-    chacha20_init(&ctx, key, 0);
-    chacha20(&ctx, ciphertext, plaintext, 64);
-    Serial.println("ChaCha20 basic init OK");
+    Serial.printf("%-18s %5u B %8lu ops/s %10lu ns/op %8lu ns/B\n",
+                  wireguard_selftest_name(primitive), (unsigned)size,
+                  (unsigned long)((uint64_t)ops * 1000000000ULL / ns),
+                  (unsigned long)(ns / ops),
+                  (unsigned long)(ns / ((uint64_t)ops * size)));
+}
+
+void test_crypto_benchmark(uint32_t budget_ms) {
+    Serial.println("=== Crypto benchmark ===");
+    wireguard_selftest_bench(NULL, budget_ms, print_bench, NULL);
 }
 
 void test_udp_send() {
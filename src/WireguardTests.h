@@ -11,12 +11,14 @@ extern "C" {
 #include "crypto/refc/x25519.h"
 #include "crypto/refc/blake2s.h"
 #include "wireguard-platform.h"
+#include "wireguard-selftest.h"
 
 #ifdef __cplusplus
 }
 #endif
 
 void test_wireguard_random();
-void test_crypto_primitives();
+bool test_crypto_primitives(uint32_t x25519_iterations = 1);
+void test_crypto_benchmark(uint32_t budget_ms = 200);
 void test_udp_send();
 void test_wireguard_handshake_manual(const char *ipStr, int port);
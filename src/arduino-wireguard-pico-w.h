@@ -7,10 +7,14 @@
 
 #include <Arduino.h>
 #include <IPAddress.h>
+#include <Print.h>
+
+#include "wireguard-stats.h"
 
 class WireGuard {
 private:
     bool _is_initialized = false;
+    bool _is_suspended = false;
     uint32_t _lastKickMs = 0;
 
 public:
@@ -39,15 +43,84 @@ public:
 
     void end();
 
+    /*
+     * For duty-cycled devices that turn Wi-Fi off between bursts: suspend() stops the
+     * tunnel timer and closes its UDP socket but keeps keys and sessions in RAM. After
+     * Wi-Fi is back, resume() reuses a session younger than REJECT_AFTER_TIME (180 s)
+     * right away and handshakes immediately otherwise - no key decoding or derivation.
+     */
+    bool suspend();
+    bool resume();
+
+    /*
+     * Call from loop(). Does the flash writes the tunnel must not do from the lwIP context:
+     * stores keys derived since begin() in the key cache (WIREGUARD_KEY_CACHE=1) and moves the
+     * handshake timestamp mark ahead (WIREGUARD_MONOTONIC_TAI64N=1).
+     */
+    void maintain();
+
     bool is_initialized() const { return this->_is_initialized; }
+    bool is_suspended() const { return this->_is_suspended; }
 
     /*
      * Returns true when the peer has a valid session key (i.e., handshake completed at least once).
      */
     bool peerUp(IPAddress* currentEndpointIp = nullptr, uint16_t* currentEndpointPort = nullptr) const;
 
+    /*
+     * Adds another address of the same peer (multi-homed concentrators). While there is no
+     * session, or the current endpoint stops answering, handshakes go to all candidates and
+     * the first to answer is kept. Call after begin(); up to WIREGUARD_MAX_ENDPOINTS in total.
+     */
+    bool addEndpoint(const char* host, uint16_t port);
+
     /*
      * Sends a tiny UDP probe via WG to trigger handshake (non-blocking). Rate-limited.
      */
     bool kickHandshake(const IPAddress& probeIp, uint16_t probePort, uint32_t minIntervalMs = 250);
+
+    /*
+     * Copies a consistent snapshot of the tunnel counters (see wireguard-stats.h).
+     * Either pointer may be null. Returns false if the tunnel is not initialized.
+     */
+    bool getStats(wireguard_device_stats* deviceStats, wireguard_peer_stats* peerStats = nullptr) const;
+
+    /*
+     * Round-trip time and liveness of the peer (see wireguard_peer_liveness). A peer turns
+     * SUSPECT after WIREGUARD_DEAD_PEER_MISSES unanswered handshakes / data, which is the
+     * signal to fail over; the tunnel keeps re-handshaking in the background.
+     */
+    bool getPeerLiveness(wireguard_peer_liveness* liveness) const;
+    wireguard_liveness_state liveness() const;
+
+    /*
+     * Copies the latency histogram of one stage. Needs WIREGUARD_LATENCY_HISTOGRAMS=1,
+     * ticks are wireguard_cycle_frequency() per second (microseconds on the Pico).
+     */
+    bool getLatencyHistogram(wireguard_latency_stage stage, wireguard_histogram* histogram) const;
+    bool resetLatencyHistograms();
+
+    /*
+     * Allocation counters of the tunnel per site (device, handshake, cookie, transport TX/RX)
+     * and heap allocations per 1000 transport packets. Needs WIREGUARD_ALLOC_STATS=1.
+     */
+    bool getAllocStats(wireguard_alloc_stats* stats) const;
+    bool resetAllocStats();
+
+    /*
+     * Packet capture ring (needs WIREGUARD_CAPTURE=1). exportCapture() writes the ring as a
+     * pcap file to any Print (Serial, a File, a client...); save it and open it in Wireshark.
+     */
+    bool setCaptureEnabled(bool enabled);
+    bool clearCapture();
+    bool exportCapture(Print& out);
+
+    /*
+     * Receive path trace for replay on a PC (needs WIREGUARD_RECORD=1, see extras/host/replay.c).
+     * Call drainRecording() often enough that the ring does not fill up. The trace contains the
+     * private key and session keys: only record with throwaway keys.
+     */
+    bool startRecording();
+    bool stopRecording();
+    bool drainRecording(Print& out);
 };
@@ -4,6 +4,133 @@
 #include <stdint.h>
 #include <stdbool.h>
 
+#include "wireguard-platform.h"
+#if WIREGUARD_CRYPTO_BACKENDS > 1
+#include "wireguard-selftest.h"
+#endif
+
+static int refc_x25519(uint8_t *out, const uint8_t *scalar, const uint8_t *point) {
+	return x25519(out, scalar, point, 1);
+}
+
+// The reference backend - the table in use starts out as a copy of it
+#define REFC_BACKEND { \
+	"refc", \
+	blake2s_init, blake2s_update, blake2s_final, blake2s, \
+	refc_x25519, \
+	chacha20poly1305_encrypt, chacha20poly1305_decrypt, xchacha20poly1305_encrypt, xchacha20poly1305_decrypt \
+}
+
+const struct wireguard_crypto_backend wireguard_crypto_refc = REFC_BACKEND;
+
+struct wireguard_crypto_backend wireguard_crypto = REFC_BACKEND;
+
+static const struct wireguard_crypto_backend *backends[WIREGUARD_CRYPTO_BACKENDS] = { &wireguard_crypto_refc };
+static uint8_t backend_count = 1;
+static const struct wireguard_crypto_backend *selected[WIREGUARD_CRYPTO_GROUPS] = { &wireguard_crypto_refc, &wireguard_crypto_refc, &wireguard_crypto_refc };
+#if WIREGUARD_CRYPTO_BACKENDS > 1
+static bool select_done = false;
+#endif
+
+bool wireguard_crypto_register(const struct wireguard_crypto_backend *backend) {
+	bool result = false;
+	uint8_t x;
+	for (x=0; x < backend_count; x++) {
+		if (backends[x] == backend) {
+			result = true;
+		}
+	}
+	if (!result && (backend_count < WIREGUARD_CRYPTO_BACKENDS)) {
+		backends[backend_count++] = backend;
+		result = true;
+	}
+	return result;
+}
+
+const struct wireguard_crypto_backend *wireguard_crypto_backend(uint8_t index) {
+	return (index < backend_count) ? backends[index] : NULL;
+}
+
+const char *wireguard_crypto_selected(uint8_t group) {
+	return (group < WIREGUARD_CRYPTO_GROUPS) ? selected[group]->name : "unknown";
+}
+
+bool wireguard_crypto_provides(const struct wireguard_crypto_backend *backend, uint8_t group) {
+	bool result = false;
+	switch (group) {
+		case WIREGUARD_CRYPTO_BLAKE2S:
+			result = backend->blake2s_init && backend->blake2s_update && backend->blake2s_final && backend->blake2s;
+			break;
+		case WIREGUARD_CRYPTO_X25519:
+			result = (backend->x25519 != NULL);
+			break;
+		case WIREGUARD_CRYPTO_AEAD:
+			result = backend->aead_encrypt && backend->aead_decrypt && backend->xaead_encrypt && backend->xaead_decrypt;
+			break;
+		default:
+			break;
+	}
+	return result;
+}
+
+#if WIREGUARD_CRYPTO_BACKENDS > 1
+static void use_group(uint8_t group, const struct wireguard_crypto_backend *backend) {
+	selected[group] = backend;
+	switch (group) {
+		case WIREGUARD_CRYPTO_BLAKE2S:
+			wireguard_crypto.blake2s_init = backend->blake2s_init;
+			wireguard_crypto.blake2s_update = backend->blake2s_update;
+			wireguard_crypto.blake2s_final = backend->blake2s_final;
+			wireguard_crypto.blake2s = backend->blake2s;
+			break;
+		case WIREGUARD_CRYPTO_X25519:
+			wireguard_crypto.x25519 = backend->x25519;
+			break;
+		case WIREGUARD_CRYPTO_AEAD:
+			wireguard_crypto.aead_encrypt = backend->aead_encrypt;
+			wireguard_crypto.aead_decrypt = backend->aead_decrypt;
+			wireguard_crypto.xaead_encrypt = backend->xaead_encrypt;
+			wireguard_crypto.xaead_decrypt = backend->xaead_decrypt;
+			break;
+		default:
+			break;
+	}
+}
+
+void wireguard_crypto_select(uint32_t budget_ms) {
+	const struct wireguard_crypto_backend *best;
+	uint32_t best_ticks, ticks;
+	uint8_t group, x;
+
+	if (!select_done && (backend_count > 1)) {
+		for (group=0; group < WIREGUARD_CRYPTO_GROUPS; group++) {
+			// The reference is used as it is, its vectors are checked by the tests
+			best = &wireguard_crypto_refc;
+			best_ticks = wireguard_selftest_time(best, group, budget_ms);
+			for (x=1; x < backend_count; x++) {
+				if (wireguard_crypto_provides(backends[x], group)
+						&& (wireguard_selftest_group(backends[x], group, 1, NULL, NULL) == 0)
+						&& (wireguard_selftest_compare(backends[x], group, 16, NULL, NULL) == 0)) {
+					ticks = wireguard_selftest_time(backends[x], group, budget_ms);
+					if (ticks < best_ticks) {
+						best = backends[x];
+						best_ticks = ticks;
+					}
+				}
+			}
+			use_group(group, best);
+		}
+		wireguard_crypto.name = (selected[0] == selected[1] && selected[1] == selected[2]) ? selected[0]->name : "mixed";
+	}
+	select_done = true;
+}
+#else
+// Nothing to choose from - and no known-answer tests or timing code linked into every firmware
+void wireguard_crypto_select(uint32_t budget_ms) {
+	(void)budget_ms;
+}
+#endif
+
 void crypto_zero(void *dest, size_t len) {
 	volatile uint8_t *p = (uint8_t *)dest;
 	while (len--) {
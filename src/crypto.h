@@ -5,24 +5,82 @@
 #include <stdint.h>
 #include <stdbool.h>
 
-// BLAKE2S IMPLEMENTATION
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// The reference implementations have no C++ guards of their own
 #include "crypto/refc/blake2s.h"
+#include "crypto/refc/x25519.h"
+#include "crypto/refc/chacha20poly1305.h"
+
+// Crypto backends
+// The primitives are called through the wireguard_crypto table. It starts out with the reference C
+// implementations (crypto/refc); other implementations are added with wireguard_crypto_register()
+// before the first device is initialised. wireguard_crypto_select(), called from wireguard_init(),
+// runs the known-answer tests of wireguard-selftest.h on each of them, compares them with the
+// reference on generated inputs and times them - the fastest one that passes serves each group.
+enum wireguard_crypto_group {
+	WIREGUARD_CRYPTO_BLAKE2S = 0,
+	WIREGUARD_CRYPTO_X25519,
+	WIREGUARD_CRYPTO_AEAD, // ChaCha20-Poly1305 and XChaCha20-Poly1305
+	WIREGUARD_CRYPTO_GROUPS
+};
+
+// A backend may leave a whole group NULL to keep another backend's
+struct wireguard_crypto_backend {
+	const char *name;
+	// BLAKE2s - every implementation works on the reference blake2s_ctx
+	int (*blake2s_init)(blake2s_ctx *ctx, size_t outlen, const void *key, size_t keylen);
+	void (*blake2s_update)(blake2s_ctx *ctx, const void *in, size_t inlen);
+	void (*blake2s_final)(blake2s_ctx *ctx, void *out);
+	int (*blake2s)(void *out, size_t outlen, const void *key, size_t keylen, const void *in, size_t inlen);
+	// X25519 with a clamped scalar, the top bit of point ignored - non-zero when the result is all zeros
+	int (*x25519)(uint8_t *out, const uint8_t *scalar, const uint8_t *point);
+	// AEAD with the WireGuard 64-bit nonce, and XChaCha20-Poly1305 - src_len of decrypt includes the tag
+	void (*aead_encrypt)(uint8_t *dst, const uint8_t *src, size_t src_len, const uint8_t *ad, size_t ad_len, uint64_t nonce, const uint8_t *key);
+	bool (*aead_decrypt)(uint8_t *dst, const uint8_t *src, size_t src_len, const uint8_t *ad, size_t ad_len, uint64_t nonce, const uint8_t *key);
+	void (*xaead_encrypt)(uint8_t *dst, const uint8_t *src, size_t src_len, const uint8_t *ad, size_t ad_len, const uint8_t *nonce, const uint8_t *key);
+	bool (*xaead_decrypt)(uint8_t *dst, const uint8_t *src, size_t src_len, const uint8_t *ad, size_t ad_len, const uint8_t *nonce, const uint8_t *key);
+};
+
+// The reference C implementations, always registered first
+extern const struct wireguard_crypto_backend wireguard_crypto_refc;
+
+// The primitives in use
+extern struct wireguard_crypto_backend wireguard_crypto;
+
+// Add a backend - false when WIREGUARD_CRYPTO_BACKENDS are registered already (default 1, only the reference)
+bool wireguard_crypto_register(const struct wireguard_crypto_backend *backend);
+
+// Registered backend by index, the reference is 0 - NULL past the last one
+const struct wireguard_crypto_backend *wireguard_crypto_backend(uint8_t index);
+
+// Does backend implement every function of group
+bool wireguard_crypto_provides(const struct wireguard_crypto_backend *backend, uint8_t group);
+
+// Name of the backend serving group
+const char *wireguard_crypto_selected(uint8_t group);
+
+// Pick the implementation of each group (about budget_ms of timing per candidate). Only does
+// anything the first time, and only when a backend besides the reference is registered.
+void wireguard_crypto_select(uint32_t budget_ms);
+
+// BLAKE2S IMPLEMENTATION
 #define wireguard_blake2s_ctx blake2s_ctx
-#define wireguard_blake2s_init(ctx,outlen,key,keylen) blake2s_init(ctx,outlen,key,keylen)
-#define wireguard_blake2s_update(ctx,in,inlen) blake2s_update(ctx,in,inlen)
-#define wireguard_blake2s_final(ctx,out) blake2s_final(ctx,out)
-#define wireguard_blake2s(out,outlen,key,keylen,in,inlen) blake2s(out,outlen,key,keylen,in,inlen)
+#define wireguard_blake2s_init(ctx,outlen,key,keylen) wireguard_crypto.blake2s_init(ctx,outlen,key,keylen)
+#define wireguard_blake2s_update(ctx,in,inlen) wireguard_crypto.blake2s_update(ctx,in,inlen)
+#define wireguard_blake2s_final(ctx,out) wireguard_crypto.blake2s_final(ctx,out)
+#define wireguard_blake2s(out,outlen,key,keylen,in,inlen) wireguard_crypto.blake2s(out,outlen,key,keylen,in,inlen)
 
 // X25519 IMPLEMENTATION
-#include "crypto/refc/x25519.h"
-#define wireguard_x25519(a,b,c)	x25519(a,b,c,1)
+#define wireguard_x25519(a,b,c)	wireguard_crypto.x25519(a,b,c)
 
 // CHACHA20POLY1305 IMPLEMENTATION
-#include "crypto/refc/chacha20poly1305.h"
-#define wireguard_aead_encrypt(dst,src,srclen,ad,adlen,nonce,key) chacha20poly1305_encrypt(dst,src,srclen,ad,adlen,nonce,key)
-#define wireguard_aead_decrypt(dst,src,srclen,ad,adlen,nonce,key) chacha20poly1305_decrypt(dst,src,srclen,ad,adlen,nonce,key)
-#define wireguard_xaead_encrypt(dst,src,srclen,ad,adlen,nonce,key) xchacha20poly1305_encrypt(dst,src,srclen,ad,adlen,nonce,key)
-#define wireguard_xaead_decrypt(dst,src,srclen,ad,adlen,nonce,key) xchacha20poly1305_decrypt(dst,src,srclen,ad,adlen,nonce,key)
+#define wireguard_aead_encrypt(dst,src,srclen,ad,adlen,nonce,key) wireguard_crypto.aead_encrypt(dst,src,srclen,ad,adlen,nonce,key)
+#define wireguard_aead_decrypt(dst,src,srclen,ad,adlen,nonce,key) wireguard_crypto.aead_decrypt(dst,src,srclen,ad,adlen,nonce,key)
+#define wireguard_xaead_encrypt(dst,src,srclen,ad,adlen,nonce,key) wireguard_crypto.xaead_encrypt(dst,src,srclen,ad,adlen,nonce,key)
+#define wireguard_xaead_decrypt(dst,src,srclen,ad,adlen,nonce,key) wireguard_crypto.xaead_decrypt(dst,src,srclen,ad,adlen,nonce,key)
 
 
 // Endian / unaligned helper macros
@@ -98,5 +156,9 @@
 void crypto_zero(void *dest, size_t len);
 bool crypto_equal(const void *a, const void *b, size_t size);
 
+#ifdef __cplusplus
+} /* extern "C" */
+#endif
+
 #endif /* _CRYPTO_H_ */
 
@@ -230,16 +230,19 @@ static void ladder_part2(fe xs[5], const fe x1) {
 
 static void x25519_core(fe xs[5], const uint8_t scalar[X25519_BYTES], const uint8_t *x1, int clamp) {
     int i;
-#if X25519_MEMCPY_PARAMS
     fe x1i;
+#if X25519_MEMCPY_PARAMS
     swapin(x1i,x1);
-    x1 = (const uint8_t *)x1;
+#else
+    memcpy(x1i,x1,sizeof(fe));
 #endif
+    /* RFC 7748 section 5: the top bit of the u-coordinate is ignored */
+    x1i[NLIMBS-1] &= ~((limb_t)1<<(X25519_WBITS-1));
     limb_t swap = 0;
     limb_t *x2 = xs[0],*x3=xs[2],*z3=xs[3];
     memset(xs,0,4*sizeof(fe));
     x2[0] = z3[0] = 1;
-    memcpy(x3,x1,sizeof(fe));
+    memcpy(x3,x1i,sizeof(fe));
 
     for (i=255; i>=0; i--) {
         uint8_t bytei = scalar[i/8];
@@ -256,7 +259,7 @@ static void x25519_core(fe xs[5], const uint8_t scalar[X25519_BYTES], const uint
         swap = doswap;
 
         ladder_part1(xs);
-        ladder_part2(xs,(const limb_t *)x1);
+        ladder_part2(xs,x1i);
     }
     condswap(x2,x3,swap);
 }
@@ -14,7 +14,10 @@ struct wireguard_handshake;
 #include <string.h>
 #include <ctype.h>
 
+// Not there when the core is built on a host (extras/host)
+#if __has_include(<Arduino.h>)
 #include <Arduino.h>
+#endif
 
 #include <lwip/netif.h>
 #include <lwip/ip4_addr.h>
@@ -89,12 +92,19 @@ void wg_logf_(const char *lvl, const char *fmt, ...);
 
 #if __has_include("pico/cyw43_arch.h")
 #include "pico/cyw43_arch.h"
-static inline struct netif *tcpip_adapter_get_netif(int /*ifx*/) {
+static inline struct netif *tcpip_adapter_get_netif(int ifx) {
+    (void)ifx;
     // cyw43_state.netif is the lwIP netif for STA mode.
     return &cyw43_state.netif[CYW43_ITF_STA];
 }
+// Serialise access to state that is otherwise only touched from the lwIP context
+#define WG_LWIP_LOCK()      cyw43_arch_lwip_begin()
+#define WG_LWIP_UNLOCK()    cyw43_arch_lwip_end()
 #else
-static inline struct netif *tcpip_adapter_get_netif(int /*ifx*/) {
+static inline struct netif *tcpip_adapter_get_netif(int ifx) {
+    (void)ifx;
     return NULL;
 }
+#define WG_LWIP_LOCK()      do { } while (0)
+#define WG_LWIP_UNLOCK()    do { } while (0)
 #endif
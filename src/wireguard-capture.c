@@ -0,0 +1,142 @@
+/*
+ * In-memory packet capture ring for the WireGuard lwIP port.
+ * SPDX-License-Identifier: BSD-3-Clause
+ */
+
+#include "wireguard-capture.h"
+
+#include <string.h>
+
+#include "crypto.h"
+
+#define PCAP_MAGIC				(0xa1b2c3d4)
+#define PCAP_VERSION_MAJOR		(2)
+#define PCAP_VERSION_MINOR		(4)
+#define PCAP_LINKTYPE_RAW		(101)
+#define PCAP_GLOBAL_HEADER_LEN	(24)
+#define PCAP_RECORD_HEADER_LEN	(16)
+
+// Synthesised IPv4 (20 bytes, no options) + UDP (8 bytes) header in front of outer packets
+#define OUTER_HEADER_LEN		(28)
+
+static uint32_t ip4_u32(const ip_addr_t *addr) {
+	uint32_t result = 0;
+	if (addr && IP_IS_V4(addr)) {
+		result = ip4_addr_get_u32(ip_2_ip4(addr));
+	}
+	return result;
+}
+
+void wireguard_capture_init(struct wireguard_capture *capture) {
+	memset(capture, 0, sizeof(struct wireguard_capture));
+	capture->enabled = true;
+}
+
+void wireguard_capture_packet(struct wireguard_capture *capture, uint8_t point, const struct pbuf *p, const ip_addr_t *local, u16_t local_port, const ip_addr_t *remote, u16_t remote_port) {
+	struct wireguard_capture_record *record;
+	if (capture->enabled && p) {
+		record = &capture->records[capture->next];
+		record->millis = wireguard_sys_now();
+		record->orig_len = p->tot_len;
+		record->caplen = pbuf_copy_partial(p, record->data, WIREGUARD_CAPTURE_SNAPLEN, 0);
+		record->point = point;
+		record->local_addr = ip4_u32(local);
+		record->remote_addr = ip4_u32(remote);
+		record->local_port = local_port;
+		record->remote_port = remote_port;
+
+		capture->next = (capture->next + 1) % WIREGUARD_CAPTURE_SLOTS;
+		if (capture->used < WIREGUARD_CAPTURE_SLOTS) {
+			capture->used++;
+		} else {
+			capture->overwritten++;
+		}
+	}
+}
+
+// Addresses are kept in network byte order so copy them as they are
+static void put_u32_raw(uint8_t *dst, uint32_t value) {
+	memcpy(dst, &value, 4);
+}
+
+static void build_outer_header(uint8_t *hdr, const struct wireguard_capture_record *record) {
+	bool tx = (record->point == WIREGUARD_CAPTURE_OUTER_TX);
+	uint32_t ip_len = OUTER_HEADER_LEN + record->orig_len;
+	uint32_t sum = 0;
+	int x;
+
+	if (ip_len > 0xFFFF) {
+		ip_len = 0xFFFF;
+	}
+
+	memset(hdr, 0, OUTER_HEADER_LEN);
+	hdr[0] = 0x45; // IPv4, 5 word header
+	hdr[2] = (uint8_t)(ip_len >> 8);
+	hdr[3] = (uint8_t)ip_len;
+	hdr[6] = 0x40; // Don't fragment
+	hdr[8] = 64; // TTL
+	hdr[9] = 17; // UDP
+	put_u32_raw(&hdr[12], tx ? record->local_addr : record->remote_addr);
+	put_u32_raw(&hdr[16], tx ? record->remote_addr : record->local_addr);
+	for (x=0; x < 20; x += 2) {
+		sum += ((uint32_t)hdr[x] << 8) | hdr[x + 1];
+	}
+	while (sum >> 16) {
+		sum = (sum & 0xFFFF) + (sum >> 16);
+	}
+	sum = ~sum & 0xFFFF;
+	hdr[10] = (uint8_t)(sum >> 8);
+	hdr[11] = (uint8_t)sum;
+
+	// UDP header - checksum 0 means "not computed"
+	hdr[20] = (uint8_t)((tx ? record->local_port : record->remote_port) >> 8);
+	hdr[21] = (uint8_t)(tx ? record->local_port : record->remote_port);
+	hdr[22] = (uint8_t)((tx ? record->remote_port : record->local_port) >> 8);
+	hdr[23] = (uint8_t)(tx ? record->remote_port : record->local_port);
+	hdr[24] = (uint8_t)((ip_len - 20) >> 8);
+	hdr[25] = (uint8_t)(ip_len - 20);
+}
+
+size_t wireguard_capture_export_pcap(const struct wireguard_capture *capture, wireguard_capture_write_fn write, void *arg) {
+	uint8_t header[PCAP_GLOBAL_HEADER_LEN];
+	uint8_t outer[OUTER_HEADER_LEN];
+	const struct wireguard_capture_record *record;
+	size_t slot;
+	size_t x;
+	uint32_t extra;
+
+	// Written little-endian, readers detect the byte order from the magic
+	U32TO8_LITTLE(&header[0], PCAP_MAGIC);
+	header[4] = PCAP_VERSION_MAJOR;
+	header[5] = 0;
+	header[6] = PCAP_VERSION_MINOR;
+	header[7] = 0;
+	U32TO8_LITTLE(&header[8], 0); // thiszone
+	U32TO8_LITTLE(&header[12], 0); // sigfigs
+	U32TO8_LITTLE(&header[16], WIREGUARD_CAPTURE_SNAPLEN + OUTER_HEADER_LEN);
+	U32TO8_LITTLE(&header[20], PCAP_LINKTYPE_RAW);
+	write(arg, header, PCAP_GLOBAL_HEADER_LEN);
+
+	slot = (capture->next + WIREGUARD_CAPTURE_SLOTS - capture->used) % WIREGUARD_CAPTURE_SLOTS;
+	for (x=0; x < capture->used; x++) {
+		record = &capture->records[slot];
+		extra = 0;
+		if ((record->point == WIREGUARD_CAPTURE_OUTER_TX) || (record->point == WIREGUARD_CAPTURE_OUTER_RX)) {
+			extra = OUTER_HEADER_LEN;
+		}
+
+		U32TO8_LITTLE(&header[0], record->millis / 1000);
+		U32TO8_LITTLE(&header[4], (record->millis % 1000) * 1000);
+		U32TO8_LITTLE(&header[8], record->caplen + extra);
+		U32TO8_LITTLE(&header[12], record->orig_len + extra);
+		write(arg, header, PCAP_RECORD_HEADER_LEN);
+		if (extra) {
+			build_outer_header(outer, record);
+			write(arg, outer, OUTER_HEADER_LEN);
+		}
+		write(arg, record->data, record->caplen);
+
+		slot = (slot + 1) % WIREGUARD_CAPTURE_SLOTS;
+	}
+	return capture->used;
+}
@@ -0,0 +1,78 @@
+/*
+ * In-memory packet capture ring for the WireGuard lwIP port.
+ * SPDX-License-Identifier: BSD-3-Clause
+ *
+ * Every capture copies at most WIREGUARD_CAPTURE_SNAPLEN bytes into the next slot of a
+ * fixed ring (overwriting the oldest), so the cost per packet is bounded and does not
+ * depend on logging. The ring is written from the lwIP context only and can be streamed
+ * as a pcap file (LINKTYPE_RAW) with wireguardif_capture_export() / WireGuard::exportCapture().
+ */
+
+#ifndef _WIREGUARD_CAPTURE_H_
+#define _WIREGUARD_CAPTURE_H_
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+
+#include "lwip/pbuf.h"
+#include "lwip/ip_addr.h"
+
+#include "wireguard-platform.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+enum wireguard_capture_point {
+	WIREGUARD_CAPTURE_INNER_TX = 0, // Plaintext IP packet routed into the tunnel, before encryption
+	WIREGUARD_CAPTURE_INNER_RX, // Decrypted IP packet, before ip_input()
+	WIREGUARD_CAPTURE_OUTER_TX, // WireGuard message sent to the network (UDP payload)
+	WIREGUARD_CAPTURE_OUTER_RX, // WireGuard message received from the network (UDP payload)
+};
+
+struct wireguard_capture_record {
+	uint32_t millis; // wireguard_sys_now() at capture time
+	uint16_t orig_len;
+	uint16_t caplen;
+	uint8_t point;
+	// Outer packets only - IPv4 addresses in network byte order, used to rebuild the IP/UDP headers on export
+	uint32_t local_addr;
+	uint32_t remote_addr;
+	uint16_t local_port;
+	uint16_t remote_port;
+	uint8_t data[WIREGUARD_CAPTURE_SNAPLEN];
+};
+
+struct wireguard_capture {
+	bool enabled;
+	uint16_t next; // Slot written by the next capture
+	uint16_t used; // Number of slots holding a record
+	uint32_t overwritten; // Records lost because the ring wrapped
+	struct wireguard_capture_record records[WIREGUARD_CAPTURE_SLOTS];
+};
+
+// Sink for the pcap stream
+typedef void (*wireguard_capture_write_fn)(void *arg, const uint8_t *data, size_t len);
+
+#if WIREGUARD_CAPTURE
+#define WIREGUARD_CAPTURE_INNER(device, point, p)							wireguard_capture_packet(&(device)->capture, point, p, NULL, 0, NULL, 0)
+#else
+#define WIREGUARD_CAPTURE_INNER(device, point, p)							do { } while (0)
+#endif
+
+// Empty the ring and start capturing
+void wireguard_capture_init(struct wireguard_capture *capture);
+
+// Copy the start of p into the ring - local/remote are only meaningful (and may only be non-NULL) for outer packets
+void wireguard_capture_packet(struct wireguard_capture *capture, uint8_t point, const struct pbuf *p, const ip_addr_t *local, u16_t local_port, const ip_addr_t *remote, u16_t remote_port);
+
+// Write the ring, oldest record first, as a pcap file - returns the number of records written
+// The caller must make sure nothing is captured meanwhile
+size_t wireguard_capture_export_pcap(const struct wireguard_capture *capture, wireguard_capture_write_fn write, void *arg);
+
+#ifdef __cplusplus
+} /* extern "C" */
+#endif
+
+#endif /* _WIREGUARD_CAPTURE_H_ */
@@ -0,0 +1,68 @@
+/*
+ * ChaCha20 random generator with fast key erasure for the WireGuard lwIP port.
+ * SPDX-License-Identifier: BSD-3-Clause
+ */
+
+#include "wireguard-drbg.h"
+
+#if WIREGUARD_DRBG
+
+#include <string.h>
+
+#include "crypto.h"
+
+void wireguard_drbg_reseed(struct wireguard_drbg *drbg, const uint8_t *entropy, size_t len, uint32_t now) {
+	wireguard_blake2s_ctx ctx;
+	// The old key (zero on the first seed) keys the hash, so a weak reseed never makes things worse
+	wireguard_blake2s_init(&ctx, CHACHA20_KEY_SIZE, drbg->key, CHACHA20_KEY_SIZE);
+	wireguard_blake2s_update(&ctx, entropy, len);
+	wireguard_blake2s_final(&ctx, drbg->key);
+	crypto_zero(&ctx, sizeof(ctx));
+
+	crypto_zero(drbg->buffer, sizeof(drbg->buffer));
+	drbg->available = 0;
+	drbg->seed_millis = now;
+	drbg->generated = 0;
+	drbg->seeded = true;
+}
+
+bool wireguard_drbg_reseed_due(const struct wireguard_drbg *drbg, uint32_t now) {
+	return !drbg->seeded ||
+		((now - drbg->seed_millis) >= WIREGUARD_DRBG_RESEED_MS) ||
+		(drbg->generated >= WIREGUARD_DRBG_RESEED_BYTES);
+}
+
+// Fast key erasure - one ChaCha20 run under the current key yields the next key and the output
+static void drbg_refill(struct wireguard_drbg *drbg) {
+	struct chacha20_ctx ctx;
+	memset(drbg->buffer, 0, sizeof(drbg->buffer));
+	chacha20_init(&ctx, drbg->key, 0);
+	chacha20(&ctx, drbg->buffer, drbg->buffer, sizeof(drbg->buffer));
+	memcpy(drbg->key, drbg->buffer, CHACHA20_KEY_SIZE);
+	crypto_zero(drbg->buffer, CHACHA20_KEY_SIZE);
+	drbg->available = sizeof(drbg->buffer) - CHACHA20_KEY_SIZE;
+	crypto_zero(&ctx, sizeof(ctx));
+}
+
+void wireguard_drbg_generate(struct wireguard_drbg *drbg, void *out, size_t len) {
+	uint8_t *p = (uint8_t *)out;
+	uint8_t *src;
+	size_t chunk;
+
+	drbg->generated += len;
+	while (len > 0) {
+		if (drbg->available == 0) {
+			drbg_refill(drbg);
+		}
+		chunk = (len < drbg->available) ? len : drbg->available;
+		// Serve the unused tail of the buffer in order and wipe what was handed out
+		src = &drbg->buffer[sizeof(drbg->buffer) - drbg->available];
+		memcpy(p, src, chunk);
+		crypto_zero(src, chunk);
+		drbg->available -= chunk;
+		p += chunk;
+		len -= chunk;
+	}
+}
+
+#endif /* WIREGUARD_DRBG */
@@ -0,0 +1,50 @@
+/*
+ * ChaCha20 random generator with fast key erasure for the WireGuard lwIP port.
+ * SPDX-License-Identifier: BSD-3-Clause
+ *
+ * Seeded (and periodically reseeded) by the platform with conditioned hardware entropy, then
+ * every refill runs ChaCha20 under the current key: the first 32 bytes of keystream replace the
+ * key, the rest is handed out and wiped as it is used. Random bytes cost a copy out of the buffer,
+ * and a later compromise of the state reveals nothing about output already returned.
+ */
+
+#ifndef _WIREGUARD_DRBG_H_
+#define _WIREGUARD_DRBG_H_
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+#include "wireguard-platform.h"
+#include "crypto/refc/chacha20.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// Keystream blocks per refill - the first 32 bytes become the next key
+#define WIREGUARD_DRBG_BLOCKS		(4)
+
+struct wireguard_drbg {
+	bool seeded;
+	uint8_t key[CHACHA20_KEY_SIZE];
+	uint8_t buffer[WIREGUARD_DRBG_BLOCKS * CHACHA20_BLOCK_SIZE];
+	size_t available; // Unused bytes at the end of buffer
+	uint32_t seed_millis; // wireguard_sys_now() of the last (re)seed
+	uint32_t generated; // Bytes handed out since the last (re)seed
+};
+
+// Mix entropy into the key - key := BLAKE2s(key, entropy) - and drop any buffered output
+void wireguard_drbg_reseed(struct wireguard_drbg *drbg, const uint8_t *entropy, size_t len, uint32_t now);
+
+// Has WIREGUARD_DRBG_RESEED_MS passed or WIREGUARD_DRBG_RESEED_BYTES been handed out since the last (re)seed
+bool wireguard_drbg_reseed_due(const struct wireguard_drbg *drbg, uint32_t now);
+
+// Fill out with len random bytes - the generator must have been seeded
+void wireguard_drbg_generate(struct wireguard_drbg *drbg, void *out, size_t len);
+
+#ifdef __cplusplus
+} /* extern "C" */
+#endif
+
+#endif /* _WIREGUARD_DRBG_H_ */
@@ -0,0 +1,88 @@
+/*
+ * Persistent cache of keys derived from the static keys, for the WireGuard lwIP port.
+ * SPDX-License-Identifier: BSD-3-Clause
+ */
+
+#include "wireguard-keycache.h"
+
+#if WIREGUARD_KEY_CACHE
+
+#include <string.h>
+
+#include "crypto.h"
+
+#define KEYCACHE_VERSION			(1)
+#define KEYCACHE_ID_LEN				(8)
+#define KEYCACHE_NONCE_LEN			(24)
+#define KEYCACHE_RECORD_LEN			(KEYCACHE_NONCE_LEN + sizeof(struct wireguard_derived_keys) + WIREGUARD_AUTHTAG_LEN)
+
+static const char LABEL_ID[] = "wireguard keycache id";
+static const char LABEL_KEY[] = "wireguard keycache key";
+
+// id := Mac(Sprivi, label || Spubr) - also used as the associated data of the record
+static void keycache_id(const uint8_t *private_key, const uint8_t *peer_public_key, uint8_t *id) {
+	wireguard_blake2s_ctx ctx;
+	uint8_t version = KEYCACHE_VERSION;
+	wireguard_blake2s_init(&ctx, KEYCACHE_ID_LEN, private_key, WIREGUARD_PRIVATE_KEY_LEN);
+	wireguard_blake2s_update(&ctx, LABEL_ID, sizeof(LABEL_ID) - 1);
+	wireguard_blake2s_update(&ctx, &version, 1);
+	if (peer_public_key) {
+		wireguard_blake2s_update(&ctx, peer_public_key, WIREGUARD_PUBLIC_KEY_LEN);
+	}
+	wireguard_blake2s_final(&ctx, id);
+}
+
+static void keycache_key(const uint8_t *private_key, uint8_t *key) {
+	wireguard_blake2s(key, WIREGUARD_SESSION_KEY_LEN, private_key, WIREGUARD_PRIVATE_KEY_LEN, LABEL_KEY, sizeof(LABEL_KEY) - 1);
+}
+
+// Storage item name - the id in hex
+static void keycache_name(const uint8_t *id, char *name) {
+	static const char hex[] = "0123456789abcdef";
+	int x;
+	for (x=0; x < KEYCACHE_ID_LEN; x++) {
+		name[x * 2] = hex[id[x] >> 4];
+		name[x * 2 + 1] = hex[id[x] & 0x0F];
+	}
+	name[KEYCACHE_ID_LEN * 2] = '\0';
+}
+
+bool wireguard_keycache_load(const uint8_t *private_key, const uint8_t *peer_public_key, struct wireguard_derived_keys *keys) {
+	uint8_t record[KEYCACHE_RECORD_LEN];
+	uint8_t id[KEYCACHE_ID_LEN];
+	uint8_t key[WIREGUARD_SESSION_KEY_LEN];
+	char name[KEYCACHE_ID_LEN * 2 + 1];
+	bool result = false;
+
+	keycache_id(private_key, peer_public_key, id);
+	keycache_name(id, name);
+	if (wireguard_storage_read(name, record, sizeof(record))) {
+		keycache_key(private_key, key);
+		result = wireguard_xaead_decrypt((uint8_t *)keys, &record[KEYCACHE_NONCE_LEN], sizeof(record) - KEYCACHE_NONCE_LEN, id, KEYCACHE_ID_LEN, record, key);
+		if (!result) {
+			crypto_zero(keys, sizeof(struct wireguard_derived_keys));
+		}
+	}
+	crypto_zero(key, sizeof(key));
+	crypto_zero(record, sizeof(record));
+	return result;
+}
+
+void wireguard_keycache_store(const uint8_t *private_key, const uint8_t *peer_public_key, const struct wireguard_derived_keys *keys) {
+	uint8_t record[KEYCACHE_RECORD_LEN];
+	uint8_t id[KEYCACHE_ID_LEN];
+	uint8_t key[WIREGUARD_SESSION_KEY_LEN];
+	char name[KEYCACHE_ID_LEN * 2 + 1];
+
+	keycache_id(private_key, peer_public_key, id);
+	keycache_name(id, name);
+	keycache_key(private_key, key);
+	// Random nonce - the same key seals every entry and every rewrite
+	wireguard_random_bytes(record, KEYCACHE_NONCE_LEN);
+	wireguard_xaead_encrypt(&record[KEYCACHE_NONCE_LEN], (const uint8_t *)keys, sizeof(struct wireguard_derived_keys), id, KEYCACHE_ID_LEN, record, key);
+	wireguard_storage_write(name, record, sizeof(record));
+	crypto_zero(key, sizeof(key));
+	crypto_zero(record, sizeof(record));
+}
+
+#endif /* WIREGUARD_KEY_CACHE */
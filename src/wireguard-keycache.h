@@ -0,0 +1,35 @@
+/*
+ * Persistent cache of keys derived from the static keys, for the WireGuard lwIP port.
+ * SPDX-License-Identifier: BSD-3-Clause
+ *
+ * With WIREGUARD_KEY_CACHE the device public key, the static-static DH of every peer and the
+ * mac1/cookie label keys are kept in flash through wireguard_storage_read()/_write(), so a boot
+ * with the same keys performs no x25519() at all. Entries are named by a BLAKE2s of the private
+ * key (and peer public key) and sealed with XChaCha20-Poly1305 under a key derived from the
+ * private key: the DH never sits in flash in the clear, a changed key simply misses, and a
+ * damaged entry fails authentication and is derived (and rewritten) again.
+ */
+
+#ifndef _WIREGUARD_KEYCACHE_H_
+#define _WIREGUARD_KEYCACHE_H_
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "wireguard.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// Look up the keys derived from private_key (peer_public_key NULL) or from private_key and peer_public_key
+bool wireguard_keycache_load(const uint8_t *private_key, const uint8_t *peer_public_key, struct wireguard_derived_keys *keys);
+
+// Remember freshly derived keys - failures are ignored, the next boot derives them again
+void wireguard_keycache_store(const uint8_t *private_key, const uint8_t *peer_public_key, const struct wireguard_derived_keys *keys);
+
+#ifdef __cplusplus
+} /* extern "C" */
+#endif
+
+#endif /* _WIREGUARD_KEYCACHE_H_ */
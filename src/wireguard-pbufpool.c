@@ -0,0 +1,96 @@
+/*
+ * Pool of transport data pbufs for the WireGuard lwIP port.
+ * SPDX-License-Identifier: BSD-3-Clause
+ */
+
+#include "wireguard-pbufpool.h"
+
+#include <string.h>
+
+#include "lwip/opt.h"
+
+#include "wireguard.h"
+#include "wireguardif.h"
+
+// lwIP only has custom pbufs with LWIP_SUPPORT_CUSTOM_PBUF, which it derives from its fragmentation options.
+// A prebuilt lwIP without them (e.g. one with LWIP_NETIF_TX_SINGLE_PBUF) gets the heap-only version below.
+#if (WIREGUARD_PBUF_POOL_SIZE > 0) && LWIP_SUPPORT_CUSTOM_PBUF
+
+// Largest transport message of an MTU-sized packet: header, data padded to 16 bytes, tag
+#define POOL_PAYLOAD_LEN	(sizeof(struct message_transport_data) + ((WIREGUARDIF_MTU + 15) & ~15) + WIREGUARD_AUTHTAG_LEN)
+// The same with room in front for the UDP, IP and link headers lwIP adds
+#define POOL_BUFFER_LEN		LWIP_MEM_ALIGN_SIZE(LWIP_MEM_ALIGN_SIZE(PBUF_TRANSPORT) + POOL_PAYLOAD_LEN)
+
+struct pool_buffer {
+	// First, so that the pbuf pbuf_free() passes to pool_free() is the buffer. lwIP also expects the data
+	// of a PBUF_RAM pbuf to follow it when it adds headers in front.
+	struct pbuf_custom custom;
+	struct pool_buffer *next;
+	uint8_t data[POOL_BUFFER_LEN] __attribute__((aligned(MEM_ALIGNMENT)));
+};
+
+static struct pool_buffer pool[WIREGUARD_PBUF_POOL_SIZE];
+static struct pool_buffer *pool_free_list;
+static bool pool_ready = false;
+static struct wireguard_pbuf_pool_stats pool_stats;
+
+static void pool_free(struct pbuf *p) {
+	struct pool_buffer *buffer = (struct pool_buffer *)p;
+	buffer->next = pool_free_list;
+	pool_free_list = buffer;
+	pool_stats.in_use--;
+}
+
+static void pool_init() {
+	int x;
+	for (x=0; x < WIREGUARD_PBUF_POOL_SIZE; x++) {
+		pool[x].next = (x + 1 < WIREGUARD_PBUF_POOL_SIZE) ? &pool[x + 1] : NULL;
+	}
+	pool_free_list = &pool[0];
+	pool_stats.size = WIREGUARD_PBUF_POOL_SIZE;
+	pool_ready = true;
+}
+
+struct pbuf *wireguard_pbuf_alloc(u16_t length) {
+	struct pool_buffer *buffer;
+	struct pbuf *result = NULL;
+	if (!pool_ready) {
+		pool_init();
+	}
+	buffer = pool_free_list;
+	if (buffer && (length <= POOL_PAYLOAD_LEN)) {
+		result = pbuf_alloced_custom(PBUF_TRANSPORT, length, PBUF_RAM, &buffer->custom, buffer->data, sizeof(buffer->data));
+	}
+	if (result) {
+		pool_free_list = buffer->next;
+		buffer->custom.custom_free_function = pool_free;
+		pool_stats.allocs++;
+		pool_stats.in_use++;
+		if (pool_stats.in_use > pool_stats.high_water) {
+			pool_stats.high_water = pool_stats.in_use;
+		}
+	} else {
+		result = pbuf_alloc(PBUF_TRANSPORT, length, PBUF_RAM);
+		if (result) {
+			pool_stats.heap_fallbacks++;
+		}
+	}
+	return result;
+}
+
+void wireguard_pbuf_pool_get_stats(struct wireguard_pbuf_pool_stats *stats) {
+	*stats = pool_stats;
+	stats->size = WIREGUARD_PBUF_POOL_SIZE;
+}
+
+#else
+
+struct pbuf *wireguard_pbuf_alloc(u16_t length) {
+	return pbuf_alloc(PBUF_TRANSPORT, length, PBUF_RAM);
+}
+
+void wireguard_pbuf_pool_get_stats(struct wireguard_pbuf_pool_stats *stats) {
+	memset(stats, 0, sizeof(struct wireguard_pbuf_pool_stats));
+}
+
+#endif /* (WIREGUARD_PBUF_POOL_SIZE > 0) && LWIP_SUPPORT_CUSTOM_PBUF */
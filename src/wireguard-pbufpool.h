@@ -0,0 +1,42 @@
+/*
+ * Pool of transport data pbufs for the WireGuard lwIP port.
+ * SPDX-License-Identifier: BSD-3-Clause
+ *
+ * Every data packet needs a pbuf in each direction: the encrypted message sent to the peer and the
+ * decrypted packet handed to ip_input(). Taking them from the lwIP heap costs a first-fit search
+ * under the heap lock twice per packet and fragments the heap with MTU-sized holes. Instead they come
+ * from WIREGUARD_PBUF_POOL_SIZE static buffers big enough for a full WIREGUARDIF_MTU packet plus the
+ * lwIP headers (custom pbufs). Allocation and pbuf_free() are O(1) on a free list. When the pool is
+ * empty, or a peer sends a message larger than the MTU, the heap is used. If lwIP was built without
+ * LWIP_SUPPORT_CUSTOM_PBUF there is no pool and every transport pbuf comes from the heap.
+ *
+ * The pool is shared by all devices and, like the rest of the interface, is only used from the lwIP
+ * context.
+ */
+
+#ifndef _WIREGUARD_PBUFPOOL_H_
+#define _WIREGUARD_PBUFPOOL_H_
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "lwip/pbuf.h"
+
+#include "wireguard-platform.h"
+#include "wireguard-stats.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// A PBUF_TRANSPORT pbuf of the given length (PBUF_RAM, never chained), from the pool if possible
+struct pbuf *wireguard_pbuf_alloc(u16_t length);
+
+// Pool counters - all zero with WIREGUARD_PBUF_POOL_SIZE 0 or without LWIP_SUPPORT_CUSTOM_PBUF
+void wireguard_pbuf_pool_get_stats(struct wireguard_pbuf_pool_stats *stats);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* _WIREGUARD_PBUFPOOL_H_ */
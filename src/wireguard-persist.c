@@ -0,0 +1,232 @@
+/*
+ * Session persistence across warm resets for the WireGuard lwIP port.
+ * SPDX-License-Identifier: BSD-3-Clause
+ */
+
+#include "wireguard-persist.h"
+
+#if WIREGUARD_PERSIST_SESSIONS
+
+#include <string.h>
+
+#include "crypto.h"
+#include "wg_port_pico.h"
+
+#define PERSIST_MAGIC				(0x57475053) // "WGPS"
+#define PERSIST_VERSION				(3)
+
+static const char PERSIST_LABEL[] = "wireguard persist";
+
+// Not touched by the C runtime on reset - valid only if the MAC says so
+NOINIT static struct wireguard_persist_image persist_image;
+// The device the image belongs to - the first one initialised
+static struct wireguard_device *persist_owner = NULL;
+
+static void persist_mac(const uint8_t *key, uint8_t *mac) {
+	wireguard_blake2s(mac, WIREGUARD_COOKIE_LEN, key, WIREGUARD_SESSION_KEY_LEN, &persist_image, offsetof(struct wireguard_persist_image, mac));
+}
+
+static void preshared_mac(const uint8_t *key, const uint8_t *preshared_key, uint8_t *mac) {
+	uint8_t zero[WIREGUARD_SESSION_KEY_LEN];
+	if (!preshared_key) {
+		crypto_zero(zero, sizeof(zero));
+		preshared_key = zero;
+	}
+	wireguard_blake2s(mac, WIREGUARD_COOKIE_LEN, key, WIREGUARD_SESSION_KEY_LEN, preshared_key, WIREGUARD_SESSION_KEY_LEN);
+}
+
+void wireguard_persist_release(struct wireguard_device *device) {
+	if (persist_owner == device) {
+		persist_owner = NULL;
+	}
+}
+
+void wireguard_persist_wipe() {
+	crypto_zero(&persist_image, sizeof(persist_image));
+}
+
+bool wireguard_persist_load(struct wireguard_device *device) {
+	uint8_t mac[WIREGUARD_COOKIE_LEN];
+	struct wireguard_persist_keypair *keypair;
+	bool result = false;
+	int x;
+	int y;
+
+	if (persist_owner && (persist_owner != device)) {
+		return false;
+	}
+	persist_owner = device;
+
+	wireguard_blake2s(device->persist_key, WIREGUARD_SESSION_KEY_LEN, device->private_key, WIREGUARD_PRIVATE_KEY_LEN, PERSIST_LABEL, sizeof(PERSIST_LABEL) - 1);
+
+	if ((persist_image.magic == PERSIST_MAGIC) && (persist_image.version == PERSIST_VERSION) && (persist_image.size == sizeof(struct wireguard_persist_image))) {
+		persist_mac(device->persist_key, mac);
+		result = crypto_equal(mac, persist_image.mac, WIREGUARD_COOKIE_LEN);
+	}
+
+	if (result) {
+		// The clock restarted with this boot - ages become relative to it, plus whatever passed since the last save
+		for (x=0; x < WIREGUARD_MAX_PEERS; x++) {
+			for (y=0; y < 3; y++) {
+				keypair = &persist_image.peers[x].keypairs[y];
+				if (keypair->valid) {
+					if (keypair->age < ((REJECT_AFTER_TIME - WIREGUARD_PERSIST_RESET_SLACK) * 1000)) {
+						keypair->age += WIREGUARD_PERSIST_RESET_SLACK * 1000;
+					} else {
+						crypto_zero(keypair, sizeof(struct wireguard_persist_keypair));
+					}
+				}
+			}
+		}
+		// Re-seal so another reset before the next save ages it again
+		persist_mac(device->persist_key, persist_image.mac);
+		log_i(TAG "persisted sessions found (%u saves)", (unsigned)persist_image.saves);
+	} else {
+		wireguard_persist_wipe();
+	}
+	crypto_zero(mac, sizeof(mac));
+	return result;
+}
+
+const struct wireguard_persist_peer *wireguard_persist_find(struct wireguard_device *device, const uint8_t *public_key, const uint8_t *preshared_key) {
+	const struct wireguard_persist_peer *result = NULL;
+	uint8_t mac[WIREGUARD_COOKIE_LEN];
+	int x;
+	if ((device == persist_owner) && (persist_image.magic == PERSIST_MAGIC)) {
+		preshared_mac(device->persist_key, preshared_key, mac);
+		for (x=0; x < WIREGUARD_MAX_PEERS; x++) {
+			if (persist_image.peers[x].valid &&
+					(memcmp(persist_image.peers[x].public_key, public_key, WIREGUARD_PUBLIC_KEY_LEN) == 0) &&
+					crypto_equal(persist_image.peers[x].preshared_mac, mac, WIREGUARD_COOKIE_LEN)) {
+				result = &persist_image.peers[x];
+				break;
+			}
+		}
+	}
+	return result;
+}
+
+static bool restore_keypair(struct wireguard_keypair *dst, const struct wireguard_persist_keypair *src, uint32_t now) {
+	bool result = false;
+	if (src->valid && (src->age < REJECT_AFTER_TIME * 1000) && (src->sending_counter < REJECT_AFTER_MESSAGES)) {
+		crypto_zero(dst, sizeof(struct wireguard_keypair));
+		dst->initiator = src->initiator;
+		// Created 'age' ms before the reset - wireguard_sys_now() started again from zero
+		dst->keypair_millis = (uint32_t)0 - src->age;
+		memcpy(dst->sending_key, src->sending_key, WIREGUARD_SESSION_KEY_LEN);
+		dst->sending_valid = src->sending_valid;
+		dst->sending_counter = src->sending_counter;
+		memcpy(dst->receiving_key, src->receiving_key, WIREGUARD_SESSION_KEY_LEN);
+		dst->receiving_valid = src->receiving_valid;
+		// Anything up to the reservation may have been accepted already
+		dst->replay_counter = src->replay_counter;
+		dst->replay_bitmap = 0xFFFFFFFF;
+		if (src->confirmed) {
+			dst->last_rx = (now != 0) ? now : 1;
+		}
+		dst->local_index = src->local_index;
+		dst->remote_index = src->remote_index;
+		dst->persisted_sending_counter = src->sending_counter;
+		dst->persisted_replay_counter = src->replay_counter;
+		dst->valid = true;
+		result = true;
+	}
+	return result;
+}
+
+int wireguard_persist_restore(struct wireguard_peer *peer, const struct wireguard_persist_peer *saved) {
+	uint32_t now = wireguard_sys_now();
+	int result = 0;
+
+	if (restore_keypair(PEER_CURR_KEYPAIR(peer), &saved->keypairs[0], now)) {
+		result++;
+	}
+	if (restore_keypair(PEER_PREV_KEYPAIR(peer), &saved->keypairs[1], now)) {
+		result++;
+	}
+	if (restore_keypair(PEER_NEXT_KEYPAIR(peer), &saved->keypairs[2], now)) {
+		result++;
+	}
+
+	// TAI64N is big-endian so the greater timestamp also compares greater bytewise
+	if (memcmp(saved->greatest_timestamp, peer->cold->greatest_timestamp, WIREGUARD_TAI64N_LEN) > 0) {
+		memcpy(peer->cold->greatest_timestamp, saved->greatest_timestamp, WIREGUARD_TAI64N_LEN);
+	}
+
+	if ((result > 0) && (saved->port != 0)) {
+		peer->ip = saved->ip;
+		peer->port = saved->port;
+	}
+	return result;
+}
+
+static void save_keypair(struct wireguard_persist_keypair *dst, struct wireguard_keypair *src, uint32_t now) {
+	memset(dst, 0, sizeof(struct wireguard_persist_keypair));
+	if (src->valid) {
+		dst->valid = true;
+		dst->initiator = src->initiator;
+		dst->confirmed = (src->last_rx != 0);
+		dst->sending_valid = src->sending_valid;
+		dst->receiving_valid = src->receiving_valid;
+		dst->age = now - src->keypair_millis;
+		memcpy(dst->sending_key, src->sending_key, WIREGUARD_SESSION_KEY_LEN);
+		memcpy(dst->receiving_key, src->receiving_key, WIREGUARD_SESSION_KEY_LEN);
+		// Reserve the next counters so the ones used until the next save never come back
+		dst->sending_counter = src->sending_counter + WIREGUARD_PERSIST_COUNTER_GAP;
+		dst->replay_counter = src->replay_counter + WIREGUARD_PERSIST_REPLAY_GAP;
+		dst->local_index = src->local_index;
+		dst->remote_index = src->remote_index;
+		src->persisted_sending_counter = dst->sending_counter;
+		src->persisted_replay_counter = dst->replay_counter;
+	}
+}
+
+void wireguard_persist_save(struct wireguard_device *device) {
+	struct wireguard_persist_peer *dst;
+	struct wireguard_peer *peer;
+	uint32_t now = wireguard_sys_now();
+	uint32_t saves;
+	bool have_peers = false;
+	int x;
+
+	for (x=0; x < WIREGUARD_MAX_PEERS; x++) {
+		if (device->peers[x].valid) {
+			have_peers = true;
+		}
+	}
+
+	// Until the peers are added again the image may still have to restore them
+	if ((device == persist_owner) && have_peers) {
+		saves = (persist_image.magic == PERSIST_MAGIC) ? persist_image.saves : 0;
+		persist_image.magic = PERSIST_MAGIC;
+		persist_image.version = PERSIST_VERSION;
+		persist_image.size = sizeof(struct wireguard_persist_image);
+		persist_image.saves = saves + 1;
+
+		for (x=0; x < WIREGUARD_MAX_PEERS; x++) {
+			peer = &device->peers[x];
+			dst = &persist_image.peers[x];
+			memset(dst, 0, sizeof(struct wireguard_persist_peer));
+			if (peer->valid) {
+				dst->valid = true;
+				memcpy(dst->public_key, peer->cold->public_key, WIREGUARD_PUBLIC_KEY_LEN);
+				preshared_mac(device->persist_key, peer->cold->preshared_key, dst->preshared_mac);
+				if (peer->cold->public_key_dh_state == WIREGUARD_DH_READY) {
+					dst->dh_ready = true;
+					memcpy(dst->derived.public_key, peer->cold->public_key_dh, WIREGUARD_PUBLIC_KEY_LEN);
+				}
+				memcpy(dst->derived.label_mac1_key, peer->cold->label_mac1_key, WIREGUARD_SESSION_KEY_LEN);
+				memcpy(dst->derived.label_cookie_key, peer->cold->label_cookie_key, WIREGUARD_SESSION_KEY_LEN);
+				memcpy(dst->greatest_timestamp, peer->cold->greatest_timestamp, WIREGUARD_TAI64N_LEN);
+				dst->ip = peer->ip;
+				dst->port = peer->port;
+				save_keypair(&dst->keypairs[0], PEER_CURR_KEYPAIR(peer), now);
+				save_keypair(&dst->keypairs[1], PEER_PREV_KEYPAIR(peer), now);
+				save_keypair(&dst->keypairs[2], PEER_NEXT_KEYPAIR(peer), now);
+			}
+		}
+		persist_mac(device->persist_key, persist_image.mac);
+	}
+}
+
+#endif /* WIREGUARD_PERSIST_SESSIONS */
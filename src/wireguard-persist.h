@@ -0,0 +1,106 @@
+/*
+ * Session persistence across warm resets for the WireGuard lwIP port.
+ * SPDX-License-Identifier: BSD-3-Clause
+ *
+ * With WIREGUARD_PERSIST_SESSIONS the keypairs, counters, replay state, greatest_timestamp and
+ * precomputed static DH of every peer are mirrored into a .noinit RAM image that survives a
+ * watchdog or soft reset. The image is versioned and authenticated with a keyed BLAKE2s MAC
+ * whose key is derived from the device private key, so cold-boot garbage, a torn save or an
+ * image written for another key are detected and wiped.
+ *
+ * Times are stored as ages and counters as reservations: a restored keypair is aged by
+ * WIREGUARD_PERSIST_RESET_SLACK more than it was at the last save, sending continues
+ * WIREGUARD_PERSIST_COUNTER_GAP past the last saved counter and every receive counter up to
+ * WIREGUARD_PERSIST_REPLAY_GAP past it is treated as already seen. Reaching a reservation forces a save before
+ * the counter is used, so a nonce is never sent twice and a packet is never accepted twice.
+ *
+ * There is a single image, owned by the first WireGuard device initialised (usually the only one).
+ */
+
+#ifndef _WIREGUARD_PERSIST_H_
+#define _WIREGUARD_PERSIST_H_
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+
+#include "wireguard.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+struct wireguard_persist_keypair {
+	bool valid;
+	bool initiator;
+	bool confirmed; // We have received data with this keypair (keypair->last_rx != 0)
+	bool sending_valid;
+	bool receiving_valid;
+	uint32_t age; // Milliseconds since the keypair was created, at save time
+	uint8_t sending_key[WIREGUARD_SESSION_KEY_LEN];
+	uint8_t receiving_key[WIREGUARD_SESSION_KEY_LEN];
+	uint64_t sending_counter; // First counter that is safe to send with after a reset
+	uint64_t replay_counter; // Highest counter that may have been accepted before a reset
+	uint32_t local_index;
+	uint32_t remote_index;
+};
+
+struct wireguard_persist_peer {
+	bool valid;
+	uint8_t public_key[WIREGUARD_PUBLIC_KEY_LEN];
+	// MAC of the preshared key - sessions are only restored for the same configuration
+	uint8_t preshared_mac[WIREGUARD_COOKIE_LEN];
+	// Static DH (when dh_ready - it may not have been needed yet) and MAC keys
+	bool dh_ready;
+	struct wireguard_derived_keys derived;
+	uint8_t greatest_timestamp[WIREGUARD_TAI64N_LEN];
+	// Latest (possibly roamed) endpoint
+	ip_addr_t ip;
+	u16_t port;
+	// curr, prev and next keypair
+	struct wireguard_persist_keypair keypairs[3];
+};
+
+struct wireguard_persist_image {
+	uint32_t magic;
+	uint16_t version;
+	uint16_t size;
+	uint32_t saves;
+	struct wireguard_persist_peer peers[WIREGUARD_MAX_PEERS];
+	uint8_t mac[WIREGUARD_COOKIE_LEN]; // Keyed BLAKE2s of everything above
+};
+
+#if WIREGUARD_PERSIST_SESSIONS
+// Save before a counter the image does not cover is used
+#define WIREGUARD_PERSIST_TX(device, keypair)				do { if ((keypair)->sending_counter >= (keypair)->persisted_sending_counter) wireguard_persist_save(device); } while (0)
+#define WIREGUARD_PERSIST_RX(device, keypair)				do { if ((keypair)->replay_counter > (keypair)->persisted_replay_counter) wireguard_persist_save(device); } while (0)
+#else
+#define WIREGUARD_PERSIST_TX(device, keypair)				do { } while (0)
+#define WIREGUARD_PERSIST_RX(device, keypair)				do { } while (0)
+#endif
+
+// Derive the image key for this device and check the image - anything invalid is wiped
+// Returns true if there is an image to restore peers from
+bool wireguard_persist_load(struct wireguard_device *device);
+
+// Saved state for this peer configuration, NULL if there is none
+const struct wireguard_persist_peer *wireguard_persist_find(struct wireguard_device *device, const uint8_t *public_key, const uint8_t *preshared_key);
+
+// Copy still-valid keypairs, greatest_timestamp and endpoint into a freshly initialised peer
+// Returns the number of keypairs restored
+int wireguard_persist_restore(struct wireguard_peer *peer, const struct wireguard_persist_peer *saved);
+
+// Rewrite the image from the current device state - skipped while the device has no peers
+void wireguard_persist_save(struct wireguard_device *device);
+
+// The device is going away - the next one initialised takes the image over (the image itself is kept)
+void wireguard_persist_release(struct wireguard_device *device);
+
+// Forget everything saved
+void wireguard_persist_wipe();
+
+#ifdef __cplusplus
+} /* extern "C" */
+#endif
+
+#endif /* _WIREGUARD_PERSIST_H_ */
@@ -13,22 +13,40 @@
 #include <string.h>
 
 #include "crypto.h"          // for U64TO8_BIG / U32TO8_BIG
+#include "wireguard-tai64n.h"
+#include "wireguard-drbg.h"
 #include <sys/time.h>        // gettimeofday()
 
 #include "hardware/regs/rosc.h"
 #include "hardware/regs/addressmap.h"
+#include "hardware/timer.h"
+#include "pico/critical_section.h"
 
 static bool is_platform_initialized = false;
 
-static void secure_bzero(void *p, size_t n) {
-  volatile uint8_t *vp = (volatile uint8_t *)p;
-  while (n--) *vp++ = 0;
+#if WIREGUARD_PLATFORM_HOOKS
+static const struct wireguard_platform_hooks *hooks = NULL;
+
+// Only what the WireGuard code sees - lwIP's own timers keep running on sys_now()
+void wireguard_platform_set_hooks(const struct wireguard_platform_hooks *new_hooks) {
+  hooks = new_hooks;
 }
+#endif
 
-void wireguard_platform_init() {
-  if (is_platform_initialized) return;
+#if WIREGUARD_DRBG
+static struct wireguard_drbg drbg;
+// Spin lock plus interrupts off - random bytes are taken from lwIP callbacks and from the sketch, on either core
+static critical_section_t drbg_lock;
 
-  is_platform_initialized = true;
+// Claimed before setup() runs, so wireguard_random_bytes() works before begin() as well - the first call seeds the DRBG
+static void __attribute__((constructor)) drbg_lock_init() {
+  critical_section_init(&drbg_lock);
+}
+#endif
+
+static void secure_bzero(void *p, size_t n) {
+  volatile uint8_t *vp = (volatile uint8_t *)p;
+  while (n--) *vp++ = 0;
 }
 
 // Hardware RNG for Pico - Ring Oscillator
@@ -44,7 +62,65 @@ static uint32_t get_hardware_random() {
     return random;
 }
 
+#if WIREGUARD_DRBG
+// The raw ROSC bits are biased and correlated - many of them go through BLAKE2s in wireguard_drbg_reseed()
+static void drbg_reseed() {
+  uint32_t samples[WIREGUARD_DRBG_SEED_SAMPLES + 2];
+  uint8_t digest[CHACHA20_KEY_SIZE];
+  int i;
+
+  // Sampled and condensed with interrupts on - only mixing the 32-byte digest into the key is atomic
+  for (i = 0; i < WIREGUARD_DRBG_SEED_SAMPLES; i++) {
+    samples[i] = get_hardware_random();
+  }
+  uint64_t t = time_us_64();
+  samples[i++] = (uint32_t)t;
+  samples[i++] = (uint32_t)(t >> 32);
+  wireguard_blake2s(digest, sizeof(digest), NULL, 0, (const uint8_t *)samples, sizeof(samples));
+  secure_bzero(samples, sizeof(samples));
+
+  critical_section_enter_blocking(&drbg_lock);
+  wireguard_drbg_reseed(&drbg, digest, sizeof(digest), wireguard_sys_now());
+  critical_section_exit(&drbg_lock);
+
+  secure_bzero(digest, sizeof(digest));
+}
+#endif
+
+void wireguard_platform_init() {
+  // Every begin() - sketch context, the only place the timestamp mark in flash is read and written
+  wireguard_tai64n_reserve();
+  if (is_platform_initialized) return;
+
+#if WIREGUARD_DRBG
+  drbg_reseed();
+#endif
+
+  is_platform_initialized = true;
+}
+
 void wireguard_random_bytes(void *bytes, size_t size) {
+#if WIREGUARD_PLATFORM_HOOKS
+    if (hooks && hooks->random_bytes) {
+        hooks->random_bytes(bytes, size);
+        return;
+    }
+#endif
+#if WIREGUARD_DRBG
+    bool due;
+
+    critical_section_enter_blocking(&drbg_lock);
+    due = wireguard_drbg_reseed_due(&drbg, wireguard_sys_now());
+    critical_section_exit(&drbg_lock);
+    if (due) {
+        // Both cores may get here at once, then both add entropy - harmless
+        drbg_reseed();
+    }
+    // Never hand out the same bytes twice, whichever core or context asks
+    critical_section_enter_blocking(&drbg_lock);
+    wireguard_drbg_generate(&drbg, bytes, size);
+    critical_section_exit(&drbg_lock);
+#else
     uint8_t *p = (uint8_t *)bytes;
     uint32_t r;
     
@@ -59,27 +135,61 @@ void wireguard_random_bytes(void *bytes, size_t size) {
         r = get_hardware_random();
         memcpy(p, &r, size);
     }
+#endif
 }
 
 uint32_t wireguard_sys_now() {
+#if WIREGUARD_PLATFORM_HOOKS
+  if (hooks && hooks->sys_now) {
+    return hooks->sys_now();
+  }
+#endif
   // we use lwIP sys_now() instead of millis() for better synchro with lwIP
   extern uint32_t sys_now(void);
   return sys_now();
 }
 
+void wireguard_tai64n_reserve() {
+#if WIREGUARD_MONOTONIC_TAI64N
+  struct timeval tv;
+  gettimeofday(&tv, NULL);
+  wireguard_tai64n_monotonic_reserve(time_us_64(), (uint64_t)tv.tv_sec * 1000000ULL + (uint64_t)tv.tv_usec);
+#endif
+}
+
 void wireguard_tai64n_now(uint8_t *output) {
+#if WIREGUARD_PLATFORM_HOOKS
+  if (hooks && hooks->tai64n_now) {
+    hooks->tai64n_now(output);
+    return;
+  }
+#endif
   // TAI64N for Pico W: NTP time (time()) + monotonic nano
   struct timeval tv;
   gettimeofday(&tv, NULL);
-  
+
+#if WIREGUARD_MONOTONIC_TAI64N
+  // Valid before NTP has synced - continues from the last timestamp of the previous boot
+  wireguard_tai64n_monotonic(output, time_us_64(), (uint64_t)tv.tv_sec * 1000000ULL + (uint64_t)tv.tv_usec);
+#else
   uint64_t seconds = 0x400000000000000aULL + (uint64_t)tv.tv_sec;
   uint32_t nanos = (uint32_t)tv.tv_usec * 1000U;
   
   // crypto.h
   U64TO8_BIG(output + 0, seconds);
   U32TO8_BIG(output + 8, nanos);
+#endif
 }
 
 bool wireguard_is_under_load() {
   return false;
 }
+
+// The Cortex-M0+ has no cycle counter (DWT) - use the 1MHz system timer instead
+uint32_t wireguard_cycle_count() {
+  return time_us_32();
+}
+
+uint32_t wireguard_cycle_frequency() {
+  return 1000000;
+}
@@ -50,11 +50,204 @@ extern "C" {
 //#define DEBUG_DEEP
 
 // Peers are allocated statically inside the device structure to avoid malloc
+#ifndef WIREGUARD_MAX_PEERS
 #define WIREGUARD_MAX_PEERS 1
+#endif
 #define WIREGUARD_MAX_SRC_IPS 2
 
+// Handshake contexts per device - handshakes in progress at the same time. A peer needs one from
+// sending (or receiving) an initiation until the session is derived, a full pool hands the oldest over.
+#ifndef WIREGUARD_MAX_HANDSHAKES
+#if WIREGUARD_MAX_PEERS < 4
+#define WIREGUARD_MAX_HANDSHAKES WIREGUARD_MAX_PEERS
+#else
+#define WIREGUARD_MAX_HANDSHAKES 4
+#endif
+#endif
+
+// Candidate endpoints per peer - handshakes go to all of them when the current one stops answering
+#ifndef WIREGUARD_MAX_ENDPOINTS
+#define WIREGUARD_MAX_ENDPOINTS 3
+#endif
+
+// Unanswered initiations after which a candidate is suspect - it stops being the primary and only gets
+// every 2nd, 4th, then 8th fan-out copy until it answers again
+#ifndef WIREGUARD_ENDPOINT_FAILURES
+#define WIREGUARD_ENDPOINT_FAILURES 2
+#endif
+
 // Per device limit on accepting (valid) initiation requests - per peer
+#ifndef MAX_INITIATIONS_PER_SECOND
 #define MAX_INITIATIONS_PER_SECOND	(2)
+#endif
+
+// Per-peer / per-device traffic and drop counters (wireguard-stats.h) - cheap enough to leave enabled
+#ifndef WIREGUARD_STATS
+#define WIREGUARD_STATS 1
+#endif
+
+// Log2 latency histograms for encrypt/decrypt, pbuf allocation, udp_sendto, ip_input and handshake phases (wireguard-stats.h)
+#ifndef WIREGUARD_LATENCY_HISTOGRAMS
+#define WIREGUARD_LATENCY_HISTOGRAMS 0
+#endif
+
+// Counts, sizes and failures of every allocation the interface makes - device context, handshake, cookie
+// and transport pbufs (wireguardif_get_alloc_stats(), wireguard-stats.h)
+#ifndef WIREGUARD_ALLOC_STATS
+#define WIREGUARD_ALLOC_STATS 0
+#endif
+
+// Dead peer detection - a peer with a session is "suspect" once this many expected responses
+// (handshake responses, or any packet back after we sent data) have not arrived
+#ifndef WIREGUARD_DEAD_PEER_MISSES
+#define WIREGUARD_DEAD_PEER_MISSES 2
+#endif
+
+// In-memory capture ring of tunnel traffic, exported as pcap (wireguard-capture.h)
+#ifndef WIREGUARD_CAPTURE
+#define WIREGUARD_CAPTURE 0
+#endif
+#ifndef WIREGUARD_CAPTURE_SLOTS
+#define WIREGUARD_CAPTURE_SLOTS 32
+#endif
+// Bytes kept from the start of each packet
+#ifndef WIREGUARD_CAPTURE_SNAPLEN
+#define WIREGUARD_CAPTURE_SNAPLEN 96
+#endif
+
+// Trace of received datagrams and randomness for replay on a host (wireguard-record.h) - test builds only,
+// the trace holds the private key and session keys
+#ifndef WIREGUARD_RECORD
+#define WIREGUARD_RECORD 0
+#endif
+#ifndef WIREGUARD_RECORD_BUFFER
+#define WIREGUARD_RECORD_BUFFER 16384
+#endif
+
+// Keep sessions in .noinit RAM so they survive a watchdog / soft reset (wireguard-persist.h)
+#ifndef WIREGUARD_PERSIST_SESSIONS
+#define WIREGUARD_PERSIST_SESSIONS 0
+#endif
+// Counters reserved per save - after a reset sending resumes this far ahead of the last saved value
+#ifndef WIREGUARD_PERSIST_COUNTER_GAP
+#define WIREGUARD_PERSIST_COUNTER_GAP 256
+#endif
+// Same for receiving - up to this many packets from the peer may be dropped as replays right after a reset,
+// and a save is forced every this many received packets
+#ifndef WIREGUARD_PERSIST_REPLAY_GAP
+#define WIREGUARD_PERSIST_REPLAY_GAP 32
+#endif
+// Seconds added to the age of restored keypairs to account for the reset and reconnect time we cannot measure
+#ifndef WIREGUARD_PERSIST_RESET_SLACK
+#define WIREGUARD_PERSIST_RESET_SLACK 30
+#endif
+
+// Cache the public key, static DH and MAC keys in flash so boots skip x25519() (wireguard-keycache.h)
+// Needs wireguard_storage_read()/_write() - LittleFS on the Pico (set a filesystem size in the board menu)
+#ifndef WIREGUARD_KEY_CACHE
+#define WIREGUARD_KEY_CACHE 0
+#endif
+
+// Handshake load estimate, and per-source token buckets for mac2-validated messages under load (wireguard-ratelimit.h)
+#ifndef WIREGUARD_RATELIMIT
+#define WIREGUARD_RATELIMIT 1
+#endif
+// Source IPs tracked at once - the least recently seen is evicted
+#ifndef WIREGUARD_RATELIMIT_SOURCES
+#define WIREGUARD_RATELIMIT_SOURCES 8
+#endif
+// Handshake messages per second allowed from one source IP, and the burst it may save up
+#ifndef WIREGUARD_RATELIMIT_PER_SECOND
+#define WIREGUARD_RATELIMIT_PER_SECOND 2
+#endif
+#ifndef WIREGUARD_RATELIMIT_BURST
+#define WIREGUARD_RATELIMIT_BURST 5
+#endif
+// Handshake messages per second (each two to four x25519) above which the device is under load and
+// requires mac2 / answers with cookies, and how long it stays so after the rate drops again
+#ifndef WIREGUARD_UNDER_LOAD_HANDSHAKES
+#define WIREGUARD_UNDER_LOAD_HANDSHAKES 4
+#endif
+#ifndef WIREGUARD_UNDER_LOAD_HOLD_MS
+#define WIREGUARD_UNDER_LOAD_HOLD_MS 1000
+#endif
+
+// wireguard_random_bytes() from a ChaCha20 generator seeded with hashed hardware entropy (wireguard-drbg.h)
+// instead of reading the entropy source for every byte
+#ifndef WIREGUARD_DRBG
+#define WIREGUARD_DRBG 1
+#endif
+// Reseed after this many milliseconds or this many bytes, whichever comes first
+#ifndef WIREGUARD_DRBG_RESEED_MS
+#define WIREGUARD_DRBG_RESEED_MS (5 * 60 * 1000)
+#endif
+#ifndef WIREGUARD_DRBG_RESEED_BYTES
+#define WIREGUARD_DRBG_RESEED_BYTES (64 * 1024)
+#endif
+// 32-bit hardware samples hashed into each (re)seed
+#ifndef WIREGUARD_DRBG_SEED_SAMPLES
+#define WIREGUARD_DRBG_SEED_SAMPLES 256
+#endif
+
+// Handshake timestamps that never go back, even before NTP and across resets (wireguard-tai64n.h)
+// The high-water mark is kept in flash through wireguard_storage_read()/_write() - LittleFS on the Pico
+#ifndef WIREGUARD_MONOTONIC_TAI64N
+#define WIREGUARD_MONOTONIC_TAI64N 1
+#endif
+// Seconds reserved in flash ahead of the issued timestamps - one write per this much time, and how far
+// the timestamps may jump forward after a power cycle
+#ifndef WIREGUARD_TAI64N_RESERVE
+#define WIREGUARD_TAI64N_RESERVE 3600
+#endif
+// Seconds since 1970 the counter starts at on the very first boot without NTP - 0 starts at 1970 itself,
+// e.g. -DWIREGUARD_TAI64N_FLOOR=$(date +%s) to start at the build time
+#ifndef WIREGUARD_TAI64N_FLOOR
+#define WIREGUARD_TAI64N_FLOOR 0
+#endif
+
+// Peers are added without their static DH, which is computed on the first handshake with them.
+// With this set the timer also computes it for one waiting peer per otherwise idle tick.
+#ifndef WIREGUARD_DH_BACKGROUND
+#define WIREGUARD_DH_BACKGROUND 1
+#endif
+
+// Crypto implementations that can be registered, the reference one included (crypto.h), and the time
+// wireguard_crypto_select() spends timing each of them per group of primitives. With 1 (the reference
+// only) the selection and the self-tests it runs are not compiled in.
+#ifndef WIREGUARD_CRYPTO_BACKENDS
+#define WIREGUARD_CRYPTO_BACKENDS 1
+#endif
+#ifndef WIREGUARD_CRYPTO_SELECT_MS
+#define WIREGUARD_CRYPTO_SELECT_MS 20
+#endif
+
+// Transport data pbufs (both directions) come from a static pool of this many MTU-sized buffers
+// (wireguard-pbufpool.h), about 1.5 KB each; the lwIP heap is used when it runs out. 0 for the heap only.
+// Ignored (heap only) when lwIP was built without LWIP_SUPPORT_CUSTOM_PBUF.
+#ifndef WIREGUARD_PBUF_POOL_SIZE
+#define WIREGUARD_PBUF_POOL_SIZE 8
+#endif
+
+// Painted-stack probe on the lwIP entry points of the interface (receive, output, timer) - each call fills
+// WIREGUARD_STACK_PROBE_DEPTH bytes below it with a pattern and afterwards looks for the deepest byte
+// overwritten. The result goes to the device stats (stack_high_water), meant for test builds.
+#ifndef WIREGUARD_STACK_PROBE
+#define WIREGUARD_STACK_PROBE 0
+#endif
+#ifndef WIREGUARD_STACK_PROBE_DEPTH
+#define WIREGUARD_STACK_PROBE_DEPTH 4096
+#endif
+// Bytes of stack the WireGuard code may use below an lwIP callback. The probe counts calls that went over
+// it (stack_over_budget), the host build checks every function's frame against WG_STACK_FRAME_BUDGET.
+#ifndef WIREGUARD_STACK_BUDGET
+#define WIREGUARD_STACK_BUDGET 2048
+#endif
+
+// wireguard_platform_set_hooks() - clock, random bytes and timestamps supplied by the application,
+// e.g. a simulated clock and a seeded generator for deterministic runs on the host (extras/host/sim.c)
+#ifndef WIREGUARD_PLATFORM_HOOKS
+#define WIREGUARD_PLATFORM_HOOKS 0
+#endif
 
 //
 // Your platform integration needs to provide implementations of these functions
@@ -74,9 +267,41 @@ void wireguard_random_bytes(void *bytes, size_t size);
 // The remote end of the Wireguard tunnel will use this value in handshake replay detection
 void wireguard_tai64n_now(uint8_t *output);
 
+// Reserve handshake timestamps ahead in storage (WIREGUARD_MONOTONIC_TAI64N) - may write flash, so only from the
+// sketch, never from the lwIP context. On the Pico wireguard_platform_init() calls it, WireGuard::resume() and
+// WireGuard::maintain() too.
+void wireguard_tai64n_reserve();
+
 // Is the system under load - i.e. should we generate cookie reply message in response to initiation messages
+// With WIREGUARD_RATELIMIT the device also considers itself under load from its own handshake rate - this
+// only adds platform knowledge (CPU busy elsewhere, low memory...)
 bool wireguard_is_under_load();
 
+// Free-running high resolution counter (CPU cycles where available, otherwise microseconds) used for latency measurements
+// Only differences between two readings are used so it may wrap at 32 bits
+uint32_t wireguard_cycle_count();
+
+// The rate of wireguard_cycle_count() in ticks per second
+uint32_t wireguard_cycle_frequency();
+
+// Small named blobs in persistent storage, only used with WIREGUARD_KEY_CACHE and WIREGUARD_MONOTONIC_TAI64N
+// Read succeeds only if the item exists with exactly len bytes, both return false when storage is unavailable
+bool wireguard_storage_read(const char *name, uint8_t *data, size_t len);
+bool wireguard_storage_write(const char *name, const uint8_t *data, size_t len);
+
+#if WIREGUARD_PLATFORM_HOOKS
+// Replacements for wireguard_sys_now(), wireguard_random_bytes() and wireguard_tai64n_now(), NULL members
+// keep the platform's own. Meant for tests and simulation, not for production use.
+struct wireguard_platform_hooks {
+	uint32_t (*sys_now)(void);
+	void (*random_bytes)(void *bytes, size_t size);
+	void (*tai64n_now)(uint8_t *output);
+};
+
+// hooks must stay valid until replaced, NULL restores the platform functions
+void wireguard_platform_set_hooks(const struct wireguard_platform_hooks *hooks);
+#endif
+
 #ifdef __cplusplus
 } /* extern "C" */
 #endif
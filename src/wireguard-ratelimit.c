@@ -0,0 +1,102 @@
+/*
+ * Handshake load estimate and per-source rate limiting for the WireGuard lwIP port.
+ * SPDX-License-Identifier: BSD-3-Clause
+ */
+
+#include "wireguard-ratelimit.h"
+
+#if WIREGUARD_RATELIMIT
+
+#include <string.h>
+
+#define RATELIMIT_TOKEN				(1000)
+#define RATELIMIT_CAPACITY			(WIREGUARD_RATELIMIT_BURST * RATELIMIT_TOKEN)
+#define LOAD_WINDOW_MS				(1000)
+
+void wireguard_ratelimit_init(struct wireguard_ratelimit *rl, uint32_t now) {
+	memset(rl, 0, sizeof(struct wireguard_ratelimit));
+	rl->window_millis = now;
+}
+
+bool wireguard_ratelimit_allow(struct wireguard_ratelimit *rl, const ip_addr_t *addr, uint32_t now) {
+	struct wireguard_ratelimit_source *source = NULL;
+	struct wireguard_ratelimit_source *oldest = NULL;
+	uint32_t elapsed;
+	bool result = false;
+	int x;
+
+	for (x=0; x < WIREGUARD_RATELIMIT_SOURCES; x++) {
+		if (rl->sources[x].valid && ip_addr_cmp(&rl->sources[x].addr, addr)) {
+			source = &rl->sources[x];
+			break;
+		}
+		if (!oldest || !rl->sources[x].valid ||
+				(oldest->valid && ((now - rl->sources[x].last_millis) > (now - oldest->last_millis)))) {
+			oldest = &rl->sources[x];
+		}
+	}
+
+	if (source) {
+		// Refill - WIREGUARD_RATELIMIT_PER_SECOND tokens per second is as many thousandths per millisecond
+		elapsed = now - source->last_millis;
+		if (elapsed > (RATELIMIT_CAPACITY / WIREGUARD_RATELIMIT_PER_SECOND)) {
+			source->tokens = RATELIMIT_CAPACITY;
+		} else {
+			source->tokens += elapsed * WIREGUARD_RATELIMIT_PER_SECOND;
+			if (source->tokens > RATELIMIT_CAPACITY) {
+				source->tokens = RATELIMIT_CAPACITY;
+			}
+		}
+	} else {
+		// New source takes the free or least recently seen slot, with a full bucket
+		source = oldest;
+		source->valid = true;
+		ip_addr_copy(source->addr, *addr);
+		source->tokens = RATELIMIT_CAPACITY;
+	}
+	source->last_millis = now;
+
+	if (source->tokens >= RATELIMIT_TOKEN) {
+		source->tokens -= RATELIMIT_TOKEN;
+		result = true;
+	}
+	return result;
+}
+
+static void load_advance(struct wireguard_ratelimit *rl, uint32_t now) {
+	uint32_t elapsed = now - rl->window_millis;
+	if (elapsed >= (2 * LOAD_WINDOW_MS)) {
+		rl->previous_work = 0;
+		rl->window_work = 0;
+		rl->window_millis = now;
+	} else if (elapsed >= LOAD_WINDOW_MS) {
+		rl->previous_work = rl->window_work;
+		rl->window_work = 0;
+		rl->window_millis += LOAD_WINDOW_MS;
+	}
+}
+
+void wireguard_ratelimit_work(struct wireguard_ratelimit *rl, uint32_t now) {
+	load_advance(rl, now);
+	if (rl->window_work < UINT16_MAX) {
+		rl->window_work++;
+	}
+}
+
+uint32_t wireguard_ratelimit_load(struct wireguard_ratelimit *rl, uint32_t now) {
+	load_advance(rl, now);
+	// The part of the previous window still inside the last second, plus the current one
+	return rl->window_work + (rl->previous_work * (LOAD_WINDOW_MS - (now - rl->window_millis))) / LOAD_WINDOW_MS;
+}
+
+bool wireguard_ratelimit_under_load(struct wireguard_ratelimit *rl, uint32_t now) {
+	if (wireguard_ratelimit_load(rl, now) >= WIREGUARD_UNDER_LOAD_HANDSHAKES) {
+		rl->under_load = true;
+		rl->under_load_millis = now;
+	} else if (rl->under_load && ((now - rl->under_load_millis) >= WIREGUARD_UNDER_LOAD_HOLD_MS)) {
+		rl->under_load = false;
+	}
+	return rl->under_load;
+}
+
+#endif /* WIREGUARD_RATELIMIT */
@@ -0,0 +1,66 @@
+/*
+ * Handshake load estimate and per-source rate limiting for the WireGuard lwIP port.
+ * SPDX-License-Identifier: BSD-3-Clause
+ *
+ * Every handshake message that passes mac1 costs two to four x25519() - tens of milliseconds each on
+ * an RP2040 - so a flood of them starves the data plane. Two defences, as in the kernel implementation:
+ * - an estimate of the handshake messages processed per second (sliding one-second window). Above
+ *   WIREGUARD_UNDER_LOAD_HANDSHAKES the device is under load for at least WIREGUARD_UNDER_LOAD_HOLD_MS
+ *   and mac2 is required, so spoofed sources only ever get a cookie reply (5.3 Denial of Service
+ *   Mitigation & Cookies);
+ * - under load, a token bucket per source IP (WIREGUARD_RATELIMIT_PER_SECOND, bursts of
+ *   WIREGUARD_RATELIMIT_BURST) for messages with a valid mac2, in a small table where the least recently
+ *   seen source is evicted, which stops a single host that does answer its cookies. Only mac2 proves the
+ *   source address: a bucket taken before it would let anyone who knows the public key drain the budget
+ *   of a real peer by spoofing its address.
+ */
+
+#ifndef _WIREGUARD_RATELIMIT_H_
+#define _WIREGUARD_RATELIMIT_H_
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "lwip/ip_addr.h"
+
+#include "wireguard-platform.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+struct wireguard_ratelimit_source {
+	bool valid;
+	ip_addr_t addr;
+	uint32_t tokens; // In thousandths of a handshake
+	uint32_t last_millis;
+};
+
+struct wireguard_ratelimit {
+	struct wireguard_ratelimit_source sources[WIREGUARD_RATELIMIT_SOURCES];
+	// Handshake messages processed in the current and the previous one-second window
+	uint32_t window_millis;
+	uint16_t window_work;
+	uint16_t previous_work;
+	bool under_load;
+	uint32_t under_load_millis; // When the estimate was last above the threshold
+};
+
+void wireguard_ratelimit_init(struct wireguard_ratelimit *rl, uint32_t now);
+
+// Take a token from the bucket of addr - false if the source is over its budget
+bool wireguard_ratelimit_allow(struct wireguard_ratelimit *rl, const ip_addr_t *addr, uint32_t now);
+
+// Record one handshake message about to be processed (DH work)
+void wireguard_ratelimit_work(struct wireguard_ratelimit *rl, uint32_t now);
+
+// Handshake messages per second, estimated over the last second
+uint32_t wireguard_ratelimit_load(struct wireguard_ratelimit *rl, uint32_t now);
+
+bool wireguard_ratelimit_under_load(struct wireguard_ratelimit *rl, uint32_t now);
+
+#ifdef __cplusplus
+} /* extern "C" */
+#endif
+
+#endif /* _WIREGUARD_RATELIMIT_H_ */
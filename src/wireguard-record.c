@@ -0,0 +1,227 @@
+/*
+ * Trace recorder for offline replay of the receive path (see wireguard-record.h).
+ * SPDX-License-Identifier: BSD-3-Clause
+ */
+
+#include "wireguard-record.h"
+
+#include <string.h>
+
+#include "crypto.h"
+#include "wireguard.h"
+
+static uint32_t ip4_u32(const ip_addr_t *addr) {
+	uint32_t result = 0;
+	if (addr && IP_IS_V4(addr)) {
+		result = ip4_addr_get_u32(ip_2_ip4(addr));
+	}
+	return result;
+}
+
+// Addresses are kept in network byte order so copy them as they are
+static uint8_t *put_u32_raw(uint8_t *dst, uint32_t value) {
+	memcpy(dst, &value, 4);
+	return dst + 4;
+}
+
+static uint8_t *put_u16(uint8_t *dst, uint16_t value) {
+	dst[0] = (uint8_t)value;
+	dst[1] = (uint8_t)(value >> 8);
+	return dst + 2;
+}
+
+static uint8_t *put_u32(uint8_t *dst, uint32_t value) {
+	U32TO8_LITTLE(dst, value);
+	return dst + 4;
+}
+
+static uint8_t *put_u64(uint8_t *dst, uint64_t value) {
+	U64TO8_LITTLE(dst, value);
+	return dst + 8;
+}
+
+static uint8_t *put_bytes(uint8_t *dst, const uint8_t *src, size_t len) {
+	memcpy(dst, src, len);
+	return dst + len;
+}
+
+static void ring_write(struct wireguard_recorder *recorder, const uint8_t *data, size_t len) {
+	uint32_t tail;
+	size_t chunk;
+	while (len > 0) {
+		tail = (recorder->head + recorder->used) % WIREGUARD_RECORD_BUFFER;
+		chunk = WIREGUARD_RECORD_BUFFER - tail;
+		if (chunk > len) {
+			chunk = len;
+		}
+		memcpy(&recorder->buffer[tail], data, chunk);
+		recorder->used += chunk;
+		data += chunk;
+		len -= chunk;
+	}
+}
+
+static void ring_write_pbuf(struct wireguard_recorder *recorder, const struct pbuf *p, u16_t len) {
+	uint32_t tail;
+	u16_t offset = 0;
+	u16_t chunk;
+	while (offset < len) {
+		tail = (recorder->head + recorder->used) % WIREGUARD_RECORD_BUFFER;
+		chunk = (u16_t)((WIREGUARD_RECORD_BUFFER - tail < (uint32_t)(len - offset)) ? (WIREGUARD_RECORD_BUFFER - tail) : (len - offset));
+		pbuf_copy_partial(p, &recorder->buffer[tail], chunk, offset);
+		recorder->used += chunk;
+		offset += chunk;
+	}
+}
+
+static void ring_write_header(struct wireguard_recorder *recorder, uint8_t type, size_t len) {
+	uint8_t header[WIREGUARD_RECORD_HEADER_LEN];
+	header[0] = type;
+	header[1] = 0;
+	put_u16(&header[2], (uint16_t)len);
+	put_u32(&header[4], wireguard_sys_now());
+	ring_write(recorder, header, sizeof(header));
+}
+
+// Room for a record with len bytes of payload - writes its header, or counts it as lost
+static bool record_begin(struct wireguard_recorder *recorder, uint8_t type, size_t len) {
+	uint8_t lost[4];
+	size_t needed = WIREGUARD_RECORD_HEADER_LEN + len;
+	bool result = false;
+	if (recorder->lost > 0) {
+		// The replay has to know where the stream has holes
+		needed += WIREGUARD_RECORD_HEADER_LEN + sizeof(lost);
+	}
+	if ((len <= 0xFFFF) && (needed <= WIREGUARD_RECORD_BUFFER - recorder->used)) {
+		if (recorder->lost > 0) {
+			put_u32(lost, recorder->lost);
+			ring_write_header(recorder, WIREGUARD_RECORD_LOST, sizeof(lost));
+			ring_write(recorder, lost, sizeof(lost));
+			recorder->lost = 0;
+		}
+		ring_write_header(recorder, type, len);
+		result = true;
+	} else {
+		recorder->lost++;
+	}
+	return result;
+}
+
+bool wireguard_record_put(struct wireguard_recorder *recorder, uint8_t type, const void *a, size_t a_len, const void *b, size_t b_len) {
+	bool result = record_begin(recorder, type, a_len + b_len);
+	if (result) {
+		ring_write(recorder, (const uint8_t *)a, a_len);
+		ring_write(recorder, (const uint8_t *)b, b_len);
+	}
+	return result;
+}
+
+void wireguard_record_rx(struct wireguard_recorder *recorder, const struct pbuf *p, const ip_addr_t *addr, u16_t port) {
+	uint8_t header[WIREGUARD_RECORD_RX_HEADER_LEN];
+	put_u16(put_u32_raw(header, ip4_u32(addr)), port);
+	if (record_begin(recorder, WIREGUARD_RECORD_RX, sizeof(header) + p->tot_len)) {
+		ring_write(recorder, header, sizeof(header));
+		ring_write_pbuf(recorder, p, p->tot_len);
+	}
+}
+
+static void record_keypair(struct wireguard_recorder *recorder, uint8_t peer_index, uint8_t slot, const struct wireguard_keypair *keypair) {
+	uint8_t record[WIREGUARD_RECORD_KEYPAIR_LEN];
+	uint8_t *dst = record;
+	uint8_t flags = 0;
+	if (keypair->valid) {
+		flags |= keypair->initiator ? WIREGUARD_RECORD_KEYPAIR_INITIATOR : 0;
+		flags |= keypair->sending_valid ? WIREGUARD_RECORD_KEYPAIR_SENDING : 0;
+		flags |= keypair->receiving_valid ? WIREGUARD_RECORD_KEYPAIR_RECEIVING : 0;
+		*dst++ = peer_index;
+		*dst++ = slot;
+		*dst++ = flags;
+		dst = put_u32(dst, keypair->local_index);
+		dst = put_u32(dst, keypair->remote_index);
+		dst = put_u32(dst, wireguard_sys_now() - keypair->keypair_millis);
+		dst = put_u64(dst, keypair->sending_counter);
+		dst = put_u64(dst, keypair->replay_counter);
+		dst = put_u32(dst, keypair->replay_bitmap);
+		dst = put_bytes(dst, keypair->sending_key, WIREGUARD_SESSION_KEY_LEN);
+		put_bytes(dst, keypair->receiving_key, WIREGUARD_SESSION_KEY_LEN);
+		wireguard_record_put(recorder, WIREGUARD_RECORD_KEYPAIR, record, sizeof(record), NULL, 0);
+		crypto_zero(record, sizeof(record));
+	}
+}
+
+static void record_peer(struct wireguard_recorder *recorder, uint8_t peer_index, const struct wireguard_peer *peer) {
+	uint8_t record[WIREGUARD_RECORD_PEER_LEN];
+	uint8_t allowed[WIREGUARD_MAX_SRC_IPS * 8];
+	uint8_t *dst = record;
+	uint8_t *allowed_dst = allowed;
+	uint8_t count = 0;
+	int x;
+
+	*dst++ = peer_index;
+	dst = put_u16(dst, peer->keepalive_interval);
+	dst = put_bytes(dst, peer->cold->public_key, WIREGUARD_PUBLIC_KEY_LEN);
+	dst = put_bytes(dst, peer->cold->preshared_key, WIREGUARD_SESSION_KEY_LEN);
+	dst = put_bytes(dst, peer->cold->greatest_timestamp, WIREGUARD_TAI64N_LEN);
+	dst = put_u32_raw(dst, ip4_u32(&peer->cold->connect_ip));
+	dst = put_u16(dst, peer->cold->connect_port);
+	for (x=0; x < WIREGUARD_MAX_SRC_IPS; x++) {
+		if (peer->allowed_source_ips[x].valid) {
+			allowed_dst = put_u32_raw(allowed_dst, ip4_addr_get_u32(&peer->allowed_source_ips[x].ip));
+			allowed_dst = put_u32_raw(allowed_dst, ip4_addr_get_u32(&peer->allowed_source_ips[x].mask));
+			count++;
+		}
+	}
+	*dst = count;
+	wireguard_record_put(recorder, WIREGUARD_RECORD_PEER, record, sizeof(record), allowed, (size_t)count * 8);
+	crypto_zero(record, sizeof(record));
+
+	record_keypair(recorder, peer_index, 0, PEER_CURR_KEYPAIR(peer));
+	record_keypair(recorder, peer_index, 1, PEER_PREV_KEYPAIR(peer));
+	record_keypair(recorder, peer_index, 2, PEER_NEXT_KEYPAIR(peer));
+}
+
+void wireguard_record_start(struct wireguard_recorder *recorder, const struct wireguard_device *device) {
+	uint8_t record[WIREGUARD_RECORD_DEVICE_LEN];
+	uint8_t *dst = record;
+	uint8_t x;
+
+	memset(recorder, 0, sizeof(struct wireguard_recorder));
+	memcpy(record, WIREGUARD_RECORD_MAGIC, 4);
+	put_u16(put_u16(&record[4], WIREGUARD_RECORD_VERSION), 0);
+	ring_write(recorder, record, WIREGUARD_RECORD_FILE_HEADER_LEN);
+
+	dst = put_bytes(dst, device->private_key, WIREGUARD_PRIVATE_KEY_LEN);
+	dst = put_u16(dst, device->listen_port);
+	dst = put_bytes(dst, device->cookie_secret, WIREGUARD_HASH_LEN);
+	dst = put_u32(dst, wireguard_sys_now() - device->cookie_secret_millis);
+	dst = put_u32_raw(dst, ip4_addr_get_u32(netif_ip4_addr(device->netif)));
+	put_u32_raw(dst, ip4_addr_get_u32(netif_ip4_netmask(device->netif)));
+	wireguard_record_put(recorder, WIREGUARD_RECORD_DEVICE, record, sizeof(record), NULL, 0);
+	crypto_zero(record, sizeof(record));
+
+	for (x=0; x < WIREGUARD_MAX_PEERS; x++) {
+		if (device->peers[x].valid) {
+			record_peer(recorder, x, &device->peers[x]);
+		}
+	}
+	recorder->active = true;
+}
+
+size_t wireguard_record_take(struct wireguard_recorder *recorder, uint8_t *out, size_t max_len) {
+	size_t taken = 0;
+	size_t chunk;
+	while ((taken < max_len) && (recorder->used > 0)) {
+		chunk = WIREGUARD_RECORD_BUFFER - recorder->head;
+		if (chunk > recorder->used) {
+			chunk = recorder->used;
+		}
+		if (chunk > max_len - taken) {
+			chunk = max_len - taken;
+		}
+		memcpy(&out[taken], &recorder->buffer[recorder->head], chunk);
+		recorder->head = (recorder->head + chunk) % WIREGUARD_RECORD_BUFFER;
+		recorder->used -= chunk;
+		taken += chunk;
+	}
+	return taken;
+}
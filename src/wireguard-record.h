@@ -0,0 +1,106 @@
+/*
+ * Trace recorder for offline replay of the receive path (WIREGUARD_RECORD test builds).
+ * SPDX-License-Identifier: BSD-3-Clause
+ *
+ * While recording, a device appends to a byte ring every datagram that reaches
+ * wireguardif_network_rx() and every random byte it uses. wireguardif_record_start()
+ * writes the device private key, the peers and their current sessions first. That is
+ * enough for a host (extras/host/replay.c) to rebuild the device and run the same
+ * datagrams through the same code: handshakes draw the recorded randomness and end up
+ * with the recorded session keys. The application drains the ring with
+ * wireguardif_record_drain(); records that do not fit are counted in a LOST record.
+ *
+ * The stream holds the private key and session keys in clear - never enable this in a
+ * build that carries real keys.
+ *
+ * Format, all integers little-endian, addresses in network byte order:
+ *   file header: "WGRT", u16 version, u16 reserved
+ *   record:      u8 type, u8 reserved, u16 payload length, u32 wireguard_sys_now(), payload
+ */
+
+#ifndef _WIREGUARD_RECORD_H_
+#define _WIREGUARD_RECORD_H_
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+
+#include "lwip/pbuf.h"
+#include "lwip/ip_addr.h"
+
+#include "wireguard-platform.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define WIREGUARD_RECORD_MAGIC				"WGRT"
+#define WIREGUARD_RECORD_VERSION			(1)
+#define WIREGUARD_RECORD_FILE_HEADER_LEN	(8)
+#define WIREGUARD_RECORD_HEADER_LEN			(8)
+
+enum wireguard_record_type {
+	// u8[32] private key, u16 listen port, u8[32] cookie secret, u32 cookie secret age (ms),
+	// u32 tunnel address, u32 tunnel netmask
+	WIREGUARD_RECORD_DEVICE = 1,
+	// u8 peer index, u16 keep-alive, u8[32] public key, u8[32] preshared key, u8[12] greatest timestamp,
+	// u32 endpoint address, u16 endpoint port, u8 count, count x (u32 allowed address, u32 mask)
+	WIREGUARD_RECORD_PEER,
+	// u8 peer index, u8 slot (0 current, 1 previous, 2 next), u8 flags (WIREGUARD_RECORD_KEYPAIR_*),
+	// u32 local index, u32 remote index, u32 age (ms), u64 sending counter, u64 replay counter,
+	// u32 replay bitmap, u8[32] sending key, u8[32] receiving key
+	WIREGUARD_RECORD_KEYPAIR,
+	// Bytes returned by wireguard_random_bytes() to this device
+	WIREGUARD_RECORD_RANDOM,
+	// u32 source address, u16 source port, UDP payload
+	WIREGUARD_RECORD_RX,
+	// u32 records dropped before this one because the ring was full
+	WIREGUARD_RECORD_LOST,
+};
+
+#define WIREGUARD_RECORD_KEYPAIR_INITIATOR	(0x01)
+#define WIREGUARD_RECORD_KEYPAIR_SENDING	(0x02)
+#define WIREGUARD_RECORD_KEYPAIR_RECEIVING	(0x04)
+
+#define WIREGUARD_RECORD_DEVICE_LEN			(32 + 2 + 32 + 4 + 4 + 4)
+#define WIREGUARD_RECORD_PEER_LEN			(1 + 2 + 32 + 32 + 12 + 4 + 2 + 1)
+#define WIREGUARD_RECORD_KEYPAIR_LEN		(1 + 1 + 1 + 4 + 4 + 4 + 8 + 8 + 4 + 32 + 32)
+#define WIREGUARD_RECORD_RX_HEADER_LEN		(4 + 2)
+
+struct wireguard_recorder {
+	bool active;
+	uint32_t head; // Oldest byte not drained yet
+	uint32_t used;
+	uint32_t lost; // Records dropped since the last LOST record
+	uint8_t buffer[WIREGUARD_RECORD_BUFFER];
+};
+
+// Sink for the recorded stream
+typedef void (*wireguard_record_write_fn)(void *arg, const uint8_t *data, size_t len);
+
+struct wireguard_device;
+
+#if WIREGUARD_RECORD
+#define WIREGUARD_RECORD_RANDOM(device, bytes, size)		do { if ((device)->recorder.active) wireguard_record_put(&(device)->recorder, WIREGUARD_RECORD_RANDOM, bytes, size, NULL, 0); } while (0)
+#define WIREGUARD_RECORD_RX(device, p, addr, port)			do { if ((device)->recorder.active) wireguard_record_rx(&(device)->recorder, p, addr, port); } while (0)
+#else
+#define WIREGUARD_RECORD_RANDOM(device, bytes, size)		do { } while (0)
+#define WIREGUARD_RECORD_RX(device, p, addr, port)			do { } while (0)
+#endif
+
+// Empty the ring, write the file header and the device, peers and sessions, then record
+void wireguard_record_start(struct wireguard_recorder *recorder, const struct wireguard_device *device);
+
+// Append one record made of two parts (either may be empty) - false if it did not fit
+bool wireguard_record_put(struct wireguard_recorder *recorder, uint8_t type, const void *a, size_t a_len, const void *b, size_t b_len);
+
+void wireguard_record_rx(struct wireguard_recorder *recorder, const struct pbuf *p, const ip_addr_t *addr, u16_t port);
+
+// Move up to max_len recorded bytes to out, returns the number moved
+size_t wireguard_record_take(struct wireguard_recorder *recorder, uint8_t *out, size_t max_len);
+
+#ifdef __cplusplus
+} /* extern "C" */
+#endif
+
+#endif /* _WIREGUARD_RECORD_H_ */
@@ -0,0 +1,981 @@
+/*
+ * Known-answer tests and microbenchmarks of the crypto primitives (see wireguard-selftest.h).
+ * SPDX-License-Identifier: BSD-3-Clause
+ */
+
+#include "wireguard-selftest.h"
+
+#include <stdio.h>
+#include <string.h>
+
+#include "crypto.h"
+#include "crypto/refc/chacha20.h"
+#include "crypto/refc/poly1305-donna.h"
+#include "wireguard-platform.h"
+
+struct chacha20_vector {
+	const char *name;
+	uint8_t key[CHACHA20_KEY_SIZE];
+	// Last 64 bits of the RFC 7539 nonce, the first 32 are zero
+	uint64_t nonce;
+	uint32_t counter;
+	const uint8_t *input; // NULL for zeros
+	const uint8_t *output;
+	size_t len;
+};
+
+struct poly1305_vector {
+	const char *name;
+	uint8_t key[32];
+	const uint8_t *input; // NULL for zeros
+	size_t len;
+	uint8_t tag[16];
+};
+
+// Key 00 01 02 .. 1f, input 00 01 02 .. of len bytes
+struct blake2s_vector {
+	size_t len;
+	uint8_t hash[32];
+};
+
+struct x25519_vector {
+	const char *name;
+	uint8_t scalar[32];
+	uint8_t point[32];
+	uint8_t out[32];
+};
+
+struct x25519_iterated {
+	uint32_t iterations;
+	uint8_t out[32];
+};
+
+static const uint8_t sunscreen[] = "Ladies and Gentlemen of the class of '99: If I could offer you only one tip for the future, sunscreen would be it.";
+
+static const uint8_t internet_drafts[] = "Internet-Drafts are draft documents valid for a maximum of six months and may be updated, "
+	"replaced, or obsoleted by other documents at any time. It is inappropriate to use Internet-Drafts as reference material "
+	"or to cite them other than as /\xe2\x80\x9cwork in progress./\xe2\x80\x9d";
+
+static const uint8_t chacha20_out_1[64] = {
+	0x76, 0xb8, 0xe0, 0xad, 0xa0, 0xf1, 0x3d, 0x90, 0x40, 0x5d, 0x6a, 0xe5, 0x53, 0x86, 0xbd, 0x28,
+	0xbd, 0xd2, 0x19, 0xb8, 0xa0, 0x8d, 0xed, 0x1a, 0xa8, 0x36, 0xef, 0xcc, 0x8b, 0x77, 0x0d, 0xc7,
+	0xda, 0x41, 0x59, 0x7c, 0x51, 0x57, 0x48, 0x8d, 0x77, 0x24, 0xe0, 0x3f, 0xb8, 0xd8, 0x4a, 0x37,
+	0x6a, 0x43, 0xb8, 0xf4, 0x15, 0x18, 0xa1, 0x1c, 0xc3, 0x87, 0xb6, 0x69, 0xb2, 0xee, 0x65, 0x86
+};
+
+static const uint8_t chacha20_out_2[64] = {
+	0x9f, 0x07, 0xe7, 0xbe, 0x55, 0x51, 0x38, 0x7a, 0x98, 0xba, 0x97, 0x7c, 0x73, 0x2d, 0x08, 0x0d,
+	0xcb, 0x0f, 0x29, 0xa0, 0x48, 0xe3, 0x65, 0x69, 0x12, 0xc6, 0x53, 0x3e, 0x32, 0xee, 0x7a, 0xed,
+	0x29, 0xb7, 0x21, 0x76, 0x9c, 0xe6, 0x4e, 0x43, 0xd5, 0x71, 0x33, 0xb0, 0x74, 0xd8, 0x39, 0xd5,
+	0x31, 0xed, 0x1f, 0x28, 0x51, 0x0a, 0xfb, 0x45, 0xac, 0xe1, 0x0a, 0x1f, 0x4b, 0x79, 0x4d, 0x6f
+};
+
+static const uint8_t chacha20_out_3[64] = {
+	0x3a, 0xeb, 0x52, 0x24, 0xec, 0xf8, 0x49, 0x92, 0x9b, 0x9d, 0x82, 0x8d, 0xb1, 0xce, 0xd4, 0xdd,
+	0x83, 0x20, 0x25, 0xe8, 0x01, 0x8b, 0x81, 0x60, 0xb8, 0x22, 0x84, 0xf3, 0xc9, 0x49, 0xaa, 0x5a,
+	0x8e, 0xca, 0x00, 0xbb, 0xb4, 0xa7, 0x3b, 0xda, 0xd1, 0x92, 0xb5, 0xc4, 0x2f, 0x73, 0xf2, 0xfd,
+	0x4e, 0x27, 0x36, 0x44, 0xc8, 0xb3, 0x61, 0x25, 0xa6, 0x4a, 0xdd, 0xeb, 0x00, 0x6c, 0x13, 0xa0
+};
+
+static const uint8_t chacha20_out_4[64] = {
+	0x72, 0xd5, 0x4d, 0xfb, 0xf1, 0x2e, 0xc4, 0x4b, 0x36, 0x26, 0x92, 0xdf, 0x94, 0x13, 0x7f, 0x32,
+	0x8f, 0xea, 0x8d, 0xa7, 0x39, 0x90, 0x26, 0x5e, 0xc1, 0xbb, 0xbe, 0xa1, 0xae, 0x9a, 0xf0, 0xca,
+	0x13, 0xb2, 0x5a, 0xa2, 0x6c, 0xb4, 0xa6, 0x48, 0xcb, 0x9b, 0x9d, 0x1b, 0xe6, 0x5b, 0x2c, 0x09,
+	0x24, 0xa6, 0x6c, 0x54, 0xd5, 0x45, 0xec, 0x1b, 0x73, 0x74, 0xf4, 0x87, 0x2e, 0x99, 0xf0, 0x96
+};
+
+static const uint8_t chacha20_out_5[64] = {
+	0xc2, 0xc6, 0x4d, 0x37, 0x8c, 0xd5, 0x36, 0x37, 0x4a, 0xe2, 0x04, 0xb9, 0xef, 0x93, 0x3f, 0xcd,
+	0x1a, 0x8b, 0x22, 0x88, 0xb3, 0xdf, 0xa4, 0x96, 0x72, 0xab, 0x76, 0x5b, 0x54, 0xee, 0x27, 0xc7,
+	0x8a, 0x97, 0x0e, 0x0e, 0x95, 0x5c, 0x14, 0xf3, 0xa8, 0x8e, 0x74, 0x1b, 0x97, 0xc2, 0x86, 0xf7,
+	0x5f, 0x8f, 0xc2, 0x99, 0xe8, 0x14, 0x83, 0x62, 0xfa, 0x19, 0x8a, 0x39, 0x53, 0x1b, 0xed, 0x6d
+};
+
+static const uint8_t chacha20_out_6[114] = {
+	0x6e, 0x2e, 0x35, 0x9a, 0x25, 0x68, 0xf9, 0x80, 0x41, 0xba, 0x07, 0x28, 0xdd, 0x0d, 0x69, 0x81,
+	0xe9, 0x7e, 0x7a, 0xec, 0x1d, 0x43, 0x60, 0xc2, 0x0a, 0x27, 0xaf, 0xcc, 0xfd, 0x9f, 0xae, 0x0b,
+	0xf9, 0x1b, 0x65, 0xc5, 0x52, 0x47, 0x33, 0xab, 0x8f, 0x59, 0x3d, 0xab, 0xcd, 0x62, 0xb3, 0x57,
+	0x16, 0x39, 0xd6, 0x24, 0xe6, 0x51, 0x52, 0xab, 0x8f, 0x53, 0x0c, 0x35, 0x9f, 0x08, 0x61, 0xd8,
+	0x07, 0xca, 0x0d, 0xbf, 0x50, 0x0d, 0x6a, 0x61, 0x56, 0xa3, 0x8e, 0x08, 0x8a, 0x22, 0xb6, 0x5e,
+	0x52, 0xbc, 0x51, 0x4d, 0x16, 0xcc, 0xf8, 0x06, 0x81, 0x8c, 0xe9, 0x1a, 0xb7, 0x79, 0x37, 0x36,
+	0x5a, 0xf9, 0x0b, 0xbf, 0x74, 0xa3, 0x5b, 0xe6, 0xb4, 0x0b, 0x8e, 0xed, 0xf2, 0x78, 0x5e, 0x42,
+	0x87, 0x4d
+};
+
+static const struct chacha20_vector chacha20_vectors[] = {
+	{
+		"RFC 7539 A.1 #1",
+		{
+			0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+			0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00
+		},
+		0x0000000000000000ULL, 0, NULL, chacha20_out_1, 64
+	},
+	{
+		"RFC 7539 A.1 #2",
+		{
+			0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+			0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00
+		},
+		0x0000000000000000ULL, 1, NULL, chacha20_out_2, 64
+	},
+	{
+		"RFC 7539 A.1 #3",
+		{
+			0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+			0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x01
+		},
+		0x0000000000000000ULL, 1, NULL, chacha20_out_3, 64
+	},
+	{
+		"RFC 7539 A.1 #4",
+		{
+			0x00, 0xff, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+			0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00
+		},
+		0x0000000000000000ULL, 2, NULL, chacha20_out_4, 64
+	},
+	{
+		"RFC 7539 A.1 #5",
+		{
+			0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+			0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00
+		},
+		0x0200000000000000ULL, 0, NULL, chacha20_out_5, 64
+	},
+	{
+		"RFC 7539 2.4.2",
+		{
+			0x00, 0x01, 0x02, 0x03, 0x04, 0x05, 0x06, 0x07, 0x08, 0x09, 0x0a, 0x0b, 0x0c, 0x0d, 0x0e, 0x0f,
+			0x10, 0x11, 0x12, 0x13, 0x14, 0x15, 0x16, 0x17, 0x18, 0x19, 0x1a, 0x1b, 0x1c, 0x1d, 0x1e, 0x1f
+		},
+		0x000000004a000000ULL, 1, sunscreen, chacha20_out_6, 114
+	},
+};
+
+static const uint8_t poly1305_in_3[16] = {
+	0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff
+};
+
+static const uint8_t poly1305_in_4[16] = {
+	0x02, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00
+};
+
+static const uint8_t poly1305_in_5[48] = {
+	0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff,
+	0xf0, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff,
+	0x11, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00
+};
+
+static const uint8_t poly1305_in_6[48] = {
+	0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff,
+	0xfb, 0xfe, 0xfe, 0xfe, 0xfe, 0xfe, 0xfe, 0xfe, 0xfe, 0xfe, 0xfe, 0xfe, 0xfe, 0xfe, 0xfe, 0xfe,
+	0x01, 0x01, 0x01, 0x01, 0x01, 0x01, 0x01, 0x01, 0x01, 0x01, 0x01, 0x01, 0x01, 0x01, 0x01, 0x01
+};
+
+static const uint8_t poly1305_in_7[16] = {
+	0xfd, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff
+};
+
+static const struct poly1305_vector poly1305_vectors[] = {
+	{
+		"RFC 7539 2.5.2",
+		{
+			0x85, 0xd6, 0xbe, 0x78, 0x57, 0x55, 0x6d, 0x33, 0x7f, 0x44, 0x52, 0xfe, 0x42, 0xd5, 0x06, 0xa8,
+			0x01, 0x03, 0x80, 0x8a, 0xfb, 0x0d, 0xb2, 0xfd, 0x4a, 0xbf, 0xf6, 0xaf, 0x41, 0x49, 0xf5, 0x1b
+		},
+		(const uint8_t *)"Cryptographic Forum Research Group", 34,
+		{
+			0xa8, 0x06, 0x1d, 0xc1, 0x30, 0x51, 0x36, 0xc6, 0xc2, 0x2b, 0x8b, 0xaf, 0x0c, 0x01, 0x27, 0xa9
+		}
+	},
+	{
+		"RFC 7539 A.3 #1",
+		{
+			0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+			0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00
+		},
+		NULL, 64,
+		{
+			0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00
+		}
+	},
+	{
+		"RFC 7539 A.3 #5",
+		{
+			0x02, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+			0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00
+		},
+		poly1305_in_3, 16,
+		{
+			0x03, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00
+		}
+	},
+	{
+		"RFC 7539 A.3 #6",
+		{
+			0x02, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+			0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff
+		},
+		poly1305_in_4, 16,
+		{
+			0x03, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00
+		}
+	},
+	{
+		"RFC 7539 A.3 #7",
+		{
+			0x01, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+			0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00
+		},
+		poly1305_in_5, 48,
+		{
+			0x05, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00
+		}
+	},
+	{
+		"RFC 7539 A.3 #8",
+		{
+			0x01, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+			0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00
+		},
+		poly1305_in_6, 48,
+		{
+			0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00
+		}
+	},
+	{
+		"RFC 7539 A.3 #9",
+		{
+			0x02, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+			0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00
+		},
+		poly1305_in_7, 16,
+		{
+			0xfa, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff
+		}
+	},
+};
+
+static const uint8_t aead_a5_key[32] = {
+	0x1c, 0x92, 0x40, 0xa5, 0xeb, 0x55, 0xd3, 0x8a, 0xf3, 0x33, 0x88, 0x86, 0x04, 0xf6, 0xb5, 0xf0,
+	0x47, 0x39, 0x17, 0xc1, 0x40, 0x2b, 0x80, 0x09, 0x9d, 0xca, 0x5c, 0xbc, 0x20, 0x70, 0x75, 0xc0
+};
+
+static const uint8_t aead_a5_ad[12] = {
+	0xf3, 0x33, 0x88, 0x86, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x4e, 0x91
+};
+
+static const uint8_t aead_a5_out[281] = {
+	0x64, 0xa0, 0x86, 0x15, 0x75, 0x86, 0x1a, 0xf4, 0x60, 0xf0, 0x62, 0xc7, 0x9b, 0xe6, 0x43, 0xbd,
+	0x5e, 0x80, 0x5c, 0xfd, 0x34, 0x5c, 0xf3, 0x89, 0xf1, 0x08, 0x67, 0x0a, 0xc7, 0x6c, 0x8c, 0xb2,
+	0x4c, 0x6c, 0xfc, 0x18, 0x75, 0x5d, 0x43, 0xee, 0xa0, 0x9e, 0xe9, 0x4e, 0x38, 0x2d, 0x26, 0xb0,
+	0xbd, 0xb7, 0xb7, 0x3c, 0x32, 0x1b, 0x01, 0x00, 0xd4, 0xf0, 0x3b, 0x7f, 0x35, 0x58, 0x94, 0xcf,
+	0x33, 0x2f, 0x83, 0x0e, 0x71, 0x0b, 0x97, 0xce, 0x98, 0xc8, 0xa8, 0x4a, 0xbd, 0x0b, 0x94, 0x81,
+	0x14, 0xad, 0x17, 0x6e, 0x00, 0x8d, 0x33, 0xbd, 0x60, 0xf9, 0x82, 0xb1, 0xff, 0x37, 0xc8, 0x55,
+	0x97, 0x97, 0xa0, 0x6e, 0xf4, 0xf0, 0xef, 0x61, 0xc1, 0x86, 0x32, 0x4e, 0x2b, 0x35, 0x06, 0x38,
+	0x36, 0x06, 0x90, 0x7b, 0x6a, 0x7c, 0x02, 0xb0, 0xf9, 0xf6, 0x15, 0x7b, 0x53, 0xc8, 0x67, 0xe4,
+	0xb9, 0x16, 0x6c, 0x76, 0x7b, 0x80, 0x4d, 0x46, 0xa5, 0x9b, 0x52, 0x16, 0xcd, 0xe7, 0xa4, 0xe9,
+	0x90, 0x40, 0xc5, 0xa4, 0x04, 0x33, 0x22, 0x5e, 0xe2, 0x82, 0xa1, 0xb0, 0xa0, 0x6c, 0x52, 0x3e,
+	0xaf, 0x45, 0x34, 0xd7, 0xf8, 0x3f, 0xa1, 0x15, 0x5b, 0x00, 0x47, 0x71, 0x8c, 0xbc, 0x54, 0x6a,
+	0x0d, 0x07, 0x2b, 0x04, 0xb3, 0x56, 0x4e, 0xea, 0x1b, 0x42, 0x22, 0x73, 0xf5, 0x48, 0x27, 0x1a,
+	0x0b, 0xb2, 0x31, 0x60, 0x53, 0xfa, 0x76, 0x99, 0x19, 0x55, 0xeb, 0xd6, 0x31, 0x59, 0x43, 0x4e,
+	0xce, 0xbb, 0x4e, 0x46, 0x6d, 0xae, 0x5a, 0x10, 0x73, 0xa6, 0x72, 0x76, 0x27, 0x09, 0x7a, 0x10,
+	0x49, 0xe6, 0x17, 0xd9, 0x1d, 0x36, 0x10, 0x94, 0xfa, 0x68, 0xf0, 0xff, 0x77, 0x98, 0x71, 0x30,
+	0x30, 0x5b, 0xea, 0xba, 0x2e, 0xda, 0x04, 0xdf, 0x99, 0x7b, 0x71, 0x4d, 0x6c, 0x6f, 0x2c, 0x29,
+	0xa6, 0xad, 0x5c, 0xb4, 0x02, 0x2b, 0x02, 0x70, 0x9b, 0xee, 0xad, 0x9d, 0x67, 0x89, 0x0c, 0xbb,
+	0x22, 0x39, 0x23, 0x36, 0xfe, 0xa1, 0x85, 0x1f, 0x38
+};
+
+static const uint8_t xaead_key[32] = {
+	0x80, 0x81, 0x82, 0x83, 0x84, 0x85, 0x86, 0x87, 0x88, 0x89, 0x8a, 0x8b, 0x8c, 0x8d, 0x8e, 0x8f,
+	0x90, 0x91, 0x92, 0x93, 0x94, 0x95, 0x96, 0x97, 0x98, 0x99, 0x9a, 0x9b, 0x9c, 0x9d, 0x9e, 0x9f
+};
+
+static const uint8_t xaead_nonce[24] = {
+	0x40, 0x41, 0x42, 0x43, 0x44, 0x45, 0x46, 0x47, 0x48, 0x49, 0x4a, 0x4b, 0x4c, 0x4d, 0x4e, 0x4f,
+	0x50, 0x51, 0x52, 0x53, 0x54, 0x55, 0x56, 0x57
+};
+
+static const uint8_t xaead_ad[12] = {
+	0x50, 0x51, 0x52, 0x53, 0xc0, 0xc1, 0xc2, 0xc3, 0xc4, 0xc5, 0xc6, 0xc7
+};
+
+static const uint8_t xaead_out[130] = {
+	0xbd, 0x6d, 0x17, 0x9d, 0x3e, 0x83, 0xd4, 0x3b, 0x95, 0x76, 0x57, 0x94, 0x93, 0xc0, 0xe9, 0x39,
+	0x57, 0x2a, 0x17, 0x00, 0x25, 0x2b, 0xfa, 0xcc, 0xbe, 0xd2, 0x90, 0x2c, 0x21, 0x39, 0x6c, 0xbb,
+	0x73, 0x1c, 0x7f, 0x1b, 0x0b, 0x4a, 0xa6, 0x44, 0x0b, 0xf3, 0xa8, 0x2f, 0x4e, 0xda, 0x7e, 0x39,
+	0xae, 0x64, 0xc6, 0x70, 0x8c, 0x54, 0xc2, 0x16, 0xcb, 0x96, 0xb7, 0x2e, 0x12, 0x13, 0xb4, 0x52,
+	0x2f, 0x8c, 0x9b, 0xa4, 0x0d, 0xb5, 0xd9, 0x45, 0xb1, 0x1b, 0x69, 0xb9, 0x82, 0xc1, 0xbb, 0x9e,
+	0x3f, 0x3f, 0xac, 0x2b, 0xc3, 0x69, 0x48, 0x8f, 0x76, 0xb2, 0x38, 0x35, 0x65, 0xd3, 0xff, 0xf9,
+	0x21, 0xf9, 0x66, 0x4c, 0x97, 0x63, 0x7d, 0xa9, 0x76, 0x88, 0x12, 0xf6, 0x15, 0xc6, 0x8b, 0x13,
+	0xb5, 0x2e, 0xc0, 0x87, 0x59, 0x24, 0xc1, 0xc7, 0x98, 0x79, 0x47, 0xde, 0xaf, 0xd8, 0x78, 0x0a,
+	0xcf, 0x49
+};
+
+static const uint8_t hchacha20_nonce[16] = {
+	0x00, 0x00, 0x00, 0x09, 0x00, 0x00, 0x00, 0x4a, 0x00, 0x00, 0x00, 0x00, 0x31, 0x41, 0x59, 0x27
+};
+
+static const uint8_t hchacha20_out[32] = {
+	0x82, 0x41, 0x3b, 0x42, 0x27, 0xb2, 0x7b, 0xfe, 0xd3, 0x0e, 0x42, 0x50, 0x8a, 0x87, 0x7d, 0x73,
+	0xa0, 0xf9, 0xe4, 0xd5, 0x8a, 0x74, 0xa8, 0x53, 0xc1, 0x2e, 0xc4, 0x13, 0x26, 0xd3, 0xec, 0xdc
+};
+
+static const struct blake2s_vector blake2s_vectors[] = {
+	{ 0, {
+		0x48, 0xa8, 0x99, 0x7d, 0xa4, 0x07, 0x87, 0x6b, 0x3d, 0x79, 0xc0, 0xd9, 0x23, 0x25, 0xad, 0x3b,
+		0x89, 0xcb, 0xb7, 0x54, 0xd8, 0x6a, 0xb7, 0x1a, 0xee, 0x04, 0x7a, 0xd3, 0x45, 0xfd, 0x2c, 0x49
+	} },
+	{ 1, {
+		0x40, 0xd1, 0x5f, 0xee, 0x7c, 0x32, 0x88, 0x30, 0x16, 0x6a, 0xc3, 0xf9, 0x18, 0x65, 0x0f, 0x80,
+		0x7e, 0x7e, 0x01, 0xe1, 0x77, 0x25, 0x8c, 0xdc, 0x0a, 0x39, 0xb1, 0x1f, 0x59, 0x80, 0x66, 0xf1
+	} },
+	{ 2, {
+		0x6b, 0xb7, 0x13, 0x00, 0x64, 0x4c, 0xd3, 0x99, 0x1b, 0x26, 0xcc, 0xd4, 0xd2, 0x74, 0xac, 0xd1,
+		0xad, 0xea, 0xb8, 0xb1, 0xd7, 0x91, 0x45, 0x46, 0xc1, 0x19, 0x8b, 0xbe, 0x9f, 0xc9, 0xd8, 0x03
+	} },
+	{ 3, {
+		0x1d, 0x22, 0x0d, 0xbe, 0x2e, 0xe1, 0x34, 0x66, 0x1f, 0xdf, 0x6d, 0x9e, 0x74, 0xb4, 0x17, 0x04,
+		0x71, 0x05, 0x56, 0xf2, 0xf6, 0xe5, 0xa0, 0x91, 0xb2, 0x27, 0x69, 0x74, 0x45, 0xdb, 0xea, 0x6b
+	} },
+	{ 31, {
+		0xb6, 0x15, 0x6f, 0x72, 0xd3, 0x80, 0xee, 0x9e, 0xa6, 0xac, 0xd1, 0x90, 0x46, 0x4f, 0x23, 0x07,
+		0xa5, 0xc1, 0x79, 0xef, 0x01, 0xfd, 0x71, 0xf9, 0x9f, 0x2d, 0x0f, 0x7a, 0x57, 0x36, 0x0a, 0xea
+	} },
+	{ 32, {
+		0xc0, 0x3b, 0xc6, 0x42, 0xb2, 0x09, 0x59, 0xcb, 0xe1, 0x33, 0xa0, 0x30, 0x3e, 0x0c, 0x1a, 0xbf,
+		0xf3, 0xe3, 0x1e, 0xc8, 0xe1, 0xa3, 0x28, 0xec, 0x85, 0x65, 0xc3, 0x6d, 0xec, 0xff, 0x52, 0x65
+	} },
+	{ 63, {
+		0xc6, 0x53, 0x82, 0x51, 0x3f, 0x07, 0x46, 0x0d, 0xa3, 0x98, 0x33, 0xcb, 0x66, 0x6c, 0x5e, 0xd8,
+		0x2e, 0x61, 0xb9, 0xe9, 0x98, 0xf4, 0xb0, 0xc4, 0x28, 0x7c, 0xee, 0x56, 0xc3, 0xcc, 0x9b, 0xcd
+	} },
+	{ 64, {
+		0x89, 0x75, 0xb0, 0x57, 0x7f, 0xd3, 0x55, 0x66, 0xd7, 0x50, 0xb3, 0x62, 0xb0, 0x89, 0x7a, 0x26,
+		0xc3, 0x99, 0x13, 0x6d, 0xf0, 0x7b, 0xab, 0xab, 0xbd, 0xe6, 0x20, 0x3f, 0xf2, 0x95, 0x4e, 0xd4
+	} },
+	{ 65, {
+		0x21, 0xfe, 0x0c, 0xeb, 0x00, 0x52, 0xbe, 0x7f, 0xb0, 0xf0, 0x04, 0x18, 0x7c, 0xac, 0xd7, 0xde,
+		0x67, 0xfa, 0x6e, 0xb0, 0x93, 0x8d, 0x92, 0x76, 0x77, 0xf2, 0x39, 0x8c, 0x13, 0x23, 0x17, 0xa8
+	} },
+	{ 127, {
+		0xdd, 0xbf, 0xea, 0x75, 0xcc, 0x46, 0x78, 0x82, 0xeb, 0x34, 0x83, 0xce, 0x5e, 0x2e, 0x75, 0x6a,
+		0x4f, 0x47, 0x01, 0xb7, 0x6b, 0x44, 0x55, 0x19, 0xe8, 0x9f, 0x22, 0xd6, 0x0f, 0xa8, 0x6e, 0x06
+	} },
+	{ 128, {
+		0x0c, 0x31, 0x1f, 0x38, 0xc3, 0x5a, 0x4f, 0xb9, 0x0d, 0x65, 0x1c, 0x28, 0x9d, 0x48, 0x68, 0x56,
+		0xcd, 0x14, 0x13, 0xdf, 0x9b, 0x06, 0x77, 0xf5, 0x3e, 0xce, 0x2c, 0xd9, 0xe4, 0x77, 0xc6, 0x0a
+	} },
+	{ 255, {
+		0x3f, 0xb7, 0x35, 0x06, 0x1a, 0xbc, 0x51, 0x9d, 0xfe, 0x97, 0x9e, 0x54, 0xc1, 0xee, 0x5b, 0xfa,
+		0xd0, 0xa9, 0xd8, 0x58, 0xb3, 0x31, 0x5b, 0xad, 0x34, 0xbd, 0xe9, 0x99, 0xef, 0xd7, 0x24, 0xdd
+	} },
+};
+
+static const uint8_t blake2s_abc_32[32] = {
+	0x50, 0x8c, 0x5e, 0x8c, 0x32, 0x7c, 0x14, 0xe2, 0xe1, 0xa7, 0x2b, 0xa3, 0x4e, 0xeb, 0x45, 0x2f,
+	0x37, 0x45, 0x8b, 0x20, 0x9e, 0xd6, 0x3a, 0x29, 0x4d, 0x99, 0x9b, 0x4c, 0x86, 0x67, 0x59, 0x82
+};
+
+static const uint8_t blake2s_abc_16[16] = {
+	0xaa, 0x49, 0x38, 0x11, 0x9b, 0x1d, 0xc7, 0xb8, 0x7c, 0xba, 0xd0, 0xff, 0xd2, 0x00, 0xd0, 0xae
+};
+
+static const struct x25519_vector x25519_vectors[] = {
+	{
+		"RFC 7748 5.2 #1",
+		{
+			0xa5, 0x46, 0xe3, 0x6b, 0xf0, 0x52, 0x7c, 0x9d, 0x3b, 0x16, 0x15, 0x4b, 0x82, 0x46, 0x5e, 0xdd,
+			0x62, 0x14, 0x4c, 0x0a, 0xc1, 0xfc, 0x5a, 0x18, 0x50, 0x6a, 0x22, 0x44, 0xba, 0x44, 0x9a, 0xc4
+		},
+		{
+			0xe6, 0xdb, 0x68, 0x67, 0x58, 0x30, 0x30, 0xdb, 0x35, 0x94, 0xc1, 0xa4, 0x24, 0xb1, 0x5f, 0x7c,
+			0x72, 0x66, 0x24, 0xec, 0x26, 0xb3, 0x35, 0x3b, 0x10, 0xa9, 0x03, 0xa6, 0xd0, 0xab, 0x1c, 0x4c
+		},
+		{
+			0xc3, 0xda, 0x55, 0x37, 0x9d, 0xe9, 0xc6, 0x90, 0x8e, 0x94, 0xea, 0x4d, 0xf2, 0x8d, 0x08, 0x4f,
+			0x32, 0xec, 0xcf, 0x03, 0x49, 0x1c, 0x71, 0xf7, 0x54, 0xb4, 0x07, 0x55, 0x77, 0xa2, 0x85, 0x52
+		}
+	},
+	{
+		"RFC 7748 5.2 #2",
+		{
+			0x4b, 0x66, 0xe9, 0xd4, 0xd1, 0xb4, 0x67, 0x3c, 0x5a, 0xd2, 0x26, 0x91, 0x95, 0x7d, 0x6a, 0xf5,
+			0xc1, 0x1b, 0x64, 0x21, 0xe0, 0xea, 0x01, 0xd4, 0x2c, 0xa4, 0x16, 0x9e, 0x79, 0x18, 0xba, 0x0d
+		},
+		{
+			0xe5, 0x21, 0x0f, 0x12, 0x78, 0x68, 0x11, 0xd3, 0xf4, 0xb7, 0x95, 0x9d, 0x05, 0x38, 0xae, 0x2c,
+			0x31, 0xdb, 0xe7, 0x10, 0x6f, 0xc0, 0x3c, 0x3e, 0xfc, 0x4c, 0xd5, 0x49, 0xc7, 0x15, 0xa4, 0x93
+		},
+		{
+			0x95, 0xcb, 0xde, 0x94, 0x76, 0xe8, 0x90, 0x7d, 0x7a, 0xad, 0xe4, 0x5c, 0xb4, 0xb8, 0x73, 0xf8,
+			0x8b, 0x59, 0x5a, 0x68, 0x79, 0x9f, 0xa1, 0x52, 0xe6, 0xf8, 0xf7, 0x64, 0x7a, 0xac, 0x79, 0x57
+		}
+	},
+	{
+		"RFC 7748 6.1 Alice public",
+		{
+			0x77, 0x07, 0x6d, 0x0a, 0x73, 0x18, 0xa5, 0x7d, 0x3c, 0x16, 0xc1, 0x72, 0x51, 0xb2, 0x66, 0x45,
+			0xdf, 0x4c, 0x2f, 0x87, 0xeb, 0xc0, 0x99, 0x2a, 0xb1, 0x77, 0xfb, 0xa5, 0x1d, 0xb9, 0x2c, 0x2a
+		},
+		{
+			0x09, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+			0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00
+		},
+		{
+			0x85, 0x20, 0xf0, 0x09, 0x89, 0x30, 0xa7, 0x54, 0x74, 0x8b, 0x7d, 0xdc, 0xb4, 0x3e, 0xf7, 0x5a,
+			0x0d, 0xbf, 0x3a, 0x0d, 0x26, 0x38, 0x1a, 0xf4, 0xeb, 0xa4, 0xa9, 0x8e, 0xaa, 0x9b, 0x4e, 0x6a
+		}
+	},
+	{
+		"RFC 7748 6.1 Bob public",
+		{
+			0x5d, 0xab, 0x08, 0x7e, 0x62, 0x4a, 0x8a, 0x4b, 0x79, 0xe1, 0x7f, 0x8b, 0x83, 0x80, 0x0e, 0xe6,
+			0x6f, 0x3b, 0xb1, 0x29, 0x26, 0x18, 0xb6, 0xfd, 0x1c, 0x2f, 0x8b, 0x27, 0xff, 0x88, 0xe0, 0xeb
+		},
+		{
+			0x09, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+			0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00
+		},
+		{
+			0xde, 0x9e, 0xdb, 0x7d, 0x7b, 0x7d, 0xc1, 0xb4, 0xd3, 0x5b, 0x61, 0xc2, 0xec, 0xe4, 0x35, 0x37,
+			0x3f, 0x83, 0x43, 0xc8, 0x5b, 0x78, 0x67, 0x4d, 0xad, 0xfc, 0x7e, 0x14, 0x6f, 0x88, 0x2b, 0x4f
+		}
+	},
+	{
+		"RFC 7748 6.1 Alice shared",
+		{
+			0x77, 0x07, 0x6d, 0x0a, 0x73, 0x18, 0xa5, 0x7d, 0x3c, 0x16, 0xc1, 0x72, 0x51, 0xb2, 0x66, 0x45,
+			0xdf, 0x4c, 0x2f, 0x87, 0xeb, 0xc0, 0x99, 0x2a, 0xb1, 0x77, 0xfb, 0xa5, 0x1d, 0xb9, 0x2c, 0x2a
+		},
+		{
+			0xde, 0x9e, 0xdb, 0x7d, 0x7b, 0x7d, 0xc1, 0xb4, 0xd3, 0x5b, 0x61, 0xc2, 0xec, 0xe4, 0x35, 0x37,
+			0x3f, 0x83, 0x43, 0xc8, 0x5b, 0x78, 0x67, 0x4d, 0xad, 0xfc, 0x7e, 0x14, 0x6f, 0x88, 0x2b, 0x4f
+		},
+		{
+			0x4a, 0x5d, 0x9d, 0x5b, 0xa4, 0xce, 0x2d, 0xe1, 0x72, 0x8e, 0x3b, 0xf4, 0x80, 0x35, 0x0f, 0x25,
+			0xe0, 0x7e, 0x21, 0xc9, 0x47, 0xd1, 0x9e, 0x33, 0x76, 0xf0, 0x9b, 0x3c, 0x1e, 0x16, 0x17, 0x42
+		}
+	},
+	{
+		"RFC 7748 6.1 Bob shared",
+		{
+			0x5d, 0xab, 0x08, 0x7e, 0x62, 0x4a, 0x8a, 0x4b, 0x79, 0xe1, 0x7f, 0x8b, 0x83, 0x80, 0x0e, 0xe6,
+			0x6f, 0x3b, 0xb1, 0x29, 0x26, 0x18, 0xb6, 0xfd, 0x1c, 0x2f, 0x8b, 0x27, 0xff, 0x88, 0xe0, 0xeb
+		},
+		{
+			0x85, 0x20, 0xf0, 0x09, 0x89, 0x30, 0xa7, 0x54, 0x74, 0x8b, 0x7d, 0xdc, 0xb4, 0x3e, 0xf7, 0x5a,
+			0x0d, 0xbf, 0x3a, 0x0d, 0x26, 0x38, 0x1a, 0xf4, 0xeb, 0xa4, 0xa9, 0x8e, 0xaa, 0x9b, 0x4e, 0x6a
+		},
+		{
+			0x4a, 0x5d, 0x9d, 0x5b, 0xa4, 0xce, 0x2d, 0xe1, 0x72, 0x8e, 0x3b, 0xf4, 0x80, 0x35, 0x0f, 0x25,
+			0xe0, 0x7e, 0x21, 0xc9, 0x47, 0xd1, 0x9e, 0x33, 0x76, 0xf0, 0x9b, 0x3c, 0x1e, 0x16, 0x17, 0x42
+		}
+	},
+};
+
+static const struct x25519_iterated x25519_iterated[] = {
+	{ 1, {
+		0x42, 0x2c, 0x8e, 0x7a, 0x62, 0x27, 0xd7, 0xbc, 0xa1, 0x35, 0x0b, 0x3e, 0x2b, 0xb7, 0x27, 0x9f,
+		0x78, 0x97, 0xb8, 0x7b, 0xb6, 0x85, 0x4b, 0x78, 0x3c, 0x60, 0xe8, 0x03, 0x11, 0xae, 0x30, 0x79
+	} },
+	{ 1000, {
+		0x68, 0x4c, 0xf5, 0x9b, 0xa8, 0x33, 0x09, 0x55, 0x28, 0x00, 0xef, 0x56, 0x6f, 0x2f, 0x4d, 0x3c,
+		0x1c, 0x38, 0x87, 0xc4, 0x93, 0x60, 0xe3, 0x87, 0x5f, 0x2e, 0xb9, 0x4d, 0x99, 0x53, 0x2c, 0x51
+	} },
+	{ 1000000, {
+		0x7c, 0x39, 0x11, 0xe0, 0xab, 0x25, 0x86, 0xfd, 0x86, 0x44, 0x97, 0x29, 0x7e, 0x57, 0x5e, 0x6f,
+		0x3b, 0xc6, 0x01, 0xc0, 0x88, 0x3c, 0x30, 0xdf, 0x5f, 0x4d, 0xd2, 0xd2, 0x4f, 0x66, 0x54, 0x24
+	} },
+};
+
+static const char *primitive_names[WIREGUARD_SELFTEST_PRIMITIVES] = {
+	"chacha20", "hchacha20", "poly1305", "chacha20poly1305", "xchacha20poly1305", "blake2s", "x25519"
+};
+
+static const size_t bench_sizes[] = { 16, 64, 256, 1024, WIREGUARD_SELFTEST_MAX_SIZE };
+
+static const uint8_t zeros[64] = { 0 };
+
+// Shared by the tests and the benchmark, too big for the stack of a small device
+static uint8_t work[WIREGUARD_SELFTEST_MAX_SIZE + 32];
+
+const char *wireguard_selftest_name(uint8_t primitive) {
+	const char *result = "unknown";
+	if (primitive < WIREGUARD_SELFTEST_PRIMITIVES) {
+		result = primitive_names[primitive];
+	}
+	return result;
+}
+
+static int check(bool ok, uint8_t primitive, const char *name, wireguard_selftest_print_fn print, void *arg) {
+	char line[80];
+	if (print) {
+		snprintf(line, sizeof(line), "%s %s: %s", primitive_names[primitive], name, ok ? "ok" : "FAILED");
+		print(arg, line);
+	}
+	return ok ? 0 : 1;
+}
+
+static int test_chacha20(wireguard_selftest_print_fn print, void *arg) {
+	struct chacha20_ctx ctx;
+	const struct chacha20_vector *v;
+	int failed = 0;
+	size_t x;
+	for (x=0; x < sizeof(chacha20_vectors) / sizeof(chacha20_vectors[0]); x++) {
+		v = &chacha20_vectors[x];
+		chacha20_init(&ctx, v->key, v->nonce);
+		ctx.state[12] = v->counter;
+		chacha20(&ctx, work, v->input ? v->input : zeros, (uint32_t)v->len);
+		failed += check(memcmp(work, v->output, v->len) == 0, WIREGUARD_SELFTEST_CHACHA20, v->name, print, arg);
+	}
+	return failed;
+}
+
+static int test_hchacha20(wireguard_selftest_print_fn print, void *arg) {
+	uint8_t key[CHACHA20_KEY_SIZE];
+	size_t x;
+	for (x=0; x < sizeof(key); x++) {
+		key[x] = (uint8_t)x;
+	}
+	hchacha20(work, hchacha20_nonce, key);
+	return check(memcmp(work, hchacha20_out, sizeof(hchacha20_out)) == 0, WIREGUARD_SELFTEST_HCHACHA20, "xchacha draft 2.2.1", print, arg);
+}
+
+static int test_poly1305(wireguard_selftest_print_fn print, void *arg) {
+	poly1305_context ctx;
+	const struct poly1305_vector *v;
+	int failed = 0;
+	size_t x;
+	for (x=0; x < sizeof(poly1305_vectors) / sizeof(poly1305_vectors[0]); x++) {
+		v = &poly1305_vectors[x];
+		poly1305_init(&ctx, v->key);
+		poly1305_update(&ctx, v->input ? v->input : zeros, v->len);
+		poly1305_finish(&ctx, work);
+		failed += check(memcmp(work, v->tag, sizeof(v->tag)) == 0, WIREGUARD_SELFTEST_POLY1305, v->name, print, arg);
+	}
+	return failed;
+}
+
+static int test_aead(const struct wireguard_crypto_backend *b, wireguard_selftest_print_fn print, void *arg) {
+	const size_t len = sizeof(internet_drafts) - 1;
+	// RFC 7539 A.5 nonce 00 00 00 00 01 02 03 04 05 06 07 08
+	const uint64_t nonce = 0x0807060504030201ULL;
+	int failed = 0;
+	bool ok;
+
+	b->aead_encrypt(work, internet_drafts, len, aead_a5_ad, sizeof(aead_a5_ad), nonce, aead_a5_key);
+	failed += check(memcmp(work, aead_a5_out, sizeof(aead_a5_out)) == 0, WIREGUARD_SELFTEST_AEAD, "RFC 7539 A.5 encrypt", print, arg);
+
+	ok = b->aead_decrypt(work, aead_a5_out, sizeof(aead_a5_out), aead_a5_ad, sizeof(aead_a5_ad), nonce, aead_a5_key);
+	failed += check(ok && memcmp(work, internet_drafts, len) == 0, WIREGUARD_SELFTEST_AEAD, "RFC 7539 A.5 decrypt", print, arg);
+
+	// Any flipped bit of the ciphertext or the tag has to be rejected
+	memcpy(work, aead_a5_out, sizeof(aead_a5_out));
+	work[sizeof(aead_a5_out) - 1] ^= 0x01;
+	ok = b->aead_decrypt(work, work, sizeof(aead_a5_out), aead_a5_ad, sizeof(aead_a5_ad), nonce, aead_a5_key);
+	failed += check(!ok, WIREGUARD_SELFTEST_AEAD, "RFC 7539 A.5 bad tag", print, arg);
+	memcpy(work, aead_a5_out, sizeof(aead_a5_out));
+	work[0] ^= 0x80;
+	ok = b->aead_decrypt(work, work, sizeof(aead_a5_out), aead_a5_ad, sizeof(aead_a5_ad), nonce, aead_a5_key);
+	failed += check(!ok, WIREGUARD_SELFTEST_AEAD, "RFC 7539 A.5 bad ciphertext", print, arg);
+	return failed;
+}
+
+static int test_xaead(const struct wireguard_crypto_backend *b, wireguard_selftest_print_fn print, void *arg) {
+	const size_t len = sizeof(sunscreen) - 1;
+	int failed = 0;
+	bool ok;
+
+	b->xaead_encrypt(work, sunscreen, len, xaead_ad, sizeof(xaead_ad), xaead_nonce, xaead_key);
+	failed += check(memcmp(work, xaead_out, sizeof(xaead_out)) == 0, WIREGUARD_SELFTEST_XAEAD, "xchacha draft A.3.1 encrypt", print, arg);
+
+	ok = b->xaead_decrypt(work, xaead_out, sizeof(xaead_out), xaead_ad, sizeof(xaead_ad), xaead_nonce, xaead_key);
+	failed += check(ok && memcmp(work, sunscreen, len) == 0, WIREGUARD_SELFTEST_XAEAD, "xchacha draft A.3.1 decrypt", print, arg);
+
+	memcpy(work, xaead_out, sizeof(xaead_out));
+	work[sizeof(xaead_out) - 1] ^= 0x01;
+	ok = b->xaead_decrypt(work, work, sizeof(xaead_out), xaead_ad, sizeof(xaead_ad), xaead_nonce, xaead_key);
+	failed += check(!ok, WIREGUARD_SELFTEST_XAEAD, "xchacha draft A.3.1 bad tag", print, arg);
+	return failed;
+}
+
+static int test_blake2s(const struct wireguard_crypto_backend *b, wireguard_selftest_print_fn print, void *arg) {
+	static const size_t chunks[] = { 1, 7, 63, 64, 65 };
+	const struct blake2s_vector *v;
+	blake2s_ctx ctx;
+	uint8_t key[32];
+	uint8_t hash[32];
+	char name[40];
+	int failed = 0;
+	size_t x, offset, n;
+
+	for (x=0; x < sizeof(key); x++) {
+		key[x] = (uint8_t)x;
+	}
+	for (x=0; x < 255; x++) {
+		work[x] = (uint8_t)x;
+	}
+	for (x=0; x < sizeof(blake2s_vectors) / sizeof(blake2s_vectors[0]); x++) {
+		v = &blake2s_vectors[x];
+		b->blake2s(hash, sizeof(hash), key, sizeof(key), work, v->len);
+		snprintf(name, sizeof(name), "keyed KAT %u bytes", (unsigned)v->len);
+		failed += check(memcmp(hash, v->hash, sizeof(hash)) == 0, WIREGUARD_SELFTEST_BLAKE2S, name, print, arg);
+	}
+
+	// The last (255 byte) vector again, fed in pieces that straddle the 64 byte blocks
+	v = &blake2s_vectors[sizeof(blake2s_vectors) / sizeof(blake2s_vectors[0]) - 1];
+	for (x=0; x < sizeof(chunks) / sizeof(chunks[0]); x++) {
+		b->blake2s_init(&ctx, sizeof(hash), key, sizeof(key));
+		for (offset = 0; offset < v->len; offset += n) {
+			n = (v->len - offset < chunks[x]) ? (v->len - offset) : chunks[x];
+			b->blake2s_update(&ctx, &work[offset], n);
+		}
+		b->blake2s_final(&ctx, hash);
+		snprintf(name, sizeof(name), "keyed KAT 255 bytes in %u byte updates", (unsigned)chunks[x]);
+		failed += check(memcmp(hash, v->hash, sizeof(hash)) == 0, WIREGUARD_SELFTEST_BLAKE2S, name, print, arg);
+	}
+
+	b->blake2s(hash, 32, NULL, 0, "abc", 3);
+	failed += check(memcmp(hash, blake2s_abc_32, 32) == 0, WIREGUARD_SELFTEST_BLAKE2S, "RFC 7693 B abc", print, arg);
+	// WireGuard's MACs are 16 byte BLAKE2s, a different parameter block than a truncated hash
+	b->blake2s(hash, 16, NULL, 0, "abc", 3);
+	failed += check(memcmp(hash, blake2s_abc_16, 16) == 0, WIREGUARD_SELFTEST_BLAKE2S, "abc, 16 byte digest", print, arg);
+	return failed;
+}
+
+static int test_x25519(const struct wireguard_crypto_backend *b, uint32_t iterations, wireguard_selftest_print_fn print, void *arg) {
+	const struct x25519_vector *v;
+	uint8_t k[32];
+	uint8_t u[32];
+	uint8_t out[32];
+	char name[48];
+	int failed = 0;
+	uint32_t done = 0;
+	size_t x;
+
+	for (x=0; x < sizeof(x25519_vectors) / sizeof(x25519_vectors[0]); x++) {
+		v = &x25519_vectors[x];
+		b->x25519(out, v->scalar, v->point);
+		failed += check(memcmp(out, v->out, sizeof(out)) == 0, WIREGUARD_SELFTEST_X25519, v->name, print, arg);
+	}
+
+	// RFC 7748 5.2: k = u = 9, then k, u = X25519(k, u), k
+	memset(k, 0, sizeof(k));
+	k[0] = 9;
+	memcpy(u, k, sizeof(u));
+	for (x=0; x < sizeof(x25519_iterated) / sizeof(x25519_iterated[0]) && x25519_iterated[x].iterations <= iterations; x++) {
+		while (done < x25519_iterated[x].iterations) {
+			b->x25519(out, k, u);
+			memcpy(u, k, sizeof(u));
+			memcpy(k, out, sizeof(k));
+			done++;
+		}
+		snprintf(name, sizeof(name), "RFC 7748 5.2 after %u iterations", (unsigned)done);
+		failed += check(memcmp(k, x25519_iterated[x].out, sizeof(k)) == 0, WIREGUARD_SELFTEST_X25519, name, print, arg);
+	}
+	return failed;
+}
+
+int wireguard_selftest_run(uint8_t primitive, uint32_t x25519_iterations, wireguard_selftest_print_fn print, void *arg) {
+	int failed = 1;
+	switch (primitive) {
+		case WIREGUARD_SELFTEST_CHACHA20:
+			failed = test_chacha20(print, arg);
+			break;
+		case WIREGUARD_SELFTEST_HCHACHA20:
+			failed = test_hchacha20(print, arg);
+			break;
+		case WIREGUARD_SELFTEST_POLY1305:
+			failed = test_poly1305(print, arg);
+			break;
+		case WIREGUARD_SELFTEST_AEAD:
+			failed = test_aead(&wireguard_crypto, print, arg);
+			break;
+		case WIREGUARD_SELFTEST_XAEAD:
+			failed = test_xaead(&wireguard_crypto, print, arg);
+			break;
+		case WIREGUARD_SELFTEST_BLAKE2S:
+			failed = test_blake2s(&wireguard_crypto, print, arg);
+			break;
+		case WIREGUARD_SELFTEST_X25519:
+			failed = test_x25519(&wireguard_crypto, x25519_iterations, print, arg);
+			break;
+		default:
+			break;
+	}
+	crypto_zero(work, sizeof(work));
+	return failed;
+}
+
+bool wireguard_selftest(uint32_t x25519_iterations, wireguard_selftest_print_fn print, void *arg) {
+	int failed = 0;
+	uint8_t x;
+	for (x=0; x < WIREGUARD_SELFTEST_PRIMITIVES; x++) {
+		failed += wireguard_selftest_run(x, x25519_iterations, print, arg);
+	}
+	return (failed == 0);
+}
+
+int wireguard_selftest_group(const struct wireguard_crypto_backend *backend, uint8_t group, uint32_t x25519_iterations, wireguard_selftest_print_fn print, void *arg) {
+	int failed = 1;
+	if (wireguard_crypto_provides(backend, group)) {
+		switch (group) {
+			case WIREGUARD_CRYPTO_BLAKE2S:
+				failed = test_blake2s(backend, print, arg);
+				break;
+			case WIREGUARD_CRYPTO_X25519:
+				failed = test_x25519(backend, x25519_iterations, print, arg);
+				break;
+			case WIREGUARD_CRYPTO_AEAD:
+				failed = test_aead(backend, print, arg) + test_xaead(backend, print, arg);
+				break;
+			default:
+				break;
+		}
+		crypto_zero(work, sizeof(work));
+	}
+	return failed;
+}
+
+// Inputs for the comparison with the reference - xorshift32, the same on every run
+static void fill(uint32_t *state, uint8_t *dst, size_t len) {
+	uint32_t x = *state;
+	while (len--) {
+		x ^= x << 13;
+		x ^= x >> 17;
+		x ^= x << 5;
+		*dst++ = (uint8_t)x;
+	}
+	*state = x;
+}
+
+// work is split in the input and the outputs of the reference and of the backend
+#define COMPARE_MAX_LEN		(400)
+#define COMPARE_IN			(&work[0])
+#define COMPARE_REF			(&work[COMPARE_MAX_LEN])
+#define COMPARE_OUT			(&work[2 * COMPARE_MAX_LEN + 16])
+
+static bool compare_round(const struct wireguard_crypto_backend *b, uint8_t group, uint32_t round) {
+	const struct wireguard_crypto_backend *ref = &wireguard_crypto_refc;
+	uint32_t state = 0x9e3779b9 ^ (round * 0x85ebca6b) ^ ((uint32_t)group << 24);
+	blake2s_ctx ctx;
+	uint8_t key[32];
+	uint8_t nonce[24];
+	uint8_t ad[32];
+	size_t len = (round == 0) ? 0 : ((round * 97) % (COMPARE_MAX_LEN + 1));
+	size_t ad_len = round % (sizeof(ad) + 1);
+	size_t split = len / 3;
+	bool ok = true;
+	int r1, r2;
+
+	fill(&state, key, sizeof(key));
+	fill(&state, nonce, sizeof(nonce));
+	fill(&state, ad, sizeof(ad));
+	fill(&state, COMPARE_IN, len);
+	switch (group) {
+		case WIREGUARD_CRYPTO_BLAKE2S:
+			// Every digest and key length, one-shot and streamed
+			len = (round * 11) % (COMPARE_MAX_LEN + 1);
+			r1 = ref->blake2s(COMPARE_REF, (round % 32) + 1, key, round % 33, COMPARE_IN, len);
+			r2 = b->blake2s(COMPARE_OUT, (round % 32) + 1, key, round % 33, COMPARE_IN, len);
+			ok = (r1 == r2) && (memcmp(COMPARE_REF, COMPARE_OUT, (round % 32) + 1) == 0);
+			b->blake2s_init(&ctx, 32, key, round % 33);
+			b->blake2s_update(&ctx, COMPARE_IN, split);
+			b->blake2s_update(&ctx, &COMPARE_IN[split], len - split);
+			b->blake2s_final(&ctx, COMPARE_OUT);
+			ref->blake2s(COMPARE_REF, 32, key, round % 33, COMPARE_IN, len);
+			ok = ok && (memcmp(COMPARE_REF, COMPARE_OUT, 32) == 0);
+			break;
+		case WIREGUARD_CRYPTO_X25519:
+			// Random points, the top bit included, which both have to ignore
+			fill(&state, COMPARE_IN, 32);
+			r1 = ref->x25519(COMPARE_REF, key, COMPARE_IN);
+			r2 = b->x25519(COMPARE_OUT, key, COMPARE_IN);
+			ok = ((r1 == 0) == (r2 == 0)) && (memcmp(COMPARE_REF, COMPARE_OUT, 32) == 0);
+			break;
+		case WIREGUARD_CRYPTO_AEAD:
+			ref->aead_encrypt(COMPARE_REF, COMPARE_IN, len, ad, ad_len, ((uint64_t)round << 32) | state, key);
+			b->aead_encrypt(COMPARE_OUT, COMPARE_IN, len, ad, ad_len, ((uint64_t)round << 32) | state, key);
+			ok = (memcmp(COMPARE_REF, COMPARE_OUT, len + 16) == 0);
+			ok = ok && b->aead_decrypt(COMPARE_OUT, COMPARE_REF, len + 16, ad, ad_len, ((uint64_t)round << 32) | state, key);
+			ok = ok && (memcmp(COMPARE_OUT, COMPARE_IN, len) == 0);
+			COMPARE_REF[round % (len + 16)] ^= (uint8_t)(1 << (round % 8));
+			ok = ok && !b->aead_decrypt(COMPARE_OUT, COMPARE_REF, len + 16, ad, ad_len, ((uint64_t)round << 32) | state, key);
+
+			ref->xaead_encrypt(COMPARE_REF, COMPARE_IN, len, ad, ad_len, nonce, key);
+			b->xaead_encrypt(COMPARE_OUT, COMPARE_IN, len, ad, ad_len, nonce, key);
+			ok = ok && (memcmp(COMPARE_REF, COMPARE_OUT, len + 16) == 0);
+			ok = ok && b->xaead_decrypt(COMPARE_OUT, COMPARE_REF, len + 16, ad, ad_len, nonce, key);
+			ok = ok && (memcmp(COMPARE_OUT, COMPARE_IN, len) == 0);
+			COMPARE_REF[(round * 7) % (len + 16)] ^= 0x80;
+			ok = ok && !b->xaead_decrypt(COMPARE_OUT, COMPARE_REF, len + 16, ad, ad_len, nonce, key);
+			break;
+		default:
+			ok = false;
+			break;
+	}
+	crypto_zero(key, sizeof(key));
+	return ok;
+}
+
+int wireguard_selftest_compare(const struct wireguard_crypto_backend *backend, uint8_t group, uint32_t rounds, wireguard_selftest_print_fn print, void *arg) {
+	static const uint8_t group_primitives[WIREGUARD_CRYPTO_GROUPS] = { WIREGUARD_SELFTEST_BLAKE2S, WIREGUARD_SELFTEST_X25519, WIREGUARD_SELFTEST_AEAD };
+	char name[48];
+	int failed = 1;
+	uint32_t x;
+	if (wireguard_crypto_provides(backend, group)) {
+		failed = 0;
+		for (x=0; x < rounds; x++) {
+			if (!compare_round(backend, group, x)) {
+				snprintf(name, sizeof(name), "%s against refc, round %u", backend->name, (unsigned)x);
+				failed += check(false, group_primitives[group], name, print, arg);
+			}
+		}
+		if (failed == 0) {
+			snprintf(name, sizeof(name), "%s against refc, %u rounds", backend->name, (unsigned)rounds);
+			check(true, group_primitives[group], name, print, arg);
+		}
+		crypto_zero(work, sizeof(work));
+	}
+	return failed;
+}
+
+// One operation of primitive on size bytes of work, through backend b
+static void bench_op(const struct wireguard_crypto_backend *b, uint8_t primitive, size_t size) {
+	struct chacha20_ctx ctx;
+	poly1305_context poly;
+	uint8_t key[32];
+	uint8_t nonce[24];
+
+	memset(key, 0x42, sizeof(key));
+	memset(nonce, 0x24, sizeof(nonce));
+	switch (primitive) {
+		case WIREGUARD_SELFTEST_CHACHA20:
+			chacha20_init(&ctx, key, 1);
+			chacha20(&ctx, work, work, (uint32_t)size);
+			break;
+		case WIREGUARD_SELFTEST_HCHACHA20:
+			hchacha20(work, nonce, key);
+			break;
+		case WIREGUARD_SELFTEST_POLY1305:
+			poly1305_init(&poly, key);
+			poly1305_update(&poly, work, size);
+			poly1305_finish(&poly, &work[size]);
+			break;
+		case WIREGUARD_SELFTEST_AEAD:
+			b->aead_encrypt(work, work, size, NULL, 0, 1, key);
+			break;
+		case WIREGUARD_SELFTEST_XAEAD:
+			b->xaead_encrypt(work, work, size, NULL, 0, nonce, key);
+			break;
+		case WIREGUARD_SELFTEST_BLAKE2S:
+			b->blake2s(&work[size], 32, NULL, 0, work, size);
+			break;
+		case WIREGUARD_SELFTEST_X25519:
+			b->x25519(work, key, &work[32]);
+			break;
+		default:
+			break;
+	}
+}
+
+// Repeats one operation for budget ticks (at least once), returns the ticks taken
+static uint32_t time_op(const struct wireguard_crypto_backend *b, uint8_t primitive, size_t size, uint32_t budget, uint32_t *ops) {
+	uint32_t start = wireguard_cycle_count();
+	uint32_t ticks;
+	*ops = 0;
+	do {
+		bench_op(b, primitive, size);
+		(*ops)++;
+		ticks = wireguard_cycle_count() - start;
+	} while (ticks < budget);
+	return ticks;
+}
+
+static uint32_t budget_ticks(uint32_t budget_ms) {
+	if (budget_ms > 1000) {
+		budget_ms = 1000;
+	}
+	return (uint32_t)(((uint64_t)wireguard_cycle_frequency() * budget_ms) / 1000);
+}
+
+// Which group a primitive is called through, WIREGUARD_CRYPTO_GROUPS for the building blocks
+static uint8_t primitive_group(uint8_t primitive) {
+	uint8_t result = WIREGUARD_CRYPTO_GROUPS;
+	switch (primitive) {
+		case WIREGUARD_SELFTEST_AEAD:
+		case WIREGUARD_SELFTEST_XAEAD:
+			result = WIREGUARD_CRYPTO_AEAD;
+			break;
+		case WIREGUARD_SELFTEST_BLAKE2S:
+			result = WIREGUARD_CRYPTO_BLAKE2S;
+			break;
+		case WIREGUARD_SELFTEST_X25519:
+			result = WIREGUARD_CRYPTO_X25519;
+			break;
+		default:
+			break;
+	}
+	return result;
+}
+
+uint32_t wireguard_selftest_time(const struct wireguard_crypto_backend *backend, uint8_t group, uint32_t budget_ms) {
+	uint32_t ops, ticks;
+	uint32_t result = UINT32_MAX;
+	if (wireguard_crypto_provides(backend, group)) {
+		memset(work, 0x5a, sizeof(work));
+		switch (group) {
+			case WIREGUARD_CRYPTO_BLAKE2S:
+				// Handshake hashing is short inputs
+				ticks = time_op(backend, WIREGUARD_SELFTEST_BLAKE2S, 64, budget_ticks(budget_ms), &ops);
+				break;
+			case WIREGUARD_CRYPTO_X25519:
+				ticks = time_op(backend, WIREGUARD_SELFTEST_X25519, 32, budget_ticks(budget_ms), &ops);
+				break;
+			default:
+				// Full-size transport packets
+				ticks = time_op(backend, WIREGUARD_SELFTEST_AEAD, WIREGUARD_SELFTEST_MAX_SIZE, budget_ticks(budget_ms), &ops);
+				break;
+		}
+		result = ticks / ops;
+		crypto_zero(work, sizeof(work));
+	}
+	return result;
+}
+
+void wireguard_selftest_bench(const struct wireguard_crypto_backend *backend, uint32_t budget_ms, wireguard_selftest_bench_fn report, void *arg) {
+	uint32_t budget = budget_ticks(budget_ms);
+	uint32_t ticks;
+	uint32_t ops;
+	uint8_t primitive, group;
+	size_t x, count, size;
+	bool run;
+
+	if (backend == NULL) {
+		backend = &wireguard_crypto;
+	}
+	memset(work, 0x5a, sizeof(work));
+	for (primitive = 0; primitive < WIREGUARD_SELFTEST_PRIMITIVES; primitive++) {
+		group = primitive_group(primitive);
+		// ChaCha20, HChaCha20 and Poly1305 are the reference building blocks, timed with refc or the table in use
+		if (group < WIREGUARD_CRYPTO_GROUPS) {
+			run = wireguard_crypto_provides(backend, group);
+		} else {
+			run = (backend == &wireguard_crypto_refc) || (backend == &wireguard_crypto);
+		}
+		if (run) {
+			// HChaCha20 and X25519 work on 32 bytes whatever the packet size
+			count = ((primitive == WIREGUARD_SELFTEST_HCHACHA20) || (primitive == WIREGUARD_SELFTEST_X25519)) ? 1 : sizeof(bench_sizes) / sizeof(bench_sizes[0]);
+			for (x=0; x < count; x++) {
+				size = (count == 1) ? 32 : bench_sizes[x];
+				ticks = time_op(backend, primitive, size, budget, &ops);
+				if (report) {
+					report(arg, primitive, size, ops, ticks);
+				}
+			}
+		}
+	}
+	crypto_zero(work, sizeof(work));
+}
@@ -0,0 +1,79 @@
+/*
+ * Known-answer tests and microbenchmarks of the crypto primitives.
+ * SPDX-License-Identifier: BSD-3-Clause
+ *
+ * The vectors come from RFC 7539 (ChaCha20, Poly1305, AEAD_CHACHA20_POLY1305 - only the ones
+ * whose nonce starts with 32 zero bits, which is all the WireGuard variant can express),
+ * RFC 7693 and the reference BLAKE2s KAT file (keyed, input 00 01 02 ...), RFC 7748 (X25519,
+ * including the iterated test) and draft-irtf-cfrg-xchacha (HChaCha20, XChaCha20-Poly1305).
+ * The same code runs on the host (extras/host/crypto-test.c, registered with ctest) and on the
+ * device (examples/crypto_selftest), so a change to a primitive is checked and timed in both places.
+ *
+ * The vectors of the backend groups (crypto.h) can be run against any registered backend, which
+ * can also be compared with the reference implementation - wireguard_crypto_select() uses both.
+ */
+
+#ifndef _WIREGUARD_SELFTEST_H_
+#define _WIREGUARD_SELFTEST_H_
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+#include "crypto.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+enum wireguard_selftest_primitive {
+	WIREGUARD_SELFTEST_CHACHA20 = 0,
+	WIREGUARD_SELFTEST_HCHACHA20,
+	WIREGUARD_SELFTEST_POLY1305,
+	WIREGUARD_SELFTEST_AEAD,
+	WIREGUARD_SELFTEST_XAEAD,
+	WIREGUARD_SELFTEST_BLAKE2S,
+	WIREGUARD_SELFTEST_X25519,
+	WIREGUARD_SELFTEST_PRIMITIVES
+};
+
+// Largest input the benchmark uses - a full WireGuard transport payload
+#define WIREGUARD_SELFTEST_MAX_SIZE		(1420)
+
+// One line of output without the line end
+typedef void (*wireguard_selftest_print_fn)(void *arg, const char *line);
+
+// ticks are wireguard_cycle_count() ticks for ops operations on size bytes each
+typedef void (*wireguard_selftest_bench_fn)(void *arg, uint8_t primitive, size_t size, uint32_t ops, uint32_t ticks);
+
+const char *wireguard_selftest_name(uint8_t primitive);
+
+// Known-answer tests of one primitive through the table in use (wireguard_crypto), returns the number of vectors that failed. print may be NULL.
+// The RFC 7748 iterated X25519 test is checked after 1, 1000 and 1000000 iterations, as far as
+// x25519_iterations goes - every iteration is one x25519(), so keep it low on the device.
+int wireguard_selftest_run(uint8_t primitive, uint32_t x25519_iterations, wireguard_selftest_print_fn print, void *arg);
+
+// Every primitive, true when all vectors passed
+bool wireguard_selftest(uint32_t x25519_iterations, wireguard_selftest_print_fn print, void *arg);
+
+// Known-answer tests of one group of backend (WIREGUARD_CRYPTO_*), the number of vectors that failed
+int wireguard_selftest_group(const struct wireguard_crypto_backend *backend, uint8_t group, uint32_t x25519_iterations, wireguard_selftest_print_fn print, void *arg);
+
+// Runs group of backend and of the reference on rounds of generated inputs (different lengths, keys,
+// AD and tampered ciphertexts) and returns the number of rounds where they disagreed
+int wireguard_selftest_compare(const struct wireguard_crypto_backend *backend, uint8_t group, uint32_t rounds, wireguard_selftest_print_fn print, void *arg);
+
+// wireguard_cycle_count() ticks per operation of group - BLAKE2s of 64 bytes, one X25519, AEAD of a
+// full-size packet - timed for about budget_ms. UINT32_MAX when backend does not provide group.
+uint32_t wireguard_selftest_time(const struct wireguard_crypto_backend *backend, uint8_t group, uint32_t budget_ms);
+
+// Times each primitive at each input size (16 bytes up to WIREGUARD_SELFTEST_MAX_SIZE; one size for
+// HChaCha20 and X25519) for about budget_ms, at most 1000 so that the 32-bit tick counter cannot wrap.
+// backend NULL times the table in use; any other backend only its own groups.
+void wireguard_selftest_bench(const struct wireguard_crypto_backend *backend, uint32_t budget_ms, wireguard_selftest_bench_fn report, void *arg);
+
+#ifdef __cplusplus
+} /* extern "C" */
+#endif
+
+#endif /* _WIREGUARD_SELFTEST_H_ */
@@ -0,0 +1,109 @@
+/*
+ * Tunnel statistics for the WireGuard lwIP port.
+ * SPDX-License-Identifier: BSD-3-Clause
+ */
+
+#include "wireguard-stats.h"
+
+static void drops_accumulate(struct wireguard_drop_stats *dst, const struct wireguard_drop_stats *src) {
+	dst->bad_mac1 += src->bad_mac1;
+	dst->replay += src->replay;
+	dst->auth_failure += src->auth_failure;
+	dst->no_keypair += src->no_keypair;
+	dst->no_memory += src->no_memory;
+	dst->allowed_ip += src->allowed_ip;
+	dst->key_expired += src->key_expired;
+	dst->malformed += src->malformed;
+	dst->rate_limited += src->rate_limited;
+}
+
+void wireguard_stats_accumulate(struct wireguard_peer_stats *dst, const struct wireguard_peer_stats *src) {
+	dst->rx_packets += src->rx_packets;
+	dst->tx_packets += src->tx_packets;
+	dst->rx_bytes += src->rx_bytes;
+	dst->tx_bytes += src->tx_bytes;
+	dst->keepalives_rx += src->keepalives_rx;
+	dst->keepalives_tx += src->keepalives_tx;
+	dst->handshake_initiations_rx += src->handshake_initiations_rx;
+	dst->handshake_initiations_tx += src->handshake_initiations_tx;
+	dst->handshake_responses_rx += src->handshake_responses_rx;
+	dst->handshake_responses_tx += src->handshake_responses_tx;
+	dst->handshakes_completed += src->handshakes_completed;
+	dst->cookies_rx += src->cookies_rx;
+	drops_accumulate(&dst->drops, &src->drops);
+}
+
+void wireguard_histogram_add(struct wireguard_histogram *hist, uint32_t ticks) {
+	uint32_t bucket = 0;
+	if (ticks != 0) {
+		bucket = 32 - __builtin_clz(ticks);
+		if (bucket >= WIREGUARD_HISTOGRAM_BUCKETS) {
+			bucket = WIREGUARD_HISTOGRAM_BUCKETS - 1;
+		}
+	}
+	hist->buckets[bucket]++;
+	hist->count++;
+	hist->sum += ticks;
+	if (ticks > hist->max) {
+		hist->max = ticks;
+	}
+}
+
+#if WIREGUARD_ALLOC_STATS
+void wireguard_alloc_record(struct wireguard_alloc_stats *stats, uint8_t site, bool allocated, bool heap, uint32_t size) {
+	struct wireguard_alloc_site_stats *s = &stats->sites[site];
+	if (allocated) {
+		s->allocs++;
+		if (heap) {
+			s->heap++;
+		}
+		s->bytes += size;
+		if (size > s->max_size) {
+			s->max_size = size;
+		}
+	} else {
+		s->failures++;
+	}
+}
+#endif
+
+#if WIREGUARD_STACK_PROBE
+#define STACK_PAINT		(0xA5)
+
+// Lowest address of the painted area - the stack is assumed to grow down, as on ARM and x86
+static uintptr_t stack_area;
+static uint8_t stack_nesting;
+
+// Not inlined so that its frame, the painted area, is exactly the stack the caller's next callees get
+__attribute__((noinline)) void wireguard_stack_paint(void) {
+	volatile uint8_t area[WIREGUARD_STACK_PROBE_DEPTH];
+	size_t x;
+	if (stack_nesting == 0) {
+		for (x=0; x < sizeof(area); x++) {
+			area[x] = STACK_PAINT;
+		}
+		stack_area = (uintptr_t)area;
+	}
+	stack_nesting++;
+}
+
+// Its own frame lands in the area too, it is smaller than anything worth measuring
+__attribute__((noinline)) void wireguard_stack_check(struct wireguard_device_stats *stats) {
+	const volatile uint8_t *area = (const volatile uint8_t *)stack_area;
+	uint32_t untouched = 0;
+	uint32_t used;
+	stack_nesting--;
+	if (stack_nesting == 0) {
+		while ((untouched < WIREGUARD_STACK_PROBE_DEPTH) && (area[untouched] == STACK_PAINT)) {
+			untouched++;
+		}
+		used = WIREGUARD_STACK_PROBE_DEPTH - untouched;
+		if (used > stats->stack_high_water) {
+			stats->stack_high_water = used;
+		}
+		if (used > WIREGUARD_STACK_BUDGET) {
+			stats->stack_over_budget++;
+		}
+	}
+}
+#endif
@@ -0,0 +1,197 @@
+/*
+ * Tunnel statistics for the WireGuard lwIP port.
+ * SPDX-License-Identifier: BSD-3-Clause
+ *
+ * Counters live inside struct wireguard_peer / struct wireguard_device and are only
+ * updated from the lwIP context, so plain increments are enough. Use the snapshot
+ * calls in wireguardif.h (or WireGuard::getStats()) to read them.
+ */
+
+#ifndef _WIREGUARD_STATS_H_
+#define _WIREGUARD_STATS_H_
+
+#include <stdint.h>
+
+#include "wireguard-platform.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// Packets dropped, by reason
+struct wireguard_drop_stats {
+	uint32_t bad_mac1; // Handshake message with invalid mac1
+	uint32_t replay; // Transport counter already seen / too old, or handshake timestamp not increasing
+	uint32_t auth_failure; // AEAD authentication failed (transport data, handshake or cookie)
+	uint32_t no_keypair; // No session (or pending handshake) matching the receiver index, or nothing to send with
+	uint32_t no_memory; // pbuf allocation failed (ERR_MEM)
+	uint32_t allowed_ip; // Inner address does not match the peer's allowed IPs
+	uint32_t key_expired; // Session is past REJECT_AFTER_TIME / REJECT_AFTER_MESSAGES
+	uint32_t malformed; // Unknown message type, bad length or corrupt inner IP header
+	uint32_t rate_limited; // Handshake message over its source's (or the peer's) rate limit
+};
+
+struct wireguard_peer_stats {
+	// Transport data messages (keep-alives included), bytes are WireGuard message lengths as sent on the wire
+	uint32_t rx_packets;
+	uint32_t tx_packets;
+	uint64_t rx_bytes;
+	uint64_t tx_bytes;
+	uint32_t keepalives_rx;
+	uint32_t keepalives_tx;
+
+	uint32_t handshake_initiations_rx;
+	uint32_t handshake_initiations_tx;
+	uint32_t handshake_responses_rx;
+	uint32_t handshake_responses_tx;
+	// New sessions derived (either side of the handshake)
+	uint32_t handshakes_completed;
+	uint32_t cookies_rx;
+
+	struct wireguard_drop_stats drops;
+};
+
+// Log2 latency histogram in wireguard_cycle_count() ticks
+// Bucket 0 counts zero-tick samples, bucket n counts samples in [2^(n-1), 2^n) - the last bucket also takes anything larger
+#define WIREGUARD_HISTOGRAM_BUCKETS		(32)
+
+struct wireguard_histogram {
+	uint32_t buckets[WIREGUARD_HISTOGRAM_BUCKETS];
+	uint32_t count;
+	uint32_t max;
+	uint64_t sum;
+};
+
+// Instrumented stages, each has its own histogram in the device
+enum wireguard_latency_stage {
+	WIREGUARD_STAGE_ENCRYPT = 0, // wireguard_encrypt_packet()
+	WIREGUARD_STAGE_DECRYPT, // wireguard_decrypt_packet()
+	WIREGUARD_STAGE_PBUF_ALLOC, // Transport pbuf allocation (TX and RX)
+	WIREGUARD_STAGE_UDP_SEND, // udp_sendto() of any outgoing message
+	WIREGUARD_STAGE_IP_INPUT, // ip_input() of a decrypted packet
+	WIREGUARD_STAGE_INITIATION_CREATE, // wireguard_create_handshake_initiation()
+	WIREGUARD_STAGE_INITIATION_CONSUME, // wireguard_process_initiation_message()
+	WIREGUARD_STAGE_RESPONSE_CREATE, // wireguard_create_handshake_response()
+	WIREGUARD_STAGE_RESPONSE_CONSUME, // wireguard_process_handshake_response()
+	WIREGUARD_STAGE_COUNT
+};
+
+// Allocation sites of the interface, counted with WIREGUARD_ALLOC_STATS
+enum wireguard_alloc_site {
+	WIREGUARD_ALLOC_DEVICE = 0, // Device context, mem_calloc() in wireguardif_init()
+	WIREGUARD_ALLOC_HANDSHAKE, // Initiation and response pbufs, including initiation copies for other endpoints
+	WIREGUARD_ALLOC_COOKIE, // Cookie reply pbufs
+	WIREGUARD_ALLOC_TRANSPORT_TX, // Encrypted transport messages (data and keep-alives)
+	WIREGUARD_ALLOC_TRANSPORT_RX, // Decrypted packets handed to ip_input()
+	WIREGUARD_ALLOC_SITE_COUNT
+};
+
+struct wireguard_alloc_site_stats {
+	uint32_t allocs; // Successful, from the lwIP heap or the transport pbuf pool
+	uint32_t heap; // Those from the lwIP heap
+	uint32_t failures;
+	uint64_t bytes; // Requested by the successful ones
+	uint32_t max_size;
+};
+
+// Shared by all devices
+struct wireguard_alloc_stats {
+	struct wireguard_alloc_site_stats sites[WIREGUARD_ALLOC_SITE_COUNT];
+	// Filled in by wireguardif_get_alloc_stats(): transport messages sent and received (one TRANSPORT_TX or
+	// TRANSPORT_RX allocation each), and heap allocations of all sites per 1000 of them
+	uint32_t packets;
+	uint32_t heap_per_1000_packets;
+};
+
+// Transport pbuf pool (wireguard-pbufpool.h), shared by all devices
+struct wireguard_pbuf_pool_stats {
+	uint32_t allocs; // Transport pbufs taken from the pool
+	uint32_t heap_fallbacks; // Taken from the lwIP heap instead - pool empty or message larger than a buffer
+	uint16_t size; // WIREGUARD_PBUF_POOL_SIZE
+	uint16_t in_use;
+	uint16_t high_water; // Most buffers in use at the same time
+};
+
+struct wireguard_device_stats {
+	// In a snapshot this is the sum over all peers (including removed ones) plus
+	// traffic that could not be attributed to any peer
+	struct wireguard_peer_stats totals;
+	uint32_t cookies_tx;
+	// Handshakes in progress dropped to make room for another (WIREGUARD_MAX_HANDSHAKES)
+	uint32_t handshakes_evicted;
+	// Deepest stack use in bytes below an lwIP callback, and callbacks over WIREGUARD_STACK_BUDGET - WIREGUARD_STACK_PROBE only
+	uint32_t stack_high_water;
+	uint32_t stack_over_budget;
+	struct wireguard_pbuf_pool_stats pbuf_pool;
+};
+
+enum wireguard_liveness_state {
+	WIREGUARD_LIVENESS_DOWN = 0, // No usable session
+	WIREGUARD_LIVENESS_ALIVE, // Session up and the peer answers
+	WIREGUARD_LIVENESS_SUSPECT, // Session up but expected responses went missing - re-handshaking
+};
+
+// Round-trip and liveness snapshot of one peer, times in milliseconds
+struct wireguard_peer_liveness {
+	uint8_t state; // enum wireguard_liveness_state
+	uint8_t missed_responses;
+	uint32_t srtt; // Smoothed handshake RTT, 0 until the first handshake
+	uint32_t rttvar;
+	uint32_t last_rtt;
+	uint32_t handshake_rtt; // Last initiation -> response time
+	uint32_t last_rx_age; // Time since the last authenticated transport packet, UINT32_MAX if none
+};
+
+#if WIREGUARD_STATS
+#define WIREGUARD_STAT_INC(stats, field)		((stats).field++)
+#define WIREGUARD_STAT_ADD(stats, field, n)		((stats).field += (n))
+#else
+#define WIREGUARD_STAT_INC(stats, field)		do { } while (0)
+#define WIREGUARD_STAT_ADD(stats, field, n)		do { } while (0)
+#endif
+
+#if WIREGUARD_LATENCY_HISTOGRAMS
+#define WIREGUARD_LATENCY_BEGIN(start)					uint32_t start = wireguard_cycle_count()
+#define WIREGUARD_LATENCY_END(device, stage, start)		wireguard_histogram_add(&(device)->latency[stage], wireguard_cycle_count() - (start))
+#else
+#define WIREGUARD_LATENCY_BEGIN(start)					do { } while (0)
+#define WIREGUARD_LATENCY_END(device, stage, start)		do { } while (0)
+#endif
+
+#if WIREGUARD_ALLOC_STATS
+#define WIREGUARD_ALLOC_RECORD(stats, site, ptr, heap, size)	wireguard_alloc_record(&(stats), site, (ptr) != NULL, heap, size)
+#else
+#define WIREGUARD_ALLOC_RECORD(stats, site, ptr, heap, size)	do { } while (0)
+#endif
+
+#if WIREGUARD_STACK_PROBE
+#define WIREGUARD_STACK_BEGIN()							wireguard_stack_paint()
+#define WIREGUARD_STACK_END(device)						wireguard_stack_check(&(device)->stats)
+#else
+#define WIREGUARD_STACK_BEGIN()							do { } while (0)
+#define WIREGUARD_STACK_END(device)						do { } while (0)
+#endif
+
+// Adds every counter in src to dst
+void wireguard_stats_accumulate(struct wireguard_peer_stats *dst, const struct wireguard_peer_stats *src);
+
+// Records one sample of the given number of ticks
+void wireguard_histogram_add(struct wireguard_histogram *hist, uint32_t ticks);
+
+#if WIREGUARD_ALLOC_STATS
+// Records one allocation attempt of size bytes at the given enum wireguard_alloc_site
+void wireguard_alloc_record(struct wireguard_alloc_stats *stats, uint8_t site, bool allocated, bool heap, uint32_t size);
+#endif
+
+#if WIREGUARD_STACK_PROBE
+// Paints the stack below the caller, then stack_high_water / stack_over_budget get what the caller's callees
+// used in between. Pairs nest - only the outermost one measures (ip_input() may lead back into the output).
+void wireguard_stack_paint(void);
+void wireguard_stack_check(struct wireguard_device_stats *stats);
+#endif
+
+#ifdef __cplusplus
+} /* extern "C" */
+#endif
+
+#endif /* _WIREGUARD_STATS_H_ */
@@ -0,0 +1,55 @@
+/*
+ * wireguard_storage_read()/_write() on top of the Arduino-Pico LittleFS.
+ * SPDX-License-Identifier: BSD-3-Clause
+ * RP2040 port by Marcin Kielesinski (jaszczurtd@tlen.pl)
+ */
+
+#include "wireguard-platform.h"
+
+#if WIREGUARD_KEY_CACHE || WIREGUARD_MONOTONIC_TAI64N
+
+#include <Arduino.h>
+#include <LittleFS.h>
+
+#define WIREGUARD_STORAGE_DIR "/wg"
+
+static bool storage_mounted = false;
+
+// Mount on first use - fails (and the key cache / timestamp mark just miss) when no filesystem size is configured
+static bool storage_begin() {
+  if (!storage_mounted) {
+    storage_mounted = LittleFS.begin();
+  }
+  return storage_mounted;
+}
+
+static String storage_path(const char *name) {
+  return String(WIREGUARD_STORAGE_DIR "/") + name;
+}
+
+bool wireguard_storage_read(const char *name, uint8_t *data, size_t len) {
+  if (!storage_begin()) return false;
+
+  File f = LittleFS.open(storage_path(name), "r");
+  if (!f) return false;
+
+  bool ok = (f.size() == len) && (f.read(data, len) == len);
+  f.close();
+  return ok;
+}
+
+bool wireguard_storage_write(const char *name, const uint8_t *data, size_t len) {
+  if (!storage_begin()) return false;
+
+  if (!LittleFS.exists(WIREGUARD_STORAGE_DIR)) {
+    LittleFS.mkdir(WIREGUARD_STORAGE_DIR);
+  }
+  File f = LittleFS.open(storage_path(name), "w");
+  if (!f) return false;
+
+  bool ok = (f.write(data, len) == len);
+  f.close();
+  return ok;
+}
+
+#endif /* WIREGUARD_KEY_CACHE || WIREGUARD_MONOTONIC_TAI64N */
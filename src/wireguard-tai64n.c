@@ -0,0 +1,135 @@
+/*
+ * Monotonic TAI64N handshake timestamps for the WireGuard lwIP port.
+ * SPDX-License-Identifier: BSD-3-Clause
+ */
+
+#include "wireguard-tai64n.h"
+
+#if WIREGUARD_MONOTONIC_TAI64N
+
+#include <string.h>
+
+#include "crypto.h"
+#include "wg_port_pico.h"
+
+#define TAI64N_STORAGE_NAME			"tai64n"
+#define TAI64N_LABEL_BASE			(0x400000000000000aULL)
+#define USEC_PER_SEC				(1000000ULL)
+
+// Last label issued, valid while check is its complement - survives warm resets
+struct tai64n_high_water {
+	uint64_t last_us;
+	uint64_t check;
+};
+
+NOINIT static struct tai64n_high_water tai64n_hwm;
+
+static bool tai64n_started = false;
+// Label (microseconds since 1970) = uptime + offset
+static uint64_t tai64n_offset_us;
+// Seconds reserved in flash - nothing at or past it has been issued. Only valid once tai64n_loaded.
+static bool tai64n_loaded = false;
+static uint64_t tai64n_mark;
+
+static bool tai64n_hwm_valid() {
+	return (tai64n_hwm.check == ~tai64n_hwm.last_us);
+}
+
+static void tai64n_start(uint64_t uptime_us) {
+	uint64_t floor_us = (uint64_t)WIREGUARD_TAI64N_FLOOR * USEC_PER_SEC;
+	if (tai64n_hwm_valid()) {
+		// Warm reset - the exact last label is known, no need to skip ahead to the mark
+		if (tai64n_hwm.last_us >= floor_us) {
+			floor_us = tai64n_hwm.last_us + 1;
+		}
+	} else if (tai64n_loaded && (tai64n_mark * USEC_PER_SEC > floor_us)) {
+		floor_us = tai64n_mark * USEC_PER_SEC;
+	}
+	tai64n_offset_us = floor_us - uptime_us;
+	tai64n_started = true;
+}
+
+// The label for now - moves the counter up to the wall clock, or past the last label issued
+static uint64_t tai64n_current(uint64_t uptime_us, uint64_t wall_us) {
+	uint64_t now_us;
+	if (!tai64n_started) {
+		tai64n_start(uptime_us);
+	}
+	now_us = tai64n_offset_us + uptime_us;
+	if (wall_us > now_us) {
+		// Wall clock (NTP / RTC) has moved past the counter - follow it from now on
+		tai64n_offset_us = wall_us - uptime_us;
+		now_us = wall_us;
+	}
+	if (tai64n_hwm_valid() && (now_us <= tai64n_hwm.last_us)) {
+		// Two calls within the same microsecond, or the wall clock stepped back
+		now_us = tai64n_hwm.last_us + 1;
+		tai64n_offset_us = now_us - uptime_us;
+	}
+	return now_us;
+}
+
+void wireguard_tai64n_monotonic_reserve(uint64_t uptime_us, uint64_t wall_us) {
+	uint8_t buffer[8];
+	uint64_t mark = 0;
+	uint64_t now_s;
+	bool loaded;
+
+	WG_LWIP_LOCK();
+	loaded = tai64n_loaded;
+	WG_LWIP_UNLOCK();
+	if (!loaded) {
+		if (wireguard_storage_read(TAI64N_STORAGE_NAME, buffer, sizeof(buffer))) {
+			mark = U8TO64_LITTLE(buffer);
+		}
+	}
+
+	// Handshakes may run on the other core meanwhile - only the flash access is left outside the lock
+	WG_LWIP_LOCK();
+	if (!loaded) {
+		tai64n_mark = mark;
+		tai64n_loaded = true;
+		// Start over from the mark unless this is a warm reset
+		tai64n_started = false;
+	}
+	now_s = tai64n_current(uptime_us, wall_us) / USEC_PER_SEC;
+	mark = tai64n_mark;
+	WG_LWIP_UNLOCK();
+
+	// Less than half of the reserve left - move the mark a full reserve ahead of now. Labels keep to the old
+	// mark until the new one is in flash, and a mark that cannot be written is never used as a limit.
+	if (now_s + (WIREGUARD_TAI64N_RESERVE / 2) >= mark) {
+		mark = now_s + WIREGUARD_TAI64N_RESERVE;
+		U64TO8_LITTLE(buffer, mark);
+		if (wireguard_storage_write(TAI64N_STORAGE_NAME, buffer, sizeof(buffer))) {
+			WG_LWIP_LOCK();
+			tai64n_mark = mark;
+			WG_LWIP_UNLOCK();
+		}
+	}
+}
+
+void wireguard_tai64n_monotonic(uint8_t *output, uint64_t uptime_us, uint64_t wall_us) {
+	uint64_t now_us = tai64n_current(uptime_us, wall_us);
+	uint64_t limit_us;
+
+	// No storage access here, this runs in the lwIP context. Nothing at or past the mark in flash is ever issued,
+	// not even when the wall clock is ahead of it: a power cycle without NTP restarts at the mark. Once the
+	// counter reaches the last second before the mark it stands still and labels only go up a microsecond each
+	// until the next wireguard_tai64n_reserve() moves the mark on.
+	if (tai64n_loaded && (tai64n_mark > 0)) {
+		limit_us = (tai64n_mark - 1) * USEC_PER_SEC;
+		if (now_us > limit_us) {
+			now_us = (tai64n_hwm_valid() && (tai64n_hwm.last_us >= limit_us)) ? (tai64n_hwm.last_us + 1) : limit_us;
+			tai64n_offset_us = now_us - uptime_us;
+		}
+	}
+
+	tai64n_hwm.last_us = now_us;
+	tai64n_hwm.check = ~now_us;
+
+	U64TO8_BIG(output + 0, TAI64N_LABEL_BASE + now_us / USEC_PER_SEC);
+	U32TO8_BIG(output + 8, (uint32_t)(now_us % USEC_PER_SEC) * 1000U);
+}
+
+#endif /* WIREGUARD_MONOTONIC_TAI64N */
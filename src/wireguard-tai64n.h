@@ -0,0 +1,43 @@
+/*
+ * Monotonic TAI64N handshake timestamps for the WireGuard lwIP port.
+ * SPDX-License-Identifier: BSD-3-Clause
+ *
+ * The responder drops initiations whose timestamp is not greater than the last one it accepted,
+ * so a wall clock still at 1970 (before NTP) keeps the tunnel down. With WIREGUARD_MONOTONIC_TAI64N
+ * timestamps are the greater of the wall clock and a counter that continues from a high-water mark:
+ * kept in .noinit RAM across warm resets and, through wireguard_storage_write(), as a mark in flash
+ * reserved WIREGUARD_TAI64N_RESERVE seconds ahead of everything issued. After a power cycle the
+ * counter starts at that mark (or at WIREGUARD_TAI64N_FLOOR on the very first boot), so it never goes
+ * back. Once the wall clock moves past the counter it is followed again.
+ *
+ * Flash is only touched by wireguard_tai64n_reserve() (sketch context: WireGuard::begin() through
+ * wireguard_platform_init(), WireGuard::resume() and WireGuard::maintain()), which loads the mark and moves it
+ * ahead when less than half of the reserve is left. Timestamps issued in the lwIP context never reach the mark,
+ * whatever the wall clock says: a counter that gets there stands still and labels go up by a microsecond each
+ * until the next reserve. With the default WIREGUARD_TAI64N_FLOOR of 0 the first boot starts at 1970.
+ */
+
+#ifndef _WIREGUARD_TAI64N_H_
+#define _WIREGUARD_TAI64N_H_
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "wireguard-platform.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// Write a TAI64N label greater than any issued before into output (12 bytes) - for wireguard_tai64n_now()
+// uptime_us: monotonic microseconds since boot, wall_us: wall clock microseconds since 1970 (may be unset)
+void wireguard_tai64n_monotonic(uint8_t *output, uint64_t uptime_us, uint64_t wall_us);
+
+// Load the mark from storage if not done yet and reserve ahead - for wireguard_tai64n_reserve(), never from lwIP
+void wireguard_tai64n_monotonic_reserve(uint64_t uptime_us, uint64_t wall_us);
+
+#ifdef __cplusplus
+} /* extern "C" */
+#endif
+
+#endif /* _WIREGUARD_TAI64N_H_ */
@@ -36,6 +36,7 @@
 #include "wireguard.h"
 
 #include <stdbool.h>
+#include <stddef.h>
 #include <stdlib.h>
 #include <string.h>
 
@@ -45,6 +46,23 @@
 // For HMAC calculation
 #define WIREGUARD_BLAKE2S_BLOCK_SIZE (64)
 
+// Size budgets of the peer (wireguard.h), checked here as the header is also compiled as C++.
+// Measured for the RP2040 (ILP32, 8-byte aligned uint64_t) with the default limits, IPv4 / dual-stack lwIP:
+// per-packet head 64 / 88 bytes, keypair 112 (128 with WIREGUARD_PERSIST_SESSIONS), cold part 280 / 360.
+#define PEER_CACHE_LINE			(64)
+// Everything ahead of the sessions fits one cache line with an IPv4 ip_addr_t. A dual-stack ip_addr_t only
+// widens the endpoint address, the keypairs that follow start at their 8-byte alignment.
+#define PEER_IP_ADDR_EXTRA		(sizeof(ip_addr_t) - sizeof(ip4_addr_t))
+#define PEER_HEAD_BUDGET		((PEER_CACHE_LINE + PEER_IP_ADDR_EXTRA + 7) & ~(size_t)7)
+// A session takes at most two cache lines, the replay counters included
+#define PEER_KEYPAIR_BUDGET		(2 * PEER_CACHE_LINE)
+// Keys, cookie and connect address of the cold part, which otherwise only grows with the endpoint list
+#define PEER_COLD_BASE_BUDGET	(256)
+#define PEER_COLD_BUDGET		(PEER_COLD_BASE_BUDGET + sizeof(struct wireguard_endpoint) * WIREGUARD_MAX_ENDPOINTS)
+_Static_assert(offsetof(struct wireguard_peer, keypairs) <= PEER_HEAD_BUDGET, "per-packet peer state over budget");
+_Static_assert(sizeof(struct wireguard_keypair) <= PEER_KEYPAIR_BUDGET, "keypair over budget");
+_Static_assert(sizeof(struct wireguard_peer_cold) <= PEER_COLD_BUDGET, "cold peer state over budget");
+
 // 5.4 Messages
 // Constants
 static const uint8_t CONSTRUCTION[37] = "Noise_IKpsk2_25519_ChaChaPoly_BLAKE2s"; // The UTF-8 string literal "Noise_IKpsk2_25519_ChaChaPoly_BLAKE2s", 37 bytes of output
@@ -63,6 +81,8 @@ static uint8_t identifier_hash[WIREGUARD_HASH_LEN];
 
 void wireguard_init() {
 	wireguard_blake2s_ctx ctx;
+	// Settle on the crypto backends before anything is hashed with them
+	wireguard_crypto_select(WIREGUARD_CRYPTO_SELECT_MS);
 	// Pre-calculate chaining key hash
 	wireguard_blake2s_init(&ctx, WIREGUARD_HASH_LEN, NULL, 0);
 	wireguard_blake2s_update(&ctx, CONSTRUCTION, sizeof(CONSTRUCTION));
@@ -74,6 +94,17 @@ void wireguard_init() {
 	wireguard_blake2s_final(&ctx, identifier_hash);
 }
 
+void wireguard_peer_clear(struct wireguard_peer *peer) {
+	struct wireguard_peer_cold *cold = peer->cold;
+	handshake_release(peer);
+	crypto_zero(cold, sizeof(struct wireguard_peer_cold));
+	crypto_zero(peer, sizeof(struct wireguard_peer));
+	peer->cold = cold;
+	peer->curr_slot = 0;
+	peer->prev_slot = 1;
+	peer->next_slot = 2;
+}
+
 struct wireguard_peer *peer_alloc(struct wireguard_device *device) {
 	struct wireguard_peer *result = NULL;
 	struct wireguard_peer *tmp;
@@ -95,7 +126,7 @@ struct wireguard_peer *peer_lookup_by_pubkey(struct wireguard_device *device, ui
 	for (x=0; x < WIREGUARD_MAX_PEERS; x++) {
 		tmp = &device->peers[x];
 		if (tmp->valid) {
-			if (memcmp(tmp->public_key, public_key, WIREGUARD_PUBLIC_KEY_LEN) == 0) {
+			if (memcmp(tmp->cold->public_key, public_key, WIREGUARD_PUBLIC_KEY_LEN) == 0) {
 				result = tmp;
 				break;
 			}
@@ -130,15 +161,14 @@ struct wireguard_peer *peer_lookup_by_receiver(struct wireguard_device *device,
 	struct wireguard_peer *result = NULL;
 	struct wireguard_peer *tmp;
 	int x;
-	for (x=0; x < WIREGUARD_MAX_PEERS; x++) {
+	int slot;
+	for (x=0; (x < WIREGUARD_MAX_PEERS) && !result; x++) {
 		tmp = &device->peers[x];
 		if (tmp->valid) {
-			if ((tmp->curr_keypair.valid && (tmp->curr_keypair.local_index == receiver)) ||
-				(tmp->next_keypair.valid && (tmp->next_keypair.local_index == receiver)) ||
-				(tmp->prev_keypair.valid && (tmp->prev_keypair.local_index == receiver))
-				) {
-				result = tmp;
-				break;
+			for (slot=0; slot < WIREGUARD_KEYPAIR_SLOTS; slot++) {
+				if (tmp->keypairs[slot].valid && (tmp->keypairs[slot].local_index == receiver)) {
+					result = tmp;
+				}
 			}
 		}
 	}
@@ -147,15 +177,13 @@ struct wireguard_peer *peer_lookup_by_receiver(struct wireguard_device *device,
 
 struct wireguard_peer *peer_lookup_by_handshake(struct wireguard_device *device, uint32_t receiver) {
 	struct wireguard_peer *result = NULL;
-	struct wireguard_peer *tmp;
+	struct wireguard_handshake *tmp;
 	int x;
-	for (x=0; x < WIREGUARD_MAX_PEERS; x++) {
-		tmp = &device->peers[x];
-		if (tmp->valid) {
-			if (tmp->handshake.valid && tmp->handshake.initiator && (tmp->handshake.local_index == receiver)) {
-				result = tmp;
-				break;
-			}
+	for (x=0; x < WIREGUARD_MAX_HANDSHAKES; x++) {
+		tmp = &device->handshakes[x];
+		if (tmp->peer && tmp->valid && tmp->initiator && (tmp->local_index == receiver)) {
+			result = tmp->peer;
+			break;
 		}
 	}
 	return result;
@@ -166,9 +194,19 @@ bool wireguard_expired(uint32_t created_millis, uint32_t valid_seconds) {
 	return (diff >= (valid_seconds * 1000));
 }
 
+// All randomness a device uses goes through here so that a trace can replay it (wireguard-record.h)
+static void device_random_bytes(struct wireguard_device *device, void *bytes, size_t size) {
+	wireguard_random_bytes(bytes, size);
+	WIREGUARD_RECORD_RANDOM(device, bytes, size);
+}
+
+// Every handshake function below ends with this, on success and failure alike
+static void scratch_release(struct wireguard_device *device) {
+	crypto_zero(&device->scratch, sizeof(struct wireguard_handshake_scratch));
+}
 
 static void generate_cookie_secret(struct wireguard_device *device) {
-	wireguard_random_bytes(device->cookie_secret, WIREGUARD_HASH_LEN);
+	device_random_bytes(device, device->cookie_secret, WIREGUARD_HASH_LEN);
 	device->cookie_secret_millis = wireguard_sys_now();
 }
 
@@ -213,17 +251,14 @@ static void wireguard_mix_hash(uint8_t *hash, const uint8_t *src, size_t src_len
 static void wireguard_hmac(uint8_t *digest, const uint8_t *key, size_t key_len, const uint8_t *text, size_t text_len) {
 	// Adapted from appendix example in RFC2104 to use BLAKE2S instead of MD5 - https://tools.ietf.org/html/rfc2104
 	wireguard_blake2s_ctx ctx;
-	uint8_t k_ipad[WIREGUARD_BLAKE2S_BLOCK_SIZE]; // inner padding - key XORd with ipad
-	uint8_t k_opad[WIREGUARD_BLAKE2S_BLOCK_SIZE]; // outer padding - key XORd with opad
-
+	uint8_t k_pad[WIREGUARD_BLAKE2S_BLOCK_SIZE]; // key XORd with ipad, then with opad
 	uint8_t tk[WIREGUARD_HASH_LEN];
 	int i;
 	// if key is longer than BLAKE2S_BLOCK_SIZE bytes reset it to key=BLAKE2S(key)
 	if (key_len > WIREGUARD_BLAKE2S_BLOCK_SIZE) {
-		wireguard_blake2s_ctx tctx;
-		wireguard_blake2s_init(&tctx, WIREGUARD_HASH_LEN, NULL, 0);
-		wireguard_blake2s_update(&tctx, key, key_len);
-		wireguard_blake2s_final(&tctx, tk);
+		wireguard_blake2s_init(&ctx, WIREGUARD_HASH_LEN, NULL, 0);
+		wireguard_blake2s_update(&ctx, key, key_len);
+		wireguard_blake2s_final(&ctx, tk);
 		key = tk;
 		key_len = WIREGUARD_HASH_LEN;
 	}
@@ -234,27 +269,32 @@ static void wireguard_hmac(uint8_t *digest, const uint8_t *key, size_t key_len,
 	// ipad is the byte 0x36 repeated BLAKE2S_BLOCK_SIZE times
 	// opad is the byte 0x5c repeated BLAKE2S_BLOCK_SIZE times
 	// and text is the data being protected
-	memset(k_ipad, 0, sizeof(k_ipad));
-	memset(k_opad, 0, sizeof(k_opad));
-	memcpy(k_ipad, key, key_len);
-	memcpy(k_opad, key, key_len);
+	memset(k_pad, 0, sizeof(k_pad));
+	memcpy(k_pad, key, key_len);
 
-	// XOR key with ipad and opad values
+	// XOR key with ipad value
 	for (i=0; i < WIREGUARD_BLAKE2S_BLOCK_SIZE; i++) {
-		k_ipad[i] ^= 0x36;
-		k_opad[i] ^= 0x5c;
+		k_pad[i] ^= 0x36;
 	}
 	// perform inner HASH
 	wireguard_blake2s_init(&ctx, WIREGUARD_HASH_LEN, NULL, 0); // init context for 1st pass
-	wireguard_blake2s_update(&ctx, k_ipad, WIREGUARD_BLAKE2S_BLOCK_SIZE); // start with inner pad
+	wireguard_blake2s_update(&ctx, k_pad, WIREGUARD_BLAKE2S_BLOCK_SIZE); // start with inner pad
 	wireguard_blake2s_update(&ctx, text, text_len); // then text of datagram
 	wireguard_blake2s_final(&ctx, digest); // finish up 1st pass
 
+	// Turn the inner pad into the outer one - (K XOR ipad) XOR (ipad XOR opad)
+	for (i=0; i < WIREGUARD_BLAKE2S_BLOCK_SIZE; i++) {
+		k_pad[i] ^= (0x36 ^ 0x5c);
+	}
 	// perform outer HASH
 	wireguard_blake2s_init(&ctx, WIREGUARD_HASH_LEN, NULL, 0); // init context for 2nd pass
-	wireguard_blake2s_update(&ctx, k_opad, WIREGUARD_BLAKE2S_BLOCK_SIZE); // start with outer pad
+	wireguard_blake2s_update(&ctx, k_pad, WIREGUARD_BLAKE2S_BLOCK_SIZE); // start with outer pad
 	wireguard_blake2s_update(&ctx, digest, WIREGUARD_HASH_LEN); // then results of 1st hash
 	wireguard_blake2s_final(&ctx, digest); // finish up 2nd pass
+
+	// Wipe intermediates
+	crypto_zero(k_pad, sizeof(k_pad));
+	crypto_zero(tk, sizeof(tk));
 }
 
 static void wireguard_kdf1(uint8_t *tau1, const uint8_t *chaining_key, const uint8_t *data, size_t data_len) {
@@ -323,54 +363,51 @@ static void wireguard_kdf3(uint8_t *tau1, uint8_t *tau2, uint8_t *tau3, const ui
 bool wireguard_check_replay(struct wireguard_keypair *keypair, uint64_t seq) {
 	// Implementation of packet replay window - as per RFC2401
 	// Adapted from code in Appendix C at https://tools.ietf.org/html/rfc2401
-	uint32_t diff;
+	// Unlike IPsec sequence numbers WireGuard counters start at 0 - the first packet of a session is valid
+	uint64_t diff;
 	bool result = false;
-	size_t ReplayWindowSize = sizeof(keypair->replay_bitmap); // 32 bits
-
-	if (seq != 0) {
-		if (seq > keypair->replay_counter) {
-			// new larger sequence number
-			diff = seq - keypair->replay_counter;
-			if (diff < ReplayWindowSize) {
-				// In window
-				keypair->replay_bitmap <<= diff;
-				// set bit for this packet
-				keypair->replay_bitmap |= 1;
-			} else {
-				// This packet has a "way larger"
-				keypair->replay_bitmap = 1;
-			}
-			keypair->replay_counter = seq;
-			// larger is good
-			result = true;
+	size_t ReplayWindowSize = sizeof(keypair->replay_bitmap) * 8; // 32 bits
+
+	if (seq > keypair->replay_counter) {
+		// new larger sequence number
+		diff = seq - keypair->replay_counter;
+		if (diff < ReplayWindowSize) {
+			// In window
+			keypair->replay_bitmap <<= diff;
+			// set bit for this packet
+			keypair->replay_bitmap |= 1;
 		} else {
-			diff = keypair->replay_counter - seq;
-			if (diff < ReplayWindowSize) {
-				if (keypair->replay_bitmap & ((uint32_t)1 << diff)) {
-					// already seen
-				} else {
-					// mark as seen
-					keypair->replay_bitmap |= ((uint32_t)1 << diff);
-					// out of order but good
-					result = true;
-				}
+			// This packet has a "way larger"
+			keypair->replay_bitmap = 1;
+		}
+		keypair->replay_counter = seq;
+		// larger is good
+		result = true;
+	} else {
+		diff = keypair->replay_counter - seq;
+		if (diff < ReplayWindowSize) {
+			if (keypair->replay_bitmap & ((uint32_t)1 << diff)) {
+				// already seen
 			} else {
-				// too old or wrapped
+				// mark as seen
+				keypair->replay_bitmap |= ((uint32_t)1 << diff);
+				// out of order but good
+				result = true;
 			}
+		} else {
+			// too old
 		}
-	} else {
-		// first == 0 or wrapped
 	}
 	return result;
 }
 
 struct wireguard_keypair *get_peer_keypair_for_idx(struct wireguard_peer *peer, uint32_t idx) {
-	if (peer->curr_keypair.valid && peer->curr_keypair.local_index == idx) {
-		return &peer->curr_keypair;
-	} else if (peer->next_keypair.valid && peer->next_keypair.local_index == idx) {
-		return &peer->next_keypair;
-	} else if (peer->prev_keypair.valid && peer->prev_keypair.local_index == idx) {
-		return &peer->prev_keypair;
+	if (PEER_CURR_KEYPAIR(peer)->valid && PEER_CURR_KEYPAIR(peer)->local_index == idx) {
+		return PEER_CURR_KEYPAIR(peer);
+	} else if (PEER_NEXT_KEYPAIR(peer)->valid && PEER_NEXT_KEYPAIR(peer)->local_index == idx) {
+		return PEER_NEXT_KEYPAIR(peer);
+	} else if (PEER_PREV_KEYPAIR(peer)->valid && PEER_PREV_KEYPAIR(peer)->local_index == idx) {
+		return PEER_PREV_KEYPAIR(peer);
 	}
 	return NULL;
 }
@@ -380,22 +417,24 @@ static uint32_t wireguard_generate_unique_index(struct wireguard_device *device)
 	uint32_t result;
 	uint8_t buf[4];
 	int x;
+	int slot;
 	struct wireguard_peer *peer;
 	bool existing;
 	do {
 		do {
-			wireguard_random_bytes(buf, 4);
+			device_random_bytes(device, buf, 4);
 			result = U8TO32_LITTLE(buf);
 		} while ((result == 0) || (result == 0xFFFFFFFF)); // Don't allow 0 or 0xFFFFFFFF as valid values
 
 		existing = false;
 		for (x=0; x < WIREGUARD_MAX_PEERS; x++) {
 			peer = &device->peers[x];
-			existing = (result == peer->curr_keypair.local_index) ||
-					(result == peer->prev_keypair.local_index) ||
-					(result == peer->next_keypair.local_index) ||
-					(result == peer->handshake.local_index);
-
+			for (slot=0; slot < WIREGUARD_KEYPAIR_SLOTS; slot++) {
+				existing = existing || (result == peer->keypairs[slot].local_index);
+			}
+		}
+		for (x=0; x < WIREGUARD_MAX_HANDSHAKES; x++) {
+			existing = existing || (result == device->handshakes[x].local_index);
 		}
 	} while (existing);
 
@@ -407,8 +446,8 @@ static void wireguard_clamp_private_key(uint8_t *key) {
 	key[31] = (key[31] & 127) | 64;
 }
 
-static void wireguard_generate_private_key(uint8_t *key) {
-	wireguard_random_bytes(key, WIREGUARD_PRIVATE_KEY_LEN);
+static void wireguard_generate_private_key(struct wireguard_device *device, uint8_t *key) {
+	device_random_bytes(device, key, WIREGUARD_PRIVATE_KEY_LEN);
 	wireguard_clamp_private_key(key);
 }
 
@@ -445,14 +484,38 @@ bool wireguard_check_mac2(struct wireguard_device *device, const uint8_t *data,
 	return result;
 }
 
-void handshake_destroy(struct wireguard_handshake *handshake) {
-	crypto_zero(handshake->ephemeral_private, WIREGUARD_PUBLIC_KEY_LEN);
-	crypto_zero(handshake->remote_ephemeral, WIREGUARD_PUBLIC_KEY_LEN);
-	crypto_zero(handshake->hash, WIREGUARD_HASH_LEN);
-	crypto_zero(handshake->chaining_key, WIREGUARD_HASH_LEN);
-	handshake->remote_index = 0;
-	handshake->local_index = 0;
-	handshake->valid = false;
+struct wireguard_handshake *handshake_acquire(struct wireguard_device *device, struct wireguard_peer *peer) {
+	struct wireguard_handshake *result = peer->cold->handshake;
+	struct wireguard_handshake *tmp;
+	uint32_t now = wireguard_sys_now();
+	int x;
+	if (!result) {
+		// First free context, else the one started longest ago
+		for (x=0; x < WIREGUARD_MAX_HANDSHAKES; x++) {
+			tmp = &device->handshakes[x];
+			if (!result || (result->peer && (!tmp->peer || ((now - tmp->handshake_millis) > (now - result->handshake_millis))))) {
+				result = tmp;
+			}
+		}
+		if (result->peer) {
+			// Its owner retries on its own timer and gets a context again then
+			handshake_release(result->peer);
+			WIREGUARD_STAT_INC(device->stats, handshakes_evicted);
+		}
+	}
+	crypto_zero(result, sizeof(struct wireguard_handshake));
+	result->peer = peer;
+	result->handshake_millis = now;
+	peer->cold->handshake = result;
+	return result;
+}
+
+void handshake_release(struct wireguard_peer *peer) {
+	struct wireguard_handshake *handshake = peer->cold->handshake;
+	if (handshake) {
+		crypto_zero(handshake, sizeof(struct wireguard_handshake));
+		peer->cold->handshake = NULL;
+	}
 }
 
 void keypair_destroy(struct wireguard_keypair *keypair) {
@@ -460,69 +523,72 @@ void keypair_destroy(struct wireguard_keypair *keypair) {
 	keypair->valid = false;
 }
 
+// The first packet on the next session makes it current: the previous one is retired and its slot
+// becomes the (empty) next. Only the role indices move, received_keypair stays where it is.
 void keypair_update(struct wireguard_peer *peer, struct wireguard_keypair *received_keypair) {
-	bool key_is_next = (received_keypair == &peer->next_keypair);
+	uint8_t retired = peer->prev_slot;
+	bool key_is_next = (received_keypair == PEER_NEXT_KEYPAIR(peer));
 	if (key_is_next) {
-		peer->prev_keypair = peer->curr_keypair;
-		peer->curr_keypair = peer->next_keypair;
-		keypair_destroy(&peer->next_keypair);
+		peer->prev_slot = peer->curr_slot;
+		peer->curr_slot = peer->next_slot;
+		peer->next_slot = retired;
+		keypair_destroy(&peer->keypairs[retired]);
 	}
 }
 
-static void add_new_keypair(struct wireguard_peer *peer, struct wireguard_keypair new_keypair) {
-	if (new_keypair.initiator) {
-		if (peer->next_keypair.valid) {
-			peer->prev_keypair = peer->next_keypair;
-			keypair_destroy(&peer->next_keypair);
+// Assigns the roles for a new session and returns its (wiped) slot. As initiator it becomes current
+// straight away and the previous session is the pending next one if there is one, else the old current.
+// As responder it waits as next for the initiator's first packet and the previous session goes.
+static struct wireguard_keypair *add_new_keypair(struct wireguard_peer *peer, bool initiator) {
+	uint8_t slot;
+	if (initiator) {
+		slot = peer->prev_slot;
+		if (PEER_NEXT_KEYPAIR(peer)->valid) {
+			keypair_destroy(PEER_CURR_KEYPAIR(peer));
+			peer->prev_slot = peer->next_slot;
+			peer->next_slot = peer->curr_slot;
 		} else  {
-			peer->prev_keypair = peer->curr_keypair;
+			peer->prev_slot = peer->curr_slot;
 		}
-		peer->curr_keypair = new_keypair;
+		peer->curr_slot = slot;
 	} else {
-		peer->next_keypair =  new_keypair;
-		keypair_destroy(&peer->prev_keypair);
+		slot = peer->next_slot;
+		keypair_destroy(PEER_PREV_KEYPAIR(peer));
 	}
+	keypair_destroy(&peer->keypairs[slot]);
+	return &peer->keypairs[slot];
 }
 
 void wireguard_start_session(struct wireguard_peer *peer, bool initiator) {
-	struct wireguard_handshake *handshake = &peer->handshake;
-	struct wireguard_keypair new_keypair;
+	struct wireguard_handshake *handshake = peer->cold->handshake;
+	struct wireguard_keypair *new_keypair = add_new_keypair(peer, initiator);
 
-	crypto_zero(&new_keypair, sizeof(struct wireguard_keypair));
-	new_keypair.initiator = initiator;
-	new_keypair.local_index = handshake->local_index;
-	new_keypair.remote_index = handshake->remote_index;
+	new_keypair->initiator = initiator;
+	new_keypair->local_index = handshake->local_index;
+	new_keypair->remote_index = handshake->remote_index;
 
-	new_keypair.keypair_millis = wireguard_sys_now();
-	new_keypair.sending_valid = true;
-	new_keypair.receiving_valid = true;
+	new_keypair->keypair_millis = wireguard_sys_now();
+	new_keypair->sending_valid = true;
+	new_keypair->receiving_valid = true;
 
 	// 5.4.5 Transport Data Key Derivation
 	// (Tsendi = Trecvr, Trecvi = Tsendr) := Kdf2(Ci = Cr,E)
-	if (new_keypair.initiator) {
-		wireguard_kdf2(new_keypair.sending_key, new_keypair.receiving_key, handshake->chaining_key, NULL, 0);
+	if (new_keypair->initiator) {
+		wireguard_kdf2(new_keypair->sending_key, new_keypair->receiving_key, handshake->chaining_key, NULL, 0);
 	} else {
-		wireguard_kdf2(new_keypair.receiving_key, new_keypair.sending_key, handshake->chaining_key, NULL, 0);
+		wireguard_kdf2(new_keypair->receiving_key, new_keypair->sending_key, handshake->chaining_key, NULL, 0);
 	}
 
-	new_keypair.replay_bitmap = 0;
-	new_keypair.replay_counter = 0;
+	new_keypair->replay_bitmap = 0;
+	new_keypair->replay_counter = 0;
 
-	new_keypair.last_tx = 0;
-	new_keypair.last_rx = 0; // No packets received yet
+	new_keypair->last_tx = 0;
+	new_keypair->last_rx = 0; // No packets received yet
 
-	new_keypair.valid = true;
+	new_keypair->valid = true;
 
 	// Eprivi = Epubi = Eprivr = Epubr = Ci = Cr := E
-	crypto_zero(handshake->ephemeral_private, WIREGUARD_PUBLIC_KEY_LEN);
-	crypto_zero(handshake->remote_ephemeral, WIREGUARD_PUBLIC_KEY_LEN);
-	crypto_zero(handshake->hash, WIREGUARD_HASH_LEN);
-	crypto_zero(handshake->chaining_key, WIREGUARD_HASH_LEN);
-	handshake->remote_index = 0;
-	handshake->local_index = 0;
-	handshake->valid = false;
-
-	add_new_keypair(peer, new_keypair);
+	handshake_release(peer);
 }
 
 uint8_t wireguard_get_message_type(const uint8_t *data, size_t len) {
@@ -562,13 +628,7 @@ struct wireguard_peer *wireguard_process_initiation_message(struct wireguard_dev
 	struct wireguard_peer *ret_peer = NULL;
 	struct wireguard_peer *peer = NULL;
 	struct wireguard_handshake *handshake;
-	uint8_t key[WIREGUARD_SESSION_KEY_LEN];
-	uint8_t chaining_key[WIREGUARD_HASH_LEN];
-	uint8_t hash[WIREGUARD_HASH_LEN];
-	uint8_t s[WIREGUARD_PUBLIC_KEY_LEN];
-	uint8_t e[WIREGUARD_PUBLIC_KEY_LEN];
-	uint8_t t[WIREGUARD_TAI64N_LEN];
-	uint8_t dh_calculation[WIREGUARD_PUBLIC_KEY_LEN];
+	struct wireguard_handshake_scratch *scratch = &device->scratch;
 	uint32_t now;
 	bool rate_limit;
 	bool replay;
@@ -578,63 +638,69 @@ struct wireguard_peer *wireguard_process_initiation_message(struct wireguard_dev
 	// We are the responder, other end is the initiator
 
 	// Ci := Hash(Construction) (precalculated hash)
-	memcpy(chaining_key, construction_hash, WIREGUARD_HASH_LEN);
+	memcpy(scratch->chaining_key, construction_hash, WIREGUARD_HASH_LEN);
 
 	// Hi := Hash(Ci || Identifier
-	memcpy(hash, identifier_hash, WIREGUARD_HASH_LEN);
+	memcpy(scratch->hash, identifier_hash, WIREGUARD_HASH_LEN);
 
 	// Hi := Hash(Hi || Spubr)
-	wireguard_mix_hash(hash, device->public_key, WIREGUARD_PUBLIC_KEY_LEN);
+	wireguard_mix_hash(scratch->hash, device->public_key, WIREGUARD_PUBLIC_KEY_LEN);
 
 	 // Ci := Kdf1(Ci, Epubi)
-	wireguard_kdf1(chaining_key, chaining_key, msg->ephemeral, WIREGUARD_PUBLIC_KEY_LEN);
+	wireguard_kdf1(scratch->chaining_key, scratch->chaining_key, msg->ephemeral, WIREGUARD_PUBLIC_KEY_LEN);
 
 	// msg.ephemeral := Epubi
-	memcpy(e, msg->ephemeral, WIREGUARD_PUBLIC_KEY_LEN);
+	memcpy(scratch->ephemeral, msg->ephemeral, WIREGUARD_PUBLIC_KEY_LEN);
 
 	// Hi := Hash(Hi || msg.ephemeral)
-	wireguard_mix_hash(hash, msg->ephemeral, WIREGUARD_PUBLIC_KEY_LEN);
+	wireguard_mix_hash(scratch->hash, msg->ephemeral, WIREGUARD_PUBLIC_KEY_LEN);
 
 	// Calculate DH(Eprivi,Spubr)
-	wireguard_x25519(dh_calculation, device->private_key, e);
-	if (!crypto_equal(dh_calculation, zero_key, WIREGUARD_PUBLIC_KEY_LEN)) {
+	wireguard_x25519(scratch->dh_calculation, device->private_key, scratch->ephemeral);
+	if (!crypto_equal(scratch->dh_calculation, zero_key, WIREGUARD_PUBLIC_KEY_LEN)) {
 
 		// (Ci,k) := Kdf2(Ci,DH(Eprivi,Spubr))
-		wireguard_kdf2(chaining_key, key, chaining_key, dh_calculation, WIREGUARD_PUBLIC_KEY_LEN);
+		wireguard_kdf2(scratch->chaining_key, scratch->key, scratch->chaining_key, scratch->dh_calculation, WIREGUARD_PUBLIC_KEY_LEN);
 
 		// msg.static := AEAD(k, 0, Spubi, Hi)
-		if (wireguard_aead_decrypt(s, msg->enc_static, sizeof(msg->enc_static), hash, WIREGUARD_HASH_LEN, 0, key)) {
+		if (wireguard_aead_decrypt(scratch->static_public, msg->enc_static, sizeof(msg->enc_static), scratch->hash, WIREGUARD_HASH_LEN, 0, scratch->key)) {
 			// Hi := Hash(Hi || msg.static)
-			wireguard_mix_hash(hash, msg->enc_static, sizeof(msg->enc_static));
-
-			peer = peer_lookup_by_pubkey(device, s);
-			if (peer) {
-				handshake = &peer->handshake;
+			wireguard_mix_hash(scratch->hash, msg->enc_static, sizeof(msg->enc_static));
 
+			peer = peer_lookup_by_pubkey(device, scratch->static_public);
+			// First contact from a peer whose static DH is still pending computes it here
+			if (peer && wireguard_peer_compute_dh(device, peer)) {
 				// (Ci,k) := Kdf2(Ci,DH(Sprivi,Spubr))
-				wireguard_kdf2(chaining_key, key, chaining_key, peer->public_key_dh, WIREGUARD_PUBLIC_KEY_LEN);
+				wireguard_kdf2(scratch->chaining_key, scratch->key, scratch->chaining_key, peer->cold->public_key_dh, WIREGUARD_PUBLIC_KEY_LEN);
 
 				// msg.timestamp := AEAD(k, 0, Timestamp(), Hi)
-				if (wireguard_aead_decrypt(t, msg->enc_timestamp, sizeof(msg->enc_timestamp), hash, WIREGUARD_HASH_LEN, 0, key)) {
+				if (wireguard_aead_decrypt(scratch->timestamp, msg->enc_timestamp, sizeof(msg->enc_timestamp), scratch->hash, WIREGUARD_HASH_LEN, 0, scratch->key)) {
 					// Hi := Hash(Hi || msg.timestamp)
-					wireguard_mix_hash(hash, msg->enc_timestamp, sizeof(msg->enc_timestamp));
+					wireguard_mix_hash(scratch->hash, msg->enc_timestamp, sizeof(msg->enc_timestamp));
 
 					now = wireguard_sys_now();
 
 					// Check that timestamp is increasing and we haven't had too many initiations (should only get one per peer every 5 seconds max?)
-					replay = (memcmp(t, peer->greatest_timestamp, WIREGUARD_TAI64N_LEN) <= 0); // tai64n is big endian so we can use memcmp to compare
-					rate_limit = (peer->last_initiation_rx - now) < (1000 / MAX_INITIATIONS_PER_SECOND);
+					replay = (memcmp(scratch->timestamp, peer->cold->greatest_timestamp, WIREGUARD_TAI64N_LEN) <= 0); // tai64n is big endian so we can use memcmp to compare
+					rate_limit = (peer->cold->last_initiation_rx != 0) && ((now - peer->cold->last_initiation_rx) < (1000 / MAX_INITIATIONS_PER_SECOND));
 
+					if (replay) {
+						WIREGUARD_STAT_INC(peer->stats, drops.replay);
+					} else if (rate_limit) {
+						WIREGUARD_STAT_INC(peer->stats, drops.rate_limited);
+					}
 					if (!replay && !rate_limit) {
 						// Success! Copy everything to peer
-						peer->last_initiation_rx = now;
-						if (memcmp(t, peer->greatest_timestamp, WIREGUARD_TAI64N_LEN) > 0) {
-							memcpy(peer->greatest_timestamp, t, WIREGUARD_TAI64N_LEN);
+						peer->cold->last_initiation_rx = now;
+						if (memcmp(scratch->timestamp, peer->cold->greatest_timestamp, WIREGUARD_TAI64N_LEN) > 0) {
+							memcpy(peer->cold->greatest_timestamp, scratch->timestamp, WIREGUARD_TAI64N_LEN);
 							// TODO: Need to notify if the higher layers want to persist latest timestamp/nonce somewhere
 						}
-						memcpy(handshake->remote_ephemeral, e, WIREGUARD_PUBLIC_KEY_LEN);
-						memcpy(handshake->hash, hash, WIREGUARD_HASH_LEN);
-						memcpy(handshake->chaining_key, chaining_key, WIREGUARD_HASH_LEN);
+						// Only now, with the initiation authenticated, does it take a context
+						handshake = handshake_acquire(device, peer);
+						memcpy(handshake->remote_ephemeral, scratch->ephemeral, WIREGUARD_PUBLIC_KEY_LEN);
+						memcpy(handshake->hash, scratch->hash, WIREGUARD_HASH_LEN);
+						memcpy(handshake->chaining_key, scratch->chaining_key, WIREGUARD_HASH_LEN);
 						handshake->remote_index = msg->sender;
 						handshake->valid = true;
 						handshake->initiator = false;
@@ -645,85 +711,78 @@ struct wireguard_peer *wireguard_process_initiation_message(struct wireguard_dev
 					}
 				} else {
 					// Failed to decrypt
+					WIREGUARD_STAT_INC(peer->stats, drops.auth_failure);
 				}
 			} else {
 				// peer not found
+				WIREGUARD_STAT_INC(device->stats.totals, drops.auth_failure);
 			}
 		} else {
 			// Failed to decrypt
+			WIREGUARD_STAT_INC(device->stats.totals, drops.auth_failure);
 		}
 	} else {
 		// Bad X25519
+		WIREGUARD_STAT_INC(device->stats.totals, drops.auth_failure);
 	}
 
-	crypto_zero(key, sizeof(key));
-	crypto_zero(hash, sizeof(hash));
-	crypto_zero(chaining_key, sizeof(chaining_key));
-	crypto_zero(dh_calculation, sizeof(dh_calculation));
+	scratch_release(device);
 
 	return ret_peer;
 }
 
 bool wireguard_process_handshake_response(struct wireguard_device *device, struct wireguard_peer *peer, struct message_handshake_response *src) {
-	struct wireguard_handshake *handshake = &peer->handshake;
+	struct wireguard_handshake *handshake = peer->cold->handshake;
+	struct wireguard_handshake_scratch *scratch = &device->scratch;
 
 	bool result = false;
-	uint8_t key[WIREGUARD_SESSION_KEY_LEN];
-	uint8_t hash[WIREGUARD_HASH_LEN];
-	uint8_t chaining_key[WIREGUARD_HASH_LEN];
-	uint8_t e[WIREGUARD_PUBLIC_KEY_LEN];
-	uint8_t ephemeral_private[WIREGUARD_PUBLIC_KEY_LEN];
-	uint8_t static_private[WIREGUARD_PUBLIC_KEY_LEN];
-	uint8_t preshared_key[WIREGUARD_SESSION_KEY_LEN];
-	uint8_t dh_calculation[WIREGUARD_PUBLIC_KEY_LEN];
-	uint8_t tau[WIREGUARD_PUBLIC_KEY_LEN];
-
-	if (handshake->valid && handshake->initiator) {
-
-		memcpy(hash, handshake->hash, WIREGUARD_HASH_LEN);
-		memcpy(chaining_key, handshake->chaining_key, WIREGUARD_HASH_LEN);
-		memcpy(ephemeral_private, handshake->ephemeral_private, WIREGUARD_PUBLIC_KEY_LEN);
-		memcpy(preshared_key, peer->preshared_key, WIREGUARD_SESSION_KEY_LEN);
+
+	if (handshake && handshake->valid && handshake->initiator) {
+
+		memcpy(scratch->hash, handshake->hash, WIREGUARD_HASH_LEN);
+		memcpy(scratch->chaining_key, handshake->chaining_key, WIREGUARD_HASH_LEN);
+		memcpy(scratch->ephemeral_private, handshake->ephemeral_private, WIREGUARD_PUBLIC_KEY_LEN);
+		memcpy(scratch->preshared_key, peer->cold->preshared_key, WIREGUARD_SESSION_KEY_LEN);
 
 		// (Eprivr, Epubr) := DH-Generate()
 		// Not required
 
 		// Cr := Kdf1(Cr,Epubr)
-		wireguard_kdf1(chaining_key, chaining_key, src->ephemeral, WIREGUARD_PUBLIC_KEY_LEN);
+		wireguard_kdf1(scratch->chaining_key, scratch->chaining_key, src->ephemeral, WIREGUARD_PUBLIC_KEY_LEN);
 
 		// msg.ephemeral := Epubr
-		memcpy(e, src->ephemeral, WIREGUARD_PUBLIC_KEY_LEN);
+		memcpy(scratch->ephemeral, src->ephemeral, WIREGUARD_PUBLIC_KEY_LEN);
 
 		// Hr := Hash(Hr || msg.ephemeral)
-		wireguard_mix_hash(hash, src->ephemeral, WIREGUARD_PUBLIC_KEY_LEN);
+		wireguard_mix_hash(scratch->hash, src->ephemeral, WIREGUARD_PUBLIC_KEY_LEN);
 
 		// Cr := Kdf1(Cr, DH(Eprivr, Epubi))
 		// Calculate DH(Eprivr, Epubi)
-		wireguard_x25519(dh_calculation, ephemeral_private, e);
-		if (!crypto_equal(dh_calculation, zero_key, WIREGUARD_PUBLIC_KEY_LEN)) {
-			wireguard_kdf1(chaining_key, chaining_key, dh_calculation, WIREGUARD_PUBLIC_KEY_LEN);
+		wireguard_x25519(scratch->dh_calculation, scratch->ephemeral_private, scratch->ephemeral);
+		if (!crypto_equal(scratch->dh_calculation, zero_key, WIREGUARD_PUBLIC_KEY_LEN)) {
+			wireguard_kdf1(scratch->chaining_key, scratch->chaining_key, scratch->dh_calculation, WIREGUARD_PUBLIC_KEY_LEN);
 
 			// Cr := Kdf1(Cr, DH(Eprivr, Spubi))
 			// CalculateDH(Eprivr, Spubi)
-			wireguard_x25519(dh_calculation, device->private_key, e);
-			if (!crypto_equal(dh_calculation, zero_key, WIREGUARD_PUBLIC_KEY_LEN)) {
-				wireguard_kdf1(chaining_key, chaining_key, dh_calculation, WIREGUARD_PUBLIC_KEY_LEN);
+			wireguard_x25519(scratch->dh_calculation, device->private_key, scratch->ephemeral);
+			if (!crypto_equal(scratch->dh_calculation, zero_key, WIREGUARD_PUBLIC_KEY_LEN)) {
+				wireguard_kdf1(scratch->chaining_key, scratch->chaining_key, scratch->dh_calculation, WIREGUARD_PUBLIC_KEY_LEN);
 
 				// (Cr, t, k) := Kdf3(Cr, Q)
-				wireguard_kdf3(chaining_key, tau, key, chaining_key, peer->preshared_key, WIREGUARD_SESSION_KEY_LEN);
+				wireguard_kdf3(scratch->chaining_key, scratch->tau, scratch->key, scratch->chaining_key, peer->cold->preshared_key, WIREGUARD_SESSION_KEY_LEN);
 
 				// Hr := Hash(Hr | t)
-				wireguard_mix_hash(hash, tau, WIREGUARD_HASH_LEN);
+				wireguard_mix_hash(scratch->hash, scratch->tau, WIREGUARD_HASH_LEN);
 
 				// msg.empty := AEAD(k, 0, E, Hr)
-				if (wireguard_aead_decrypt(NULL, src->enc_empty, sizeof(src->enc_empty), hash, WIREGUARD_HASH_LEN, 0, key)) {
+				if (wireguard_aead_decrypt(NULL, src->enc_empty, sizeof(src->enc_empty), scratch->hash, WIREGUARD_HASH_LEN, 0, scratch->key)) {
 					// Hr := Hash(Hr | msg.empty)
 					// Not required as discarded
 
 					//Copy details to handshake
-					memcpy(handshake->remote_ephemeral, e, WIREGUARD_HASH_LEN);
-					memcpy(handshake->hash, hash, WIREGUARD_HASH_LEN);
-					memcpy(handshake->chaining_key, chaining_key, WIREGUARD_HASH_LEN);
+					memcpy(handshake->remote_ephemeral, scratch->ephemeral, WIREGUARD_HASH_LEN);
+					memcpy(handshake->hash, scratch->hash, WIREGUARD_HASH_LEN);
+					memcpy(handshake->chaining_key, scratch->chaining_key, WIREGUARD_HASH_LEN);
 					handshake->remote_index = src->sender;
 
 					result = true;
@@ -740,45 +799,39 @@ bool wireguard_process_handshake_response(struct wireguard_device *device, struc
 		}
 
 	}
-	crypto_zero(key, sizeof(key));
-	crypto_zero(hash, sizeof(hash));
-	crypto_zero(chaining_key, sizeof(chaining_key));
-	crypto_zero(ephemeral_private, sizeof(ephemeral_private));
-	crypto_zero(static_private, sizeof(static_private));
-	crypto_zero(preshared_key, sizeof(preshared_key));
-	crypto_zero(tau, sizeof(tau));
+	scratch_release(device);
 
 	return result;
 }
 
 bool wireguard_process_cookie_message(struct wireguard_device *device, struct wireguard_peer *peer, struct message_cookie_reply *src) {
-	uint8_t cookie[WIREGUARD_COOKIE_LEN];
+	struct wireguard_handshake *handshake = peer->cold->handshake;
+	struct wireguard_handshake_scratch *scratch = &device->scratch;
 	bool result = false;
 
-	if (peer->handshake_mac1_valid) {
+	if (handshake && handshake->mac1_valid) {
 
-		result = wireguard_xaead_decrypt(cookie, src->enc_cookie, sizeof(src->enc_cookie), peer->handshake_mac1, WIREGUARD_COOKIE_LEN, src->nonce, peer->label_cookie_key);
+		result = wireguard_xaead_decrypt(scratch->cookie, src->enc_cookie, sizeof(src->enc_cookie), handshake->mac1, WIREGUARD_COOKIE_LEN, src->nonce, peer->cold->label_cookie_key);
 
 		if (result) {
 			// 5.4.7 Under Load: Cookie Reply Message
 			// Upon receiving this message, if it is valid, the only thing the recipient of this message should do is store the cookie along with the time at which it was received
-			memcpy(peer->cookie, cookie, WIREGUARD_COOKIE_LEN);
-			peer->cookie_millis = wireguard_sys_now();
-			peer->handshake_mac1_valid = false;
+			memcpy(peer->cold->cookie, scratch->cookie, WIREGUARD_COOKIE_LEN);
+			peer->cold->cookie_millis = wireguard_sys_now();
+			handshake->mac1_valid = false;
 		}
 	} else {
 		// We didn't send any initiation packet so we shouldn't be getting a cookie reply!
 	}
+	scratch_release(device);
 	return result;
 }
 
 bool wireguard_create_handshake_initiation(struct wireguard_device *device, struct wireguard_peer *peer, struct message_handshake_initiation *dst) {
-	uint8_t timestamp[WIREGUARD_TAI64N_LEN];
-	uint8_t key[WIREGUARD_SESSION_KEY_LEN];
-	uint8_t dh_calculation[WIREGUARD_PUBLIC_KEY_LEN];
 	bool result = false;
 
-	struct wireguard_handshake *handshake = &peer->handshake;
+	struct wireguard_handshake *handshake = handshake_acquire(device, peer);
+	struct wireguard_handshake_scratch *scratch = &device->scratch;
 
 	memset(dst, 0, sizeof(struct message_handshake_initiation));
 
@@ -789,11 +842,12 @@ bool wireguard_create_handshake_initiation(struct wireguard_device *device, stru
 	memcpy(handshake->hash, identifier_hash, WIREGUARD_HASH_LEN);
 
 	// Hi := Hash(Hi || Spubr)
-	wireguard_mix_hash(handshake->hash, peer->public_key, WIREGUARD_PUBLIC_KEY_LEN);
+	wireguard_mix_hash(handshake->hash, peer->cold->public_key, WIREGUARD_PUBLIC_KEY_LEN);
 
 	// (Eprivi, Epubi) := DH-Generate()
-	wireguard_generate_private_key(handshake->ephemeral_private);
-	if (wireguard_generate_public_key(dst->ephemeral, handshake->ephemeral_private)) {
+	// DH(Sprivi,Spubr) is computed here if no earlier handshake with this peer needed it
+	wireguard_generate_private_key(device, handshake->ephemeral_private);
+	if (wireguard_peer_compute_dh(device, peer) && wireguard_generate_public_key(dst->ephemeral, handshake->ephemeral_private)) {
 
 		// Ci := Kdf1(Ci, Epubi)
 		wireguard_kdf1(handshake->chaining_key, handshake->chaining_key, dst->ephemeral, WIREGUARD_PUBLIC_KEY_LEN);
@@ -805,25 +859,25 @@ bool wireguard_create_handshake_initiation(struct wireguard_device *device, stru
 		wireguard_mix_hash(handshake->hash, dst->ephemeral, WIREGUARD_PUBLIC_KEY_LEN);
 
 		// Calculate DH(Eprivi,Spubr)
-		wireguard_x25519(dh_calculation, handshake->ephemeral_private, peer->public_key);
-		if (!crypto_equal(dh_calculation, zero_key, WIREGUARD_PUBLIC_KEY_LEN)) {
+		wireguard_x25519(scratch->dh_calculation, handshake->ephemeral_private, peer->cold->public_key);
+		if (!crypto_equal(scratch->dh_calculation, zero_key, WIREGUARD_PUBLIC_KEY_LEN)) {
 
 			// (Ci,k) := Kdf2(Ci,DH(Eprivi,Spubr))
-			wireguard_kdf2(handshake->chaining_key, key, handshake->chaining_key, dh_calculation, WIREGUARD_PUBLIC_KEY_LEN);
+			wireguard_kdf2(handshake->chaining_key, scratch->key, handshake->chaining_key, scratch->dh_calculation, WIREGUARD_PUBLIC_KEY_LEN);
 
 			// msg.static := AEAD(k,0,Spubi, Hi)
-			wireguard_aead_encrypt(dst->enc_static, device->public_key, WIREGUARD_PUBLIC_KEY_LEN, handshake->hash, WIREGUARD_HASH_LEN, 0, key);
+			wireguard_aead_encrypt(dst->enc_static, device->public_key, WIREGUARD_PUBLIC_KEY_LEN, handshake->hash, WIREGUARD_HASH_LEN, 0, scratch->key);
 
 			// Hi := Hash(Hi || msg.static)
 			wireguard_mix_hash(handshake->hash, dst->enc_static, sizeof(dst->enc_static));
 
 			// (Ci,k) := Kdf2(Ci,DH(Sprivi,Spubr))
-			// note DH(Sprivi,Spubr) is precomputed per peer
-			wireguard_kdf2(handshake->chaining_key, key, handshake->chaining_key, peer->public_key_dh, WIREGUARD_PUBLIC_KEY_LEN);
+			// note DH(Sprivi,Spubr) is computed once per peer
+			wireguard_kdf2(handshake->chaining_key, scratch->key, handshake->chaining_key, peer->cold->public_key_dh, WIREGUARD_PUBLIC_KEY_LEN);
 
 			// msg.timestamp := AEAD(k, 0, Timestamp(), Hi)
-			wireguard_tai64n_now(timestamp);
-			wireguard_aead_encrypt(dst->enc_timestamp, timestamp, WIREGUARD_TAI64N_LEN, handshake->hash, WIREGUARD_HASH_LEN, 0, key);
+			wireguard_tai64n_now(scratch->timestamp);
+			wireguard_aead_encrypt(dst->enc_timestamp, scratch->timestamp, WIREGUARD_TAI64N_LEN, handshake->hash, WIREGUARD_HASH_LEN, 0, scratch->key);
 
 			// Hi := Hash(Hi || msg.timestamp)
 			wireguard_mix_hash(handshake->hash, dst->enc_timestamp, sizeof(dst->enc_timestamp));
@@ -843,37 +897,39 @@ bool wireguard_create_handshake_initiation(struct wireguard_device *device, stru
 		// 5.4.4 Cookie MACs
 		// msg.mac1 := Mac(Hash(Label-Mac1 || Spubm' ), msgA)
 		// The value Hash(Label-Mac1 || Spubm' ) above can be pre-computed
-		wireguard_mac(dst->mac1, dst, (sizeof(struct message_handshake_initiation)-(2*WIREGUARD_COOKIE_LEN)), peer->label_mac1_key, WIREGUARD_SESSION_KEY_LEN);
+		wireguard_mac(dst->mac1, dst, (sizeof(struct message_handshake_initiation)-(2*WIREGUARD_COOKIE_LEN)), peer->cold->label_mac1_key, WIREGUARD_SESSION_KEY_LEN);
+		// Kept to authenticate a cookie reply to this initiation
+		memcpy(handshake->mac1, dst->mac1, WIREGUARD_COOKIE_LEN);
+		handshake->mac1_valid = true;
 
 		// if Lm = E or Lm ≥ 120:
-		if ((peer->cookie_millis == 0) || wireguard_expired(peer->cookie_millis, COOKIE_SECRET_MAX_AGE)) {
+		if ((peer->cold->cookie_millis == 0) || wireguard_expired(peer->cold->cookie_millis, COOKIE_SECRET_MAX_AGE)) {
 			// msg.mac2 := 0
 			crypto_zero(dst->mac2, WIREGUARD_COOKIE_LEN);
 		} else {
 			// msg.mac2 := Mac(Lm, msgB)
-			wireguard_mac(dst->mac2, dst, (sizeof(struct message_handshake_initiation)-(WIREGUARD_COOKIE_LEN)), peer->cookie, WIREGUARD_COOKIE_LEN);
+			wireguard_mac(dst->mac2, dst, (sizeof(struct message_handshake_initiation)-(WIREGUARD_COOKIE_LEN)), peer->cold->cookie, WIREGUARD_COOKIE_LEN);
 
 		}
+	} else {
+		handshake_release(peer);
 	}
 
-	crypto_zero(key, sizeof(key));
-	crypto_zero(dh_calculation, sizeof(dh_calculation));
+	scratch_release(device);
 	return result;
 }
 
 bool wireguard_create_handshake_response(struct wireguard_device *device, struct wireguard_peer *peer, struct message_handshake_response *dst) {
-	struct wireguard_handshake *handshake = &peer->handshake;
-	uint8_t key[WIREGUARD_SESSION_KEY_LEN];
-	uint8_t dh_calculation[WIREGUARD_PUBLIC_KEY_LEN];
-	uint8_t tau[WIREGUARD_HASH_LEN];
+	struct wireguard_handshake *handshake = peer->cold->handshake;
+	struct wireguard_handshake_scratch *scratch = &device->scratch;
 	bool result = false;
 
 	memset(dst, 0, sizeof(struct message_handshake_response));
 
-	if (handshake->valid && !handshake->initiator) {
+	if (handshake && handshake->valid && !handshake->initiator) {
 
 		// (Eprivr, Epubr) := DH-Generate()
-		wireguard_generate_private_key(handshake->ephemeral_private);
+		wireguard_generate_private_key(device, handshake->ephemeral_private);
 		if (wireguard_generate_public_key(dst->ephemeral, handshake->ephemeral_private)) {
 
 			// Cr := Kdf1(Cr,Epubr)
@@ -887,24 +943,24 @@ bool wireguard_create_handshake_response(struct wireguard_device *device, struct
 
 			// Cr := Kdf1(Cr, DH(Eprivr, Epubi))
 			// Calculate DH(Eprivi,Spubr)
-			wireguard_x25519(dh_calculation, handshake->ephemeral_private, handshake->remote_ephemeral);
-			if (!crypto_equal(dh_calculation, zero_key, WIREGUARD_PUBLIC_KEY_LEN)) {
-				wireguard_kdf1(handshake->chaining_key, handshake->chaining_key, dh_calculation, WIREGUARD_PUBLIC_KEY_LEN);
+			wireguard_x25519(scratch->dh_calculation, handshake->ephemeral_private, handshake->remote_ephemeral);
+			if (!crypto_equal(scratch->dh_calculation, zero_key, WIREGUARD_PUBLIC_KEY_LEN)) {
+				wireguard_kdf1(handshake->chaining_key, handshake->chaining_key, scratch->dh_calculation, WIREGUARD_PUBLIC_KEY_LEN);
 
 				// Cr := Kdf1(Cr, DH(Eprivr, Spubi))
 				// Calculate DH(Eprivi,Spubr)
-				wireguard_x25519(dh_calculation, handshake->ephemeral_private, peer->public_key);
-				if (!crypto_equal(dh_calculation, zero_key, WIREGUARD_PUBLIC_KEY_LEN)) {
-					wireguard_kdf1(handshake->chaining_key, handshake->chaining_key, dh_calculation, WIREGUARD_PUBLIC_KEY_LEN);
+				wireguard_x25519(scratch->dh_calculation, handshake->ephemeral_private, peer->cold->public_key);
+				if (!crypto_equal(scratch->dh_calculation, zero_key, WIREGUARD_PUBLIC_KEY_LEN)) {
+					wireguard_kdf1(handshake->chaining_key, handshake->chaining_key, scratch->dh_calculation, WIREGUARD_PUBLIC_KEY_LEN);
 
 					// (Cr, t, k) := Kdf3(Cr, Q)
-					wireguard_kdf3(handshake->chaining_key, tau, key, handshake->chaining_key, peer->preshared_key, WIREGUARD_SESSION_KEY_LEN);
+					wireguard_kdf3(handshake->chaining_key, scratch->tau, scratch->key, handshake->chaining_key, peer->cold->preshared_key, WIREGUARD_SESSION_KEY_LEN);
 
 					// Hr := Hash(Hr | t)
-					wireguard_mix_hash(handshake->hash, tau, WIREGUARD_HASH_LEN);
+					wireguard_mix_hash(handshake->hash, scratch->tau, WIREGUARD_HASH_LEN);
 
 					// msg.empty := AEAD(k, 0, E, Hr)
-					wireguard_aead_encrypt(dst->enc_empty, NULL, 0, handshake->hash, WIREGUARD_HASH_LEN, 0, key);
+					wireguard_aead_encrypt(dst->enc_empty, NULL, 0, handshake->hash, WIREGUARD_HASH_LEN, 0, scratch->key);
 
 					// Hr := Hash(Hr | msg.empty)
 					wireguard_mix_hash(handshake->hash, dst->enc_empty, sizeof(dst->enc_empty));
@@ -932,80 +988,129 @@ bool wireguard_create_handshake_response(struct wireguard_device *device, struct
 		// 5.4.4 Cookie MACs
 		// msg.mac1 := Mac(Hash(Label-Mac1 || Spubm' ), msgA)
 		// The value Hash(Label-Mac1 || Spubm' ) above can be pre-computed
-		wireguard_mac(dst->mac1, dst, (sizeof(struct message_handshake_response)-(2*WIREGUARD_COOKIE_LEN)), peer->label_mac1_key, WIREGUARD_SESSION_KEY_LEN);
+		wireguard_mac(dst->mac1, dst, (sizeof(struct message_handshake_response)-(2*WIREGUARD_COOKIE_LEN)), peer->cold->label_mac1_key, WIREGUARD_SESSION_KEY_LEN);
 
 		// if Lm = E or Lm ≥ 120:
-		if ((peer->cookie_millis == 0) || wireguard_expired(peer->cookie_millis, COOKIE_SECRET_MAX_AGE)) {
+		if ((peer->cold->cookie_millis == 0) || wireguard_expired(peer->cold->cookie_millis, COOKIE_SECRET_MAX_AGE)) {
 			// msg.mac2 := 0
 			crypto_zero(dst->mac2, WIREGUARD_COOKIE_LEN);
 		} else {
 			// msg.mac2 := Mac(Lm, msgB)
-			wireguard_mac(dst->mac2, dst, (sizeof(struct message_handshake_response)-(WIREGUARD_COOKIE_LEN)), peer->cookie, WIREGUARD_COOKIE_LEN);
+			wireguard_mac(dst->mac2, dst, (sizeof(struct message_handshake_response)-(WIREGUARD_COOKIE_LEN)), peer->cold->cookie, WIREGUARD_COOKIE_LEN);
 		}
+	} else if (handshake && !handshake->initiator) {
+		// No session comes of this one
+		handshake_release(peer);
 	}
 
-	crypto_zero(key, sizeof(key));
-	crypto_zero(dh_calculation, sizeof(dh_calculation));
-	crypto_zero(tau, sizeof(tau));
+	scratch_release(device);
 	return result;
 }
 
 void wireguard_create_cookie_reply(struct wireguard_device *device, struct message_cookie_reply *dst, const uint8_t *mac1, uint32_t index, uint8_t *source_addr_port, size_t source_length) {
-	uint8_t cookie[WIREGUARD_COOKIE_LEN];
+	struct wireguard_handshake_scratch *scratch = &device->scratch;
 	crypto_zero(dst, sizeof(struct message_cookie_reply));
 	dst->type = MESSAGE_COOKIE_REPLY;
 	dst->receiver = index;
-	wireguard_random_bytes(dst->nonce, COOKIE_NONCE_LEN);
-	generate_peer_cookie(device, cookie, source_addr_port, source_length);
-	wireguard_xaead_encrypt(dst->enc_cookie, cookie, WIREGUARD_COOKIE_LEN, mac1, WIREGUARD_COOKIE_LEN, dst->nonce, device->label_cookie_key);
+	device_random_bytes(device, dst->nonce, COOKIE_NONCE_LEN);
+	generate_peer_cookie(device, scratch->cookie, source_addr_port, source_length);
+	wireguard_xaead_encrypt(dst->enc_cookie, scratch->cookie, WIREGUARD_COOKIE_LEN, mac1, WIREGUARD_COOKIE_LEN, dst->nonce, device->label_cookie_key);
+	scratch_release(device);
 }
 
 bool wireguard_peer_init(struct wireguard_device *device, struct wireguard_peer *peer, const uint8_t *public_key, const uint8_t *preshared_key) {
+	return wireguard_peer_init_precomputed(device, peer, public_key, preshared_key, NULL);
+}
+
+bool wireguard_peer_init_precomputed(struct wireguard_device *device, struct wireguard_peer *peer, const uint8_t *public_key, const uint8_t *preshared_key, const struct wireguard_derived_keys *derived) {
 	// Clear out structure
-	memset(peer, 0, sizeof(struct wireguard_peer));
+	wireguard_peer_clear(peer);
 
 	if (device->valid) {
 		// Copy across the public key into our peer structure
-		memcpy(peer->public_key, public_key, WIREGUARD_PUBLIC_KEY_LEN);
+		memcpy(peer->cold->public_key, public_key, WIREGUARD_PUBLIC_KEY_LEN);
 		if (preshared_key) {
-			memcpy(peer->preshared_key, preshared_key, WIREGUARD_SESSION_KEY_LEN);
+			memcpy(peer->cold->preshared_key, preshared_key, WIREGUARD_SESSION_KEY_LEN);
 		} else {
-			crypto_zero(peer->preshared_key, WIREGUARD_SESSION_KEY_LEN);
+			crypto_zero(peer->cold->preshared_key, WIREGUARD_SESSION_KEY_LEN);
 		}
 
-		if (wireguard_x25519(peer->public_key_dh, device->private_key, peer->public_key) == 0) {
-			// Zero out handshake
-			memset(&peer->handshake, 0, sizeof(struct wireguard_handshake));
-			peer->handshake.valid = false;
+		if (derived) {
+			// Caller vouches that this is DH(Sprivi,Spubr) for this device and peer
+			memcpy(peer->cold->public_key_dh, derived->public_key, WIREGUARD_PUBLIC_KEY_LEN);
+			peer->cold->public_key_dh_state = WIREGUARD_DH_READY;
+		} else {
+			// The x25519() is deferred to wireguard_peer_compute_dh() so rarely used peers cost nothing at boot
+			peer->cold->public_key_dh_state = WIREGUARD_DH_PENDING;
+		}
 
-			// Zero out any cookie info - we haven't received one yet
-			peer->cookie_millis = 0;
-			memset(&peer->cookie, 0, WIREGUARD_COOKIE_LEN);
+		// No handshake in progress
+		handshake_release(peer);
 
-			// Precompute keys to deal with mac1/2 calculation
-			wireguard_mac_key(peer->label_mac1_key, peer->public_key, LABEL_MAC1, sizeof(LABEL_MAC1));
-			wireguard_mac_key(peer->label_cookie_key, peer->public_key, LABEL_COOKIE, sizeof(LABEL_COOKIE));
+		// Zero out any cookie info - we haven't received one yet
+		peer->cold->cookie_millis = 0;
+		memset(&peer->cold->cookie, 0, WIREGUARD_COOKIE_LEN);
 
-			peer->valid = true;
+		// Precompute keys to deal with mac1/2 calculation
+		if (derived) {
+			memcpy(peer->cold->label_mac1_key, derived->label_mac1_key, WIREGUARD_SESSION_KEY_LEN);
+			memcpy(peer->cold->label_cookie_key, derived->label_cookie_key, WIREGUARD_SESSION_KEY_LEN);
 		} else {
-			crypto_zero(peer->public_key_dh, WIREGUARD_PUBLIC_KEY_LEN);
+			wireguard_mac_key(peer->cold->label_mac1_key, peer->cold->public_key, LABEL_MAC1, sizeof(LABEL_MAC1));
+			wireguard_mac_key(peer->cold->label_cookie_key, peer->cold->public_key, LABEL_COOKIE, sizeof(LABEL_COOKIE));
 		}
+
+		peer->valid = true;
 	}
 	return peer->valid;
 }
 
+bool wireguard_peer_compute_dh(struct wireguard_device *device, struct wireguard_peer *peer) {
+	if (peer->cold->public_key_dh_state == WIREGUARD_DH_PENDING) {
+		if (wireguard_x25519(peer->cold->public_key_dh, device->private_key, peer->cold->public_key) == 0) {
+			peer->cold->public_key_dh_state = WIREGUARD_DH_READY;
+		} else {
+			crypto_zero(peer->cold->public_key_dh, WIREGUARD_PUBLIC_KEY_LEN);
+			peer->cold->public_key_dh_state = WIREGUARD_DH_INVALID;
+		}
+	}
+	return (peer->cold->public_key_dh_state == WIREGUARD_DH_READY);
+}
+
 bool wireguard_device_init(struct wireguard_device *device, const uint8_t *private_key) {
+	return wireguard_device_init_precomputed(device, private_key, NULL);
+}
+
+bool wireguard_device_init_precomputed(struct wireguard_device *device, const uint8_t *private_key, const struct wireguard_derived_keys *derived) {
+	int x;
+	crypto_zero(device->handshakes, sizeof(device->handshakes));
+	for (x=0; x < WIREGUARD_MAX_PEERS; x++) {
+		device->peers[x].cold = &device->peer_cold[x];
+		device->peer_cold[x].handshake = NULL;
+		wireguard_peer_clear(&device->peers[x]);
+	}
 	// Set the private key and calculate public key from it
 	memcpy(device->private_key, private_key, WIREGUARD_PRIVATE_KEY_LEN);
 	// Ensure private key is correctly "clamped"
 	wireguard_clamp_private_key(device->private_key);
-	device->valid = wireguard_generate_public_key(device->public_key, private_key);
+	if (derived) {
+		// Caller vouches that this is the public key of private_key
+		memcpy(device->public_key, derived->public_key, WIREGUARD_PUBLIC_KEY_LEN);
+		device->valid = true;
+	} else {
+		device->valid = wireguard_generate_public_key(device->public_key, private_key);
+	}
 	if (device->valid) {
 		generate_cookie_secret(device);
-		// 5.4.4 Cookie MACs - The value Hash(Label-Mac1 || Spubm' ) above can be pre-computed.
-		wireguard_mac_key(device->label_mac1_key, device->public_key, LABEL_MAC1, sizeof(LABEL_MAC1));
-		// 5.4.7 Under Load: Cookie Reply Message - The value Hash(Label-Cookie || Spubm) above can be pre-computed.
-		wireguard_mac_key(device->label_cookie_key, device->public_key, LABEL_COOKIE, sizeof(LABEL_COOKIE));
+		if (derived) {
+			memcpy(device->label_mac1_key, derived->label_mac1_key, WIREGUARD_SESSION_KEY_LEN);
+			memcpy(device->label_cookie_key, derived->label_cookie_key, WIREGUARD_SESSION_KEY_LEN);
+		} else {
+			// 5.4.4 Cookie MACs - The value Hash(Label-Mac1 || Spubm' ) above can be pre-computed.
+			wireguard_mac_key(device->label_mac1_key, device->public_key, LABEL_MAC1, sizeof(LABEL_MAC1));
+			// 5.4.7 Under Load: Cookie Reply Message - The value Hash(Label-Cookie || Spubm) above can be pre-computed.
+			wireguard_mac_key(device->label_cookie_key, device->public_key, LABEL_COOKIE, sizeof(LABEL_COOKIE));
+		}
 
 	} else {
 		crypto_zero(device->private_key, WIREGUARD_PRIVATE_KEY_LEN);
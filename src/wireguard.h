@@ -47,6 +47,10 @@
 
 // Platform-specific functions that need to be implemented per-platform
 #include "wireguard-platform.h"
+#include "wireguard-stats.h"
+#include "wireguard-capture.h"
+#include "wireguard-record.h"
+#include "wireguard-ratelimit.h"
 
 // tai64n contains 64-bit seconds and 32-bit nano offset (12 bytes)
 #define WIREGUARD_TAI64N_LEN		(12)
@@ -66,118 +70,230 @@
 #define COOKIE_SECRET_MAX_AGE		(2 * 60)
 #define COOKIE_NONCE_LEN			(24)
 
+// Overridable only so that tests can reach them
+#ifndef REKEY_AFTER_MESSAGES
 #define REKEY_AFTER_MESSAGES		(1ULL << 60)
+#endif
+#ifndef REJECT_AFTER_MESSAGES
 #define REJECT_AFTER_MESSAGES		(0xFFFFFFFFFFFFFFFFULL - (1ULL << 13))
+#endif
 #define REKEY_AFTER_TIME			(120)
 #define REJECT_AFTER_TIME			(180)
 #define REKEY_TIMEOUT				(5)
 #define KEEPALIVE_TIMEOUT			(10)
 
+// Everything computed from the static keys alone
+struct wireguard_derived_keys {
+	uint8_t public_key[WIREGUARD_PUBLIC_KEY_LEN]; // Device: our public key - peer: DH(Sprivi,Spubr)
+	uint8_t label_mac1_key[WIREGUARD_SESSION_KEY_LEN];
+	uint8_t label_cookie_key[WIREGUARD_SESSION_KEY_LEN];
+};
+
+// State of the per-peer static DH, which is only computed when it is first needed
+enum wireguard_dh_state {
+	WIREGUARD_DH_PENDING = 0,
+	WIREGUARD_DH_READY,
+	WIREGUARD_DH_INVALID // Peer public key gives an all-zero DH - no handshake is possible
+};
+
+// Ordered so that the fields every packet reads share the first cache line: the lookup by receiver
+// index (valid, local_index) and the checks before decryption. The keys come last.
 struct wireguard_keypair {
 	bool valid;
 	bool initiator; // Did we initiate this session (send the initiation packet rather than sending the response packet)
+	bool sending_valid;
+	bool receiving_valid;
+
+	uint32_t local_index; // This is the index we generated for our end
+	uint32_t remote_index; // This is the index on the other end
 	uint32_t keypair_millis;
 
-	uint8_t sending_key[WIREGUARD_SESSION_KEY_LEN];
-	bool sending_valid;
 	uint64_t sending_counter;
-
-	uint8_t receiving_key[WIREGUARD_SESSION_KEY_LEN];
-	bool receiving_valid;
+	uint64_t replay_counter;
+	uint32_t replay_bitmap;
 
 	uint32_t last_tx;
 	uint32_t last_rx;
 
-	uint32_t replay_bitmap;
-	uint64_t replay_counter;
+	uint8_t sending_key[WIREGUARD_SESSION_KEY_LEN];
+	uint8_t receiving_key[WIREGUARD_SESSION_KEY_LEN];
 
-	uint32_t local_index; // This is the index we generated for our end
-	uint32_t remote_index; // This is the index on the other end
+#if WIREGUARD_PERSIST_SESSIONS
+	// Counters the persisted image covers - reaching them forces a save (wireguard-persist.h)
+	uint64_t persisted_sending_counter;
+	uint64_t persisted_replay_counter;
+#endif
 };
 
+// Sessions of a peer: current, previous and next (responder side, until the initiator uses it)
+#define WIREGUARD_KEYPAIR_SLOTS		(3)
+
+struct wireguard_peer;
+
+// Noise state of a handshake in flight. Contexts come from a small device pool (handshake_acquire())
+// and go back on completion, timeout or peer reset, the oldest is taken over when the pool runs out.
 struct wireguard_handshake {
+	struct wireguard_peer *peer; // Owner, NULL while the context is free
 	bool valid;
 	bool initiator;
+	// mac1 of the initiation we sent, the additional data of a cookie reply to it
+	bool mac1_valid;
 	uint32_t local_index;
 	uint32_t remote_index;
+	uint32_t handshake_millis; // When the owner last (re)started this handshake
+	uint8_t mac1[WIREGUARD_COOKIE_LEN];
 	uint8_t ephemeral_private[WIREGUARD_PRIVATE_KEY_LEN];
 	uint8_t remote_ephemeral[WIREGUARD_PUBLIC_KEY_LEN];
 	uint8_t hash[WIREGUARD_HASH_LEN];
 	uint8_t chaining_key[WIREGUARD_HASH_LEN];
 };
 
-/* Handshake lifecycle helpers. Defined in wireguard.c and used by wireguardif.c. */
-void handshake_destroy(struct wireguard_handshake *hs);
+// Temporaries of the handshake functions, one per device instead of on the stack of every caller.
+// Only one of them runs at a time, each wipes it before returning.
+struct wireguard_handshake_scratch {
+	uint8_t key[WIREGUARD_SESSION_KEY_LEN];
+	uint8_t hash[WIREGUARD_HASH_LEN];
+	uint8_t chaining_key[WIREGUARD_HASH_LEN];
+	uint8_t static_public[WIREGUARD_PUBLIC_KEY_LEN];
+	uint8_t ephemeral[WIREGUARD_PUBLIC_KEY_LEN];
+	uint8_t ephemeral_private[WIREGUARD_PRIVATE_KEY_LEN];
+	uint8_t preshared_key[WIREGUARD_SESSION_KEY_LEN];
+	uint8_t dh_calculation[WIREGUARD_PUBLIC_KEY_LEN];
+	uint8_t tau[WIREGUARD_HASH_LEN];
+	uint8_t timestamp[WIREGUARD_TAI64N_LEN];
+	uint8_t cookie[WIREGUARD_COOKIE_LEN];
+};
 
+// Only IPv4 is routed by allowed IP (see wireguardif_add_allowed_ip)
 struct wireguard_allowed_ip {
+	ip4_addr_t ip;
+	ip4_addr_t mask;
 	bool valid;
-	ip_addr_t ip;
-	ip_addr_t mask;
 };
 
-struct wireguard_peer {
-	bool valid; // Is this peer initialised?
-	bool active; // Should we be actively trying to connect?
+#if WIREGUARD_MAX_ENDPOINTS > 8
+#error "WIREGUARD_MAX_ENDPOINTS must fit the endpoints_tried bitmask"
+#endif
 
-	// This is the configured IP of the peer (endpoint)
-	ip_addr_t connect_ip;
-	u16_t connect_port;
-	// This is the latest received IP/port
+struct wireguard_endpoint {
+	bool valid;
 	ip_addr_t ip;
 	u16_t port;
-	// keep-alive interval in seconds, 0 is disable
-	uint16_t keepalive_interval;
-
-	struct wireguard_allowed_ip allowed_source_ips[WIREGUARD_MAX_SRC_IPS];
+	// Initiation -> response time when this endpoint last answered first (ms), 0 if unknown
+	uint32_t rtt;
+	// Initiations sent here that went unanswered since it last answered
+	uint8_t failures;
+	// Fan-out rounds this suspect endpoint was left out of since it was last tried
+	uint8_t skipped;
+};
 
+// Peer state that packets do not touch: configuration, endpoints, the link to the handshake in
+// progress and cookies. It lives in device->peer_cold[], next to the peer table rather than inside it.
+struct wireguard_peer_cold {
 	uint8_t public_key[WIREGUARD_PUBLIC_KEY_LEN];
 	uint8_t preshared_key[WIREGUARD_SESSION_KEY_LEN];
 
-	// Precomputed DH(Sprivi,Spubr) with device private key, and peer public key
+	// DH(Sprivi,Spubr) with device private key, and peer public key - see public_key_dh_state
 	uint8_t public_key_dh[WIREGUARD_PUBLIC_KEY_LEN];
 
-	// Session keypairs
-	struct wireguard_keypair curr_keypair;
-	struct wireguard_keypair prev_keypair;
-	struct wireguard_keypair next_keypair;
+	// Precomputed keys for use in mac validation
+	uint8_t label_cookie_key[WIREGUARD_SESSION_KEY_LEN];
+	uint8_t label_mac1_key[WIREGUARD_SESSION_KEY_LEN];
 
 	// 5.1 Silence is a Virtue: The responder keeps track of the greatest timestamp received per peer
 	uint8_t greatest_timestamp[WIREGUARD_TAI64N_LEN];
 
-	// The active handshake that is happening
-	struct wireguard_handshake handshake;
-
-	// Decrypted cookie from the responder
-	uint32_t cookie_millis;
+	// Decrypted cookie from the responder - kept here as it outlives the handshake it answered
 	uint8_t cookie[WIREGUARD_COOKIE_LEN];
+	uint32_t cookie_millis;
 
-	// The latest mac1 we sent with initiation
-	bool handshake_mac1_valid;
-	uint8_t handshake_mac1[WIREGUARD_COOKIE_LEN];
+	// The handshake in progress (an entry of device->handshakes), NULL if none
+	struct wireguard_handshake *handshake;
 
-	// Precomputed keys for use in mac validation
-	uint8_t label_cookie_key[WIREGUARD_SESSION_KEY_LEN];
-	uint8_t label_mac1_key[WIREGUARD_SESSION_KEY_LEN];
+	// This is the configured IP of the peer (endpoint) - always the currently selected candidate below
+	ip_addr_t connect_ip;
+	u16_t connect_port;
+	uint8_t endpoint_index;
+	// Bit per endpoint the outstanding initiation was sent to
+	uint8_t endpoints_tried;
+	// Candidate endpoints, the first one to answer a handshake becomes connect_ip/connect_port
+	struct wireguard_endpoint endpoints[WIREGUARD_MAX_ENDPOINTS];
 
 	// The last time we received a valid initiation message
 	uint32_t last_initiation_rx;
 	// The last time we sent an initiation message to this peer
 	uint32_t last_initiation_tx;
+	uint32_t handshake_rtt;
+
+	uint8_t public_key_dh_state;
+#if WIREGUARD_KEY_CACHE
+	bool public_key_dh_cached; // public_key_dh is (or was loaded from) a key cache entry
+#endif
+	bool active; // Should we be actively trying to connect?
+	// The last initiation we sent has not been answered yet
+	bool initiation_pending;
+};
+
+// The part of a peer that the data path reads and writes, in order of use: the allowed IP scan of
+// every outgoing packet, the endpoint and timers, then the sessions.
+struct wireguard_peer {
+	bool valid; // Is this peer initialised?
+	// We set this flag on RX/TX of packets if we think that we should initiate a new handshake
+	bool send_handshake;
+	// Set when we send data and cleared by the next authenticated packet from the peer
+	bool probe_pending;
+	// Expected responses that did not arrive since we last heard from the peer
+	uint8_t missed_responses;
+	// Slots of keypairs[] holding the current, previous and next session - always a permutation of 0..2,
+	// so that rotating the sessions moves no keys and a keypair pointer stays valid across rotations
+	uint8_t curr_slot;
+	uint8_t prev_slot;
+	uint8_t next_slot;
+
+	struct wireguard_allowed_ip allowed_source_ips[WIREGUARD_MAX_SRC_IPS];
+
+	// This is the latest received IP/port
+	ip_addr_t ip;
+	u16_t port;
+	// keep-alive interval in seconds, 0 is disable
+	uint16_t keepalive_interval;
 
 	// last_tx and last_rx of data packets
 	uint32_t last_tx;
 	uint32_t last_rx;
+	uint32_t probe_tx;
 
-	// We set this flag on RX/TX of packets if we think that we should initiate a new handshake
-	bool send_handshake;
+	// Round-trip estimate in ms from initiation -> response times (RFC 6298 smoothing), srtt 0 means no sample yet
+	uint32_t srtt;
+	uint32_t rttvar;
+	uint32_t last_rtt;
+
+	// Session keypairs - a fixed ring of slots, the roles below say which slot is which
+	struct wireguard_keypair keypairs[WIREGUARD_KEYPAIR_SLOTS];
+
+	struct wireguard_peer_stats stats;
+
+	// This peer's entry of device->peer_cold, set by wireguard_device_init() and kept for the life of the device
+	struct wireguard_peer_cold *cold;
 };
 
+// The session of each role of a peer (a struct wireguard_peer pointer)
+#define PEER_CURR_KEYPAIR(peer)		(&(peer)->keypairs[(peer)->curr_slot])
+#define PEER_PREV_KEYPAIR(peer)		(&(peer)->keypairs[(peer)->prev_slot])
+#define PEER_NEXT_KEYPAIR(peer)		(&(peer)->keypairs[(peer)->next_slot])
+
 struct wireguard_device {
 	// Maybe have a "Device private" member to abstract these?
 	struct netif *netif;
 	struct udp_pcb *udp_pcb;
 
 	struct netif *underlying_netif;
+	// Between wireguardif_suspend() and wireguardif_resume() - no timer and no udp_pcb, keys kept
+	bool suspended;
+	u16_t listen_port;
+	// Last seen state of underlying_netif, to notice Wi-Fi reconnects and new DHCP leases
+	bool underlying_link_up;
+	uint32_t underlying_addr;
 
 	uint8_t public_key[WIREGUARD_PUBLIC_KEY_LEN];
 	uint8_t private_key[WIREGUARD_PRIVATE_KEY_LEN];
@@ -191,6 +307,35 @@ struct wireguard_device {
 
 	// List of peers associated with this device
  	struct wireguard_peer peers[WIREGUARD_MAX_PEERS];
+	struct wireguard_peer_cold peer_cold[WIREGUARD_MAX_PEERS];
+
+	// Handshake contexts, shared by the peers
+	struct wireguard_handshake handshakes[WIREGUARD_MAX_HANDSHAKES];
+	struct wireguard_handshake_scratch scratch;
+
+	// Traffic not attributable to a peer, plus counters of peers that have been removed
+	struct wireguard_device_stats stats;
+
+#if WIREGUARD_LATENCY_HISTOGRAMS
+	struct wireguard_histogram latency[WIREGUARD_STAGE_COUNT];
+#endif
+
+#if WIREGUARD_CAPTURE
+	struct wireguard_capture capture;
+#endif
+
+#if WIREGUARD_RECORD
+	struct wireguard_recorder recorder;
+#endif
+
+#if WIREGUARD_RATELIMIT
+	struct wireguard_ratelimit ratelimit;
+#endif
+
+#if WIREGUARD_PERSIST_SESSIONS
+	// Key of the MAC over the persisted session image, derived from private_key
+	uint8_t persist_key[WIREGUARD_SESSION_KEY_LEN];
+#endif
 
 	bool valid;
 };
@@ -249,6 +394,16 @@ struct message_transport_data {
 void wireguard_init();
 bool wireguard_device_init(struct wireguard_device *device, const uint8_t *private_key);
 bool wireguard_peer_init(struct wireguard_device *device, struct wireguard_peer *peer, const uint8_t *public_key, const uint8_t *preshared_key);
+// Variants taking the derived keys from a cache (wireguard-keycache.h) or a warm reset (wireguard-persist.h) - skip
+// the x25519() scalar multiplication and the MAC key hashes. NULL derives them as the plain versions do.
+bool wireguard_device_init_precomputed(struct wireguard_device *device, const uint8_t *private_key, const struct wireguard_derived_keys *derived);
+bool wireguard_peer_init_precomputed(struct wireguard_device *device, struct wireguard_peer *peer, const uint8_t *public_key, const uint8_t *preshared_key, const struct wireguard_derived_keys *derived);
+// Peer init leaves the static DH pending unless it was passed in - this computes it (once) and returns
+// whether it is usable. Handshakes call it on demand, wireguardif also runs it for idle peers in the background.
+bool wireguard_peer_compute_dh(struct wireguard_device *device, struct wireguard_peer *peer);
+
+// Wipe a peer, both parts, and keep it linked to its cold part
+void wireguard_peer_clear(struct wireguard_peer *peer);
 
 struct wireguard_peer *peer_alloc(struct wireguard_device *device);
 uint8_t wireguard_peer_index(struct wireguard_device *device, struct wireguard_peer *peer);
@@ -257,6 +412,11 @@ struct wireguard_peer *peer_lookup_by_peer_index(struct wireguard_device *device
 struct wireguard_peer *peer_lookup_by_receiver(struct wireguard_device *device, uint32_t receiver);
 struct wireguard_peer *peer_lookup_by_handshake(struct wireguard_device *device, uint32_t receiver);
 
+// Context for a new handshake of peer: its current one, else a free one, else the oldest taken from its owner
+struct wireguard_handshake *handshake_acquire(struct wireguard_device *device, struct wireguard_peer *peer);
+// Wipe peer's handshake context, if any, and return it to the pool
+void handshake_release(struct wireguard_peer *peer);
+
 void wireguard_start_session(struct wireguard_peer *peer, bool initiator);
 
 void keypair_update(struct wireguard_peer *peer, struct wireguard_keypair *received_keypair);
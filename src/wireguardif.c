@@ -47,25 +47,109 @@
 #include "lwip/timeouts.h"
 
 #include "wireguard.h"
+#include "wireguard-persist.h"
+#include "wireguard-keycache.h"
+#include "wireguard-pbufpool.h"
 #include "crypto.h"
 
 #define WIREGUARDIF_TIMER_MSECS 400
 
+// Lower bound of the handshake response timeout / fast retry interval - the responder only accepts
+// MAX_INITIATIONS_PER_SECOND initiations per second from a peer
+#define WIREGUARDIF_MIN_RTO_MSECS 1000
+
+#if WIREGUARD_ALLOC_STATS
+// Every allocation of the interface, for all devices - the device context is allocated before there is a device
+static struct wireguard_alloc_stats alloc_stats;
+#endif
+// Transport pool buffers are custom pbufs, every other pbuf comes from the lwIP heap
+#define ALLOC_RECORD_PBUF(site, pbuf, size)	WIREGUARD_ALLOC_RECORD(alloc_stats, site, pbuf, ((pbuf) != NULL) && !((pbuf)->flags & PBUF_FLAG_IS_CUSTOM), size)
+
 static void update_peer_addr(struct wireguard_peer *peer, const ip_addr_t *addr, u16_t port) {
 	peer->ip = *addr;
 	peer->port = port;
 }
 
+static int endpoint_find(struct wireguard_peer *peer, const ip_addr_t *addr, u16_t port) {
+	int result = -1;
+	int x;
+	for (x=0; x < WIREGUARD_MAX_ENDPOINTS; x++) {
+		if (peer->cold->endpoints[x].valid && (peer->cold->endpoints[x].port == port) && ip_addr_cmp(&peer->cold->endpoints[x].ip, addr)) {
+			result = x;
+			break;
+		}
+	}
+	return result;
+}
+
+static int endpoint_count(struct wireguard_peer *peer) {
+	int result = 0;
+	int x;
+	for (x=0; x < WIREGUARD_MAX_ENDPOINTS; x++) {
+		if (peer->cold->endpoints[x].valid) {
+			result++;
+		}
+	}
+	return result;
+}
+
+static void endpoint_select(struct wireguard_peer *peer, int index) {
+	peer->cold->endpoint_index = index;
+	peer->cold->connect_ip = peer->cold->endpoints[index].ip;
+	peer->cold->connect_port = peer->cold->endpoints[index].port;
+}
+
+// Move off a primary that keeps missing responses, to the candidate with the fewest failures
+static void endpoint_fallback(struct wireguard_peer *peer, int current) {
+	struct wireguard_endpoint *best = &peer->cold->endpoints[current];
+	int index = current;
+	int x;
+	if (best->failures >= WIREGUARD_ENDPOINT_FAILURES) {
+		for (x=0; x < WIREGUARD_MAX_ENDPOINTS; x++) {
+			if (peer->cold->endpoints[x].valid && (peer->cold->endpoints[x].failures < best->failures)) {
+				best = &peer->cold->endpoints[x];
+				index = x;
+			}
+		}
+		if (index != current) {
+			endpoint_select(peer, index);
+			peer->ip = peer->cold->connect_ip;
+			peer->port = peer->cold->connect_port;
+		}
+	}
+}
+
+// Suspect candidates back off - they get every 2nd, 4th and at most every 8th fan-out round
+static bool endpoint_fan_out_due(struct wireguard_endpoint *endpoint) {
+	bool result = true;
+	int shift;
+	if (endpoint->failures >= WIREGUARD_ENDPOINT_FAILURES) {
+		shift = endpoint->failures - WIREGUARD_ENDPOINT_FAILURES + 1;
+		if (shift > 3) {
+			shift = 3;
+		}
+		if (endpoint->skipped < 0xFF) {
+			endpoint->skipped++;
+		}
+		result = (endpoint->skipped >= (1 << shift));
+	}
+	if (result) {
+		endpoint->skipped = 0;
+	}
+	return result;
+}
+
 static struct wireguard_peer *peer_lookup_by_allowed_ip(struct wireguard_device *device, const ip_addr_t *ipaddr) {
 	struct wireguard_peer *result = NULL;
 	struct wireguard_peer *tmp;
 	int x;
 	int y;
-	for (x=0; (!result) && (x < WIREGUARD_MAX_PEERS); x++) {
+	// Allowed IPs are IPv4 networks only
+	for (x=0; IP_IS_V4(ipaddr) && (!result) && (x < WIREGUARD_MAX_PEERS); x++) {
 		tmp = &device->peers[x];
 		if (tmp->valid) {
 			for (y=0; y < WIREGUARD_MAX_SRC_IPS; y++) {
-				if ((tmp->allowed_source_ips[y].valid) && ip_addr_netcmp(ipaddr, &tmp->allowed_source_ips[y].ip, ip_2_ip4(&tmp->allowed_source_ips[y].mask))) {
+				if ((tmp->allowed_source_ips[y].valid) && ip4_addr_netcmp(ip_2_ip4(ipaddr), &tmp->allowed_source_ips[y].ip, &tmp->allowed_source_ips[y].mask)) {
 					result = tmp;
 					break;
 				}
@@ -75,8 +159,93 @@ static struct wireguard_peer *peer_lookup_by_allowed_ip(struct wireguard_device
 	return result;
 }
 
+static void peer_rtt_sample(struct wireguard_peer *peer, uint32_t rtt) {
+	uint32_t delta;
+	peer->last_rtt = rtt;
+	if (peer->srtt == 0) {
+		peer->srtt = rtt;
+		peer->rttvar = rtt / 2;
+	} else {
+		delta = (peer->srtt > rtt) ? (peer->srtt - rtt) : (rtt - peer->srtt);
+		peer->rttvar = (3 * peer->rttvar + delta) / 4;
+		peer->srtt = (7 * peer->srtt + rtt) / 8;
+	}
+	// Keep 0 meaning "no sample"
+	if (peer->srtt == 0) {
+		peer->srtt = 1;
+	}
+}
+
+// How long to wait for a handshake response before counting it as missed
+static uint32_t peer_rto(struct wireguard_peer *peer) {
+	uint32_t result = REKEY_TIMEOUT * 1000;
+	if (peer->srtt != 0) {
+		result = peer->srtt + 4 * peer->rttvar;
+		if (result < WIREGUARDIF_MIN_RTO_MSECS) {
+			result = WIREGUARDIF_MIN_RTO_MSECS;
+		} else if (result > REKEY_TIMEOUT * 1000) {
+			result = REKEY_TIMEOUT * 1000;
+		}
+	}
+	return result;
+}
+
+static bool peer_is_suspect(struct wireguard_peer *peer) {
+	return (peer->missed_responses >= WIREGUARD_DEAD_PEER_MISSES);
+}
+
+// Any authenticated message from the peer shows it is alive
+static void peer_heard_from(struct wireguard_peer *peer) {
+	peer->probe_pending = false;
+	peer->missed_responses = 0;
+}
+
+static void peer_missed_response(struct wireguard_peer *peer) {
+	if (peer->missed_responses < 0xFF) {
+		peer->missed_responses++;
+	}
+	// Try a new handshake straight away - once suspect the REKEY_TIMEOUT spacing is shortened as well
+	peer->send_handshake = true;
+}
+
+static void wireguardif_check_liveness(struct wireguard_peer *peer) {
+	uint32_t now = wireguard_sys_now();
+	int x;
+	if (peer->cold->initiation_pending && ((now - peer->cold->last_initiation_tx) >= peer_rto(peer))) {
+		peer->cold->initiation_pending = false;
+		for (x=0; x < WIREGUARD_MAX_ENDPOINTS; x++) {
+			if ((peer->cold->endpoints_tried & (1 << x)) && (peer->cold->endpoints[x].failures < 0xFF)) {
+				peer->cold->endpoints[x].failures++;
+			}
+		}
+		peer->cold->endpoints_tried = 0;
+		peer_missed_response(peer);
+	}
+	// 6.5 After sending data the peer answers within KEEPALIVE_TIMEOUT at the latest (passive keep-alive)
+	if (peer->probe_pending && ((now - peer->probe_tx) >= (KEEPALIVE_TIMEOUT * 1000 + peer_rto(peer)))) {
+		peer->probe_pending = false;
+		peer_missed_response(peer);
+	}
+}
+
 static bool wireguardif_can_send_initiation(struct wireguard_peer *peer) {
-	return ((peer->last_initiation_tx == 0) || (wireguard_expired(peer->last_initiation_tx, REKEY_TIMEOUT)));
+	bool result;
+	uint32_t retry;
+	uint8_t backoff;
+	if (peer->cold->last_initiation_tx == 0) {
+		result = true;
+	} else if (peer_is_suspect(peer)) {
+		// Fast re-handshake, backing off towards REKEY_TIMEOUT while the peer stays silent
+		backoff = peer->missed_responses - WIREGUARD_DEAD_PEER_MISSES;
+		retry = peer_rto(peer) << ((backoff < 3) ? backoff : 3);
+		if (retry > REKEY_TIMEOUT * 1000) {
+			retry = REKEY_TIMEOUT * 1000;
+		}
+		result = ((wireguard_sys_now() - peer->cold->last_initiation_tx) >= retry);
+	} else {
+		result = wireguard_expired(peer->cold->last_initiation_tx, REKEY_TIMEOUT);
+	}
+	return result;
 }
 
 // static err_t wireguardif_peer_output(struct netif *netif, struct pbuf *q, struct wireguard_peer *peer) {
@@ -86,9 +255,20 @@ static bool wireguardif_can_send_initiation(struct wireguard_peer *peer) {
 // 	return udp_sendto_if(device->udp_pcb, q, &peer->ip, peer->port, device->underlying_netif);
 // }
 
+#if WIREGUARD_CAPTURE
+static void wireguardif_capture_outer(struct wireguard_device *device, uint8_t point, const struct pbuf *p, const ip_addr_t *addr, u16_t port) {
+	const ip_addr_t *local = device->underlying_netif ? netif_ip_addr4(device->underlying_netif) : NULL;
+	wireguard_capture_packet(&device->capture, point, p, local, device->udp_pcb->local_port, addr, port);
+}
+#define WIREGUARD_CAPTURE_OUTER(device, point, p, addr, port)		wireguardif_capture_outer(device, point, p, addr, port)
+#else
+#define WIREGUARD_CAPTURE_OUTER(device, point, p, addr, port)		do { } while (0)
+#endif
+
 static err_t wireguardif_peer_output(struct netif *netif, struct pbuf *q, struct wireguard_peer *peer) {
     struct wireguard_device *device = (struct wireguard_device *)netif->state;
     
+	#ifdef DEBUG_DEEP
     char ip_str[16];
     ipaddr_ntoa_r(&peer->ip, ip_str, sizeof(ip_str));
     log_i(TAG "SENDING to %s:%d, size: %d bytes", ip_str, peer->port, q->tot_len);
@@ -98,23 +278,30 @@ static err_t wireguardif_peer_output(struct netif *netif, struct pbuf *q, struct
     
     // DEBUG: Sprawdź PCB i netif
     log_i(TAG "PCB: %p, Underlying netif: %p", device->udp_pcb, device->underlying_netif);
+	#endif
     
+    // q stays owned by the caller on every path
     if (device->udp_pcb == NULL) {
         log_e(TAG "UDP PCB is NULL!");
-        pbuf_free(q);
         return ERR_ARG;
     }
     
     if (device->underlying_netif == NULL) {
         log_e(TAG "Underlying netif is NULL!");
-        pbuf_free(q);
         return ERR_ARG;
     }
     
+	#ifdef DEBUG_DEEP
     log_i(TAG "Calling udp_sendto...");
+	#endif
+		WIREGUARD_CAPTURE_OUTER(device, WIREGUARD_CAPTURE_OUTER_TX, q, &peer->ip, peer->port);
 //    err_t result = udp_sendto_if(device->udp_pcb, q, &peer->ip, peer->port, device->underlying_netif);
+		WIREGUARD_LATENCY_BEGIN(start);
 		err_t result = udp_sendto(device->udp_pcb, q, &peer->ip, peer->port);
+		WIREGUARD_LATENCY_END(device, WIREGUARD_STAGE_UDP_SEND, start);
+	#ifdef DEBUG_DEEP
     log_i(TAG "udp_sendto returned: %d", result);
+	#endif
     
     // DEBUG: check lwIP errors
     if (result != ERR_OK) {
@@ -131,11 +318,19 @@ static err_t wireguardif_peer_output(struct netif *netif, struct pbuf *q, struct
 }
 
 static err_t wireguardif_device_output(struct wireguard_device *device, struct pbuf *q, const ip_addr_t *ipaddr, u16_t port) {
-	return udp_sendto_if(device->udp_pcb, q, ipaddr, port, device->underlying_netif);
+	err_t result;
+	WIREGUARD_CAPTURE_OUTER(device, WIREGUARD_CAPTURE_OUTER_TX, q, ipaddr, port);
+	WIREGUARD_LATENCY_BEGIN(start);
+	result = udp_sendto_if(device->udp_pcb, q, ipaddr, port, device->underlying_netif);
+	WIREGUARD_LATENCY_END(device, WIREGUARD_STAGE_UDP_SEND, start);
+	return result;
 }
 
 static err_t wireguardif_output_to_peer(struct netif *netif, struct pbuf *q, const ip_addr_t *ipaddr, struct wireguard_peer *peer) {
 	// The LWIP IP layer wants to send an IP packet out over the interface - we need to encrypt and send it to the peer
+#if WIREGUARD_LATENCY_HISTOGRAMS || WIREGUARD_CAPTURE || WIREGUARD_PERSIST_SESSIONS
+	struct wireguard_device *device = (struct wireguard_device *)netif->state;
+#endif
 	struct message_transport_data *hdr;
 	struct pbuf *pbuf;
 	err_t result;
@@ -144,11 +339,11 @@ static err_t wireguardif_output_to_peer(struct netif *netif, struct pbuf *q, con
 	size_t header_len = 16;
 	uint8_t *dst;
 	uint32_t now;
-	struct wireguard_keypair *keypair = &peer->curr_keypair;
+	struct wireguard_keypair *keypair = PEER_CURR_KEYPAIR(peer);
 
 	// Note: We may not be able to use the current keypair if we haven't received data, may need to resort to using previous keypair
 	if (keypair->valid && (!keypair->initiator) && (keypair->last_rx == 0)) {
-		keypair = &peer->prev_keypair;
+		keypair = PEER_PREV_KEYPAIR(peer);
 	}
 
 	if (keypair->valid && (keypair->initiator || keypair->last_rx != 0)) {
@@ -170,7 +365,10 @@ static err_t wireguardif_output_to_peer(struct netif *netif, struct pbuf *q, con
 
 			// The buffer needs to be allocated from "transport" pool to leave room for LwIP generated IP headers
 			// The IP packet consists of 16 byte header (struct message_transport_data), data padded upto 16 byte boundary + encrypted auth tag (16 bytes)
-			pbuf = pbuf_alloc(PBUF_TRANSPORT, header_len + padded_len + WIREGUARD_AUTHTAG_LEN, PBUF_RAM);
+			WIREGUARD_LATENCY_BEGIN(alloc_start);
+			pbuf = wireguard_pbuf_alloc(header_len + padded_len + WIREGUARD_AUTHTAG_LEN);
+			WIREGUARD_LATENCY_END(device, WIREGUARD_STAGE_PBUF_ALLOC, alloc_start);
+			ALLOC_RECORD_PBUF(WIREGUARD_ALLOC_TRANSPORT_TX, pbuf, header_len + padded_len + WIREGUARD_AUTHTAG_LEN);
 			if (pbuf) {
 				log_v(TAG "preparing transport data...");
 				// Note: allocating pbuf from RAM above guarantees that the pbuf is in one section and not chained
@@ -193,10 +391,14 @@ static err_t wireguardif_output_to_peer(struct netif *netif, struct pbuf *q, con
 
 					// Copy pbuf to memory - handles case where pbuf is chained
 					pbuf_copy_partial(q, dst, unpadded_len, 0);
+					WIREGUARD_CAPTURE_INNER(device, WIREGUARD_CAPTURE_INNER_TX, q);
 				}
 
 				// Then encrypt
+				WIREGUARD_PERSIST_TX(device, keypair);
+				WIREGUARD_LATENCY_BEGIN(encrypt_start);
 				wireguard_encrypt_packet(dst, dst, padded_len, keypair);
+				WIREGUARD_LATENCY_END(device, WIREGUARD_STAGE_ENCRYPT, encrypt_start);
 
 				result = wireguardif_peer_output(netif, pbuf, peer);
 
@@ -204,6 +406,15 @@ static err_t wireguardif_output_to_peer(struct netif *netif, struct pbuf *q, con
 					now = wireguard_sys_now();
 					peer->last_tx = now;
 					keypair->last_tx = now;
+					WIREGUARD_STAT_INC(peer->stats, tx_packets);
+					WIREGUARD_STAT_ADD(peer->stats, tx_bytes, header_len + padded_len + WIREGUARD_AUTHTAG_LEN);
+					if (!q) {
+						WIREGUARD_STAT_INC(peer->stats, keepalives_tx);
+					} else if (!peer->probe_pending) {
+						// Expect something back for this data (keep-alives are not answered)
+						peer->probe_pending = true;
+						peer->probe_tx = now;
+					}
 				}
 
 				pbuf_free(pbuf);
@@ -217,15 +428,18 @@ static err_t wireguardif_output_to_peer(struct netif *netif, struct pbuf *q, con
 
 			} else {
 				// Failed to allocate memory
+				WIREGUARD_STAT_INC(peer->stats, drops.no_memory);
 				result = ERR_MEM;
 			}
 		} else {
 			// key has expired...
+			WIREGUARD_STAT_INC(peer->stats, drops.key_expired);
 			keypair_destroy(keypair);
 			result = ERR_CONN;
 		}
 	} else {
 		// No valid keys!
+		WIREGUARD_STAT_INC(peer->stats, drops.no_keypair);
 		result = ERR_CONN;
 	}
 	return result;
@@ -235,15 +449,23 @@ static err_t wireguardif_output_to_peer(struct netif *netif, struct pbuf *q, con
 // The ipaddr here is the one inside the VPN which we use to lookup the correct peer/endpoint
 static err_t wireguardif_output(struct netif *netif, struct pbuf *q, const ip4_addr_t *ip4addr) {
 	struct wireguard_device *device = (struct wireguard_device *)netif->state;
+	err_t result;
+	WIREGUARD_STACK_BEGIN();
 	// Send to peer that matches dest IP
 	ip_addr_t ipaddr;
 	ip_addr_copy_from_ip4(ipaddr, *ip4addr);
 	struct wireguard_peer *peer = peer_lookup_by_allowed_ip(device, &ipaddr);
-	if (peer) {
-		return wireguardif_output_to_peer(netif, q, &ipaddr, peer);
+	if (device->suspended) {
+		// Nothing leaves (or gets queued for a handshake) until wireguardif_resume()
+		result = ERR_CONN;
+	} else if (peer) {
+		result = wireguardif_output_to_peer(netif, q, &ipaddr, peer);
 	} else {
-		return ERR_RTE;
+		WIREGUARD_STAT_INC(device->stats.totals, drops.allowed_ip);
+		result = ERR_RTE;
 	}
+	WIREGUARD_STACK_END(device);
+	return result;
 }
 
 static void wireguardif_send_keepalive(struct wireguard_device *device, struct wireguard_peer *peer) {
@@ -252,13 +474,37 @@ static void wireguardif_send_keepalive(struct wireguard_device *device, struct w
 }
 
 static void wireguardif_process_response_message(struct wireguard_device *device, struct wireguard_peer *peer, struct message_handshake_response *response, const ip_addr_t *addr, u16_t port) {
-	if (wireguard_process_handshake_response(device, peer, response)) {
+	bool valid;
+	int endpoint;
+	WIREGUARD_LATENCY_BEGIN(start);
+	valid = wireguard_process_handshake_response(device, peer, response);
+	WIREGUARD_LATENCY_END(device, WIREGUARD_STAGE_RESPONSE_CONSUME, start);
+	if (valid) {
 		// Packet is good
 		// Update the peer location
 		log_i(TAG "good handshake from %08x:%d", WG_IP4_U32(addr), port);
 		update_peer_addr(peer, addr, port);
+		WIREGUARD_STAT_INC(peer->stats, handshake_responses_rx);
+
+		if (peer->cold->initiation_pending) {
+			peer->cold->initiation_pending = false;
+			peer->cold->handshake_rtt = wireguard_sys_now() - peer->cold->last_initiation_tx;
+			peer_rtt_sample(peer, peer->cold->handshake_rtt);
+		}
+		peer_heard_from(peer);
+
+		// Initiations race to every candidate, so the first one to answer is also the quickest - keep it
+		endpoint = endpoint_find(peer, addr, port);
+		if (endpoint >= 0) {
+			peer->cold->endpoints[endpoint].rtt = peer->cold->handshake_rtt;
+			peer->cold->endpoints[endpoint].failures = 0;
+			peer->cold->endpoints[endpoint].skipped = 0;
+			endpoint_select(peer, endpoint);
+		}
+		peer->cold->endpoints_tried = 0;
 
 		wireguard_start_session(peer, true);
+		WIREGUARD_STAT_INC(peer->stats, handshakes_completed);
 		wireguardif_send_keepalive(device, peer);
 
 		// Set the IF-UP flag on netif
@@ -266,6 +512,7 @@ static void wireguardif_process_response_message(struct wireguard_device *device
 	} else {
 		// Packet bad
 		log_i(TAG "bad handshake from %08x:%d", WG_IP4_U32(addr), port);
+		WIREGUARD_STAT_INC(peer->stats, drops.auth_failure);
 	}
 }
 
@@ -273,26 +520,29 @@ static bool peer_add_ip(struct wireguard_peer *peer, ip_addr_t ip, ip_addr_t mas
 	bool result = false;
 	struct wireguard_allowed_ip *allowed;
 	int x;
-	// Look for existing match first
-	for (x=0; x < WIREGUARD_MAX_SRC_IPS; x++) {
-		allowed = &peer->allowed_source_ips[x];
-		if ((allowed->valid) && ip_addr_cmp(&allowed->ip, &ip) && ip_addr_cmp(&allowed->mask, &mask)) {
-			result = true;
-			break;
-		}
-	}
-	if (!result) {
-		// Look for a free slot
+	// Allowed IPs are matched as IPv4 networks only
+	if (IP_IS_V4(&ip) && IP_IS_V4(&mask)) {
+		// Look for existing match first
 		for (x=0; x < WIREGUARD_MAX_SRC_IPS; x++) {
 			allowed = &peer->allowed_source_ips[x];
-			if (!allowed->valid) {
-				allowed->valid = true;
-				allowed->ip = ip;
-				allowed->mask = mask;
+			if ((allowed->valid) && ip4_addr_cmp(&allowed->ip, ip_2_ip4(&ip)) && ip4_addr_cmp(&allowed->mask, ip_2_ip4(&mask))) {
 				result = true;
 				break;
 			}
 		}
+		if (!result) {
+			// Look for a free slot
+			for (x=0; x < WIREGUARD_MAX_SRC_IPS; x++) {
+				allowed = &peer->allowed_source_ips[x];
+				if (!allowed->valid) {
+					allowed->valid = true;
+					ip4_addr_copy(allowed->ip, *ip_2_ip4(&ip));
+					ip4_addr_copy(allowed->mask, *ip_2_ip4(&mask));
+					result = true;
+					break;
+				}
+			}
+		}
 	}
 	return result;
 }
@@ -304,9 +554,10 @@ static void wireguardif_process_data_message(struct wireguard_device *device, st
 	size_t src_len;
 	struct pbuf *pbuf;
 	struct ip_hdr *iphdr;
-	ip_addr_t dest;
+	ip4_addr_t dest;
 	bool dest_ok = false;
 	int x;
+	bool decrypted;
 	uint32_t now;
 	uint16_t header_len = 0xFFFF;
 	uint32_t idx = data_hdr->receiver;
@@ -326,11 +577,17 @@ static void wireguardif_process_data_message(struct wireguard_device *device, st
 			src_len = data_len;
 
 			// We don't know the unpadded size until we have decrypted the packet and validated/inspected the IP header
-			pbuf = pbuf_alloc(PBUF_TRANSPORT, src_len - WIREGUARD_AUTHTAG_LEN, PBUF_RAM);
+			WIREGUARD_LATENCY_BEGIN(alloc_start);
+			pbuf = wireguard_pbuf_alloc(src_len - WIREGUARD_AUTHTAG_LEN);
+			WIREGUARD_LATENCY_END(device, WIREGUARD_STAGE_PBUF_ALLOC, alloc_start);
+			ALLOC_RECORD_PBUF(WIREGUARD_ALLOC_TRANSPORT_RX, pbuf, src_len - WIREGUARD_AUTHTAG_LEN);
 			if (pbuf) {
 				// Decrypt the packet
 				memset(pbuf->payload, 0, pbuf->tot_len);
-				if (wireguard_decrypt_packet(pbuf->payload, src, src_len, nonce, keypair)) {
+				WIREGUARD_LATENCY_BEGIN(decrypt_start);
+				decrypted = wireguard_decrypt_packet(pbuf->payload, src, src_len, nonce, keypair);
+				WIREGUARD_LATENCY_END(device, WIREGUARD_STAGE_DECRYPT, decrypt_start);
+				if (decrypted) {
 
 					// 3. Since the packet has authenticated correctly, the source IP of the outer UDP/IP packet is used to update the endpoint for peer TrMv...WXX0.
 					// Update the peer location
@@ -339,6 +596,11 @@ static void wireguardif_process_data_message(struct wireguard_device *device, st
 					now = wireguard_sys_now();
 					keypair->last_rx = now;
 					peer->last_rx = now;
+					// Shows the peer is alive, but the time since our data is no RTT sample: it includes the time the
+					// application takes to answer, or is next to nothing when unrelated traffic comes in
+					peer_heard_from(peer);
+					WIREGUARD_STAT_INC(peer->stats, rx_packets);
+					WIREGUARD_STAT_ADD(peer->stats, rx_bytes, data_len + sizeof(struct message_transport_data));
 
 					// Might need to shuffle next key --> current keypair
 					keypair_update(peer, keypair);
@@ -352,19 +614,21 @@ static void wireguardif_process_data_message(struct wireguard_device *device, st
 					netif_set_link_up(device->netif);
 
 					if (pbuf->tot_len > 0) {
+						WIREGUARD_CAPTURE_INNER(device, WIREGUARD_CAPTURE_INNER_RX, pbuf);
 						//4a. Once the packet payload is decrypted, the interface has a plaintext packet. If this is not an IP packet, it is dropped.
 						iphdr = (struct ip_hdr *)pbuf->payload;
 						// Check for packet replay / dupes
 						if (wireguard_check_replay(keypair, nonce)) {
+							WIREGUARD_PERSIST_RX(device, keypair);
 
 							// 4b. Otherwise, WireGuard checks to see if the source IP address of the plaintext inner-packet routes correspondingly in the cryptokey routing table
 							// Also check packet length!
 #if LWIP_IPV4
 							if (IPH_V(iphdr) == 4) {
-								ip_addr_copy_from_ip4(dest, iphdr->dest);
+								ip4_addr_copy(dest, iphdr->dest);
 								for (x=0; x < WIREGUARD_MAX_SRC_IPS; x++) {
 									if (peer->allowed_source_ips[x].valid) {
-										if (ip_addr_netcmp(&dest, &peer->allowed_source_ips[x].ip, ip_2_ip4(&peer->allowed_source_ips[x].mask))) {
+										if (ip4_addr_netcmp(&dest, &peer->allowed_source_ips[x].ip, &peer->allowed_source_ips[x].mask)) {
 											dest_ok = true;
 											header_len = PP_NTOHS(IPH_LEN(iphdr));
 											break;
@@ -385,24 +649,35 @@ static void wireguardif_process_data_message(struct wireguard_device *device, st
 								// 5. If the plaintext packet has not been dropped, it is inserted into the receive queue of the wg0 interface.
 								if (dest_ok) {
 									// Send packet to be process by LWIP
+									WIREGUARD_LATENCY_BEGIN(input_start);
 									ip_input(pbuf, device->netif);
+									WIREGUARD_LATENCY_END(device, WIREGUARD_STAGE_IP_INPUT, input_start);
 									// pbuf is owned by IP layer now
 									pbuf = NULL;
+								} else {
+									WIREGUARD_STAT_INC(peer->stats, drops.allowed_ip);
 								}
 							} else {
 								// IP header is corrupt or lied about packet size
+								WIREGUARD_STAT_INC(peer->stats, drops.malformed);
 							}
 						} else {
 							// This is a duplicate packet / replayed / too far out of order
+							WIREGUARD_STAT_INC(peer->stats, drops.replay);
 						}
 					} else {
 						// This was a keep-alive packet
+						WIREGUARD_STAT_INC(peer->stats, keepalives_rx);
 					}
+				} else {
+					WIREGUARD_STAT_INC(peer->stats, drops.auth_failure);
 				}
 
 				if (pbuf) {
 					pbuf_free(pbuf);
 				}
+			} else {
+				WIREGUARD_STAT_INC(peer->stats, drops.no_memory);
 			}
 
 
@@ -410,33 +685,36 @@ static void wireguardif_process_data_message(struct wireguard_device *device, st
 			//After Reject-After-Messages transport data messages or after the current secure session is Reject- After-Time seconds old,
 			// whichever comes first, WireGuard will refuse to send or receive any more transport data messages using the current secure session,
 			// until a new secure session is created through the 1-RTT handshake
+			WIREGUARD_STAT_INC(peer->stats, drops.key_expired);
 			keypair_destroy(keypair);
 		}
 
 	} else {
 		// Could not locate valid keypair for remote index
+		WIREGUARD_STAT_INC(peer->stats, drops.no_keypair);
 	}
 }
 
-static struct pbuf *wireguardif_initiate_handshake(struct wireguard_device *device, struct wireguard_peer *peer, struct message_handshake_initiation *msg, err_t *error) {
-	struct pbuf *pbuf = NULL;
+// The handshake messages are built straight into the pbuf they are sent in - allocated first, so
+// running out of memory costs no DH work and no message struct sits on the stack of the caller
+static struct pbuf *wireguardif_initiate_handshake(struct wireguard_device *device, struct wireguard_peer *peer, err_t *error) {
+	struct pbuf *pbuf;
 	err_t err = ERR_OK;
-	if (wireguard_create_handshake_initiation(device, peer, msg)) {
-		// Send this packet out!
-		pbuf = pbuf_alloc(PBUF_TRANSPORT, sizeof(struct message_handshake_initiation), PBUF_RAM);
-		if (pbuf) {
-			err = pbuf_take(pbuf, msg, sizeof(struct message_handshake_initiation));
-			if (err == ERR_OK) {
-				// OK!
-			} else {
-				pbuf_free(pbuf);
-				pbuf = NULL;
-			}
-		} else {
-			err = ERR_MEM;
+	bool created;
+	// PBUF_RAM is one contiguous payload, see wireguardif_output_to_peer()
+	pbuf = pbuf_alloc(PBUF_TRANSPORT, sizeof(struct message_handshake_initiation), PBUF_RAM);
+	ALLOC_RECORD_PBUF(WIREGUARD_ALLOC_HANDSHAKE, pbuf, sizeof(struct message_handshake_initiation));
+	if (pbuf) {
+		WIREGUARD_LATENCY_BEGIN(start);
+		created = wireguard_create_handshake_initiation(device, peer, (struct message_handshake_initiation *)pbuf->payload);
+		WIREGUARD_LATENCY_END(device, WIREGUARD_STAGE_INITIATION_CREATE, start);
+		if (!created) {
+			pbuf_free(pbuf);
+			pbuf = NULL;
+			err = ERR_ARG;
 		}
 	} else {
-		err = ERR_ARG;
+		err = ERR_MEM;
 	}
 	if (error) {
 		*error = err;
@@ -445,24 +723,30 @@ static struct pbuf *wireguardif_initiate_handshake(struct wireguard_device *devi
 }
 
 static void wireguardif_send_handshake_response(struct wireguard_device *device, struct wireguard_peer *peer) {
-	struct message_handshake_response packet;
-	struct pbuf *pbuf = NULL;
-	err_t err = ERR_OK;
+	struct pbuf *pbuf;
+	bool created;
 
-	if (wireguard_create_handshake_response(device, peer, &packet)) {
+	pbuf = pbuf_alloc(PBUF_TRANSPORT, sizeof(struct message_handshake_response), PBUF_RAM);
+	ALLOC_RECORD_PBUF(WIREGUARD_ALLOC_HANDSHAKE, pbuf, sizeof(struct message_handshake_response));
+	if (pbuf) {
+		WIREGUARD_LATENCY_BEGIN(start);
+		created = wireguard_create_handshake_response(device, peer, (struct message_handshake_response *)pbuf->payload);
+		WIREGUARD_LATENCY_END(device, WIREGUARD_STAGE_RESPONSE_CREATE, start);
+		if (created) {
 
-		wireguard_start_session(peer, false);
+			wireguard_start_session(peer, false);
+			WIREGUARD_STAT_INC(peer->stats, handshakes_completed);
 
-		// Send this packet out!
-		pbuf = pbuf_alloc(PBUF_TRANSPORT, sizeof(struct message_handshake_response), PBUF_RAM);
-		if (pbuf) {
-			err = pbuf_take(pbuf, &packet, sizeof(struct message_handshake_response));
-			if (err == ERR_OK) {
-				// OK!
-				wireguardif_peer_output(device->netif, pbuf, peer);
+			// Send this packet out!
+			if (wireguardif_peer_output(device->netif, pbuf, peer) == ERR_OK) {
+				WIREGUARD_STAT_INC(peer->stats, handshake_responses_tx);
 			}
-			pbuf_free(pbuf);
 		}
+		pbuf_free(pbuf);
+	} else {
+		// Nothing to answer with - the initiator retries and gets a fresh context then
+		handshake_release(peer);
+		WIREGUARD_STAT_INC(peer->stats, drops.no_memory);
 	}
 }
 
@@ -496,23 +780,53 @@ static size_t get_source_addr_port(const ip_addr_t *addr, u16_t port, uint8_t *b
 }
 
 static void wireguardif_send_handshake_cookie(struct wireguard_device *device, const uint8_t *mac1, uint32_t index, const ip_addr_t *addr, u16_t port) {
-	struct message_cookie_reply packet;
-	struct pbuf *pbuf = NULL;
-	err_t err = ERR_OK;
+	struct pbuf *pbuf;
 	uint8_t source_buf[18];
 	size_t source_len = get_source_addr_port(addr, port, source_buf, sizeof(source_buf));
 
-	wireguard_create_cookie_reply(device, &packet, mac1, index, source_buf, source_len);
-
-	// Send this packet out!
 	pbuf = pbuf_alloc(PBUF_TRANSPORT, sizeof(struct message_cookie_reply), PBUF_RAM);
+	ALLOC_RECORD_PBUF(WIREGUARD_ALLOC_COOKIE, pbuf, sizeof(struct message_cookie_reply));
 	if (pbuf) {
-		err = pbuf_take(pbuf, &packet, sizeof(struct message_cookie_reply));
-		if (err == ERR_OK) {
-			wireguardif_device_output(device, pbuf, addr, port);
+		wireguard_create_cookie_reply(device, (struct message_cookie_reply *)pbuf->payload, mac1, index, source_buf, source_len);
+
+		// Send this packet out!
+		if (wireguardif_device_output(device, pbuf, addr, port) == ERR_OK) {
+			WIREGUARD_STAT_INC(device->stats, cookies_tx);
 		}
 		pbuf_free(pbuf);
+	} else {
+		WIREGUARD_STAT_INC(device->stats.totals, drops.no_memory);
+	}
+}
+
+static bool wireguardif_source_allowed(struct wireguard_device *device, const ip_addr_t *addr) {
+#if WIREGUARD_RATELIMIT
+	return wireguard_ratelimit_allow(&device->ratelimit, addr, wireguard_sys_now());
+#else
+	LWIP_UNUSED_ARG(device);
+	LWIP_UNUSED_ARG(addr);
+	return true;
+#endif
+}
+
+static bool wireguardif_under_load(struct wireguard_device *device) {
+#if WIREGUARD_RATELIMIT
+	if (wireguard_ratelimit_under_load(&device->ratelimit, wireguard_sys_now())) {
+		return true;
 	}
+#else
+	LWIP_UNUSED_ARG(device);
+#endif
+	return wireguard_is_under_load();
+}
+
+// A handshake message passed the mac checks and is about to cost DH work
+static void wireguardif_handshake_work(struct wireguard_device *device) {
+#if WIREGUARD_RATELIMIT
+	wireguard_ratelimit_work(&device->ratelimit, wireguard_sys_now());
+#else
+	LWIP_UNUSED_ARG(device);
+#endif
 }
 
 static bool wireguardif_check_initiation_message(struct wireguard_device *device, struct message_handshake_initiation *msg, const ip_addr_t *addr, u16_t port) {
@@ -524,7 +838,7 @@ static bool wireguardif_check_initiation_message(struct wireguard_device *device
 
 	if (wireguard_check_mac1(device, data, sizeof(struct message_handshake_initiation) - (2 * WIREGUARD_COOKIE_LEN), msg->mac1)) {
 		// mac1 is valid!
-		if (!wireguard_is_under_load()) {
+		if (!wireguardif_under_load(device)) {
 			// If we aren't under load we only need mac1 to be correct
 			result = true;
 		} else {
@@ -538,11 +852,16 @@ static bool wireguardif_check_initiation_message(struct wireguard_device *device
 				// 5.3 Denial of Service Mitigation & Cookies
 				// If the responder receives a message with a valid msg.mac1 yet with an invalid msg.mac2, and is under load, it may respond with a cookie reply message
 				wireguardif_send_handshake_cookie(device, msg->mac1, msg->sender, addr, port);
+			} else if (!wireguardif_source_allowed(device, addr)) {
+				// mac2 proves the source address, only now is its handshake budget its own - drop before any DH work
+				WIREGUARD_STAT_INC(device->stats.totals, drops.rate_limited);
+				result = false;
 			}
 		}
 
 	} else {
 		// mac1 is invalid
+		WIREGUARD_STAT_INC(device->stats.totals, drops.bad_mac1);
 	}
 	return result;
 }
@@ -556,7 +875,7 @@ static bool wireguardif_check_response_message(struct wireguard_device *device,
 
 	if (wireguard_check_mac1(device, data, sizeof(struct message_handshake_response) - (2 * WIREGUARD_COOKIE_LEN), msg->mac1)) {
 		// mac1 is valid!
-		if (!wireguard_is_under_load()) {
+		if (!wireguardif_under_load(device)) {
 			// If we aren't under load we only need mac1 to be correct
 			result = true;
 		} else {
@@ -570,11 +889,16 @@ static bool wireguardif_check_response_message(struct wireguard_device *device,
 				// 5.3 Denial of Service Mitigation & Cookies
 				// If the responder receives a message with a valid msg.mac1 yet with an invalid msg.mac2, and is under load, it may respond with a cookie reply message
 				wireguardif_send_handshake_cookie(device, msg->mac1, msg->sender, addr, port);
+			} else if (!wireguardif_source_allowed(device, addr)) {
+				// mac2 proves the source address, only now is its handshake budget its own - drop before any DH work
+				WIREGUARD_STAT_INC(device->stats.totals, drops.rate_limited);
+				result = false;
 			}
 		}
 
 	} else {
 		// mac1 is invalid
+		WIREGUARD_STAT_INC(device->stats.totals, drops.bad_mac1);
 	}
 	return result;
 }
@@ -592,9 +916,11 @@ void wireguardif_network_rx(void *arg, struct udp_pcb *pcb, struct pbuf *p, cons
 	struct message_cookie_reply *msg_cookie;
 	struct message_transport_data *msg_data;
 
+	#ifdef DEBUG_DEEP
 	log_i(TAG "=== UDP RX START ===");
 	log_i(TAG "RX from %s:%d, len=%d, local port: %d", 
 				ipaddr_ntoa(addr), port, p->len, pcb->local_port);
+	#endif
 
 	// check if this is a loopback packet
 	if (ip_addr_cmp(addr, &pcb->local_ip)) {
@@ -603,10 +929,16 @@ void wireguardif_network_rx(void *arg, struct udp_pcb *pcb, struct pbuf *p, cons
 			return;
 	}
 
+	WIREGUARD_STACK_BEGIN();
+
 	// Log first bytes
 	uint8_t *data = (uint8_t *)p->payload;
 	size_t len = p->len; // This buf, not chained ones
+	#ifdef DEBUG_DEEP
 	log_i(TAG "RX packet type: 0x%02X", data[0]);
+	#endif
+	WIREGUARD_CAPTURE_OUTER(device, WIREGUARD_CAPTURE_OUTER_RX, p, addr, port);
+	WIREGUARD_RECORD_RX(device, p, addr, port);
 
 	uint8_t type = wireguard_get_message_type(data, len);
 	ESP_LOGV(TAG, "network_rx: %08x:%d", WG_IP4_U32(addr), port);
@@ -617,9 +949,14 @@ void wireguardif_network_rx(void *arg, struct udp_pcb *pcb, struct pbuf *p, cons
 			log_i(TAG "HANDSHAKE_INITIATION: %08x:%d", WG_IP4_U32(addr), port);
 			// Check mac1 (and optionally mac2) are correct - note it may internally generate a cookie reply packet
 			if (wireguardif_check_initiation_message(device, msg_initiation, addr, port)) {
+				wireguardif_handshake_work(device);
 
+				WIREGUARD_LATENCY_BEGIN(start);
 				peer = wireguard_process_initiation_message(device, msg_initiation);
+				WIREGUARD_LATENCY_END(device, WIREGUARD_STAGE_INITIATION_CONSUME, start);
 				if (peer) {
+					WIREGUARD_STAT_INC(peer->stats, handshake_initiations_rx);
+					peer_heard_from(peer);
 					// Update the peer location
 					update_peer_addr(peer, addr, port);
 
@@ -638,8 +975,11 @@ void wireguardif_network_rx(void *arg, struct udp_pcb *pcb, struct pbuf *p, cons
 
 				peer = peer_lookup_by_handshake(device, msg_response->receiver);
 				if (peer) {
+					wireguardif_handshake_work(device);
 					// Process the handshake response
 					wireguardif_process_response_message(device, peer, msg_response, addr, port);
+				} else {
+					WIREGUARD_STAT_INC(device->stats.totals, drops.no_keypair);
 				}
 			}
 			break;
@@ -650,11 +990,16 @@ void wireguardif_network_rx(void *arg, struct udp_pcb *pcb, struct pbuf *p, cons
 			peer = peer_lookup_by_handshake(device, msg_cookie->receiver);
 			if (peer) {
 				if (wireguard_process_cookie_message(device, peer, msg_cookie)) {
+					WIREGUARD_STAT_INC(peer->stats, cookies_rx);
 					// Update the peer location
 					update_peer_addr(peer, addr, port);
 
 					// Don't send anything out - we stay quiet until the next initiation message
+				} else {
+					WIREGUARD_STAT_INC(peer->stats, drops.auth_failure);
 				}
+			} else {
+				WIREGUARD_STAT_INC(device->stats.totals, drops.no_keypair);
 			}
 			break;
 
@@ -666,17 +1011,23 @@ void wireguardif_network_rx(void *arg, struct udp_pcb *pcb, struct pbuf *p, cons
 			if (peer) {
 				// header is 16 bytes long so take that off the length
 				wireguardif_process_data_message(device, peer, msg_data, len - 16, addr, port);
+			} else {
+				WIREGUARD_STAT_INC(device->stats.totals, drops.no_keypair);
 			}
 			break;
 
 		default:
 			// Unknown or bad packet header
+			WIREGUARD_STAT_INC(device->stats.totals, drops.malformed);
 			break;
 	}
 	// Release data!
 	pbuf_free(p);
+	WIREGUARD_STACK_END(device);
 
+	#ifdef DEBUG_DEEP
 	log_i(TAG "=== UDP RX END ===");
+	#endif
 }
 
 // static err_t wireguard_start_handshake(struct netif *netif, struct wireguard_peer *peer) {
@@ -691,35 +1042,86 @@ void wireguardif_network_rx(void *arg, struct udp_pcb *pcb, struct pbuf *p, cons
 // 		log_i(TAG "start handshake %08x,%d - %d", WG_IP4_U32(&peer->ip), peer->port, result);
 // 		pbuf_free(pbuf);
 // 		peer->send_handshake = false;
-// 		peer->last_initiation_tx = wireguard_sys_now();
-// 		memcpy(peer->handshake_mac1, msg.mac1, WIREGUARD_COOKIE_LEN);
-// 		peer->handshake_mac1_valid = true;
+// 		peer->cold->last_initiation_tx = wireguard_sys_now();
+// 		memcpy(peer->cold->handshake_mac1, msg.mac1, WIREGUARD_COOKIE_LEN);
+// 		peer->cold->handshake_mac1_valid = true;
 // 	}
 // 	return result;
 // }
 
+// Send a copy of the initiation to another candidate endpoint (a pbuf cannot be sent twice)
+static err_t wireguardif_send_initiation_to(struct wireguard_device *device, const struct message_handshake_initiation *msg, const ip_addr_t *addr, u16_t port) {
+	struct pbuf *pbuf;
+	err_t result = ERR_MEM;
+	pbuf = pbuf_alloc(PBUF_TRANSPORT, sizeof(struct message_handshake_initiation), PBUF_RAM);
+	ALLOC_RECORD_PBUF(WIREGUARD_ALLOC_HANDSHAKE, pbuf, sizeof(struct message_handshake_initiation));
+	if (pbuf) {
+		result = pbuf_take(pbuf, msg, sizeof(struct message_handshake_initiation));
+		if (result == ERR_OK) {
+			WIREGUARD_CAPTURE_OUTER(device, WIREGUARD_CAPTURE_OUTER_TX, pbuf, addr, port);
+			WIREGUARD_LATENCY_BEGIN(start);
+			result = udp_sendto(device->udp_pcb, pbuf, addr, port);
+			WIREGUARD_LATENCY_END(device, WIREGUARD_STAGE_UDP_SEND, start);
+		}
+		pbuf_free(pbuf);
+	}
+	return result;
+}
+
+// Race all candidates when there is no session or the current endpoint stopped answering
+static bool wireguardif_should_fan_out(struct wireguard_peer *peer) {
+	return (endpoint_count(peer) > 1) &&
+		((!PEER_CURR_KEYPAIR(peer)->valid && !PEER_PREV_KEYPAIR(peer)->valid) || (peer->missed_responses > 0));
+}
+
 static err_t wireguard_start_handshake(struct netif *netif, struct wireguard_peer *peer) {
     log_i(TAG "STARTING HANDSHAKE for peer");
     
     struct wireguard_device *device = (struct wireguard_device *)netif->state;
     err_t result;
     struct pbuf *pbuf;
-    struct message_handshake_initiation msg;
+    bool copy_sent = false;
+    int x;
 
     log_i(TAG "Creating handshake initiation packet...");
-    pbuf = wireguardif_initiate_handshake(device, peer, &msg, &result);
+    pbuf = wireguardif_initiate_handshake(device, peer, &result);
     
     if (pbuf) {
         log_i(TAG "Handshake packet created, size: %d", pbuf->tot_len);
+        x = endpoint_find(peer, &peer->ip, peer->port);
+        if ((x >= 0) && wireguardif_should_fan_out(peer)) {
+            endpoint_fallback(peer, x);
+            x = peer->cold->endpoint_index;
+        }
+        peer->cold->endpoints_tried = (x >= 0) ? (1 << x) : 0;
+        // The copies go first, from the payload of the pbuf - sending it may prepend headers to it
+        if (wireguardif_should_fan_out(peer) && (device->udp_pcb != NULL)) {
+            for (x=0; x < WIREGUARD_MAX_ENDPOINTS; x++) {
+                if (peer->cold->endpoints[x].valid && !(peer->cold->endpoints_tried & (1 << x)) && endpoint_fan_out_due(&peer->cold->endpoints[x])) {
+                    if (wireguardif_send_initiation_to(device, (const struct message_handshake_initiation *)pbuf->payload, &peer->cold->endpoints[x].ip, peer->cold->endpoints[x].port) == ERR_OK) {
+                        peer->cold->endpoints_tried |= (1 << x);
+                        copy_sent = true;
+                    }
+                }
+            }
+        }
         result = wireguardif_peer_output(netif, pbuf, peer);
         log_i(TAG "Handshake sent, result: %d", result);
         pbuf_free(pbuf);
+        if (copy_sent) {
+            result = ERR_OK;
+        }
+        if (result == ERR_OK) {
+            WIREGUARD_STAT_INC(peer->stats, handshake_initiations_tx);
+        }
         peer->send_handshake = false;
-        peer->last_initiation_tx = wireguard_sys_now();
-        memcpy(peer->handshake_mac1, msg.mac1, WIREGUARD_COOKIE_LEN);
-        peer->handshake_mac1_valid = true;
+        peer->cold->last_initiation_tx = wireguard_sys_now();
+        peer->cold->initiation_pending = true;
     } else {
         log_i(TAG "Failed to create handshake, error: %d", result);
+        if (result == ERR_MEM) {
+            WIREGUARD_STAT_INC(peer->stats, drops.no_memory);
+        }
     }
     
     return result;
@@ -751,11 +1153,11 @@ err_t wireguardif_connect(struct netif *netif, u8_t peer_index) {
 	err_t result = wireguardif_lookup_peer(netif, peer_index, &peer);
 	if (result == ERR_OK) {
 		// Check that a valid connect ip and port have been set
-		if (!ip_addr_isany(&peer->connect_ip) && (peer->connect_port > 0)) {
+		if (!ip_addr_isany(&peer->cold->connect_ip) && (peer->cold->connect_port > 0)) {
 			// Set the flag that we want to try connecting
-			peer->active = true;
-			peer->ip = peer->connect_ip;
-			peer->port = peer->connect_port;
+			peer->cold->active = true;
+			peer->ip = peer->cold->connect_ip;
+			peer->port = peer->cold->connect_port;
 			result = ERR_OK;
 		} else {
 			result = ERR_ARG;
@@ -769,11 +1171,14 @@ err_t wireguardif_disconnect(struct netif *netif, u8_t peer_index) {
 	err_t result = wireguardif_lookup_peer(netif, peer_index, &peer);
 	if (result == ERR_OK) {
 		// Set the flag that we want to try connecting
-		peer->active = false;
+		peer->cold->active = false;
+		peer->probe_pending = false;
+		peer->cold->initiation_pending = false;
+		peer->missed_responses = 0;
 		// Wipe out current keys
-		keypair_destroy(&peer->next_keypair);
-		keypair_destroy(&peer->curr_keypair);
-		keypair_destroy(&peer->prev_keypair);
+		keypair_destroy(PEER_NEXT_KEYPAIR(peer));
+		keypair_destroy(PEER_CURR_KEYPAIR(peer));
+		keypair_destroy(PEER_PREV_KEYPAIR(peer));
 		result = ERR_OK;
 	}
 	return result;
@@ -783,7 +1188,7 @@ err_t wireguardif_peer_is_up(struct netif *netif, u8_t peer_index, ip_addr_t *cu
 	struct wireguard_peer *peer;
 	err_t result = wireguardif_lookup_peer(netif, peer_index, &peer);
 	if (result == ERR_OK) {
-		if ((peer->curr_keypair.valid) || (peer->prev_keypair.valid)) {
+		if ((PEER_CURR_KEYPAIR(peer)->valid) || (PEER_PREV_KEYPAIR(peer)->valid)) {
 			result = ERR_OK;
 		} else {
 			result = ERR_CONN;
@@ -798,12 +1203,266 @@ err_t wireguardif_peer_is_up(struct netif *netif, u8_t peer_index, ip_addr_t *cu
 	return result;
 }
 
+err_t wireguardif_get_peer_stats(struct netif *netif, u8_t peer_index, struct wireguard_peer_stats *stats) {
+	struct wireguard_peer *peer;
+	err_t result;
+	WG_LWIP_LOCK();
+	result = wireguardif_lookup_peer(netif, peer_index, &peer);
+	if (result == ERR_OK) {
+		*stats = peer->stats;
+	}
+	WG_LWIP_UNLOCK();
+	return result;
+}
+
+err_t wireguardif_get_device_stats(struct netif *netif, struct wireguard_device_stats *stats) {
+	struct wireguard_device *device = (struct wireguard_device *)netif->state;
+	err_t result = ERR_ARG;
+	int x;
+	WG_LWIP_LOCK();
+	if (device && device->valid) {
+		*stats = device->stats;
+		wireguard_pbuf_pool_get_stats(&stats->pbuf_pool);
+		for (x=0; x < WIREGUARD_MAX_PEERS; x++) {
+			if (device->peers[x].valid) {
+				wireguard_stats_accumulate(&stats->totals, &device->peers[x].stats);
+			}
+		}
+		result = ERR_OK;
+	}
+	WG_LWIP_UNLOCK();
+	return result;
+}
+
+err_t wireguardif_get_peer_liveness(struct netif *netif, u8_t peer_index, struct wireguard_peer_liveness *liveness) {
+	struct wireguard_peer *peer;
+	err_t result;
+	WG_LWIP_LOCK();
+	result = wireguardif_lookup_peer(netif, peer_index, &peer);
+	if (result == ERR_OK) {
+		memset(liveness, 0, sizeof(struct wireguard_peer_liveness));
+		if (PEER_CURR_KEYPAIR(peer)->valid || PEER_PREV_KEYPAIR(peer)->valid) {
+			liveness->state = peer_is_suspect(peer) ? WIREGUARD_LIVENESS_SUSPECT : WIREGUARD_LIVENESS_ALIVE;
+		} else {
+			liveness->state = WIREGUARD_LIVENESS_DOWN;
+		}
+		liveness->missed_responses = peer->missed_responses;
+		liveness->srtt = peer->srtt;
+		liveness->rttvar = peer->rttvar;
+		liveness->last_rtt = peer->last_rtt;
+		liveness->handshake_rtt = peer->cold->handshake_rtt;
+		liveness->last_rx_age = (peer->last_rx != 0) ? (wireguard_sys_now() - peer->last_rx) : UINT32_MAX;
+	}
+	WG_LWIP_UNLOCK();
+	return result;
+}
+
+err_t wireguardif_get_latency_histogram(struct netif *netif, u8_t stage, struct wireguard_histogram *hist) {
+	err_t result = ERR_ARG;
+#if WIREGUARD_LATENCY_HISTOGRAMS
+	struct wireguard_device *device = (struct wireguard_device *)netif->state;
+	WG_LWIP_LOCK();
+	if (device && device->valid && (stage < WIREGUARD_STAGE_COUNT)) {
+		*hist = device->latency[stage];
+		result = ERR_OK;
+	}
+	WG_LWIP_UNLOCK();
+#else
+	LWIP_UNUSED_ARG(netif);
+	LWIP_UNUSED_ARG(stage);
+	LWIP_UNUSED_ARG(hist);
+	result = ERR_VAL;
+#endif
+	return result;
+}
+
+err_t wireguardif_reset_latency_histograms(struct netif *netif) {
+	err_t result = ERR_ARG;
+#if WIREGUARD_LATENCY_HISTOGRAMS
+	struct wireguard_device *device = (struct wireguard_device *)netif->state;
+	WG_LWIP_LOCK();
+	if (device && device->valid) {
+		memset(device->latency, 0, sizeof(device->latency));
+		result = ERR_OK;
+	}
+	WG_LWIP_UNLOCK();
+#else
+	LWIP_UNUSED_ARG(netif);
+	result = ERR_VAL;
+#endif
+	return result;
+}
+
+err_t wireguardif_get_alloc_stats(struct wireguard_alloc_stats *stats) {
+	err_t result = ERR_VAL;
+#if WIREGUARD_ALLOC_STATS
+	uint32_t heap = 0;
+	int x;
+	WG_LWIP_LOCK();
+	*stats = alloc_stats;
+	WG_LWIP_UNLOCK();
+	for (x=0; x < WIREGUARD_ALLOC_SITE_COUNT; x++) {
+		heap += stats->sites[x].heap;
+	}
+	stats->packets = stats->sites[WIREGUARD_ALLOC_TRANSPORT_TX].allocs + stats->sites[WIREGUARD_ALLOC_TRANSPORT_TX].failures
+			+ stats->sites[WIREGUARD_ALLOC_TRANSPORT_RX].allocs + stats->sites[WIREGUARD_ALLOC_TRANSPORT_RX].failures;
+	stats->heap_per_1000_packets = (stats->packets > 0) ? (uint32_t)(((uint64_t)heap * 1000) / stats->packets) : 0;
+	result = ERR_OK;
+#else
+	LWIP_UNUSED_ARG(stats);
+#endif
+	return result;
+}
+
+err_t wireguardif_reset_alloc_stats(void) {
+	err_t result = ERR_VAL;
+#if WIREGUARD_ALLOC_STATS
+	WG_LWIP_LOCK();
+	memset(&alloc_stats, 0, sizeof(alloc_stats));
+	WG_LWIP_UNLOCK();
+	result = ERR_OK;
+#endif
+	return result;
+}
+
+err_t wireguardif_capture_enable(struct netif *netif, bool enable) {
+	err_t result = ERR_ARG;
+#if WIREGUARD_CAPTURE
+	struct wireguard_device *device = (struct wireguard_device *)netif->state;
+	WG_LWIP_LOCK();
+	if (device && device->valid) {
+		device->capture.enabled = enable;
+		result = ERR_OK;
+	}
+	WG_LWIP_UNLOCK();
+#else
+	LWIP_UNUSED_ARG(netif);
+	LWIP_UNUSED_ARG(enable);
+	result = ERR_VAL;
+#endif
+	return result;
+}
+
+err_t wireguardif_capture_clear(struct netif *netif) {
+	err_t result = ERR_ARG;
+#if WIREGUARD_CAPTURE
+	struct wireguard_device *device = (struct wireguard_device *)netif->state;
+	bool enabled;
+	WG_LWIP_LOCK();
+	if (device && device->valid) {
+		enabled = device->capture.enabled;
+		wireguard_capture_init(&device->capture);
+		device->capture.enabled = enabled;
+		result = ERR_OK;
+	}
+	WG_LWIP_UNLOCK();
+#else
+	LWIP_UNUSED_ARG(netif);
+	result = ERR_VAL;
+#endif
+	return result;
+}
+
+err_t wireguardif_capture_export(struct netif *netif, wireguard_capture_write_fn write, void *arg) {
+	err_t result = ERR_ARG;
+#if WIREGUARD_CAPTURE
+	struct wireguard_device *device = (struct wireguard_device *)netif->state;
+	bool enabled = false;
+	WG_LWIP_LOCK();
+	if (device && device->valid && write) {
+		// Freeze the ring so the (possibly slow) writer can run without holding the lwIP lock
+		enabled = device->capture.enabled;
+		device->capture.enabled = false;
+		result = ERR_OK;
+	}
+	WG_LWIP_UNLOCK();
+	if (result == ERR_OK) {
+		wireguard_capture_export_pcap(&device->capture, write, arg);
+		WG_LWIP_LOCK();
+		device->capture.enabled = enabled;
+		WG_LWIP_UNLOCK();
+	}
+#else
+	LWIP_UNUSED_ARG(netif);
+	LWIP_UNUSED_ARG(write);
+	LWIP_UNUSED_ARG(arg);
+	result = ERR_VAL;
+#endif
+	return result;
+}
+
+err_t wireguardif_record_start(struct netif *netif) {
+	err_t result = ERR_ARG;
+#if WIREGUARD_RECORD
+	struct wireguard_device *device = (struct wireguard_device *)netif->state;
+	WG_LWIP_LOCK();
+	if (device && device->valid) {
+		wireguard_record_start(&device->recorder, device);
+		result = ERR_OK;
+	}
+	WG_LWIP_UNLOCK();
+#else
+	LWIP_UNUSED_ARG(netif);
+	result = ERR_VAL;
+#endif
+	return result;
+}
+
+err_t wireguardif_record_stop(struct netif *netif) {
+	err_t result = ERR_ARG;
+#if WIREGUARD_RECORD
+	struct wireguard_device *device = (struct wireguard_device *)netif->state;
+	WG_LWIP_LOCK();
+	if (device && device->valid) {
+		device->recorder.active = false;
+		result = ERR_OK;
+	}
+	WG_LWIP_UNLOCK();
+#else
+	LWIP_UNUSED_ARG(netif);
+	result = ERR_VAL;
+#endif
+	return result;
+}
+
+err_t wireguardif_record_drain(struct netif *netif, wireguard_record_write_fn write, void *arg) {
+	err_t result = ERR_ARG;
+#if WIREGUARD_RECORD
+	struct wireguard_device *device = (struct wireguard_device *)netif->state;
+	uint8_t chunk[512];
+	size_t len;
+	if (device && write) {
+		result = ERR_OK;
+		// Take the ring a chunk at a time under the lock and let the (possibly slow) writer run outside it
+		do {
+			len = 0;
+			WG_LWIP_LOCK();
+			if (device->valid) {
+				len = wireguard_record_take(&device->recorder, chunk, sizeof(chunk));
+			}
+			WG_LWIP_UNLOCK();
+			if (len > 0) {
+				write(arg, chunk, len);
+			}
+		} while (len > 0);
+		crypto_zero(chunk, sizeof(chunk));
+	}
+#else
+	LWIP_UNUSED_ARG(netif);
+	LWIP_UNUSED_ARG(write);
+	LWIP_UNUSED_ARG(arg);
+	result = ERR_VAL;
+#endif
+	return result;
+}
+
 err_t wireguardif_remove_peer(struct netif *netif, u8_t peer_index) {
 	struct wireguard_peer *peer;
 	err_t result = wireguardif_lookup_peer(netif, peer_index, &peer);
 	if (result == ERR_OK) {
-		crypto_zero(peer, sizeof(struct wireguard_peer));
-		peer->valid = false;
+		// Keep the device totals monotonic
+		wireguard_stats_accumulate(&((struct wireguard_device *)netif->state)->stats.totals, &peer->stats);
+		wireguard_peer_clear(peer);
 		result = ERR_OK;
 	}
 	return result;
@@ -811,15 +1470,96 @@ err_t wireguardif_remove_peer(struct netif *netif, u8_t peer_index) {
 
 err_t wireguardif_update_endpoint(struct netif *netif, u8_t peer_index, const ip_addr_t *ip, u16_t port) {
 	struct wireguard_peer *peer;
+	struct wireguard_endpoint *endpoint;
 	err_t result = wireguardif_lookup_peer(netif, peer_index, &peer);
 	if (result == ERR_OK) {
-		peer->connect_ip = *ip;
-		peer->connect_port = port;
+		// Replaces the selected candidate
+		endpoint = &peer->cold->endpoints[peer->cold->endpoint_index];
+		memset(endpoint, 0, sizeof(struct wireguard_endpoint));
+		endpoint->valid = !ip_addr_isany(ip) && (port > 0);
+		endpoint->ip = *ip;
+		endpoint->port = port;
+		peer->cold->connect_ip = *ip;
+		peer->cold->connect_port = port;
 		result = ERR_OK;
 	}
 	return result;
 }
 
+err_t wireguardif_add_endpoint(struct netif *netif, u8_t peer_index, const ip_addr_t *ip, u16_t port) {
+	struct wireguard_peer *peer;
+	int x;
+	err_t result;
+	if (ip_addr_isany(ip) || (port == 0)) {
+		return ERR_ARG;
+	}
+	WG_LWIP_LOCK();
+	result = wireguardif_lookup_peer(netif, peer_index, &peer);
+	if ((result == ERR_OK) && (endpoint_find(peer, ip, port) < 0)) {
+		result = ERR_MEM;
+		for (x=0; x < WIREGUARD_MAX_ENDPOINTS; x++) {
+			if (!peer->cold->endpoints[x].valid) {
+				memset(&peer->cold->endpoints[x], 0, sizeof(struct wireguard_endpoint));
+				peer->cold->endpoints[x].valid = true;
+				peer->cold->endpoints[x].ip = *ip;
+				peer->cold->endpoints[x].port = port;
+				if (ip_addr_isany(&peer->cold->connect_ip)) {
+					// First known endpoint of a peer added without one
+					endpoint_select(peer, x);
+				}
+				result = ERR_OK;
+				break;
+			}
+		}
+	}
+	WG_LWIP_UNLOCK();
+	return result;
+}
+
+err_t wireguardif_add_allowed_ip(struct netif *netif, u8_t peer_index, const ip_addr_t *ip, const ip_addr_t *mask) {
+	struct wireguard_peer *peer;
+	err_t result;
+	WG_LWIP_LOCK();
+	result = wireguardif_lookup_peer(netif, peer_index, &peer);
+	if ((result == ERR_OK) && !peer_add_ip(peer, *ip, *mask)) {
+		result = ERR_MEM;
+	}
+	WG_LWIP_UNLOCK();
+	return result;
+}
+
+err_t wireguardif_get_endpoint(struct netif *netif, u8_t peer_index, u8_t endpoint_index, ip_addr_t *ip, u16_t *port, uint32_t *rtt, uint8_t *failures, bool *selected) {
+	struct wireguard_peer *peer;
+	struct wireguard_endpoint *endpoint;
+	err_t result;
+	WG_LWIP_LOCK();
+	result = wireguardif_lookup_peer(netif, peer_index, &peer);
+	if (result == ERR_OK) {
+		if ((endpoint_index < WIREGUARD_MAX_ENDPOINTS) && peer->cold->endpoints[endpoint_index].valid) {
+			endpoint = &peer->cold->endpoints[endpoint_index];
+			if (ip) {
+				*ip = endpoint->ip;
+			}
+			if (port) {
+				*port = endpoint->port;
+			}
+			if (rtt) {
+				*rtt = endpoint->rtt;
+			}
+			if (failures) {
+				*failures = endpoint->failures;
+			}
+			if (selected) {
+				*selected = (endpoint_index == peer->cold->endpoint_index);
+			}
+		} else {
+			result = ERR_ARG;
+		}
+	}
+	WG_LWIP_UNLOCK();
+	return result;
+}
+
 
 err_t wireguardif_add_peer(struct netif *netif, struct wireguardif_peer *p, u8_t *peer_index) {
 	//LWIP_ASSERT("netif != NULL", (netif != NULL));
@@ -830,6 +1570,13 @@ err_t wireguardif_add_peer(struct netif *netif, struct wireguardif_peer *p, u8_t
 	uint8_t public_key[WIREGUARD_PUBLIC_KEY_LEN];
 	size_t public_key_len = sizeof(public_key);
 	struct wireguard_peer *peer = NULL;
+	const struct wireguard_derived_keys *derived = NULL;
+#if WIREGUARD_PERSIST_SESSIONS
+	const struct wireguard_persist_peer *saved = NULL;
+#endif
+#if WIREGUARD_KEY_CACHE
+	struct wireguard_derived_keys cached;
+#endif
 
 	uint32_t t1 = wireguard_sys_now();
 
@@ -842,20 +1589,51 @@ err_t wireguardif_add_peer(struct netif *netif, struct wireguardif_peer *p, u8_t
 			// Not active - see if we have room to allocate a new one
 			peer = peer_alloc(device);
 			if (peer) {
+#if WIREGUARD_PERSIST_SESSIONS
+				// Warm reset - the static DH is already known
+				saved = wireguard_persist_find(device, public_key, p->preshared_key);
+				if (saved && saved->dh_ready) {
+					derived = &saved->derived;
+				}
+#endif
+#if WIREGUARD_KEY_CACHE
+				if (!derived && wireguard_keycache_load(device->private_key, public_key, &cached)) {
+					derived = &cached;
+				}
+#endif
 
-				if (wireguard_peer_init(device, peer, public_key, p->preshared_key)) {
+				// Without derived keys the static DH stays pending until a handshake (or an idle tick) needs it
+				if (wireguard_peer_init_precomputed(device, peer, public_key, p->preshared_key, derived)) {
+#if WIREGUARD_KEY_CACHE
+					// Otherwise wireguardif_maintain() stores it once it has been computed
+					peer->cold->public_key_dh_cached = (derived != NULL);
+					crypto_zero(&cached, sizeof(cached));
+#endif
 
-					peer->connect_ip = p->endpoint_ip;
-					peer->connect_port = p->endport_port;
-					peer->ip = peer->connect_ip;
-					peer->port = peer->connect_port;
+					peer->cold->connect_ip = p->endpoint_ip;
+					peer->cold->connect_port = p->endport_port;
+					if (!ip_addr_isany(&p->endpoint_ip) && (p->endport_port > 0)) {
+						peer->cold->endpoints[0].valid = true;
+						peer->cold->endpoints[0].ip = p->endpoint_ip;
+						peer->cold->endpoints[0].port = p->endport_port;
+					}
+					peer->ip = peer->cold->connect_ip;
+					peer->port = peer->cold->connect_port;
 					if (p->keep_alive == WIREGUARDIF_KEEPALIVE_DEFAULT) {
 						peer->keepalive_interval = KEEPALIVE_TIMEOUT;
 					} else {
 						peer->keepalive_interval = p->keep_alive;
 					}
 					peer_add_ip(peer, p->allowed_ip, p->allowed_mask);
-					memcpy(peer->greatest_timestamp, p->greatest_timestamp, sizeof(peer->greatest_timestamp));
+					memcpy(peer->cold->greatest_timestamp, p->greatest_timestamp, sizeof(peer->cold->greatest_timestamp));
+#if WIREGUARD_PERSIST_SESSIONS
+					if (saved && (wireguard_persist_restore(peer, saved) > 0)) {
+						log_i(TAG "restored session from before the reset");
+						netif_set_link_up(device->netif);
+						// Our source port probably changed with the reset - let the peer learn the new one
+						wireguardif_send_keepalive(device, peer);
+					}
+#endif
 
 					result = ERR_OK;
 				} else {
@@ -889,9 +1667,9 @@ err_t wireguardif_add_peer(struct netif *netif, struct wireguardif_peer *p, u8_t
 // 	if (wireguardif_can_send_initiation(peer)) {
 // 		if (peer->send_handshake) {
 // 			result = true;
-// 		} else if (peer->curr_keypair.valid && !peer->curr_keypair.initiator && wireguard_expired(peer->curr_keypair.keypair_millis, REJECT_AFTER_TIME - peer->keepalive_interval)) {
+// 		} else if (PEER_CURR_KEYPAIR(peer)->valid && !PEER_CURR_KEYPAIR(peer)->initiator && wireguard_expired(PEER_CURR_KEYPAIR(peer)->keypair_millis, REJECT_AFTER_TIME - peer->keepalive_interval)) {
 // 			result = true;
-// 		} else if (!peer->curr_keypair.valid && peer->active) {
+// 		} else if (!PEER_CURR_KEYPAIR(peer)->valid && peer->cold->active) {
 // 			result = true;
 // 		}
 // 	}
@@ -908,11 +1686,11 @@ static bool should_send_initiation(struct wireguard_peer *peer) {
         if (peer->send_handshake) {
             log_i(TAG "  send_handshake flag is TRUE");
             result = true;
-        } else if (peer->curr_keypair.valid && !peer->curr_keypair.initiator && 
-                   wireguard_expired(peer->curr_keypair.keypair_millis, REJECT_AFTER_TIME - peer->keepalive_interval)) {
+        } else if (PEER_CURR_KEYPAIR(peer)->valid && !PEER_CURR_KEYPAIR(peer)->initiator && 
+                   wireguard_expired(PEER_CURR_KEYPAIR(peer)->keypair_millis, REJECT_AFTER_TIME - peer->keepalive_interval)) {
             log_i(TAG "  curr_keypair expired");
             result = true;
-        } else if (!peer->curr_keypair.valid && peer->active) {
+        } else if (!PEER_CURR_KEYPAIR(peer)->valid && peer->cold->active) {
             log_i(TAG "  no valid keypair and peer active");
             result = true;
         }
@@ -929,7 +1707,7 @@ static bool should_send_initiation(struct wireguard_peer *peer) {
 static bool should_send_keepalive(struct wireguard_peer *peer) {
 	bool result = false;
 	if (peer->keepalive_interval > 0) {
-		if ((peer->curr_keypair.valid) || (peer->prev_keypair.valid)) {
+		if ((PEER_CURR_KEYPAIR(peer)->valid) || (PEER_PREV_KEYPAIR(peer)->valid)) {
 			if (wireguard_expired(peer->last_tx, peer->keepalive_interval)) {
 				result = true;
 			}
@@ -940,9 +1718,9 @@ static bool should_send_keepalive(struct wireguard_peer *peer) {
 
 static bool should_destroy_current_keypair(struct wireguard_peer *peer) {
 	bool result = false;
-	if (peer->curr_keypair.valid &&
-			(wireguard_expired(peer->curr_keypair.keypair_millis, REJECT_AFTER_TIME) ||
-			(peer->curr_keypair.sending_counter >= REJECT_AFTER_MESSAGES))
+	if (PEER_CURR_KEYPAIR(peer)->valid &&
+			(wireguard_expired(PEER_CURR_KEYPAIR(peer)->keypair_millis, REJECT_AFTER_TIME) ||
+			(PEER_CURR_KEYPAIR(peer)->sending_counter >= REJECT_AFTER_MESSAGES))
 		) {
 		result = true;
 	}
@@ -951,12 +1729,83 @@ static bool should_destroy_current_keypair(struct wireguard_peer *peer) {
 
 static bool should_reset_peer(struct wireguard_peer *peer) {
 	bool result = false;
-	if (peer->curr_keypair.valid && (wireguard_expired(peer->curr_keypair.keypair_millis, REJECT_AFTER_TIME * 3))) {
+	if (PEER_CURR_KEYPAIR(peer)->valid && (wireguard_expired(PEER_CURR_KEYPAIR(peer)->keypair_millis, REJECT_AFTER_TIME * 3))) {
 		result = true;
 	}
 	return result;
 }
 
+// Our address or link changed underneath the tunnel - NAT mappings and roamed endpoints are stale
+static void wireguardif_underlying_changed(struct wireguard_device *device) {
+	struct wireguard_peer *peer;
+	int x;
+	for (x=0; x < WIREGUARD_MAX_PEERS; x++) {
+		peer = &device->peers[x];
+		if (peer->valid) {
+			if (!ip_addr_isany(&peer->cold->connect_ip)) {
+				peer->ip = peer->cold->connect_ip;
+				peer->port = peer->cold->connect_port;
+			}
+			// Cookies are bound to the source address we had
+			peer->cold->cookie_millis = 0;
+			peer->probe_pending = false;
+			peer->cold->initiation_pending = false;
+			peer->cold->endpoints_tried = 0;
+			if (peer->cold->active || PEER_CURR_KEYPAIR(peer)->valid || PEER_PREV_KEYPAIR(peer)->valid) {
+				// Handshake right away instead of waiting for REKEY_TIMEOUT / rekey / reset timers
+				peer->send_handshake = true;
+				peer->cold->last_initiation_tx = 0;
+			}
+		}
+	}
+}
+
+// Returns true if underlying_netif came (back) up or got a new address since we last looked
+static bool wireguardif_check_underlying(struct wireguard_device *device) {
+	struct netif *underlying = device->underlying_netif;
+	bool result = false;
+	bool link_up;
+	uint32_t addr;
+	// wireguardif_resume() takes a fresh look at the underlying netif
+	if (underlying && !device->suspended) {
+		link_up = netif_is_up(underlying) && netif_is_link_up(underlying);
+		addr = ip4_addr_get_u32(netif_ip4_addr(underlying));
+		if ((link_up != device->underlying_link_up) || (addr != device->underlying_addr)) {
+			device->underlying_link_up = link_up;
+			device->underlying_addr = addr;
+			// Nothing to do until we can send again
+			if (link_up && (addr != IPADDR_ANY)) {
+				log_i(TAG "underlying netif changed, re-handshaking");
+				wireguardif_underlying_changed(device);
+				result = true;
+			}
+		}
+	}
+	return result;
+}
+
+#if WIREGUARD_KEY_CACHE
+// Hand out a static DH computed since the peer was added and not cached yet - the store itself is left to
+// wireguardif_maintain(), the timer never touches flash
+static bool wireguardif_take_peer_dh(struct wireguard_device *device, uint8_t *peer_public_key, struct wireguard_derived_keys *keys) {
+	struct wireguard_peer *peer;
+	bool result = false;
+	int x;
+	for (x=0; (!result) && (x < WIREGUARD_MAX_PEERS); x++) {
+		peer = &device->peers[x];
+		if (peer->valid && (peer->cold->public_key_dh_state == WIREGUARD_DH_READY) && !peer->cold->public_key_dh_cached) {
+			memcpy(peer_public_key, peer->cold->public_key, WIREGUARD_PUBLIC_KEY_LEN);
+			memcpy(keys->public_key, peer->cold->public_key_dh, WIREGUARD_PUBLIC_KEY_LEN);
+			memcpy(keys->label_mac1_key, peer->cold->label_mac1_key, WIREGUARD_SESSION_KEY_LEN);
+			memcpy(keys->label_cookie_key, peer->cold->label_cookie_key, WIREGUARD_SESSION_KEY_LEN);
+			peer->cold->public_key_dh_cached = true;
+			result = true;
+		}
+	}
+	return result;
+}
+#endif
+
 static void wireguardif_tmr(void *arg) {
 	#ifdef DEBUG_DEEP
 	log_i(TAG "=== TIMER START (%dms intervalm timestamp: %ld) ===", WIREGUARDIF_TIMER_MSECS, millis());
@@ -965,6 +1814,9 @@ static void wireguardif_tmr(void *arg) {
 	struct wireguard_device *device = (struct wireguard_device *)arg;
 	struct wireguard_peer *peer;
 	int x;
+#if WIREGUARD_DH_BACKGROUND
+	bool idle = true;
+#endif
 
 	#ifdef DEBUG_DEEP
 	log_i(TAG "Device valid: %d", device->valid);
@@ -972,6 +1824,15 @@ static void wireguardif_tmr(void *arg) {
 
 	// Reschedule this timer
 	sys_timeout(WIREGUARDIF_TIMER_MSECS, wireguardif_tmr, device);
+	WIREGUARD_STACK_BEGIN();
+
+	// Polled as well in case netif ext callbacks are not compiled into lwIP
+	wireguardif_check_underlying(device);
+
+#if WIREGUARD_PERSIST_SESSIONS
+	// Keeps ages, keypair rotation and greatest_timestamp current - counters force their own saves
+	wireguard_persist_save(device);
+#endif
 
 	// Check periodic things
 	bool link_up = false;
@@ -979,15 +1840,21 @@ static void wireguardif_tmr(void *arg) {
 		peer = &device->peers[x];
 		#ifdef DEBUG_DEEP
 		log_i(TAG "Peer[%d]: valid=%d, active=%d, send_handshake=%d", 
-              x, peer->valid, peer->active, peer->send_handshake);		
+              x, peer->valid, peer->cold->active, peer->send_handshake);		
 		#endif
 
 		if (peer->valid) {
 			#ifdef DEBUG_DEEP
 			log_i(TAG "  curr_keypair.valid=%d, last_tx=%u, last_rx=%u",
-                  peer->curr_keypair.valid, peer->last_tx, peer->last_rx);
+                  PEER_CURR_KEYPAIR(peer)->valid, peer->last_tx, peer->last_rx);
 			#endif
 
+			wireguardif_check_liveness(peer);
+			// A handshake not completed within REKEY_TIMEOUT gives its context back - a retry takes one again
+			if (peer->cold->handshake && wireguard_expired(peer->cold->handshake->handshake_millis, REKEY_TIMEOUT)) {
+				handshake_release(peer);
+			}
+
 			// Sprawdź czy powinien wysłać handshake
 			bool should_send = should_send_initiation(peer);
 			#ifdef DEBUG_DEEP
@@ -1001,27 +1868,38 @@ static void wireguardif_tmr(void *arg) {
 			// Do we need to rekey / send a handshake?
 			if (should_reset_peer(peer)) {
 				// Nothing back for too long - we should wipe out all crypto state
-				keypair_destroy(&peer->next_keypair);
-				keypair_destroy(&peer->curr_keypair);
-				keypair_destroy(&peer->prev_keypair);
-				handshake_destroy(&peer->handshake);
+				keypair_destroy(PEER_NEXT_KEYPAIR(peer));
+				keypair_destroy(PEER_CURR_KEYPAIR(peer));
+				keypair_destroy(PEER_PREV_KEYPAIR(peer));
+				handshake_release(peer);
 
 				// Revert back to default IP/port if these were altered
-				peer->ip = peer->connect_ip;
-				peer->port = peer->connect_port;
+				peer->ip = peer->cold->connect_ip;
+				peer->port = peer->cold->connect_port;
 			}
 			if (should_destroy_current_keypair(peer)) {
 				// Destroy current keypair
-				keypair_destroy(&peer->curr_keypair);
+				keypair_destroy(PEER_CURR_KEYPAIR(peer));
 			}
 			if (should_send_keepalive(peer)) {
 				wireguardif_send_keepalive(device, peer);
 			}
 			if (should_send_initiation(peer)) {
 				wireguard_start_handshake(device->netif, peer);
+#if WIREGUARD_DH_BACKGROUND
+				idle = false;
+#endif
 			}
 
-			if ((peer->curr_keypair.valid) || (peer->prev_keypair.valid)) {
+#if WIREGUARD_DH_BACKGROUND
+			// At most one x25519() per tick, and none on a tick that already sent an initiation
+			if (idle && (peer->cold->public_key_dh_state == WIREGUARD_DH_PENDING)) {
+				wireguard_peer_compute_dh(device, peer);
+				idle = false;
+			}
+#endif
+
+			if ((PEER_CURR_KEYPAIR(peer)->valid) || (PEER_PREV_KEYPAIR(peer)->valid)) {
 				link_up = true;
 			}
 		}
@@ -1031,12 +1909,178 @@ static void wireguardif_tmr(void *arg) {
 		// Clear the IF-UP flag on netif
 		netif_set_link_down(device->netif);
 	}
+	WIREGUARD_STACK_END(device);
 
 	#ifdef DEBUG_DEEP
 	log_i(TAG "=== TIMER END ===");
 	#endif
 }
 
+#if LWIP_NETIF_EXT_STATUS_CALLBACK
+static netif_ext_callback_t wireguardif_ext_callback;
+static bool wireguardif_ext_callback_registered = false;
+
+static void wireguardif_netif_ext_callback(struct netif *netif, netif_nsc_reason_t reason, const netif_ext_callback_args_t *args) {
+	struct netif *wg_netif;
+	struct wireguard_device *device;
+	LWIP_UNUSED_ARG(args);
+	if (reason & (LWIP_NSC_LINK_CHANGED | LWIP_NSC_STATUS_CHANGED | LWIP_NSC_IPV4_ADDRESS_CHANGED | LWIP_NSC_IPV4_SETTINGS_CHANGED)) {
+		// Find the WireGuard interfaces running on top of this netif
+		for (wg_netif = netif_list; wg_netif != NULL; wg_netif = wg_netif->next) {
+			device = (struct wireguard_device *)wg_netif->state;
+			if ((wg_netif->output == wireguardif_output) && device && device->valid && (device->underlying_netif == netif)) {
+				if (wireguardif_check_underlying(device)) {
+					// Run the timer now so the initiation goes out immediately
+					sys_untimeout(wireguardif_tmr, device);
+					sys_timeout(0, wireguardif_tmr, device);
+				}
+			}
+		}
+	}
+}
+#endif /* LWIP_NETIF_EXT_STATUS_CALLBACK */
+
+err_t wireguardif_suspend(struct netif *netif) {
+	struct wireguard_device *device = (struct wireguard_device *)netif->state;
+	err_t result = ERR_ARG;
+	WG_LWIP_LOCK();
+	if (device && device->valid) {
+		if (!device->suspended) {
+			sys_untimeout(wireguardif_tmr, device);
+			if (device->udp_pcb) {
+				// Come back on the same port so the peer's idea of our endpoint stays right when the NAT allows it
+				device->listen_port = device->udp_pcb->local_port;
+				udp_disconnect(device->udp_pcb);
+				udp_remove(device->udp_pcb);
+				device->udp_pcb = NULL;
+			}
+			device->suspended = true;
+			netif_set_link_down(netif);
+		}
+		result = ERR_OK;
+	}
+	WG_LWIP_UNLOCK();
+	return result;
+}
+
+static void wireguardif_resume_peer(struct wireguard_device *device, struct wireguard_peer *peer) {
+	// Forget whatever expired while we were away
+	if (PEER_NEXT_KEYPAIR(peer)->valid && wireguard_expired(PEER_NEXT_KEYPAIR(peer)->keypair_millis, REJECT_AFTER_TIME)) {
+		keypair_destroy(PEER_NEXT_KEYPAIR(peer));
+	}
+	if (PEER_CURR_KEYPAIR(peer)->valid && wireguard_expired(PEER_CURR_KEYPAIR(peer)->keypair_millis, REJECT_AFTER_TIME)) {
+		keypair_destroy(PEER_CURR_KEYPAIR(peer));
+	}
+	if (PEER_PREV_KEYPAIR(peer)->valid && wireguard_expired(PEER_PREV_KEYPAIR(peer)->keypair_millis, REJECT_AFTER_TIME)) {
+		keypair_destroy(PEER_PREV_KEYPAIR(peer));
+	}
+	// A handshake in flight at suspend time went nowhere, and silence while we slept is not the peer's fault
+	if (peer->cold->handshake && peer->cold->handshake->initiator) {
+		handshake_release(peer);
+	}
+	peer->probe_pending = false;
+	peer->cold->initiation_pending = false;
+	peer->missed_responses = 0;
+	peer->cold->endpoints_tried = 0;
+
+	if (PEER_CURR_KEYPAIR(peer)->valid || PEER_PREV_KEYPAIR(peer)->valid) {
+		// Session still usable - tell the peer where we are now (new NAT mapping) instead of a full handshake
+		wireguardif_send_keepalive(device, peer);
+		if (PEER_CURR_KEYPAIR(peer)->valid && PEER_CURR_KEYPAIR(peer)->initiator && wireguard_expired(PEER_CURR_KEYPAIR(peer)->keypair_millis, REKEY_AFTER_TIME)) {
+			peer->send_handshake = true;
+		}
+	} else if (peer->cold->active) {
+		peer->send_handshake = true;
+		peer->cold->last_initiation_tx = 0;
+	}
+}
+
+err_t wireguardif_resume(struct netif *netif) {
+	struct wireguard_device *device = (struct wireguard_device *)netif->state;
+	struct netif *underlying;
+	struct udp_pcb *udp;
+	bool link_up = false;
+	err_t result = ERR_ARG;
+	int x;
+	WG_LWIP_LOCK();
+	if (device && device->valid) {
+		if (device->suspended) {
+			udp = udp_new();
+			if (udp) {
+				result = udp_bind(udp, IP_ADDR_ANY, device->listen_port);
+				if (result != ERR_OK) {
+					// Port taken meanwhile - any port will do, the keep-alive / handshake announces it
+					result = udp_bind(udp, IP_ADDR_ANY, 0);
+				}
+				if (result == ERR_OK) {
+					udp_recv(udp, wireguardif_network_rx, device);
+					device->udp_pcb = udp;
+
+					underlying = tcpip_adapter_get_netif(TCPIP_ADAPTER_IF_STA);
+					if (underlying) {
+						device->underlying_netif = underlying;
+					}
+					if (device->underlying_netif) {
+						device->underlying_link_up = netif_is_up(device->underlying_netif) && netif_is_link_up(device->underlying_netif);
+						device->underlying_addr = ip4_addr_get_u32(netif_ip4_addr(device->underlying_netif));
+					}
+					device->suspended = false;
+
+					for (x=0; x < WIREGUARD_MAX_PEERS; x++) {
+						if (device->peers[x].valid) {
+							wireguardif_resume_peer(device, &device->peers[x]);
+							if (PEER_CURR_KEYPAIR(&device->peers[x])->valid || PEER_PREV_KEYPAIR(&device->peers[x])->valid) {
+								link_up = true;
+							}
+						}
+					}
+					if (link_up) {
+						netif_set_link_up(netif);
+					}
+					// Run the timer straight away so a needed handshake goes out now
+					sys_timeout(0, wireguardif_tmr, device);
+				} else {
+					udp_remove(udp);
+				}
+			} else {
+				result = ERR_MEM;
+			}
+		} else {
+			result = ERR_OK;
+		}
+	}
+	WG_LWIP_UNLOCK();
+	return result;
+}
+
+void wireguardif_maintain(struct netif *netif) {
+#if WIREGUARD_KEY_CACHE
+	struct wireguard_device *device;
+	uint8_t private_key[WIREGUARD_PRIVATE_KEY_LEN];
+	uint8_t peer_public_key[WIREGUARD_PUBLIC_KEY_LEN];
+	struct wireguard_derived_keys keys;
+	bool pending = true;
+	// One entry per lock, the flash write itself runs with lwIP free to go on
+	while (pending) {
+		pending = false;
+		WG_LWIP_LOCK();
+		device = (struct wireguard_device *)netif->state;
+		if (device && device->valid) {
+			pending = wireguardif_take_peer_dh(device, peer_public_key, &keys);
+			memcpy(private_key, device->private_key, WIREGUARD_PRIVATE_KEY_LEN);
+		}
+		WG_LWIP_UNLOCK();
+		if (pending) {
+			wireguard_keycache_store(private_key, peer_public_key, &keys);
+		}
+	}
+	crypto_zero(&keys, sizeof(keys));
+	crypto_zero(private_key, sizeof(private_key));
+#else
+	LWIP_UNUSED_ARG(netif);
+#endif
+}
+
 void wireguardif_shutdown(struct netif *netif) {
 	//LWIP_ASSERT("netif != NULL", (netif != NULL));
 	//LWIP_ASSERT("state != NULL", (netif->state != NULL));
@@ -1044,14 +2088,17 @@ void wireguardif_shutdown(struct netif *netif) {
 	struct wireguard_device * device = (struct wireguard_device *)netif->state;
 	// Disable timer.
 	sys_untimeout(wireguardif_tmr, device);
+#if WIREGUARD_PERSIST_SESSIONS
+	wireguard_persist_release(device);
+#endif
 	// remove UDP context.
 	if( device->udp_pcb ) {
 		udp_disconnect(device->udp_pcb);
 		udp_remove(device->udp_pcb);
 		device->udp_pcb = NULL;
 	}
-	// remove device context.
-	free(device);
+	// remove device context - allocated with mem_calloc() in wireguardif_init()
+	mem_free(device);
 	netif->state = NULL;
 }
 
@@ -1062,6 +2109,10 @@ err_t wireguardif_init(struct netif *netif) {
 	struct udp_pcb *udp;
 	uint8_t private_key[WIREGUARD_PRIVATE_KEY_LEN];
 	size_t private_key_len = sizeof(private_key);
+	const struct wireguard_derived_keys *derived = NULL;
+#if WIREGUARD_KEY_CACHE
+	struct wireguard_derived_keys cached;
+#endif
 
 	struct netif* underlying_netif;
 	underlying_netif = tcpip_adapter_get_netif(TCPIP_ADAPTER_IF_STA);
@@ -1086,6 +2137,11 @@ err_t wireguardif_init(struct netif *netif) {
 		// Clear out and set if function is successful
 		netif->state = NULL;
 
+		// An explicitly bound netif wins over the station one (host builds have no CYW43 to ask)
+		if (init_data->bind_netif) {
+			underlying_netif = init_data->bind_netif;
+		}
+
 		if (wireguard_base64_decode(init_data->private_key, private_key, &private_key_len)
 				&& (private_key_len == WIREGUARD_PRIVATE_KEY_LEN)) {
 
@@ -1095,18 +2151,46 @@ err_t wireguardif_init(struct netif *netif) {
 				result = udp_bind(udp, IP_ADDR_ANY, init_data->listen_port); // Note this listens on all interfaces! Really just want the passed netif
 				if (result == ERR_OK) {
 					device = (struct wireguard_device *)mem_calloc(1, sizeof(struct wireguard_device));
+					WIREGUARD_ALLOC_RECORD(alloc_stats, WIREGUARD_ALLOC_DEVICE, device, true, sizeof(struct wireguard_device));
 					if (device) {
 						device->netif = netif;
 						device->underlying_netif = underlying_netif;
 						//udp_bind_netif(udp, underlying_netif);
 
 						device->udp_pcb = udp;
+						if (underlying_netif) {
+							device->underlying_link_up = netif_is_up(underlying_netif) && netif_is_link_up(underlying_netif);
+							device->underlying_addr = ip4_addr_get_u32(netif_ip4_addr(underlying_netif));
+						}
+#if WIREGUARD_CAPTURE
+						wireguard_capture_init(&device->capture);
+#endif
+#if WIREGUARD_RATELIMIT
+						wireguard_ratelimit_init(&device->ratelimit, wireguard_sys_now());
+#endif
 						log_d(TAG "start device initialization");
 						// Per-wireguard netif/device setup
 						uint32_t t1 = wireguard_sys_now();
-						if (wireguard_device_init(device, private_key)) {
+#if WIREGUARD_KEY_CACHE
+						if (wireguard_keycache_load(private_key, NULL, &cached)) {
+							derived = &cached;
+						}
+#endif
+						if (wireguard_device_init_precomputed(device, private_key, derived)) {
 							uint32_t t2 = wireguard_sys_now();
-							log_d(TAG "Device init took %ums\r\n", (t2-t1));
+							log_d(TAG "Device init took %ums (%s)\r\n", (t2-t1), derived ? "cached keys" : "derived keys");
+#if WIREGUARD_KEY_CACHE
+							if (!derived) {
+								memcpy(cached.public_key, device->public_key, WIREGUARD_PUBLIC_KEY_LEN);
+								memcpy(cached.label_mac1_key, device->label_mac1_key, WIREGUARD_SESSION_KEY_LEN);
+								memcpy(cached.label_cookie_key, device->label_cookie_key, WIREGUARD_SESSION_KEY_LEN);
+								wireguard_keycache_store(private_key, NULL, &cached);
+							}
+							crypto_zero(&cached, sizeof(cached));
+#endif
+#if WIREGUARD_PERSIST_SESSIONS
+							wireguard_persist_load(device);
+#endif
 
 #if LWIP_CHECKSUM_CTRL_PER_NETIF
 							NETIF_SET_CHECKSUM_CTRL(netif, NETIF_CHECKSUM_ENABLE_ALL);
@@ -1127,6 +2211,14 @@ err_t wireguardif_init(struct netif *netif) {
 							// Start a periodic timer for this wireguard device
 							sys_timeout(WIREGUARDIF_TIMER_MSECS, wireguardif_tmr, device);
 
+#if LWIP_NETIF_EXT_STATUS_CALLBACK
+							// Re-handshake as soon as the Wi-Fi link or our address changes
+							if (!wireguardif_ext_callback_registered) {
+								netif_add_ext_callback(&wireguardif_ext_callback, wireguardif_netif_ext_callback);
+								wireguardif_ext_callback_registered = true;
+							}
+#endif
+
 							result = ERR_OK;
 						} else {
 							log_e(TAG "failed to initialize WireGuard device.");
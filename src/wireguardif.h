@@ -41,6 +41,10 @@
 #include "lwip/netif.h"
 #include "lwip/ip_addr.h"
 
+#include "wireguard-stats.h"
+#include "wireguard-capture.h"
+#include "wireguard-record.h"
+
 /*
  * This header is included from both C and C++ sources.
  * The functions declared here are implemented in .c files, so when
@@ -121,6 +125,16 @@ err_t wireguardif_init(struct netif *netif);
 // Shutdown a WireGuard network interface (netif)
 void wireguardif_shutdown(struct netif *netif);
 
+// Sketch (not lwIP) context: writes the keys derived since the last call to the key cache in flash
+void wireguardif_maintain(struct netif *netif);
+
+// Stop the timer and release the UDP pcb (e.g. before switching Wi-Fi off) but keep peers and session keys
+err_t wireguardif_suspend(struct netif *netif);
+
+// Bind again and carry on: sessions still within REJECT_AFTER_TIME are reused (a keep-alive announces
+// our possibly new address), peers without one handshake immediately
+err_t wireguardif_resume(struct netif *netif);
+
 // Helper to initialise the peer struct with defaults
 void wireguardif_peer_init(struct wireguardif_peer *peer);
 
@@ -134,6 +148,18 @@ err_t wireguardif_remove_peer(struct netif *netif, u8_t peer_index);
 // Update the "connect" IP of the given peer
 err_t wireguardif_update_endpoint(struct netif *netif, u8_t peer_index, const ip_addr_t *ip, u16_t port);
 
+// Add another candidate endpoint for the given peer (up to WIREGUARD_MAX_ENDPOINTS)
+// Initiations go to every candidate while there is no session or the current one stops answering, the first to respond is kept
+// Candidates that missed WIREGUARD_ENDPOINT_FAILURES responses in a row are only tried now and then, see wireguard-platform.h
+err_t wireguardif_add_endpoint(struct netif *netif, u8_t peer_index, const ip_addr_t *ip, u16_t port);
+
+// Read back one candidate endpoint - rtt is its last handshake round trip in ms (0 if unknown), failures the initiations
+// it left unanswered since, selected is true for the one in use
+err_t wireguardif_get_endpoint(struct netif *netif, u8_t peer_index, u8_t endpoint_index, ip_addr_t *ip, u16_t *port, uint32_t *rtt, uint8_t *failures, bool *selected);
+
+// Add another allowed IP range for the given peer (up to WIREGUARD_MAX_SRC_IPS including the one given to wireguardif_add_peer())
+err_t wireguardif_add_allowed_ip(struct netif *netif, u8_t peer_index, const ip_addr_t *ip, const ip_addr_t *mask);
+
 // Try and connect to the given peer
 err_t wireguardif_connect(struct netif *netif, u8_t peer_index);
 
@@ -143,6 +169,48 @@ err_t wireguardif_disconnect(struct netif *netif, u8_t peer_index);
 // Is the given peer "up"? A peer is up if it has a valid session key it can communicate with
 err_t wireguardif_peer_is_up(struct netif *netif, u8_t peer_index, ip_addr_t *current_ip, u16_t *current_port);
 
+// Copy a consistent snapshot of the counters of the given peer
+err_t wireguardif_get_peer_stats(struct netif *netif, u8_t peer_index, struct wireguard_peer_stats *stats);
+
+// Copy a consistent snapshot of the device counters - totals include every peer
+err_t wireguardif_get_device_stats(struct netif *netif, struct wireguard_device_stats *stats);
+
+// Round-trip estimate and liveness state of the given peer
+err_t wireguardif_get_peer_liveness(struct netif *netif, u8_t peer_index, struct wireguard_peer_liveness *liveness);
+
+// Copy one latency histogram (stage is an enum wireguard_latency_stage), ticks are wireguard_cycle_frequency() per second
+// Returns ERR_VAL if the library was built without WIREGUARD_LATENCY_HISTOGRAMS
+err_t wireguardif_get_latency_histogram(struct netif *netif, u8_t stage, struct wireguard_histogram *hist);
+
+// Clear all latency histograms, e.g. before starting a measurement run
+err_t wireguardif_reset_latency_histograms(struct netif *netif);
+
+// Copy the allocation counters of all devices (wireguard-stats.h), with the per-packet average filled in
+// Returns ERR_VAL if the library was built without WIREGUARD_ALLOC_STATS
+err_t wireguardif_get_alloc_stats(struct wireguard_alloc_stats *stats);
+
+// Clear the allocation counters, e.g. once the tunnel is up and only the data path should be counted
+err_t wireguardif_reset_alloc_stats(void);
+
+// Pause / resume the capture ring (capturing starts enabled) - ERR_VAL if built without WIREGUARD_CAPTURE
+err_t wireguardif_capture_enable(struct netif *netif, bool enable);
+
+// Drop everything captured so far
+err_t wireguardif_capture_clear(struct netif *netif);
+
+// Stream the capture ring as a pcap file (LINKTYPE_RAW) through write(), capturing is paused meanwhile
+// Outer packets get a synthesised IPv4/UDP header so Wireshark can decode them as WireGuard
+err_t wireguardif_capture_export(struct netif *netif, wireguard_capture_write_fn write, void *arg);
+
+// Start recording a trace for extras/host/replay.c, discarding anything not drained yet - ERR_VAL if built
+// without WIREGUARD_RECORD. The trace carries the private key and session keys, see wireguard-record.h
+err_t wireguardif_record_start(struct netif *netif);
+
+err_t wireguardif_record_stop(struct netif *netif);
+
+// Move what has been recorded so far to write(), recording continues meanwhile
+err_t wireguardif_record_drain(struct netif *netif, wireguard_record_write_fn write, void *arg);
+
 #ifdef __cplusplus
 } /* extern "C" */
 #endif